@@ -201,6 +201,7 @@ filter("platforms:Windows")
     "shlwapi",
     "dxguid",
     "bcrypt",
+    "Synchronization",
   })
 
 -- Embed the manifest for things like dependencies and DPI awareness.
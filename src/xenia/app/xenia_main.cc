@@ -25,6 +25,7 @@
 #include "xenia/base/profiling.h"
 #include "xenia/base/threading.h"
 #include "xenia/config.h"
+#include "xenia/cpu/background_compiler.h"
 #include "xenia/debug/ui/debug_window.h"
 #include "xenia/emulator.h"
 #include "xenia/kernel/xam/xam_module.h"
@@ -100,6 +101,11 @@ DEFINE_transient_path(target, "",
 DEFINE_transient_bool(portable, true,
                       "Specifies if Xenia should run in portable mode.",
                       "General");
+DEFINE_transient_bool(
+    aot_compile, false,
+    "Compile the target .xex ahead of time instead of running it, writing the "
+    "code cache and the function manifest used by later runs, and exit.",
+    "CPU");
 
 DECLARE_bool(debug);
 
@@ -453,6 +459,11 @@ bool EmulatorApp::OnInitialize() {
     XELOGE("Cannot initialize CURL! Error code: {}", status);
   }
 
+  // Compile on all the background compiler threads.
+  if (cvars::aot_compile && !cvars::background_compiler_threads) {
+    cvars::background_compiler_threads = -1;
+  }
+
   // Create the emulator but don't initialize so we can setup the window.
   emulator_ =
       std::make_unique<Emulator>("", storage_root, content_root, cache_root);
@@ -648,6 +659,20 @@ void EmulatorApp::EmulatorThread() {
     path = cvars::target;
   }
 
+  if (cvars::aot_compile) {
+    if (path.empty()) {
+      XELOGE("No target specified to compile ahead of time");
+    } else {
+      result =
+          emulator_->CompileXexAheadOfTime(std::filesystem::absolute(path));
+      if (XFAILED(result)) {
+        XELOGE("Failed to compile the target ahead of time: {:08X}", result);
+      }
+    }
+    app_context().RequestDeferredQuit();
+    return;
+  }
+
   if (!path.empty()) {
     // Normalize the path and make absolute.
     auto abs_path = std::filesystem::absolute(path);
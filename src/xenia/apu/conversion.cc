@@ -0,0 +1,427 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2023 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/apu/conversion.h"
+
+#include "xenia/base/assert.h"
+#include "xenia/base/byte_order.h"
+#include "xenia/base/math.h"
+#include "xenia/base/platform.h"
+
+#if XE_ARCH_AMD64
+#include <immintrin.h>
+
+#if XE_COMPILER_HAS_GNU_EXTENSIONS || XE_COMPILER_HAS_CLANG_EXTENSIONS
+#define XE_APU_AVX2_TARGET __attribute__((target("avx2")))
+#else
+#define XE_APU_AVX2_TARGET
+#endif
+#endif  // XE_ARCH_AMD64
+
+namespace xe {
+namespace apu {
+namespace conversion {
+
+namespace {
+
+constexpr float kS16Scale = (1 << 15) - 1;
+
+// The 6-channel scalar conversions start from first_sample, for converting the
+// remainder after the vectorized ones.
+
+void Scalar_sequential_6_BE_to_interleaved_6_LE(float* XE_RESTRICT output,
+                                                const float* XE_RESTRICT input,
+                                                size_t ch_sample_count,
+                                                size_t first_sample = 0) {
+  for (size_t sample = first_sample; sample < ch_sample_count; sample++) {
+    for (size_t channel = 0; channel < 6; channel++) {
+      output[sample * 6 + channel] =
+          xe::byte_swap(input[channel * ch_sample_count + sample]);
+    }
+  }
+}
+
+void Scalar_sequential_6_BE_to_interleaved_2_LE(float* XE_RESTRICT output,
+                                                const float* XE_RESTRICT input,
+                                                size_t ch_sample_count,
+                                                size_t first_sample = 0) {
+  for (size_t sample = first_sample; sample < ch_sample_count; sample++) {
+    float fl = xe::byte_swap(input[0 * ch_sample_count + sample]);
+    float fr = xe::byte_swap(input[1 * ch_sample_count + sample]);
+    float fc = xe::byte_swap(input[2 * ch_sample_count + sample]);
+    float bl = xe::byte_swap(input[4 * ch_sample_count + sample]);
+    float br = xe::byte_swap(input[5 * ch_sample_count + sample]);
+    float center_halved = fc * 0.5f;
+    output[sample * 2] = (fl + bl + center_halved) * (1.0f / 2.5f);
+    output[sample * 2 + 1] = (fr + br + center_halved) * (1.0f / 2.5f);
+  }
+}
+
+void Scalar_planar_float_to_interleaved_s16_BE(int16_t* XE_RESTRICT output,
+                                               const float* const* input,
+                                               uint32_t channel_count,
+                                               size_t ch_sample_count) {
+  size_t o = 0;
+  for (size_t i = 0; i < ch_sample_count; i++) {
+    for (uint32_t j = 0; j < channel_count; j++) {
+      // Raw samples sometimes aren't within [-1, 1].
+      float scaled_sample =
+          xe::clamp_float(input[j][i], -1.0f, 1.0f) * kS16Scale;
+      output[o++] = xe::byte_swap(static_cast<int16_t>(scaled_sample));
+    }
+  }
+}
+
+#if XE_ARCH_AMD64
+
+// Baseline for AMD64 builds, which target AVX.
+
+void SSE_sequential_6_BE_to_interleaved_6_LE(float* XE_RESTRICT output,
+                                             const float* XE_RESTRICT input,
+                                             size_t ch_sample_count) {
+  const __m128i byte_swap_shuffle =
+      _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+  size_t sample = 0;
+  for (; sample + 4 <= ch_sample_count; sample += 4) {
+    __m128 c[6];
+    for (size_t channel = 0; channel < 6; channel++) {
+      c[channel] = _mm_castsi128_ps(_mm_shuffle_epi8(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+              &input[channel * ch_sample_count + sample])),
+          byte_swap_shuffle));
+    }
+    // Transpose the first 4 channels to 4 samples.
+    __m128 c01_01 = _mm_unpacklo_ps(c[0], c[1]);
+    __m128 c23_01 = _mm_unpacklo_ps(c[2], c[3]);
+    __m128 c01_23 = _mm_unpackhi_ps(c[0], c[1]);
+    __m128 c23_23 = _mm_unpackhi_ps(c[2], c[3]);
+    __m128 s0 = _mm_shuffle_ps(c01_01, c23_01, _MM_SHUFFLE(1, 0, 1, 0));
+    __m128 s1 = _mm_shuffle_ps(c01_01, c23_01, _MM_SHUFFLE(3, 2, 3, 2));
+    __m128 s2 = _mm_shuffle_ps(c01_23, c23_23, _MM_SHUFFLE(1, 0, 1, 0));
+    __m128 s3 = _mm_shuffle_ps(c01_23, c23_23, _MM_SHUFFLE(3, 2, 3, 2));
+    // Put the last 2 channels between them.
+    __m128 c45_01 = _mm_unpacklo_ps(c[4], c[5]);
+    __m128 c45_23 = _mm_unpackhi_ps(c[4], c[5]);
+    float* sample_output = &output[sample * 6];
+    _mm_storeu_ps(sample_output, s0);
+    _mm_storeu_ps(sample_output + 4,
+                  _mm_shuffle_ps(c45_01, s1, _MM_SHUFFLE(1, 0, 1, 0)));
+    _mm_storeu_ps(sample_output + 8,
+                  _mm_shuffle_ps(s1, c45_01, _MM_SHUFFLE(3, 2, 3, 2)));
+    _mm_storeu_ps(sample_output + 12, s2);
+    _mm_storeu_ps(sample_output + 16,
+                  _mm_shuffle_ps(c45_23, s3, _MM_SHUFFLE(1, 0, 1, 0)));
+    _mm_storeu_ps(sample_output + 20,
+                  _mm_shuffle_ps(s3, c45_23, _MM_SHUFFLE(3, 2, 3, 2)));
+  }
+  Scalar_sequential_6_BE_to_interleaved_6_LE(output, input, ch_sample_count,
+                                             sample);
+}
+
+void SSE_sequential_6_BE_to_interleaved_2_LE(float* XE_RESTRICT output,
+                                             const float* XE_RESTRICT input,
+                                             size_t ch_sample_count) {
+  const __m128i byte_swap_shuffle =
+      _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128 two_fifths = _mm_set1_ps(1.0f / 2.5f);
+  size_t sample = 0;
+  for (; sample + 4 <= ch_sample_count; sample += 4) {
+    // load 4 samples from 6 channels each
+    __m128 fl = _mm_loadu_ps(&input[0 * ch_sample_count + sample]);
+    __m128 fr = _mm_loadu_ps(&input[1 * ch_sample_count + sample]);
+    __m128 fc = _mm_loadu_ps(&input[2 * ch_sample_count + sample]);
+    __m128 bl = _mm_loadu_ps(&input[4 * ch_sample_count + sample]);
+    __m128 br = _mm_loadu_ps(&input[5 * ch_sample_count + sample]);
+    // byte swap
+    fl = _mm_castsi128_ps(
+        _mm_shuffle_epi8(_mm_castps_si128(fl), byte_swap_shuffle));
+    fr = _mm_castsi128_ps(
+        _mm_shuffle_epi8(_mm_castps_si128(fr), byte_swap_shuffle));
+    fc = _mm_castsi128_ps(
+        _mm_shuffle_epi8(_mm_castps_si128(fc), byte_swap_shuffle));
+    bl = _mm_castsi128_ps(
+        _mm_shuffle_epi8(_mm_castps_si128(bl), byte_swap_shuffle));
+    br = _mm_castsi128_ps(
+        _mm_shuffle_epi8(_mm_castps_si128(br), byte_swap_shuffle));
+
+    __m128 center_halved = _mm_mul_ps(fc, half);
+    __m128 left = _mm_add_ps(_mm_add_ps(fl, bl), center_halved);
+    __m128 right = _mm_add_ps(_mm_add_ps(fr, br), center_halved);
+    left = _mm_mul_ps(left, two_fifths);
+    right = _mm_mul_ps(right, two_fifths);
+    _mm_storeu_ps(&output[sample * 2], _mm_unpacklo_ps(left, right));
+    _mm_storeu_ps(&output[(sample + 2) * 2], _mm_unpackhi_ps(left, right));
+  }
+  Scalar_sequential_6_BE_to_interleaved_2_LE(output, input, ch_sample_count,
+                                             sample);
+}
+
+void SSE_planar_float_to_interleaved_s16_BE(int16_t* XE_RESTRICT output,
+                                            const float* const* input,
+                                            uint32_t channel_count,
+                                            size_t ch_sample_count) {
+  const __m128 scale = _mm_set1_ps(kS16Scale);
+  const float* in_channel_0 = input[0];
+  size_t i = 0;
+  if (channel_count == 2) {
+    const float* in_channel_1 = input[1];
+    const __m128i shufmask =
+        _mm_set_epi8(14, 15, 6, 7, 12, 13, 4, 5, 10, 11, 2, 3, 8, 9, 0, 1);
+    for (; i + 4 <= ch_sample_count; i += 4) {
+      // Load 8 samples, 4 for each channel.
+      __m128 in_mm0 = _mm_loadu_ps(&in_channel_0[i]);
+      __m128 in_mm1 = _mm_loadu_ps(&in_channel_1[i]);
+      // Rescale and cast to int32.
+      __m128i out_mm0 = _mm_cvtps_epi32(_mm_mul_ps(in_mm0, scale));
+      __m128i out_mm1 = _mm_cvtps_epi32(_mm_mul_ps(in_mm1, scale));
+      // Saturated cast and pack to int16.
+      __m128i out_mm = _mm_packs_epi32(out_mm0, out_mm1);
+      // Interleave channels and byte swap.
+      out_mm = _mm_shuffle_epi8(out_mm, shufmask);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(&output[i * 2]), out_mm);
+    }
+  } else {
+    const __m128i shufmask =
+        _mm_set_epi8(14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1);
+    for (; i + 8 <= ch_sample_count; i += 8) {
+      __m128 in_mm0 = _mm_loadu_ps(&in_channel_0[i]);
+      __m128 in_mm1 = _mm_loadu_ps(&in_channel_0[i + 4]);
+      __m128i out_mm0 = _mm_cvtps_epi32(_mm_mul_ps(in_mm0, scale));
+      __m128i out_mm1 = _mm_cvtps_epi32(_mm_mul_ps(in_mm1, scale));
+      __m128i out_mm = _mm_packs_epi32(out_mm0, out_mm1);
+      // Byte swap.
+      out_mm = _mm_shuffle_epi8(out_mm, shufmask);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(&output[i]), out_mm);
+    }
+  }
+  const float* remaining_input[2] = {
+      input[0] + i, channel_count == 2 ? input[1] + i : nullptr};
+  Scalar_planar_float_to_interleaved_s16_BE(
+      output + i * channel_count, remaining_input, channel_count,
+      ch_sample_count - i);
+}
+
+// Same as the SSE ones, with 256-bit operations working in the two 128-bit
+// lanes independently, one lane for the first 4 samples, the other for the
+// next 4.
+
+XE_APU_AVX2_TARGET void AVX2_sequential_6_BE_to_interleaved_6_LE(
+    float* XE_RESTRICT output, const float* XE_RESTRICT input,
+    size_t ch_sample_count) {
+  const __m256i byte_swap_shuffle = _mm256_set_epi8(
+      12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3, 12, 13, 14, 15, 8,
+      9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+  size_t sample = 0;
+  for (; sample + 8 <= ch_sample_count; sample += 8) {
+    __m256 c[6];
+    for (size_t channel = 0; channel < 6; channel++) {
+      c[channel] = _mm256_castsi256_ps(_mm256_shuffle_epi8(
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(
+              &input[channel * ch_sample_count + sample])),
+          byte_swap_shuffle));
+    }
+    __m256 c01_01 = _mm256_unpacklo_ps(c[0], c[1]);
+    __m256 c23_01 = _mm256_unpacklo_ps(c[2], c[3]);
+    __m256 c01_23 = _mm256_unpackhi_ps(c[0], c[1]);
+    __m256 c23_23 = _mm256_unpackhi_ps(c[2], c[3]);
+    __m256 s0 = _mm256_shuffle_ps(c01_01, c23_01, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s1 = _mm256_shuffle_ps(c01_01, c23_01, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s2 = _mm256_shuffle_ps(c01_23, c23_23, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s3 = _mm256_shuffle_ps(c01_23, c23_23, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 c45_01 = _mm256_unpacklo_ps(c[4], c[5]);
+    __m256 c45_23 = _mm256_unpackhi_ps(c[4], c[5]);
+    __m256 o0 = s0;
+    __m256 o1 = _mm256_shuffle_ps(c45_01, s1, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 o2 = _mm256_shuffle_ps(s1, c45_01, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 o3 = s2;
+    __m256 o4 = _mm256_shuffle_ps(c45_23, s3, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 o5 = _mm256_shuffle_ps(s3, c45_23, _MM_SHUFFLE(3, 2, 3, 2));
+    // Gather the lanes of the first 4 samples, then of the next 4.
+    float* sample_output = &output[sample * 6];
+    _mm256_storeu_ps(sample_output, _mm256_permute2f128_ps(o0, o1, 0x20));
+    _mm256_storeu_ps(sample_output + 8, _mm256_permute2f128_ps(o2, o3, 0x20));
+    _mm256_storeu_ps(sample_output + 16,
+                     _mm256_permute2f128_ps(o4, o5, 0x20));
+    _mm256_storeu_ps(sample_output + 24,
+                     _mm256_permute2f128_ps(o0, o1, 0x31));
+    _mm256_storeu_ps(sample_output + 32,
+                     _mm256_permute2f128_ps(o2, o3, 0x31));
+    _mm256_storeu_ps(sample_output + 40,
+                     _mm256_permute2f128_ps(o4, o5, 0x31));
+  }
+  Scalar_sequential_6_BE_to_interleaved_6_LE(output, input, ch_sample_count,
+                                             sample);
+}
+
+XE_APU_AVX2_TARGET void AVX2_sequential_6_BE_to_interleaved_2_LE(
+    float* XE_RESTRICT output, const float* XE_RESTRICT input,
+    size_t ch_sample_count) {
+  const __m256i byte_swap_shuffle = _mm256_set_epi8(
+      12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3, 12, 13, 14, 15, 8,
+      9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+  const __m256 half = _mm256_set1_ps(0.5f);
+  const __m256 two_fifths = _mm256_set1_ps(1.0f / 2.5f);
+  size_t sample = 0;
+  for (; sample + 8 <= ch_sample_count; sample += 8) {
+    __m256 fl = _mm256_castsi256_ps(_mm256_shuffle_epi8(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(
+            &input[0 * ch_sample_count + sample])),
+        byte_swap_shuffle));
+    __m256 fr = _mm256_castsi256_ps(_mm256_shuffle_epi8(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(
+            &input[1 * ch_sample_count + sample])),
+        byte_swap_shuffle));
+    __m256 fc = _mm256_castsi256_ps(_mm256_shuffle_epi8(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(
+            &input[2 * ch_sample_count + sample])),
+        byte_swap_shuffle));
+    __m256 bl = _mm256_castsi256_ps(_mm256_shuffle_epi8(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(
+            &input[4 * ch_sample_count + sample])),
+        byte_swap_shuffle));
+    __m256 br = _mm256_castsi256_ps(_mm256_shuffle_epi8(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(
+            &input[5 * ch_sample_count + sample])),
+        byte_swap_shuffle));
+    __m256 center_halved = _mm256_mul_ps(fc, half);
+    __m256 left = _mm256_add_ps(_mm256_add_ps(fl, bl), center_halved);
+    __m256 right = _mm256_add_ps(_mm256_add_ps(fr, br), center_halved);
+    left = _mm256_mul_ps(left, two_fifths);
+    right = _mm256_mul_ps(right, two_fifths);
+    __m256 lr_lo = _mm256_unpacklo_ps(left, right);
+    __m256 lr_hi = _mm256_unpackhi_ps(left, right);
+    _mm256_storeu_ps(&output[sample * 2],
+                     _mm256_permute2f128_ps(lr_lo, lr_hi, 0x20));
+    _mm256_storeu_ps(&output[(sample + 4) * 2],
+                     _mm256_permute2f128_ps(lr_lo, lr_hi, 0x31));
+  }
+  Scalar_sequential_6_BE_to_interleaved_2_LE(output, input, ch_sample_count,
+                                             sample);
+}
+
+XE_APU_AVX2_TARGET void AVX2_planar_float_to_interleaved_s16_BE(
+    int16_t* XE_RESTRICT output, const float* const* input,
+    uint32_t channel_count, size_t ch_sample_count) {
+  const __m256 scale = _mm256_set1_ps(kS16Scale);
+  const float* in_channel_0 = input[0];
+  size_t i = 0;
+  if (channel_count == 2) {
+    const float* in_channel_1 = input[1];
+    const __m256i shufmask = _mm256_set_epi8(
+        14, 15, 6, 7, 12, 13, 4, 5, 10, 11, 2, 3, 8, 9, 0, 1, 14, 15, 6, 7, 12,
+        13, 4, 5, 10, 11, 2, 3, 8, 9, 0, 1);
+    for (; i + 8 <= ch_sample_count; i += 8) {
+      __m256i out_mm0 = _mm256_cvtps_epi32(
+          _mm256_mul_ps(_mm256_loadu_ps(&in_channel_0[i]), scale));
+      __m256i out_mm1 = _mm256_cvtps_epi32(
+          _mm256_mul_ps(_mm256_loadu_ps(&in_channel_1[i]), scale));
+      // Each lane has 4 samples of each channel, in order.
+      __m256i out_mm = _mm256_packs_epi32(out_mm0, out_mm1);
+      out_mm = _mm256_shuffle_epi8(out_mm, shufmask);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(&output[i * 2]), out_mm);
+    }
+  } else {
+    const __m256i shufmask = _mm256_set_epi8(
+        14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1, 14, 15, 12, 13,
+        10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1);
+    for (; i + 16 <= ch_sample_count; i += 16) {
+      __m256i out_mm0 = _mm256_cvtps_epi32(
+          _mm256_mul_ps(_mm256_loadu_ps(&in_channel_0[i]), scale));
+      __m256i out_mm1 = _mm256_cvtps_epi32(
+          _mm256_mul_ps(_mm256_loadu_ps(&in_channel_0[i + 8]), scale));
+      // Packing is done per lane, gives 0-3, 8-11, 4-7, 12-15.
+      __m256i out_mm = _mm256_permute4x64_epi64(
+          _mm256_packs_epi32(out_mm0, out_mm1), _MM_SHUFFLE(3, 1, 2, 0));
+      out_mm = _mm256_shuffle_epi8(out_mm, shufmask);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(&output[i]), out_mm);
+    }
+  }
+  const float* remaining_input[2] = {
+      input[0] + i, channel_count == 2 ? input[1] + i : nullptr};
+  SSE_planar_float_to_interleaved_s16_BE(output + i * channel_count,
+                                         remaining_input, channel_count,
+                                         ch_sample_count - i);
+}
+
+#endif  // XE_ARCH_AMD64
+
+}  // namespace
+
+InstructionSet GetHostInstructionSet() {
+#if XE_ARCH_AMD64
+  static const InstructionSet host_instruction_set =
+      (amd64::GetFeatureFlags() & amd64::kX64EmitAVX2) ? InstructionSet::kAVX2
+                                                        : InstructionSet::kSSE;
+  return host_instruction_set;
+#else
+  return InstructionSet::kScalar;
+#endif  // XE_ARCH_AMD64
+}
+
+void sequential_6_BE_to_interleaved_6_LE(float* output, const float* input,
+                                         size_t ch_sample_count,
+                                         InstructionSet instruction_set) {
+#if XE_ARCH_AMD64
+  if (instruction_set == InstructionSet::kAVX2 &&
+      GetHostInstructionSet() == InstructionSet::kAVX2) {
+    AVX2_sequential_6_BE_to_interleaved_6_LE(output, input, ch_sample_count);
+    return;
+  }
+  if (instruction_set != InstructionSet::kScalar) {
+    SSE_sequential_6_BE_to_interleaved_6_LE(output, input, ch_sample_count);
+    return;
+  }
+#endif  // XE_ARCH_AMD64
+  Scalar_sequential_6_BE_to_interleaved_6_LE(output, input, ch_sample_count);
+}
+
+void sequential_6_BE_to_interleaved_2_LE(float* output, const float* input,
+                                         size_t ch_sample_count,
+                                         InstructionSet instruction_set) {
+#if XE_ARCH_AMD64
+  if (instruction_set == InstructionSet::kAVX2 &&
+      GetHostInstructionSet() == InstructionSet::kAVX2) {
+    AVX2_sequential_6_BE_to_interleaved_2_LE(output, input, ch_sample_count);
+    return;
+  }
+  if (instruction_set != InstructionSet::kScalar) {
+    SSE_sequential_6_BE_to_interleaved_2_LE(output, input, ch_sample_count);
+    return;
+  }
+#endif  // XE_ARCH_AMD64
+  Scalar_sequential_6_BE_to_interleaved_2_LE(output, input, ch_sample_count);
+}
+
+void planar_float_to_interleaved_s16_BE(int16_t* output,
+                                        const float* const* input,
+                                        uint32_t channel_count,
+                                        size_t ch_sample_count,
+                                        InstructionSet instruction_set) {
+  assert_true(channel_count == 1 || channel_count == 2);
+#if XE_ARCH_AMD64
+  if (instruction_set == InstructionSet::kAVX2 &&
+      GetHostInstructionSet() == InstructionSet::kAVX2) {
+    AVX2_planar_float_to_interleaved_s16_BE(output, input, channel_count,
+                                            ch_sample_count);
+    return;
+  }
+  if (instruction_set != InstructionSet::kScalar) {
+    SSE_planar_float_to_interleaved_s16_BE(output, input, channel_count,
+                                           ch_sample_count);
+    return;
+  }
+#endif  // XE_ARCH_AMD64
+  Scalar_planar_float_to_interleaved_s16_BE(output, input, channel_count,
+                                            ch_sample_count);
+}
+
+}  // namespace conversion
+}  // namespace apu
+}  // namespace xe
@@ -0,0 +1,192 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2023 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/apu/conversion.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+#include "third_party/fmt/include/fmt/format.h"
+
+#include "xenia/base/byte_order.h"
+
+namespace xe {
+namespace apu {
+namespace test {
+
+using conversion::InstructionSet;
+
+namespace {
+
+const InstructionSet kInstructionSets[] = {
+    InstructionSet::kScalar,
+    InstructionSet::kSSE,
+    InstructionSet::kAVX2,
+};
+
+const char* GetInstructionSetName(InstructionSet instruction_set) {
+  switch (instruction_set) {
+    case InstructionSet::kSSE:
+      return "SSE";
+    case InstructionSet::kAVX2:
+      return "AVX2";
+    default:
+      return "scalar";
+  }
+}
+
+// Slightly out of [-1, 1] like FFmpeg output may be.
+std::vector<float> GenerateSamples(size_t count, bool big_endian) {
+  std::mt19937 random(0x584D4132);
+  std::uniform_real_distribution<float> distribution(-1.125f, 1.125f);
+  std::vector<float> samples(count);
+  for (float& sample : samples) {
+    sample = distribution(random);
+    if (big_endian) {
+      sample = xe::byte_swap(sample);
+    }
+  }
+  return samples;
+}
+
+// Not a multiple of the vector width, to also cover the remainder.
+constexpr size_t kTestChannelSampleCount = 256 + 7;
+
+}  // namespace
+
+TEST_CASE("conversion_6_BE_to_interleaved_6_LE", "[conversion]") {
+  std::vector<float> input = GenerateSamples(6 * kTestChannelSampleCount, true);
+  std::vector<float> expected(input.size());
+  for (size_t sample = 0; sample < kTestChannelSampleCount; ++sample) {
+    for (size_t channel = 0; channel < 6; ++channel) {
+      expected[sample * 6 + channel] =
+          xe::byte_swap(input[channel * kTestChannelSampleCount + sample]);
+    }
+  }
+  for (InstructionSet instruction_set : kInstructionSets) {
+    std::vector<float> output(input.size());
+    conversion::sequential_6_BE_to_interleaved_6_LE(
+        output.data(), input.data(), kTestChannelSampleCount, instruction_set);
+    REQUIRE(!std::memcmp(output.data(), expected.data(),
+                         sizeof(float) * expected.size()));
+  }
+}
+
+TEST_CASE("conversion_6_BE_to_interleaved_2_LE", "[conversion]") {
+  std::vector<float> input = GenerateSamples(6 * kTestChannelSampleCount, true);
+  std::vector<float> expected(2 * kTestChannelSampleCount);
+  conversion::sequential_6_BE_to_interleaved_2_LE(
+      expected.data(), input.data(), kTestChannelSampleCount,
+      InstructionSet::kScalar);
+  // Left is front left, back left and half of center.
+  float fl = xe::byte_swap(input[0 * kTestChannelSampleCount]);
+  float fc = xe::byte_swap(input[2 * kTestChannelSampleCount]);
+  float bl = xe::byte_swap(input[4 * kTestChannelSampleCount]);
+  REQUIRE(std::abs(expected[0] - (fl + bl + fc * 0.5f) / 2.5f) <= 1.0e-6f);
+  for (InstructionSet instruction_set : kInstructionSets) {
+    std::vector<float> output(expected.size());
+    conversion::sequential_6_BE_to_interleaved_2_LE(
+        output.data(), input.data(), kTestChannelSampleCount, instruction_set);
+    for (size_t i = 0; i < expected.size(); ++i) {
+      REQUIRE(std::abs(output[i] - expected[i]) <= 1.0e-6f);
+    }
+  }
+}
+
+TEST_CASE("conversion_planar_float_to_interleaved_s16_BE", "[conversion]") {
+  for (uint32_t channel_count = 1; channel_count <= 2; ++channel_count) {
+    std::vector<float> input =
+        GenerateSamples(channel_count * kTestChannelSampleCount, false);
+    const float* channels[2] = {input.data(),
+                                input.data() + kTestChannelSampleCount};
+    std::vector<int16_t> expected(channel_count * kTestChannelSampleCount);
+    conversion::planar_float_to_interleaved_s16_BE(
+        expected.data(), channels, channel_count, kTestChannelSampleCount,
+        InstructionSet::kScalar);
+    for (InstructionSet instruction_set : kInstructionSets) {
+      std::vector<int16_t> output(expected.size());
+      conversion::planar_float_to_interleaved_s16_BE(
+          output.data(), channels, channel_count, kTestChannelSampleCount,
+          instruction_set);
+      // The scalar conversion truncates, the vector ones round to nearest.
+      for (size_t i = 0; i < expected.size(); ++i) {
+        int32_t difference = int32_t(xe::byte_swap(output[i])) -
+                             int32_t(xe::byte_swap(expected[i]));
+        REQUIRE(difference >= -1);
+        REQUIRE(difference <= 1);
+      }
+    }
+  }
+}
+
+// Hidden, run explicitly with [benchmark]. Converts the frames of a few
+// seconds of audio.
+TEST_CASE("conversion_audio_frames", "[.][benchmark][conversion]") {
+  // 256 samples per channel per audio driver frame, 512 per XMA frame.
+  constexpr size_t kDriverChannelSampleCount = 256;
+  constexpr size_t kXmaChannelSampleCount = 512;
+  constexpr uint32_t kFrameCount = 32768;
+  std::vector<float> driver_input =
+      GenerateSamples(6 * kDriverChannelSampleCount, true);
+  std::vector<float> driver_output(6 * kDriverChannelSampleCount);
+  std::vector<float> xma_input =
+      GenerateSamples(2 * kXmaChannelSampleCount, false);
+  const float* xma_channels[2] = {xma_input.data(),
+                                  xma_input.data() + kXmaChannelSampleCount};
+  std::vector<int16_t> xma_output(2 * kXmaChannelSampleCount);
+  for (InstructionSet instruction_set : kInstructionSets) {
+    if (instruction_set != InstructionSet::kScalar &&
+        conversion::GetHostInstructionSet() < instruction_set) {
+      fmt::print("{}: not supported\n",
+                 GetInstructionSetName(instruction_set));
+      continue;
+    }
+    auto measure = [&](auto convert) {
+      auto start = std::chrono::steady_clock::now();
+      for (uint32_t i = 0; i < kFrameCount; ++i) {
+        convert();
+      }
+      auto end = std::chrono::steady_clock::now();
+      return std::chrono::duration<double, std::milli>(end - start).count();
+    };
+    double interleave_6_ms = measure([&]() {
+      conversion::sequential_6_BE_to_interleaved_6_LE(
+          driver_output.data(), driver_input.data(),
+          kDriverChannelSampleCount, instruction_set);
+    });
+    double downmix_2_ms = measure([&]() {
+      conversion::sequential_6_BE_to_interleaved_2_LE(
+          driver_output.data(), driver_input.data(),
+          kDriverChannelSampleCount, instruction_set);
+    });
+    double xma_mono_ms = measure([&]() {
+      conversion::planar_float_to_interleaved_s16_BE(
+          xma_output.data(), xma_channels, 1, kXmaChannelSampleCount,
+          instruction_set);
+    });
+    double xma_stereo_ms = measure([&]() {
+      conversion::planar_float_to_interleaved_s16_BE(
+          xma_output.data(), xma_channels, 2, kXmaChannelSampleCount,
+          instruction_set);
+    });
+    fmt::print(
+        "{}, {} frames: 5.1 interleave {:.2f} ms, 5.1 to stereo {:.2f} ms, "
+        "XMA mono {:.2f} ms, XMA stereo {:.2f} ms\n",
+        GetInstructionSetName(instruction_set), kFrameCount, interleave_6_ms,
+        downmix_2_ms, xma_mono_ms, xma_stereo_ms);
+  }
+}
+
+}  // namespace test
+}  // namespace apu
+}  // namespace xe
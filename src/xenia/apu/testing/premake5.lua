@@ -0,0 +1,15 @@
+project_root = "../../../.."
+include(project_root.."/tools/build")
+
+test_suite("xenia-apu-tests", project_root, ".", {
+  includedirs = {
+    project_root.."/third_party/FFmpeg/",
+  },
+  links = {
+    "fmt",
+    "libavcodec",
+    "libavutil",
+    "xenia-apu",
+    "xenia-base",
+  },
+})
@@ -0,0 +1,215 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2024 Xenia Canary. All rights reserved.                          *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/apu/xma_context_new.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+#include "third_party/fmt/include/fmt/format.h"
+
+#include "xenia/base/bit_stream.h"
+
+extern "C" {
+#if XE_COMPILER_MSVC
+#pragma warning(push)
+#pragma warning(disable : 4101 4244 5033)
+#endif
+#include "third_party/FFmpeg/libavcodec/avcodec.h"
+#if XE_COMPILER_MSVC
+#pragma warning(pop)
+#endif
+}  // extern "C"
+
+namespace xe {
+namespace apu {
+namespace test {
+
+namespace {
+
+constexpr uint32_t kBytesPerPacket = XmaContextNew::kBytesPerPacket;
+constexpr uint32_t kBytesPerPacketHeader =
+    XmaContextNew::kBytesPerPacketHeader;
+constexpr uint32_t kBytesPerPacketData = XmaContextNew::kBytesPerPacketData;
+constexpr uint32_t kBitsPerPacket = XmaContextNew::kBitsPerPacket;
+constexpr uint32_t kBitsPerPacketHeader = XmaContextNew::kBitsPerPacketHeader;
+
+// The buffers of XmaContextNew.
+struct FrameBuffers {
+  std::array<uint8_t, kBytesPerPacketData * 2> input_buffer;
+  std::array<uint8_t, 1 + 4096> xma_frame;
+  std::array<uint8_t, XmaContextNew::kBytesPerFrameChannel * 2> raw_frame;
+};
+
+// Prepares a frame for FFmpeg like XmaContextNew::Decode did before frames
+// were read directly from guest memory.
+void PrepareFrameCopying(FrameBuffers& buffers, uint8_t* packet,
+                         uint8_t* next_packet, uint32_t relative_offset,
+                         uint32_t frame_size) {
+  buffers.input_buffer.fill(0);
+  if (relative_offset + frame_size > kBitsPerPacket) {
+    std::memcpy(buffers.input_buffer.data() + kBytesPerPacketData,
+                next_packet + kBytesPerPacketHeader, kBytesPerPacketData);
+  }
+  std::memcpy(buffers.input_buffer.data(), packet + kBytesPerPacketHeader,
+              kBytesPerPacketData);
+  BitStream stream(buffers.input_buffer.data(),
+                   (kBitsPerPacket - kBitsPerPacketHeader) * 2);
+  stream.SetOffset(relative_offset - kBitsPerPacketHeader);
+  buffers.xma_frame.fill(0);
+  stream.Copy(buffers.xma_frame.data() + 1, frame_size);
+  buffers.raw_frame.fill(0);
+}
+
+// Prepares a frame for FFmpeg like XmaContextNew::Decode does now.
+void PrepareFrameDirect(FrameBuffers& buffers, uint8_t* packet,
+                        uint8_t* next_packet, uint32_t relative_offset,
+                        uint32_t frame_size) {
+  BitStream stream(packet, kBitsPerPacket);
+  if (relative_offset + frame_size > kBitsPerPacket) {
+    std::memcpy(buffers.input_buffer.data(), packet + kBytesPerPacketHeader,
+                kBytesPerPacketData);
+    std::memcpy(buffers.input_buffer.data() + kBytesPerPacketData,
+                next_packet + kBytesPerPacketHeader, kBytesPerPacketData);
+    stream = BitStream(buffers.input_buffer.data(),
+                       (kBitsPerPacket - kBitsPerPacketHeader) * 2);
+    stream.SetOffset(relative_offset - kBitsPerPacketHeader);
+  } else {
+    stream.SetOffset(relative_offset);
+  }
+  size_t frame_bytes = 1 + ((relative_offset & 7) + frame_size + 7) / 8 +
+                       AV_INPUT_BUFFER_PADDING_SIZE;
+  std::memset(buffers.xma_frame.data(), 0,
+              std::min(buffers.xma_frame.size(), frame_bytes));
+  stream.Copy(buffers.xma_frame.data() + 1, frame_size);
+}
+
+double MeasureMilliseconds(uint32_t count, const std::function<void()>& f) {
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < count; ++i) {
+    f();
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+}  // namespace
+
+TEST_CASE("xma_frame_preparation", "[xma]") {
+  std::mt19937 random(0x584D4132);
+  std::vector<uint8_t> packets(kBytesPerPacket * 2);
+  for (uint8_t& byte : packets) {
+    byte = uint8_t(random());
+  }
+  uint8_t* packet = packets.data();
+  uint8_t* next_packet = packets.data() + kBytesPerPacket;
+  auto copying = std::make_unique<FrameBuffers>();
+  auto direct = std::make_unique<FrameBuffers>();
+  const uint32_t frame_size = 3000;
+  // Within the packet, and split between the two packets.
+  for (uint32_t relative_offset :
+       {kBitsPerPacketHeader + 15, kBitsPerPacket - 1003}) {
+    PrepareFrameCopying(*copying, packet, next_packet, relative_offset,
+                        frame_size);
+    PrepareFrameDirect(*direct, packet, next_packet, relative_offset,
+                       frame_size);
+    // The bytes FFmpeg may read.
+    size_t frame_bytes = 1 + ((relative_offset & 7) + frame_size + 7) / 8 +
+                         AV_INPUT_BUFFER_PADDING_SIZE;
+    REQUIRE(std::memcmp(copying->xma_frame.data(), direct->xma_frame.data(),
+                        frame_bytes) == 0);
+  }
+}
+
+// Hidden, run explicitly with [benchmark]. Measures the work done around the
+// FFmpeg call for each frame before and after frames were read directly from
+// guest memory, and switching a context between two formats by reopening the
+// codec and by flushing a decoder kept opened. There are no captured XMA
+// streams in the tree to time the decoding itself with.
+TEST_CASE("xma_decoder_overhead", "[.][benchmark][xma]") {
+  constexpr uint32_t kFrameCount = 32768;
+  constexpr uint32_t kSwitchCount = 1024;
+
+  std::mt19937 random(0x584D4132);
+  std::vector<uint8_t> packets(kBytesPerPacket * 2);
+  for (uint8_t& byte : packets) {
+    byte = uint8_t(random());
+  }
+  uint8_t* packet = packets.data();
+  uint8_t* next_packet = packets.data() + kBytesPerPacket;
+  auto buffers = std::make_unique<FrameBuffers>();
+  const uint32_t frame_size = 3000;
+  const uint32_t frame_offset = kBitsPerPacketHeader + 15;
+  const uint32_t split_frame_offset = kBitsPerPacket - 1003;
+  double copying_ms = MeasureMilliseconds(kFrameCount, [&]() {
+    PrepareFrameCopying(*buffers, packet, next_packet, frame_offset,
+                        frame_size);
+  });
+  double direct_ms = MeasureMilliseconds(kFrameCount, [&]() {
+    PrepareFrameDirect(*buffers, packet, next_packet, frame_offset,
+                       frame_size);
+  });
+  double split_copying_ms = MeasureMilliseconds(kFrameCount, [&]() {
+    PrepareFrameCopying(*buffers, packet, next_packet, split_frame_offset,
+                        frame_size);
+  });
+  double split_direct_ms = MeasureMilliseconds(kFrameCount, [&]() {
+    PrepareFrameDirect(*buffers, packet, next_packet, split_frame_offset,
+                       frame_size);
+  });
+  fmt::print(
+      "{} frames: copied {:.2f} ms, direct {:.2f} ms; split copied {:.2f} "
+      "ms, split joined {:.2f} ms\n",
+      kFrameCount, copying_ms, direct_ms, split_copying_ms, split_direct_ms);
+
+  auto codec = avcodec_find_decoder(AV_CODEC_ID_XMAFRAMES);
+  if (!codec) {
+    fmt::print("XMA decoder not available\n");
+    return;
+  }
+  const int sample_rates[2] = {44100, 48000};
+  const int channel_counts[2] = {2, 1};
+  AVCodecContext* contexts[2];
+  for (uint32_t i = 0; i < 2; ++i) {
+    contexts[i] = avcodec_alloc_context3(codec);
+    REQUIRE(contexts[i]);
+    contexts[i]->sample_rate = sample_rates[i];
+    contexts[i]->channels = channel_counts[i];
+    REQUIRE(avcodec_open2(contexts[i], codec, nullptr) >= 0);
+  }
+  uint32_t format = 0;
+  double reopen_ms = MeasureMilliseconds(kSwitchCount, [&]() {
+    format ^= 1;
+    avcodec_close(contexts[0]);
+    contexts[0]->sample_rate = sample_rates[format];
+    contexts[0]->channels = channel_counts[format];
+    avcodec_open2(contexts[0], codec, nullptr);
+  });
+  double flush_ms = MeasureMilliseconds(kSwitchCount, [&]() {
+    format ^= 1;
+    avcodec_flush_buffers(contexts[format]);
+  });
+  fmt::print("{} format switches: reopened {:.2f} ms, flushed {:.2f} ms\n",
+             kSwitchCount, reopen_ms, flush_ms);
+  for (AVCodecContext* context : contexts) {
+    avcodec_close(context);
+    av_free(context);
+  }
+}
+
+}  // namespace test
+}  // namespace apu
+}  // namespace xe
@@ -42,6 +42,12 @@ XmaContextNew::~XmaContextNew() {
     }
     av_free(av_context_);
   }
+  for (AVCodecContext* inactive_av_context : inactive_av_contexts_) {
+    if (inactive_av_context) {
+      avcodec_close(inactive_av_context);
+      av_free(inactive_av_context);
+    }
+  }
   if (av_frame_) {
     av_frame_free(&av_frame_);
   }
@@ -309,8 +315,6 @@ void XmaContextNew::Decode(XMA_CONTEXT_DATA* data) {
     return;
   }
 
-  input_buffer_.fill(0);
-
   UpdateLoopStatus(data);
 
   if (!data->output_buffer_block_count) {
@@ -366,34 +370,45 @@ void XmaContextNew::Decode(XMA_CONTEXT_DATA* data) {
     return;
   }
 
-  if (packet_info.isLastFrameInPacket()) {
+  if (packet_info.isLastFrameInPacket() &&
+      stream.BitsRemaining() < packet_info.current_frame_size_) {
     // Frame is a splitted frame
-    if (stream.BitsRemaining() < packet_info.current_frame_size_) {
-      const uint8_t* next_packet =
-          GetNextPacket(data, next_packet_index, current_input_packet_count);
-
-      if (!next_packet) {
-        // Error path
-        // Decoder probably should return error here
-        // Not sure what error code should be returned
-        data->error_status = 4;
-        return;
-      }
-      // Copy next packet to buffer
-      std::memcpy(input_buffer_.data() + kBytesPerPacketData,
-                  next_packet + kBytesPerPacketHeader, kBytesPerPacketData);
+    const uint8_t* next_packet =
+        GetNextPacket(data, next_packet_index, current_input_packet_count);
+
+    if (!next_packet) {
+      // Error path
+      // Decoder probably should return error here
+      // Not sure what error code should be returned
+      data->error_status = 4;
+      return;
     }
-  }
-
-  // Copy current packet to buffer
-  std::memcpy(input_buffer_.data(), packet + kBytesPerPacketHeader,
-              kBytesPerPacketData);
-
-  stream = BitStream(input_buffer_.data(),
-                     (kBitsPerPacket - kBitsPerPacketHeader) * 2);
-  stream.SetOffset(relative_offset - kBitsPerPacketHeader);
-
-  xma_frame_.fill(0);
+    // Join the data of both packets, without the headers.
+    std::memcpy(input_buffer_.data(), packet + kBytesPerPacketHeader,
+                kBytesPerPacketData);
+    std::memcpy(input_buffer_.data() + kBytesPerPacketData,
+                next_packet + kBytesPerPacketHeader, kBytesPerPacketData);
+
+    stream = BitStream(input_buffer_.data(),
+                       (kBitsPerPacket - kBitsPerPacketHeader) * 2);
+    stream.SetOffset(relative_offset - kBitsPerPacketHeader);
+  } else {
+    // The whole frame is in the packet, read it directly from guest memory.
+    stream = BitStream(packet, kBitsPerPacket);
+    stream.SetOffset(relative_offset);
+  }
+
+  // Only clear the bytes the decoder may read - the frame, keeping its bit
+  // offset within the first byte, and the input padding FFmpeg requires. The
+  // packet headers are whole bytes, so the offset is the same in the packet.
+  const uint32_t frame_padding_bits = relative_offset & 7;
+  std::memset(
+      xma_frame_.data(), 0,
+      std::min(xma_frame_.size(),
+               size_t(1) +
+                   (frame_padding_bits + packet_info.current_frame_size_ + 7) /
+                       8 +
+                   AV_INPUT_BUFFER_PADDING_SIZE));
 
   XELOGAPU(
       "XmaContext {}: Reading Frame {}/{} (size: {}) From Packet "
@@ -405,14 +420,15 @@ void XmaContextNew::Decode(XMA_CONTEXT_DATA* data) {
   const uint32_t padding_start = static_cast<uint8_t>(
       stream.Copy(xma_frame_.data() + 1, packet_info.current_frame_size_));
 
-  raw_frame_.fill(0);
-
   PrepareDecoder(data->sample_rate, bool(data->is_stereo));
   PreparePacket(packet_info.current_frame_size_, padding_start);
   if (DecodePacket(av_context_, av_packet_, av_frame_)) {
     // dump_raw(av_frame_, id());
     ConvertFrame(reinterpret_cast<const uint8_t**>(&av_frame_->data),
                  bool(data->is_stereo), raw_frame_.data());
+  } else {
+    // Output silence for the frame.
+    raw_frame_.fill(0);
   }
 
   // TODO: Write function to regenerate decoder
@@ -644,22 +660,59 @@ int XmaContextNew::PrepareDecoder(int sample_rate, bool is_two_channel) {
 
   // Re-initialize the context with new sample rate and channels.
   uint32_t channels = is_two_channel ? 2 : 1;
-  if (av_context_->sample_rate != sample_rate ||
-      av_context_->channels != channels) {
-    // We have to reopen the codec so it'll realloc whatever data it needs.
-    // TODO(DrChat): Find a better way.
+  if (av_context_->sample_rate == sample_rate &&
+      av_context_->channels == channels) {
+    return 0;
+  }
+
+  if (avcodec_is_open(av_context_)) {
+    // Switch to a decoder already opened for the format if there is one,
+    // keeping the current one as the most recently used.
+    for (size_t i = 0; i < inactive_av_contexts_.size(); ++i) {
+      AVCodecContext* inactive_av_context = inactive_av_contexts_[i];
+      if (inactive_av_context &&
+          inactive_av_context->sample_rate == sample_rate &&
+          inactive_av_context->channels == channels) {
+        std::move_backward(inactive_av_contexts_.begin(),
+                           inactive_av_contexts_.begin() + i,
+                           inactive_av_contexts_.begin() + i + 1);
+        inactive_av_contexts_[0] = av_context_;
+        av_context_ = inactive_av_context;
+        // Don't continue the stream previously decoded in this format.
+        avcodec_flush_buffers(av_context_);
+        return 1;
+      }
+    }
+    // Open a decoder for the format, in place of the least recently used
+    // inactive one if there are too many.
+    AVCodecContext* new_av_context = inactive_av_contexts_.back();
+    if (!new_av_context) {
+      new_av_context = avcodec_alloc_context3(av_codec_);
+      if (!new_av_context) {
+        XELOGE("XmaContext {}: Couldn't allocate context", id());
+        return -1;
+      }
+    }
+    std::move_backward(inactive_av_contexts_.begin(),
+                       inactive_av_contexts_.end() - 1,
+                       inactive_av_contexts_.end());
+    inactive_av_contexts_[0] = av_context_;
+    av_context_ = new_av_context;
+  }
+
+  // We have to reopen the codec so it'll realloc whatever data it needs.
+  if (avcodec_is_open(av_context_)) {
     avcodec_close(av_context_);
+  }
 
-    av_context_->sample_rate = sample_rate;
-    av_context_->channels = channels;
+  av_context_->sample_rate = sample_rate;
+  av_context_->channels = channels;
 
-    if (avcodec_open2(av_context_, av_codec_, NULL) < 0) {
-      XELOGE("XmaContext: Failed to reopen FFmpeg context");
-      return -1;
-    }
-    return 1;
+  if (avcodec_open2(av_context_, av_codec_, NULL) < 0) {
+    XELOGE("XmaContext: Failed to reopen FFmpeg context");
+    return -1;
   }
-  return 0;
+  return 1;
 }
 
 void XmaContextNew::PreparePacket(const uint32_t frame_size,
@@ -121,6 +121,13 @@ class XmaContextNew : public XmaContext {
   // and we want to find offset in next buffer
   uint32_t GetPacketFirstFrameOffset(const XMA_CONTEXT_DATA* data);
 
+  // Decoders opened for other formats (sample rate and channel count), most
+  // recently used first, to switch to instead of reopening the codec when a
+  // context is reused for voices of different formats.
+  static constexpr size_t kMaxInactiveDecoders = 1;
+  std::array<AVCodecContext*, kMaxInactiveDecoders> inactive_av_contexts_ = {};
+
+  // For joining the data of frames split between two packets.
   std::array<uint8_t, kBytesPerPacketData * 2> input_buffer_;
   // first byte contains bit offset information
   std::array<uint8_t, 1 + 4096> xma_frame_;
@@ -404,7 +404,6 @@ void XmaContextOld::Decode(XMA_CONTEXT_DATA* data) {
   // is_dirty_ = false;  // TODO
   assert_false(data->stop_when_done);
   assert_false(data->interrupt_when_done);
-  static int total_samples = 0;
   // Decode until we can't write any more data.
   while (output_remaining_bytes > 0) {
     if (!data->input_buffer_0_valid && !data->input_buffer_1_valid) {
@@ -674,8 +673,6 @@ void XmaContextOld::Decode(XMA_CONTEXT_DATA* data) {
       output_remaining_bytes -= byte_count;
       data->output_buffer_write_offset = output_rb.write_offset() / 256;
 
-      total_samples += id_ == 0 ? kSamplesPerFrame : 0;
-
       uint32_t offset =
           std::max(kBitsPerHeader, data->input_buffer_read_offset);
       offset = static_cast<uint32_t>(
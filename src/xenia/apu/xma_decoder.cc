@@ -13,6 +13,7 @@
 #include "xenia/apu/xma_context_new.h"
 #include "xenia/apu/xma_context_old.h"
 
+#include "xenia/base/clock.h"
 #include "xenia/base/cvar.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
@@ -62,6 +63,12 @@ DEFINE_bool(use_dedicated_xma_thread, true,
             "better results, but decrease performance a bit.",
             "APU");
 
+DEFINE_uint32(xma_decoder_threads, 2,
+              "Number of threads decoding XMA contexts in parallel with the "
+              "XMA decoder thread, for titles playing many voices at once. 0 "
+              "to decode all contexts on the XMA decoder thread.",
+              "APU");
+
 namespace xe {
 namespace apu {
 
@@ -156,6 +163,25 @@ X_STATUS XmaDecoder::Setup(kernel::KernelState* kernel_state) {
   worker_running_ = true;
   work_event_ = xe::threading::Event::CreateAutoResetEvent(false);
   assert_not_null(work_event_);
+  // Created before the worker thread, which checks whether there are any.
+  if (cvars::use_dedicated_xma_thread) {
+    decode_threads_running_ = true;
+    for (uint32_t i = 0; i < cvars::xma_decoder_threads; ++i) {
+      auto thread =
+          kernel::object_ref<kernel::XHostThread>(new kernel::XHostThread(
+              kernel_state, 128 * 1024, 0,
+              [this]() {
+                DecodeThreadMain();
+                return 0;
+              },
+              kernel_state->GetIdleProcess()));
+      thread->set_name(fmt::format("XMA Decoder {}", i));
+      thread->set_can_debugger_suspend(true);
+      thread->Create();
+      decode_threads_.push_back(std::move(thread));
+    }
+  }
+
   worker_thread_ =
       kernel::object_ref<kernel::XHostThread>(new kernel::XHostThread(
           kernel_state, 128 * 1024, 0,
@@ -180,13 +206,35 @@ void XmaDecoder::WorkerThreadMain() {
   while (worker_running_) {
     // Okay, let's loop through XMA contexts to find ones we need to decode!
     bool did_work = false;
-    for (uint32_t n = 0; n < kContextCount; n++) {
-      did_work = contexts_[n]->Work() || did_work;
-
-      // TODO: Need thread safety to do this.
-      // Probably not too important though.
-      // registers_.current_context = n;
-      // registers_.next_context = (n + 1) % kContextCount;
+    if (decode_threads_.empty()) {
+      for (uint32_t n = 0; n < kContextCount; n++) {
+        did_work = WorkContext(n) || did_work;
+
+        // TODO: Need thread safety to do this.
+        // Probably not too important though.
+        // registers_.current_context = n;
+        // registers_.next_context = (n + 1) % kContextCount;
+      }
+    } else {
+      {
+        std::lock_guard<std::mutex> lock(decode_mutex_);
+        assert_zero(decode_pending_count_);
+        for (uint32_t n = 0; n < kContextCount; n++) {
+          if (contexts_[n]->is_enabled() && contexts_[n]->is_allocated()) {
+            decode_queue_.push(n);
+          }
+        }
+        decode_pending_count_ = uint32_t(decode_queue_.size());
+        decode_did_work_ = false;
+      }
+      decode_cond_.notify_all();
+      // Decode along with the decode threads, then wait for the contexts they
+      // have taken.
+      DecodeQueuedContexts();
+      std::unique_lock<std::mutex> lock(decode_mutex_);
+      decode_done_cond_.wait(lock,
+                             [this]() { return !decode_pending_count_; });
+      did_work = decode_did_work_;
     }
 
     if (paused_) {
@@ -203,6 +251,70 @@ void XmaDecoder::WorkerThreadMain() {
   }
 }
 
+void XmaDecoder::DecodeThreadMain() {
+  std::unique_lock<std::mutex> lock(decode_mutex_);
+  while (true) {
+    decode_cond_.wait(lock, [this]() {
+      return !decode_threads_running_ || !decode_queue_.empty();
+    });
+    if (!decode_threads_running_) {
+      break;
+    }
+    lock.unlock();
+    DecodeQueuedContexts();
+    lock.lock();
+  }
+}
+
+bool XmaDecoder::DecodeQueuedContexts() {
+  bool did_work = false;
+  std::unique_lock<std::mutex> lock(decode_mutex_);
+  while (!decode_queue_.empty()) {
+    uint32_t id = decode_queue_.front();
+    decode_queue_.pop();
+    lock.unlock();
+    bool context_did_work = WorkContext(id);
+    lock.lock();
+    did_work = did_work || context_did_work;
+    decode_did_work_ = decode_did_work_ || context_did_work;
+    if (!--decode_pending_count_) {
+      decode_done_cond_.notify_all();
+    }
+  }
+  return did_work;
+}
+
+bool XmaDecoder::WorkContext(uint32_t id) {
+  uint64_t start_ticks = Clock::QueryHostTickCount();
+  if (!contexts_[id]->Work()) {
+    return false;
+  }
+  uint64_t ticks = Clock::QueryHostTickCount() - start_ticks;
+  ContextDecodeCounters& counters = context_decode_counters_[id];
+  counters.work_count.fetch_add(1, std::memory_order_relaxed);
+  counters.decode_ticks.fetch_add(ticks, std::memory_order_relaxed);
+  // Only one thread decodes a context at a time.
+  if (ticks > counters.max_decode_ticks.load(std::memory_order_relaxed)) {
+    counters.max_decode_ticks.store(ticks, std::memory_order_relaxed);
+  }
+  return true;
+}
+
+XmaDecoder::ContextDecodeStats XmaDecoder::GetContextDecodeStats(
+    uint32_t id) const {
+  const ContextDecodeCounters& counters = context_decode_counters_[id];
+  uint64_t frequency = Clock::QueryHostTickFrequency();
+  ContextDecodeStats stats;
+  stats.work_count = counters.work_count.load(std::memory_order_relaxed);
+  stats.decode_time_us =
+      counters.decode_ticks.load(std::memory_order_relaxed) * 1000000 /
+      frequency;
+  stats.max_decode_time_us =
+      counters.max_decode_ticks.load(std::memory_order_relaxed) * 1000000 /
+      frequency;
+  return stats;
+}
+
 void XmaDecoder::Shutdown() {
   worker_running_ = false;
 
@@ -220,6 +332,42 @@ void XmaDecoder::Shutdown() {
     worker_thread_.reset();
   }
 
+  if (!decode_threads_.empty()) {
+    {
+      std::lock_guard<std::mutex> lock(decode_mutex_);
+      decode_threads_running_ = false;
+    }
+    decode_cond_.notify_all();
+    for (auto& thread : decode_threads_) {
+      xe::threading::Wait(thread->thread(), false);
+    }
+    decode_threads_.clear();
+  }
+
+  uint32_t decoded_context_count = 0;
+  uint64_t decode_time_us = 0;
+  uint32_t slowest_context_id = 0;
+  uint64_t slowest_decode_time_us = 0;
+  for (uint32_t i = 0; i < kContextCount; ++i) {
+    ContextDecodeStats stats = GetContextDecodeStats(i);
+    if (!stats.work_count) {
+      continue;
+    }
+    ++decoded_context_count;
+    decode_time_us += stats.decode_time_us;
+    if (stats.max_decode_time_us > slowest_decode_time_us) {
+      slowest_context_id = i;
+      slowest_decode_time_us = stats.max_decode_time_us;
+    }
+  }
+  if (decoded_context_count) {
+    XELOGI(
+        "XMA decoder: {} contexts decoded in {} ms, longest decode {} us "
+        "(context {})",
+        decoded_context_count, decode_time_us / 1000, slowest_decode_time_us,
+        slowest_context_id);
+  }
+
   if (context_data_first_ptr_) {
     memory()->SystemHeapFree(context_data_first_ptr_);
   }
@@ -11,8 +11,10 @@
 #define XENIA_APU_XMA_DECODER_H_
 
 #include <atomic>
+#include <condition_variable>
 #include <mutex>
 #include <queue>
+#include <vector>
 
 #include "xenia/apu/xma_context.h"
 #include "xenia/apu/xma_register_file.h"
@@ -51,11 +53,24 @@ class XmaDecoder {
   void Pause();
   void Resume();
 
+  struct ContextDecodeStats {
+    // Number of times the context has been decoded on the decoder threads.
+    uint64_t work_count;
+    uint64_t decode_time_us;
+    uint64_t max_decode_time_us;
+  };
+  ContextDecodeStats GetContextDecodeStats(uint32_t id) const;
+
  protected:
   int GetContextId(uint32_t guest_ptr);
 
  private:
   void WorkerThreadMain();
+  void DecodeThreadMain();
+  // Decodes the queued contexts until the queue is empty, returning whether
+  // any context has done work.
+  bool DecodeQueuedContexts();
+  bool WorkContext(uint32_t id);
 
   static uint32_t MMIOReadRegisterThunk(void* ppc_context, XmaDecoder* as,
                                         uint32_t addr) {
@@ -84,6 +99,28 @@ class XmaDecoder {
   XmaContext* contexts_[kContextCount];
   BitMap context_bitmap_;
 
+  // Threads decoding the contexts enabled at the beginning of a pass of the
+  // worker thread along with it. Every context is queued at most once per
+  // pass, and the worker thread waits for the whole pass to be decoded, so
+  // a context is never decoded on two threads at once.
+  std::vector<kernel::object_ref<kernel::XHostThread>> decode_threads_;
+  std::mutex decode_mutex_;
+  std::condition_variable decode_cond_;
+  std::condition_variable decode_done_cond_;
+  // Guarded by decode_mutex_.
+  bool decode_threads_running_ = false;
+  std::queue<uint32_t> decode_queue_;
+  // Queued contexts plus contexts being decoded.
+  uint32_t decode_pending_count_ = 0;
+  bool decode_did_work_ = false;
+
+  struct ContextDecodeCounters {
+    std::atomic<uint64_t> work_count = {0};
+    std::atomic<uint64_t> decode_ticks = {0};
+    std::atomic<uint64_t> max_decode_ticks = {0};
+  };
+  ContextDecodeCounters context_decode_counters_[kContextCount];
+
   uint32_t context_data_first_ptr_ = 0;
   uint32_t context_data_last_ptr_ = 0;
 };
@@ -0,0 +1,153 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2023 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/aes_cbc.h"
+
+#include <cstring>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/platform.h"
+
+#include "third_party/crypto/rijndael-alg-fst.c"
+#include "third_party/crypto/rijndael-alg-fst.h"
+
+#if XE_ARCH_AMD64
+#include <wmmintrin.h>
+
+#define XBYAK_NO_OP_NAMES
+#include "third_party/xbyak/xbyak/xbyak.h"
+#include "third_party/xbyak/xbyak/xbyak_util.h"
+
+#if XE_COMPILER_HAS_GNU_EXTENSIONS || XE_COMPILER_HAS_CLANG_EXTENSIONS
+#define XE_AES_NI_TARGET __attribute__((target("aes")))
+#else
+#define XE_AES_NI_TARGET
+#endif
+#endif  // XE_ARCH_AMD64
+
+namespace xe {
+
+AesCbcDecryptor::AesCbcDecryptor(const uint8_t* key, const uint8_t* iv,
+                                 bool allow_aes_ni)
+    : use_aes_ni_(allow_aes_ni && IsAesNiSupported()) {
+  if (iv) {
+    std::memcpy(iv_, iv, kBlockSize);
+  } else {
+    std::memset(iv_, 0, kBlockSize);
+  }
+
+  int round_count = rijndaelKeySetupDec(software_round_keys_, key, 128);
+  assert_true(round_count == kRoundCount);
+
+#if XE_ARCH_AMD64
+  if (use_aes_ni_) {
+    // The table-based decryption schedule is the encryption schedule in
+    // reverse with InvMixColumns applied to the middle round keys, which is
+    // exactly what aesdec expects, just stored as big-endian words.
+    for (size_t i = 0; i < 4 * (kRoundCount + 1); ++i) {
+      uint32_t word = software_round_keys_[i];
+      uint8_t* bytes = &round_keys_[i * 4];
+      bytes[0] = uint8_t(word >> 24);
+      bytes[1] = uint8_t(word >> 16);
+      bytes[2] = uint8_t(word >> 8);
+      bytes[3] = uint8_t(word);
+    }
+  }
+#endif  // XE_ARCH_AMD64
+}
+
+bool AesCbcDecryptor::IsAesNiSupported() {
+#if XE_ARCH_AMD64
+  static const bool is_supported =
+      Xbyak::util::Cpu().has(Xbyak::util::Cpu::tAESNI);
+  return is_supported;
+#else
+  return false;
+#endif  // XE_ARCH_AMD64
+}
+
+void AesCbcDecryptor::Decrypt(const uint8_t* input, uint8_t* output,
+                              size_t length) {
+  assert_zero(length % kBlockSize);
+#if XE_ARCH_AMD64
+  if (use_aes_ni_) {
+    DecryptAesNi(input, output, length);
+    return;
+  }
+#endif  // XE_ARCH_AMD64
+  DecryptSoftware(input, output, length);
+}
+
+void AesCbcDecryptor::DecryptSoftware(const uint8_t* input, uint8_t* output,
+                                      size_t length) {
+  uint8_t ciphertext[kBlockSize];
+  for (size_t n = 0; n < length; n += kBlockSize) {
+    // Keep the ciphertext for chaining in case the decryption is in-place.
+    std::memcpy(ciphertext, input + n, kBlockSize);
+    rijndaelDecrypt(software_round_keys_, kRoundCount, ciphertext, output + n);
+    for (size_t i = 0; i < kBlockSize; i++) {
+      output[n + i] ^= iv_[i];
+    }
+    std::memcpy(iv_, ciphertext, kBlockSize);
+  }
+}
+
+#if XE_ARCH_AMD64
+XE_AES_NI_TARGET void AesCbcDecryptor::DecryptAesNi(const uint8_t* input,
+                                                    uint8_t* output,
+                                                    size_t length) {
+  __m128i keys[kRoundCount + 1];
+  for (int i = 0; i <= kRoundCount; ++i) {
+    keys[i] = _mm_load_si128(
+        reinterpret_cast<const __m128i*>(round_keys_ + kBlockSize * i));
+  }
+  __m128i iv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(iv_));
+
+  // Blocks are independent in CBC decryption, interleave a few to hide the
+  // latency of aesdec.
+  constexpr size_t kInterleave = 4;
+  size_t n = 0;
+  for (; n + kBlockSize * kInterleave <= length;
+       n += kBlockSize * kInterleave) {
+    __m128i ciphertext[kInterleave], block[kInterleave];
+    for (size_t i = 0; i < kInterleave; ++i) {
+      ciphertext[i] = _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(input + n + kBlockSize * i));
+      block[i] = _mm_xor_si128(ciphertext[i], keys[0]);
+    }
+    for (int round = 1; round < kRoundCount; ++round) {
+      for (size_t i = 0; i < kInterleave; ++i) {
+        block[i] = _mm_aesdec_si128(block[i], keys[round]);
+      }
+    }
+    for (size_t i = 0; i < kInterleave; ++i) {
+      block[i] = _mm_aesdeclast_si128(block[i], keys[kRoundCount]);
+      block[i] = _mm_xor_si128(block[i], i ? ciphertext[i - 1] : iv);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(output + n + kBlockSize * i),
+                       block[i]);
+    }
+    iv = ciphertext[kInterleave - 1];
+  }
+  for (; n < length; n += kBlockSize) {
+    __m128i ciphertext =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + n));
+    __m128i block = _mm_xor_si128(ciphertext, keys[0]);
+    for (int round = 1; round < kRoundCount; ++round) {
+      block = _mm_aesdec_si128(block, keys[round]);
+    }
+    block = _mm_aesdeclast_si128(block, keys[kRoundCount]);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(output + n),
+                     _mm_xor_si128(block, iv));
+    iv = ciphertext;
+  }
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(iv_), iv);
+}
+#endif  // XE_ARCH_AMD64
+
+}  // namespace xe
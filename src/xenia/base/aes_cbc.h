@@ -0,0 +1,53 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2023 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_AES_CBC_H_
+#define XENIA_BASE_AES_CBC_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace xe {
+
+// AES-128 decryption in cipher block chaining mode, as used for XEX images
+// and their keys. Uses AES-NI, decrypting multiple blocks at once, when the
+// host supports it.
+class AesCbcDecryptor {
+ public:
+  static constexpr size_t kBlockSize = 16;
+  static constexpr size_t kKeySize = 16;
+
+  // A null iv is all zeros.
+  explicit AesCbcDecryptor(const uint8_t* key, const uint8_t* iv = nullptr,
+                           bool allow_aes_ni = true);
+
+  static bool IsAesNiSupported();
+  bool is_using_aes_ni() const { return use_aes_ni_; }
+
+  // Decrypts length bytes, a multiple of kBlockSize, continuing the chain of
+  // the previous call. The input and the output may be the same buffer.
+  void Decrypt(const uint8_t* input, uint8_t* output, size_t length);
+
+ private:
+  static constexpr int kRoundCount = 10;
+
+  void DecryptSoftware(const uint8_t* input, uint8_t* output, size_t length);
+  void DecryptAesNi(const uint8_t* input, uint8_t* output, size_t length);
+
+  bool use_aes_ni_;
+  // Decryption round keys, in the order aesdec uses them.
+  alignas(16) uint8_t round_keys_[kBlockSize * (kRoundCount + 1)];
+  // Decryption round keys for the table-based implementation.
+  uint32_t software_round_keys_[4 * (kRoundCount + 1)];
+  uint8_t iv_[kBlockSize];
+};
+
+}  // namespace xe
+
+#endif  // XENIA_BASE_AES_CBC_H_
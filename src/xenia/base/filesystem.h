@@ -103,6 +103,10 @@ class FileHandle {
   // Flushes any pending write buffers to the underlying filesystem.
   virtual void Flush() = 0;
 
+  // Hints that the given range will be read soon, so the host can start
+  // bringing it into its cache. Does nothing where there's no such hint.
+  virtual void Prefetch(size_t file_offset, size_t length) {}
+
  protected:
   explicit FileHandle(const std::filesystem::path& path) : path_(path) {}
 
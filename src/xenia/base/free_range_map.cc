@@ -0,0 +1,198 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/free_range_map.h"
+
+#include <algorithm>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/math.h"
+
+namespace xe {
+
+void FreeRangeMap::Reset(uint32_t entry_count) {
+  entry_count_ = entry_count;
+  uint32_t word_count = (entry_count + 63) >> 6;
+  free_.assign(word_count, ~uint64_t(0));
+  if (entry_count & 63) {
+    free_.back() = (uint64_t(1) << (entry_count & 63)) - 1;
+  }
+  uint32_t summary_word_count = (word_count + 63) >> 6;
+  any_free_.assign(summary_word_count, 0);
+  all_free_.assign(summary_word_count, 0);
+  for (uint32_t i = 0; i < word_count; ++i) {
+    UpdateSummary(i);
+  }
+}
+
+bool FreeRangeMap::IsRangeFree(uint32_t first, uint32_t count) const {
+  if (first > entry_count_ || entry_count_ - first < count) {
+    return false;
+  }
+  return FindNext(first, first + count, false) == first + count;
+}
+
+uint32_t FreeRangeMap::FindFirst(uint32_t count, uint32_t alignment,
+                                 uint32_t low, uint32_t high) const {
+  alignment = std::max(alignment, uint32_t(1));
+  high = std::min(high, entry_count_);
+  uint32_t base = xe::round_up(low, alignment, false);
+  while (base < high && high - base >= count) {
+    uint32_t free_index = FindNext(base, high, true);
+    if (free_index >= high) {
+      break;
+    }
+    base = xe::round_up(free_index, alignment, false);
+    if (base >= high || high - base < count) {
+      break;
+    }
+    uint32_t used_index = FindNext(base, base + count, false);
+    if (used_index == base + count) {
+      return base;
+    }
+    // The run must start after the used entry.
+    base = xe::round_up(used_index + 1, alignment, false);
+  }
+  return kInvalidIndex;
+}
+
+uint32_t FreeRangeMap::FindLast(uint32_t count, uint32_t alignment,
+                                uint32_t low, uint32_t high) const {
+  alignment = std::max(alignment, uint32_t(1));
+  high = std::min(high, entry_count_);
+  // Exclusive end of the run.
+  uint32_t end = high;
+  while (end >= count && end - count >= low) {
+    uint32_t base = (end - count) / alignment * alignment;
+    if (base < low) {
+      break;
+    }
+    uint32_t used_index = FindPrev(base, base + count, false);
+    if (used_index == kInvalidIndex) {
+      return base;
+    }
+    // The run must end before the used entry, and at the latest right after
+    // the last free entry preceding it.
+    uint32_t free_index = FindPrev(low, used_index, true);
+    if (free_index == kInvalidIndex) {
+      break;
+    }
+    end = free_index + 1;
+  }
+  return kInvalidIndex;
+}
+
+void FreeRangeMap::Set(uint32_t first, uint32_t count, bool free) {
+  assert_true(first <= entry_count_ && entry_count_ - first >= count);
+  uint32_t end = first + std::min(count, entry_count_ - first);
+  while (first < end) {
+    uint32_t word_index = first >> 6;
+    uint32_t bit_index = first & 63;
+    uint32_t bit_count = std::min(64 - bit_index, end - first);
+    uint64_t mask = bit_count == 64
+                        ? ~uint64_t(0)
+                        : ((uint64_t(1) << bit_count) - 1) << bit_index;
+    if (free) {
+      free_[word_index] |= mask;
+    } else {
+      free_[word_index] &= ~mask;
+    }
+    UpdateSummary(word_index);
+    first += bit_count;
+  }
+}
+
+void FreeRangeMap::UpdateSummary(uint32_t word_index) {
+  uint64_t word = free_[word_index];
+  uint64_t bit = uint64_t(1) << (word_index & 63);
+  uint32_t summary_index = word_index >> 6;
+  if (word) {
+    any_free_[summary_index] |= bit;
+  } else {
+    any_free_[summary_index] &= ~bit;
+  }
+  if (word == ~uint64_t(0)) {
+    all_free_[summary_index] |= bit;
+  } else {
+    all_free_[summary_index] &= ~bit;
+  }
+}
+
+uint32_t FreeRangeMap::FindNextWord(uint32_t word_index, bool free) const {
+  uint32_t word_count = uint32_t(free_.size());
+  if (word_index >= word_count) {
+    return word_count;
+  }
+  uint32_t summary_index = word_index >> 6;
+  uint64_t summary = GetSummaryWord(summary_index, free) &
+                     (~uint64_t(0) << (word_index & 63));
+  while (!summary) {
+    if (++summary_index >= any_free_.size()) {
+      return word_count;
+    }
+    summary = GetSummaryWord(summary_index, free);
+  }
+  // Summary bits past the word count are set for used entries.
+  return std::min((summary_index << 6) + xe::tzcnt(summary), word_count);
+}
+
+uint32_t FreeRangeMap::FindPrevWord(uint32_t word_index, bool free) const {
+  uint32_t summary_index = word_index >> 6;
+  uint64_t summary = GetSummaryWord(summary_index, free) &
+                     (~uint64_t(0) >> (63 - (word_index & 63)));
+  while (!summary) {
+    if (!summary_index) {
+      return kInvalidIndex;
+    }
+    summary = GetSummaryWord(--summary_index, free);
+  }
+  return (summary_index << 6) + 63 - xe::lzcnt(summary);
+}
+
+uint32_t FreeRangeMap::FindNext(uint32_t begin, uint32_t end,
+                                bool free) const {
+  if (begin >= end) {
+    return end;
+  }
+  uint32_t word_index = begin >> 6;
+  uint64_t word = GetWord(word_index, free) & (~uint64_t(0) << (begin & 63));
+  while (!word) {
+    word_index = FindNextWord(word_index + 1, free);
+    if (word_index >= free_.size() || (word_index << 6) >= end) {
+      return end;
+    }
+    word = GetWord(word_index, free);
+  }
+  return std::min((word_index << 6) + xe::tzcnt(word), end);
+}
+
+uint32_t FreeRangeMap::FindPrev(uint32_t begin, uint32_t end,
+                                bool free) const {
+  if (begin >= end) {
+    return kInvalidIndex;
+  }
+  uint32_t last = end - 1;
+  uint32_t word_index = last >> 6;
+  uint64_t word =
+      GetWord(word_index, free) & (~uint64_t(0) >> (63 - (last & 63)));
+  while (!word) {
+    if (!word_index) {
+      return kInvalidIndex;
+    }
+    word_index = FindPrevWord(word_index - 1, free);
+    if (word_index == kInvalidIndex || (word_index << 6) + 63 < begin) {
+      return kInvalidIndex;
+    }
+    word = GetWord(word_index, free);
+  }
+  uint32_t index = (word_index << 6) + 63 - xe::lzcnt(word);
+  return index >= begin ? index : kInvalidIndex;
+}
+
+}  // namespace xe
@@ -0,0 +1,89 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_FREE_RANGE_MAP_H_
+#define XENIA_BASE_FREE_RANGE_MAP_H_
+
+#include <cstdint>
+#include <vector>
+
+namespace xe {
+
+// Free Range Map: tracks which entries (such as pages) are free, and finds
+// aligned runs of free entries without checking them one by one.
+// There's a bit per entry, and for every 64 entries, summary bits telling
+// whether any and whether all of them are free. This way stretches of used or
+// free entries are skipped 64 entries at a time, or 4096 at a time when the
+// whole stretch is either used or free.
+// Not thread-safe, the owner must synchronize access.
+class FreeRangeMap {
+ public:
+  static constexpr uint32_t kInvalidIndex = UINT32_MAX;
+
+  FreeRangeMap() = default;
+  explicit FreeRangeMap(uint32_t entry_count) { Reset(entry_count); }
+
+  // Resizes the map to entry_count entries, all free.
+  void Reset(uint32_t entry_count);
+
+  uint32_t entry_count() const { return entry_count_; }
+
+  bool IsFree(uint32_t index) const {
+    return (free_[index >> 6] >> (index & 63)) & 1;
+  }
+  // Returns whether all the entries in [first, first + count) are free.
+  bool IsRangeFree(uint32_t first, uint32_t count) const;
+
+  void MarkUsed(uint32_t first, uint32_t count) { Set(first, count, false); }
+  void MarkFree(uint32_t first, uint32_t count) { Set(first, count, true); }
+
+  // Finds count free entries, starting at a multiple of alignment, that are
+  // all within [low, high). Returns the lowest (FindFirst) or the highest
+  // (FindLast) index the run can start at, or kInvalidIndex if there's none.
+  uint32_t FindFirst(uint32_t count, uint32_t alignment, uint32_t low,
+                     uint32_t high) const;
+  uint32_t FindLast(uint32_t count, uint32_t alignment, uint32_t low,
+                    uint32_t high) const;
+
+ private:
+  void Set(uint32_t first, uint32_t count, bool free);
+  void UpdateSummary(uint32_t word_index);
+
+  uint64_t GetWord(uint32_t word_index, bool free) const {
+    return free ? free_[word_index] : ~free_[word_index];
+  }
+  // Summary bits of the words that have entries that are free (or used).
+  uint64_t GetSummaryWord(uint32_t summary_index, bool free) const {
+    return free ? any_free_[summary_index] : ~all_free_[summary_index];
+  }
+  // Returns the first word at or after word_index with free (or used) entries,
+  // or the word count if there's none.
+  uint32_t FindNextWord(uint32_t word_index, bool free) const;
+  // Returns the last word at or before word_index with free (or used)
+  // entries, or kInvalidIndex if there's none.
+  uint32_t FindPrevWord(uint32_t word_index, bool free) const;
+  // Returns the first free (or used) entry in [begin, end), or end if there's
+  // none.
+  uint32_t FindNext(uint32_t begin, uint32_t end, bool free) const;
+  // Returns the last free (or used) entry in [begin, end), or kInvalidIndex
+  // if there's none.
+  uint32_t FindPrev(uint32_t begin, uint32_t end, bool free) const;
+
+  uint32_t entry_count_ = 0;
+  // A set bit per free entry. Bits past the entry count are clear.
+  std::vector<uint64_t> free_;
+  // A bit per word of free_, set if the word has any free entries.
+  std::vector<uint64_t> any_free_;
+  // A bit per word of free_, set if all entries of the word are free.
+  std::vector<uint64_t> all_free_;
+};
+
+}  // namespace xe
+
+#endif  // XENIA_BASE_FREE_RANGE_MAP_H_
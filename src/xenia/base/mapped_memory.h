@@ -52,6 +52,10 @@ class MappedMemory {
   uint8_t* data() const { return reinterpret_cast<uint8_t*>(data_); }
   size_t size() const { return size_; }
 
+  // Hints the host that a range of the mapping will be read soon, so it can
+  // be paged in ahead of the accesses. The range is clamped to the mapping.
+  void Prefetch(size_t offset, size_t length) const;
+
   // Close, and optionally truncate file to size
   virtual void Close(uint64_t truncate_size = 0) {}
   virtual void Flush() {}
@@ -13,9 +13,11 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <algorithm>
 #include <memory>
 
 #include "xenia/base/filesystem.h"
+#include "xenia/base/memory.h"
 #include "xenia/base/platform.h"
 
 namespace xe {
@@ -130,6 +132,18 @@ std::unique_ptr<MappedMemory> MappedMemory::OpenForAndroidContentUri(
 }
 #endif  // XE_PLATFORM_ANDROID
 
+void MappedMemory::Prefetch(size_t offset, size_t length) const {
+  if (offset >= size_) {
+    return;
+  }
+  length = std::min(length, size_ - offset);
+  // madvise needs a page-aligned start.
+  uintptr_t start = reinterpret_cast<uintptr_t>(data()) + offset;
+  uintptr_t aligned_start = start & ~uintptr_t(memory::page_size() - 1);
+  madvise(reinterpret_cast<void*>(aligned_start),
+          length + (start - aligned_start), MADV_WILLNEED);
+}
+
 std::unique_ptr<ChunkedMappedMemoryWriter> ChunkedMappedMemoryWriter::Open(
     const std::filesystem::path& path, size_t chunk_size,
     bool low_address_space) {
@@ -7,6 +7,7 @@
  ******************************************************************************
  */
 
+#include <algorithm>
 #include <memory>
 #include <mutex>
 #include <vector>
@@ -101,6 +102,18 @@ class Win32MappedMemory : public MappedMemory {
   DWORD view_access_ = 0;
 };
 
+void MappedMemory::Prefetch(size_t offset, size_t length) const {
+#ifdef XE_BASE_MAPPED_MEMORY_WIN_USE_DESKTOP_FUNCTIONS
+  if (offset >= size_) {
+    return;
+  }
+  WIN32_MEMORY_RANGE_ENTRY range;
+  range.VirtualAddress = data() + offset;
+  range.NumberOfBytes = std::min(length, size_ - offset);
+  PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#endif
+}
+
 std::unique_ptr<MappedMemory> MappedMemory::Open(
     const std::filesystem::path& path, Mode mode, size_t offset,
     size_t length) {
@@ -0,0 +1,120 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2023 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/aes_cbc.h"
+
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+#include "third_party/fmt/include/fmt/format.h"
+
+namespace xe {
+namespace base {
+namespace test {
+
+namespace {
+
+// NIST SP 800-38A, F.2.2 CBC-AES128.Decrypt.
+const uint8_t kKey[16] = {0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6,
+                          0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C};
+const uint8_t kIv[16] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+                         0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F};
+const uint8_t kCiphertext[64] = {
+    0x76, 0x49, 0xAB, 0xAC, 0x81, 0x19, 0xB2, 0x46, 0xCE, 0xE9, 0x8E,
+    0x9B, 0x12, 0xE9, 0x19, 0x7D, 0x50, 0x86, 0xCB, 0x9B, 0x50, 0x72,
+    0x19, 0xEE, 0x95, 0xDB, 0x11, 0x3A, 0x91, 0x76, 0x78, 0xB2, 0x73,
+    0xBE, 0xD6, 0xB8, 0xE3, 0xC1, 0x74, 0x3B, 0x71, 0x16, 0xE6, 0x9E,
+    0x22, 0x22, 0x95, 0x16, 0x3F, 0xF1, 0xCA, 0xA1, 0x68, 0x1F, 0xAC,
+    0x09, 0x12, 0x0E, 0xCA, 0x30, 0x75, 0x86, 0xE1, 0xA7};
+const uint8_t kPlaintext[64] = {
+    0x6B, 0xC1, 0xBE, 0xE2, 0x2E, 0x40, 0x9F, 0x96, 0xE9, 0x3D, 0x7E,
+    0x11, 0x73, 0x93, 0x17, 0x2A, 0xAE, 0x2D, 0x8A, 0x57, 0x1E, 0x03,
+    0xAC, 0x9C, 0x9E, 0xB7, 0x6F, 0xAC, 0x45, 0xAF, 0x8E, 0x51, 0x30,
+    0xC8, 0x1C, 0x46, 0xA3, 0x5C, 0xE4, 0x11, 0xE5, 0xFB, 0xC1, 0x19,
+    0x1A, 0x0A, 0x52, 0xEF, 0xF6, 0x9F, 0x24, 0x45, 0xDF, 0x4F, 0x9B,
+    0x17, 0xAD, 0x2B, 0x41, 0x7B, 0xE6, 0x6C, 0x37, 0x10};
+
+void TestKnownAnswer(bool allow_aes_ni) {
+  uint8_t output[64];
+  AesCbcDecryptor(kKey, kIv, allow_aes_ni)
+      .Decrypt(kCiphertext, output, sizeof(output));
+  REQUIRE(!std::memcmp(output, kPlaintext, sizeof(output)));
+
+  // In-place, continuing the chain across calls.
+  std::memcpy(output, kCiphertext, sizeof(output));
+  AesCbcDecryptor split(kKey, kIv, allow_aes_ni);
+  split.Decrypt(output, output, 16);
+  split.Decrypt(output + 16, output + 16, 48);
+  REQUIRE(!std::memcmp(output, kPlaintext, sizeof(output)));
+}
+
+std::vector<uint8_t> GenerateData(size_t length) {
+  std::mt19937 random(0x58455832);
+  std::vector<uint8_t> data(length);
+  for (uint8_t& byte : data) {
+    byte = uint8_t(random());
+  }
+  return data;
+}
+
+}  // namespace
+
+TEST_CASE("aes_cbc_known_answer", "[aes_cbc]") {
+  SECTION("Table-based") { TestKnownAnswer(false); }
+  if (AesCbcDecryptor::IsAesNiSupported()) {
+    SECTION("AES-NI") { TestKnownAnswer(true); }
+  }
+}
+
+TEST_CASE("aes_cbc_aes_ni_matches_software", "[aes_cbc]") {
+  if (!AesCbcDecryptor::IsAesNiSupported()) {
+    return;
+  }
+  // Not a multiple of the interleaved block count.
+  std::vector<uint8_t> input = GenerateData(16 * 1027);
+  std::vector<uint8_t> software_output(input.size());
+  std::vector<uint8_t> aes_ni_output(input.size());
+  AesCbcDecryptor(kKey, nullptr, false)
+      .Decrypt(input.data(), software_output.data(), input.size());
+  AesCbcDecryptor aes_ni(kKey, nullptr, true);
+  REQUIRE(aes_ni.is_using_aes_ni());
+  aes_ni.Decrypt(input.data(), aes_ni_output.data(), 16 * 5);
+  aes_ni.Decrypt(input.data() + 16 * 5, aes_ni_output.data() + 16 * 5,
+                 input.size() - 16 * 5);
+  REQUIRE(software_output == aes_ni_output);
+}
+
+// Hidden, run explicitly with [benchmark]. The size of the image of a large
+// XEX.
+TEST_CASE("aes_cbc_xex_image", "[.][benchmark][aes_cbc]") {
+  std::vector<uint8_t> input = GenerateData(64 * 1024 * 1024);
+  std::vector<uint8_t> output(input.size());
+  auto measure = [&](bool allow_aes_ni) {
+    auto start = std::chrono::steady_clock::now();
+    AesCbcDecryptor(kKey, nullptr, allow_aes_ni)
+        .Decrypt(input.data(), output.data(), input.size());
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+  };
+  double software_ms = measure(false);
+  if (AesCbcDecryptor::IsAesNiSupported()) {
+    fmt::print("{} MiB: table-based {:.2f} ms, AES-NI {:.2f} ms\n",
+               input.size() >> 20, software_ms, measure(true));
+  } else {
+    fmt::print("{} MiB: table-based {:.2f} ms, AES-NI not supported\n",
+               input.size() >> 20, software_ms);
+  }
+}
+
+}  // namespace test
+}  // namespace base
+}  // namespace xe
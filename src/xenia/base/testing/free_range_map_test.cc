@@ -0,0 +1,217 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/free_range_map.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+#include "third_party/fmt/include/fmt/format.h"
+
+namespace xe {
+namespace base {
+namespace test {
+
+namespace {
+
+// Reference implementation, the page table scan BaseHeap::AllocRange used to
+// do: checking aligned bases one by one, skipping past a used entry once one
+// is found.
+uint32_t FindNaive(const std::vector<bool>& free, uint32_t count,
+                   uint32_t alignment, uint32_t low, uint32_t high,
+                   bool top_down) {
+  high = std::min(high, uint32_t(free.size()));
+  int64_t first_base = (int64_t(low) + alignment - 1) / alignment * alignment;
+  int64_t last_base = (int64_t(high) - count) / alignment * alignment;
+  if (int64_t(high) < count) {
+    return FreeRangeMap::kInvalidIndex;
+  }
+  int64_t base = top_down ? last_base : first_base;
+  while (base >= first_base && base <= last_base) {
+    int64_t used = -1;
+    for (uint32_t i = 0; i < count; ++i) {
+      if (!free[size_t(base) + i]) {
+        used = base + i;
+        if (!top_down) {
+          break;
+        }
+      }
+    }
+    if (used < 0) {
+      return uint32_t(base);
+    }
+    if (top_down) {
+      if (used < count) {
+        break;
+      }
+      base = (used - count) / alignment * alignment;
+    } else {
+      base = (used + alignment) / alignment * alignment;
+    }
+  }
+  return FreeRangeMap::kInvalidIndex;
+}
+
+struct TraceEntry {
+  // Zero to free the allocation made by the entry at free_entry.
+  uint32_t page_count;
+  uint32_t alignment;
+  bool top_down;
+  size_t free_entry;
+};
+
+// Allocation pattern of a title streaming its world in: long-lived
+// allocations made during loading, then a churn of texture, geometry and
+// audio buffers of varied sizes freed in a different order than allocated.
+std::vector<TraceEntry> GenerateStreamingTrace(uint32_t entry_count) {
+  std::mt19937 random(0x58454E49);
+  std::vector<TraceEntry> trace;
+  std::vector<size_t> live;
+  for (uint32_t i = 0; i < 512; ++i) {
+    trace.push_back({1u + random() % 64, 1u << (random() % 5), false, 0});
+  }
+  while (trace.size() < entry_count) {
+    if (live.size() > 256 || (!live.empty() && random() % 2)) {
+      size_t live_index = random() % live.size();
+      trace.push_back({0, 0, false, live[live_index]});
+      live[live_index] = live.back();
+      live.pop_back();
+    } else {
+      uint32_t size_class = random() % 16;
+      uint32_t page_count = size_class < 10   ? 1u + random() % 16
+                            : size_class < 15 ? 16u + random() % 256
+                                              : 256u + random() % 4096;
+      live.push_back(trace.size());
+      trace.push_back(
+          {page_count, 1u << (random() % 5), random() % 4 == 0, 0});
+    }
+  }
+  return trace;
+}
+
+}  // namespace
+
+TEST_CASE("free_range_map_basic", "[free_range_map]") {
+  FreeRangeMap map(200);
+  REQUIRE(map.entry_count() == 200);
+  REQUIRE(map.IsRangeFree(0, 200));
+  REQUIRE(map.FindFirst(200, 1, 0, 200) == 0);
+  REQUIRE(map.FindFirst(201, 1, 0, 200) == FreeRangeMap::kInvalidIndex);
+
+  map.MarkUsed(10, 100);
+  REQUIRE(!map.IsFree(10));
+  REQUIRE(!map.IsFree(109));
+  REQUIRE(map.IsFree(110));
+  REQUIRE(!map.IsRangeFree(0, 11));
+  REQUIRE(map.FindFirst(10, 1, 0, 200) == 0);
+  REQUIRE(map.FindFirst(11, 1, 0, 200) == 110);
+  REQUIRE(map.FindFirst(11, 16, 0, 200) == 112);
+  REQUIRE(map.FindLast(11, 1, 0, 200) == 189);
+  REQUIRE(map.FindLast(11, 16, 0, 200) == 176);
+  REQUIRE(map.FindLast(10, 1, 0, 110) == 0);
+  REQUIRE(map.FindLast(90, 1, 0, 200) == 110);
+  REQUIRE(map.FindLast(91, 1, 0, 200) == FreeRangeMap::kInvalidIndex);
+
+  map.MarkFree(10, 100);
+  REQUIRE(map.IsRangeFree(0, 200));
+  map.Reset(64);
+  REQUIRE(map.FindLast(64, 64, 0, 64) == 0);
+}
+
+TEST_CASE("free_range_map_matches_naive_search", "[free_range_map]") {
+  std::mt19937 random(1);
+  for (uint32_t iteration = 0; iteration < 50; ++iteration) {
+    uint32_t entry_count = 1 + random() % 9000;
+    FreeRangeMap map(entry_count);
+    std::vector<bool> free(entry_count, true);
+    for (uint32_t operation = 0; operation < 200; ++operation) {
+      uint32_t first = random() % entry_count;
+      uint32_t count = random() % std::min(entry_count - first, 300u);
+      bool mark_free = random() % 2;
+      if (mark_free) {
+        map.MarkFree(first, count);
+      } else {
+        map.MarkUsed(first, count);
+      }
+      std::fill(free.begin() + first, free.begin() + first + count, mark_free);
+
+      uint32_t find_count = 1 + random() % 40;
+      uint32_t alignment = 1u << (random() % 5);
+      uint32_t low = random() % entry_count;
+      uint32_t high = low + random() % (entry_count - low + 8);
+      REQUIRE(map.FindFirst(find_count, alignment, low, high) ==
+              FindNaive(free, find_count, alignment, low, high, false));
+      REQUIRE(map.FindLast(find_count, alignment, low, high) ==
+              FindNaive(free, find_count, alignment, low, high, true));
+    }
+  }
+}
+
+// Hidden, run explicitly with [benchmark].
+TEST_CASE("free_range_map_streaming_trace", "[.][benchmark][free_range_map]") {
+  // The 4 KB page range of the 0x40000000 virtual heap.
+  constexpr uint32_t kPageCount = 0x3F000000 / 4096;
+  std::vector<TraceEntry> trace = GenerateStreamingTrace(50000);
+
+  auto replay = [&](auto find, auto mark) {
+    std::vector<uint32_t> bases(trace.size(), FreeRangeMap::kInvalidIndex);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < trace.size(); ++i) {
+      const TraceEntry& entry = trace[i];
+      if (entry.page_count) {
+        bases[i] = find(entry.page_count, entry.alignment, entry.top_down);
+        if (bases[i] != FreeRangeMap::kInvalidIndex) {
+          mark(bases[i], entry.page_count, false);
+        }
+      } else if (bases[entry.free_entry] != FreeRangeMap::kInvalidIndex) {
+        mark(bases[entry.free_entry], trace[entry.free_entry].page_count,
+             true);
+      }
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::make_pair(
+        bases, std::chrono::duration<double, std::milli>(end - start).count());
+  };
+
+  std::vector<bool> naive_free(kPageCount, true);
+  auto naive = replay(
+      [&](uint32_t count, uint32_t alignment, bool top_down) {
+        return FindNaive(naive_free, count, alignment, 0, kPageCount,
+                         top_down);
+      },
+      [&](uint32_t first, uint32_t count, bool mark_free) {
+        std::fill(naive_free.begin() + first,
+                  naive_free.begin() + first + count, mark_free);
+      });
+
+  FreeRangeMap map(kPageCount);
+  auto indexed = replay(
+      [&](uint32_t count, uint32_t alignment, bool top_down) {
+        return top_down ? map.FindLast(count, alignment, 0, kPageCount)
+                        : map.FindFirst(count, alignment, 0, kPageCount);
+      },
+      [&](uint32_t first, uint32_t count, bool mark_free) {
+        if (mark_free) {
+          map.MarkFree(first, count);
+        } else {
+          map.MarkUsed(first, count);
+        }
+      });
+
+  REQUIRE(naive.first == indexed.first);
+  fmt::print("{} operations: page scan {:.2f} ms, free range map {:.2f} ms\n",
+             trace.size(), naive.second, indexed.second);
+}
+
+}  // namespace test
+}  // namespace base
+}  // namespace xe
@@ -113,6 +113,14 @@ void MaybeYield();
 // Memory barrier (request - may be ignored).
 void SyncMemory();
 
+// Blocks the calling thread while the value at the address equals
+// expected_value, until another thread of the process calls WakeByAddressSingle
+// or WakeByAddressAll with the same address. May also return spuriously, the
+// caller must check the value again.
+void WaitOnAddress(volatile uint32_t* address, uint32_t expected_value);
+void WakeByAddressSingle(volatile uint32_t* address);
+void WakeByAddressAll(volatile uint32_t* address);
+
 // Sleeps the current thread for at least as long as the given duration.
 void Sleep(std::chrono::microseconds duration);
 void NanoSleep(int64_t ns);
@@ -14,6 +14,7 @@
 #include "xenia/base/platform.h"
 #include "xenia/base/threading_timer_queue.h"
 
+#include <linux/futex.h>
 #include <pthread.h>
 #include <sched.h>
 #include <signal.h>
@@ -23,6 +24,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <array>
+#include <climits>
 #include <cstddef>
 #include <ctime>
 #include <memory>
@@ -145,6 +147,20 @@ void MaybeYield() {
 
 void SyncMemory() { __sync_synchronize(); }
 
+void WaitOnAddress(volatile uint32_t* address, uint32_t expected_value) {
+  syscall(SYS_futex, address, FUTEX_WAIT_PRIVATE, expected_value, nullptr,
+          nullptr, 0);
+}
+
+void WakeByAddressSingle(volatile uint32_t* address) {
+  syscall(SYS_futex, address, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+}
+
+void WakeByAddressAll(volatile uint32_t* address) {
+  syscall(SYS_futex, address, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr,
+          0);
+}
+
 void Sleep(std::chrono::microseconds duration) {
   timespec rqtp = DurationToTimeSpec(duration);
   timespec rmtp = {};
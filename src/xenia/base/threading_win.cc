@@ -161,6 +161,18 @@ void NanoSleep(int64_t ns) {
 }
 void SyncMemory() { MemoryBarrier(); }
 
+void WaitOnAddress(volatile uint32_t* address, uint32_t expected_value) {
+  ::WaitOnAddress(address, &expected_value, sizeof(expected_value), INFINITE);
+}
+
+void WakeByAddressSingle(volatile uint32_t* address) {
+  ::WakeByAddressSingle(const_cast<uint32_t*>(address));
+}
+
+void WakeByAddressAll(volatile uint32_t* address) {
+  ::WakeByAddressAll(const_cast<uint32_t*>(address));
+}
+
 void Sleep(std::chrono::microseconds duration) {
   if (duration.count() < 100) {
     MaybeYield();
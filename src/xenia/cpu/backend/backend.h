@@ -10,6 +10,7 @@
 #ifndef XENIA_CPU_BACKEND_BACKEND_H_
 #define XENIA_CPU_BACKEND_BACKEND_H_
 
+#include <filesystem>
 #include <memory>
 
 #include "xenia/cpu/backend/machine_info.h"
@@ -99,6 +100,17 @@ class Backend {
     return false;
   }
 
+  // Restores previously generated guest code from the given file, and
+  // remembers the path for SavePersistentCode. Must be called before any guest
+  // code is generated. Returns false if the backend doesn't support persisting
+  // code.
+  virtual bool LoadPersistentCode(const std::filesystem::path& path) {
+    return false;
+  }
+  // Writes the guest code generated so far to the path passed to
+  // LoadPersistentCode, if any.
+  virtual void SavePersistentCode() {}
+
   virtual uint32_t CreateGuestTrampoline(GuestTrampolineProc proc,
                                          void* userdata1, void* userdata2,
                                          bool long_term = false) {
@@ -92,8 +92,12 @@ bool X64Assembler::Assemble(GuestFunction* function, HIRBuilder* builder,
   }
 
   function->set_debug_info(std::move(debug_info));
-  static_cast<X64Function*>(function)->Setup(
-      reinterpret_cast<uint8_t*>(machine_code), code_size);
+  auto x64_function = static_cast<X64Function*>(function);
+  x64_function->Setup(reinterpret_cast<uint8_t*>(machine_code), code_size);
+  x64_function->SetupPersistentInfo(
+      emitter_->is_relocatable(), emitter_->func_info(),
+      emitter_->relocations(), emitter_->direct_callees(),
+      emitter_->call_sites());
 
   // Install into indirection table.
   uint64_t host_address = reinterpret_cast<uint64_t>(machine_code);
@@ -11,11 +11,16 @@
 
 #include <stddef.h>
 #include <algorithm>
+#include <vector>
 #include "third_party/capstone/include/capstone/capstone.h"
 #include "third_party/capstone/include/capstone/x86.h"
 
 #include "xenia/base/exception_handler.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/mapped_memory.h"
+#include "xenia/base/platform_amd64.h"
+#include "xenia/base/xxhash.h"
 #include "xenia/cpu/backend/x64/x64_assembler.h"
 #include "xenia/cpu/backend/x64/x64_code_cache.h"
 #include "xenia/cpu/backend/x64/x64_emitter.h"
@@ -41,10 +46,50 @@ DEFINE_bool(enable_host_guest_stack_synchronization, true,
             "and checks for reentry at return sites. Has slight performance "
             "impact, but fixes crashes in games that use setjmp/longjmp.",
             "x64");
+
+DEFINE_uint32(reservation_granularity_shift, 7,
+              "Log2 of the size of the guest memory blocks reserved by "
+              "lwarx/ldarx, from 3 to 16. A stwcx/stdcx fails if another "
+              "thread has reserved the same block in between. The default of "
+              "7 is the 128 byte cache line of the Xenon, 16 is the 64 KB "
+              "granularity used previously.",
+              "x64");
+DEFINE_bool(reservation_contention_counters, false,
+            "Count, per reservation block, how many times a lwarx/ldarx "
+            "found the block reserved by another thread, and log the most "
+            "contended blocks on shutdown.",
+            "x64");
 #if XE_X64_PROFILER_AVAILABLE == 1
 DECLARE_bool(instrument_call_times);
 #endif
 
+// Settings that affect the generated code, for the persistent code cache key.
+DECLARE_bool(emit_source_annotations);
+DECLARE_bool(enable_incorrect_roundingmode_behavior);
+DECLARE_uint32(align_all_basic_blocks);
+DECLARE_bool(elide_e0_check);
+DECLARE_bool(enable_rmw_context_merging);
+DECLARE_bool(emit_mmio_aware_stores_for_recorded_exception_addresses);
+DECLARE_bool(xop_rotates);
+DECLARE_bool(xop_left_shifts);
+DECLARE_bool(xop_right_shifts);
+DECLARE_bool(xop_arithmetic_right_shifts);
+DECLARE_bool(xop_compares);
+DECLARE_bool(use_fast_dot_product);
+DECLARE_bool(no_round_to_single);
+DECLARE_bool(inline_loadclock);
+DECLARE_bool(delay_via_maybeyield);
+DECLARE_bool(inline_mmio_access);
+DECLARE_bool(permit_float_constant_evaluation);
+DECLARE_bool(store_all_context_values);
+DECLARE_bool(full_optimization_even_with_debug);
+DECLARE_bool(ignore_trap_instructions);
+DECLARE_bool(no_reserved_ops);
+DECLARE_bool(disable_prefetch_and_cachecontrol);
+DECLARE_bool(break_on_unimplemented_instructions);
+DECLARE_bool(linear_scan_register_allocation);
+DECLARE_bool(patch_guest_call_sites);
+
 namespace xe {
 namespace cpu {
 namespace backend {
@@ -64,6 +109,7 @@ class X64HelperEmitter : public X64Emitter {
   HostToGuestThunk EmitHostToGuestThunk();
   GuestToHostThunk EmitGuestToHostThunk();
   ResolveFunctionThunk EmitResolveFunctionThunk();
+  void* EmitIndirectCallThunk();
   void* EmitGuestAndHostSynchronizeStackHelper();
   // 1 for loading byte, 2 for halfword and 4 for word.
   // these specialized versions save space in the caller
@@ -72,6 +118,10 @@ class X64HelperEmitter : public X64Emitter {
 
   void* EmitTryAcquireReservationHelper();
   void* EmitReservedStoreHelper(bool bit64 = false);
+  // ecx = guest address, reserve_helper = the ReserveHelper.
+  // Returns the address of the qword of the reservation table entry in rdx,
+  // and the bit in it in ecx.
+  void EmitReserveEntryLookup(const Xbyak::Reg64& reserve_helper);
 
   void* EmitScalarVRsqrteHelper();
   void* EmitVectorVRsqrteHelper(void* scalar_helper);
@@ -136,6 +186,18 @@ X64Backend::X64Backend() : Backend(), code_cache_(nullptr) {
 }
 
 X64Backend::~X64Backend() {
+  if (reserve_contention_) {
+    DumpReserveContention();
+  }
+  if (code_cache_) {
+    X64CodeCache::CallSiteStats call_site_stats =
+        code_cache_->GetCallSiteStats();
+    if (call_site_stats.total) {
+      XELOGI("Guest call sites: {} patched to direct calls, {} still indirect",
+             call_site_stats.patched,
+             call_site_stats.total - call_site_stats.patched);
+    }
+  }
   if (capstone_handle_) {
     cs_close(&capstone_handle_);
   }
@@ -267,6 +329,10 @@ bool X64Backend::Initialize(Processor* processor) {
   host_to_guest_thunk_ = thunk_emitter.EmitHostToGuestThunk();
   guest_to_host_thunk_ = thunk_emitter.EmitGuestToHostThunk();
   resolve_function_thunk_ = thunk_emitter.EmitResolveFunctionThunk();
+  indirect_call_thunk_ = thunk_emitter.EmitIndirectCallThunk();
+  assert_zero(uint64_t(indirect_call_thunk_) & 0xFFFFFFFF00000000ull);
+  code_cache_->set_indirect_call_thunk(
+      uint32_t(uint64_t(indirect_call_thunk_)));
 
   if (cvars::enable_host_guest_stack_synchronization) {
     synchronize_guest_and_host_stack_helper_ =
@@ -282,6 +348,10 @@ bool X64Backend::Initialize(Processor* processor) {
         thunk_emitter.EmitGuestAndHostSynchronizeStackSizeLoadThunk(
             synchronize_guest_and_host_stack_helper_, 4);
   }
+  if (cvars::reservation_contention_counters) {
+    reserve_contention_ =
+        std::make_unique<ReserveContention[]>(RESERVE_NUM_ENTRIES);
+  }
   try_acquire_reservation_helper_ =
       thunk_emitter.EmitTryAcquireReservationHelper();
   reserved_store_32_helper = thunk_emitter.EmitReservedStoreHelper(false);
@@ -522,8 +592,11 @@ uint64_t X64Backend::CalculateNextHostInstruction(ThreadDebugInfo* thread_info,
 }
 
 void X64Backend::InstallBreakpoint(Breakpoint* breakpoint) {
-  breakpoint->ForEachHostAddress([breakpoint](uint64_t host_address) {
+  breakpoint->ForEachHostAddress([this, breakpoint](uint64_t host_address) {
     auto ptr = reinterpret_cast<void*>(host_address);
+    // Patching must not write over the breakpoint or change the original
+    // bytes.
+    code_cache_->PinCallSites(reinterpret_cast<uint8_t*>(ptr), 2, true);
     auto original_bytes = xe::load_and_swap<uint16_t>(ptr);
     assert_true(original_bytes != 0x0F0B);
     xe::store_and_swap<uint16_t>(ptr, 0x0F0B);
@@ -544,6 +617,7 @@ void X64Backend::InstallBreakpoint(Breakpoint* breakpoint, Function* fn) {
 
   // Assume we haven't already installed a breakpoint in this spot.
   auto ptr = reinterpret_cast<void*>(host_address);
+  code_cache_->PinCallSites(reinterpret_cast<uint8_t*>(ptr), 2, true);
   auto original_bytes = xe::load_and_swap<uint16_t>(ptr);
   assert_true(original_bytes != 0x0F0B);
   xe::store_and_swap<uint16_t>(ptr, 0x0F0B);
@@ -556,6 +630,7 @@ void X64Backend::UninstallBreakpoint(Breakpoint* breakpoint) {
     auto instruction_bytes = xe::load_and_swap<uint16_t>(ptr);
     assert_true(instruction_bytes == 0x0F0B);
     xe::store_and_swap<uint16_t>(ptr, static_cast<uint16_t>(pair.second));
+    code_cache_->PinCallSites(ptr, 2, false);
   }
   breakpoint->backend_data().clear();
 }
@@ -784,6 +859,23 @@ ResolveFunctionThunk X64HelperEmitter::EmitResolveFunctionThunk() {
   void* fn = Emplace(func_info);
   return (ResolveFunctionThunk)fn;
 }
+
+void* X64HelperEmitter::EmitIndirectCallThunk() {
+  // ebx = target PPC address
+  // Called or jumped to by call sites that haven't been patched to call the
+  // target directly, see X64CallSite.
+  _code_offsets code_offsets = {};
+  code_offsets.prolog = getSize();
+  code_offsets.prolog_stack_alloc = getSize();
+  code_offsets.body = getSize();
+
+  mov(eax, dword[rbx]);
+  jmp(rax);
+
+  code_offsets.epilog = getSize();
+  code_offsets.tail = getSize();
+  return EmitCurrentForOffsets(code_offsets);
+}
 // r11 = size of callers stack, r8 = return address w/ adjustment
 // i'm not proud of this code, but it shouldn't be executed frequently at all
 void* X64HelperEmitter::EmitGuestAndHostSynchronizeStackHelper() {
@@ -1347,23 +1439,41 @@ void* X64HelperEmitter::EmitFrsqrteHelper() {
   return EmitCurrentForOffsets(code_offsets);
 }
 
+void X64HelperEmitter::EmitReserveEntryLookup(
+    const Xbyak::Reg64& reserve_helper) {
+  uint32_t shift = X64Backend::GetReserveGranularityShift();
+  shr(ecx, shift);
+  if (32 - shift > RESERVE_TABLE_BITS) {
+    // Fibonacci hashing, spreads nearby blocks over the whole table.
+    imul(ecx, ecx, int32_t(0x9E3779B1));
+    shr(ecx, 32 - RESERVE_TABLE_BITS);
+  }
+  mov(edx, ecx);
+  shr(edx, 6);  // divide by 64
+  lea(rdx, ptr[reserve_helper + rdx * 8]);
+  and_(ecx, 64 - 1);
+}
+
 void* X64HelperEmitter::EmitTryAcquireReservationHelper() {
   _code_offsets code_offsets = {};
   code_offsets.prolog = getSize();
 
   Xbyak::Label already_has_a_reservation;
   Xbyak::Label acquire_new_reservation;
+  Xbyak::Label acquired;
+  bool count_contention = backend()->reserve_contention() != nullptr;
 
   btr(GetBackendFlagsPtr(), kX64BackendHasReserveBit);
   mov(r8, GetBackendCtxPtr(offsetof(X64BackendContext, reserve_helper_)));
   jc(already_has_a_reservation);
 
-  shr(ecx, RESERVE_BLOCK_SHIFT);
+  if (count_contention) {
+    mov(GetBackendCtxPtr(
+            offsetof(X64BackendContext, reserve_contention_address)),
+        ecx);
+  }
+  EmitReserveEntryLookup(r8);
   xor_(r9d, r9d);
-  mov(edx, ecx);
-  shr(edx, 6);  // divide by 64
-  lea(rdx, ptr[r8 + rdx * 8]);
-  and_(ecx, 64 - 1);
 
   lock();
   bts(qword[rdx], rcx);
@@ -1377,6 +1487,22 @@ void* X64HelperEmitter::EmitTryAcquireReservationHelper() {
   mov(GetBackendCtxPtr(offsetof(X64BackendContext, cached_reserve_bit)), ecx);
 
   or_(GetBackendCtxPtr(offsetof(X64BackendContext, flags)), r9d);
+  if (count_contention) {
+    test(r9d, r9d);
+    jnz(acquired);
+    // Entry index = qword offset * 8 + bit.
+    sub(rdx, r8);
+    lea(rcx, ptr[rcx + rdx * 8]);
+    mov(r8,
+        GetBackendCtxPtr(offsetof(X64BackendContext, reserve_contention_)));
+    lock();
+    inc(dword[r8 + rcx * 8 + offsetof(ReserveContention, count)]);
+    mov(edx, GetBackendCtxPtr(
+                 offsetof(X64BackendContext, reserve_contention_address)));
+    mov(dword[r8 + rcx * 8 + offsetof(ReserveContention, last_guest_address)],
+        edx);
+    L(acquired);
+  }
   ret();
   L(already_has_a_reservation);
   DebugBreak();
@@ -1405,10 +1531,7 @@ void* X64HelperEmitter::EmitReservedStoreHelper(bool bit64) {
 
   mov(rax, GetBackendCtxPtr(offsetof(X64BackendContext, reserve_helper_)));
 
-  shr(ecx, RESERVE_BLOCK_SHIFT);
-  mov(edx, ecx);
-  shr(edx, 6);  // divide by 64
-  lea(rdx, ptr[rax + rdx * 8]);
+  EmitReserveEntryLookup(rax);
   // begin acquiring exclusive access to cacheline containing our bit
   prefetchw(ptr[rdx]);
 
@@ -1419,10 +1542,6 @@ void* X64HelperEmitter::EmitReservedStoreHelper(bool bit64) {
   mov(rax,
       GetBackendCtxPtr(offsetof(X64BackendContext, cached_reserve_value_)));
 
-  // we need modulo bitsize, it turns out bittests' modulus behavior for the
-  // bitoffset only applies for register operands, for memory ones we bug out
-  // todo: actually, the above note may not be true, double check it
-  and_(ecx, 64 - 1);
   cmp(GetBackendCtxPtr(offsetof(X64BackendContext, cached_reserve_bit)), ecx);
   jnz(reservation_isnt_for_our_addr);
 
@@ -1436,7 +1555,7 @@ void* X64HelperEmitter::EmitReservedStoreHelper(bool bit64) {
   }
   // the ZF flag is unaffected by BTR! we exploit this for the retval
 
-  // cancel our lock on the 65k block
+  // cancel our lock on the block
   lock();
   btr(qword[rdx], rcx);
 
@@ -1450,10 +1569,18 @@ void* X64HelperEmitter::EmitReservedStoreHelper(bool bit64) {
   cmp(ax, 0x0101);
   ret();
 
-  // could be the same label, but otherwise we don't know where we came from
-  // when one gets triggered
+  // A store to another block than the one reserved, which may happen in
+  // normal guest code with fine reservation granularity, fails like on the
+  // guest, releasing the reservation.
   L(reservation_isnt_for_our_addr);
-  DebugBreak();
+  mov(rdx,
+      GetBackendCtxPtr(offsetof(X64BackendContext, cached_reserve_offset)));
+  mov(ecx, GetBackendCtxPtr(offsetof(X64BackendContext, cached_reserve_bit)));
+  lock();
+  btr(qword[rdx], rcx);
+  xor_(eax, eax);
+  cmp(ax, 0x0101);
+  ret();
 
   L(somehow_double_cleared);  // somehow, something else cleared our reserve??
   DebugBreak();
@@ -1584,6 +1711,8 @@ void X64Backend::InitializeBackendContext(void* ctx) {
   bctx->Ox1000 = 0x1000;
   bctx->guest_tick_count = Clock::GetGuestTickCountPointer();
   bctx->reserve_helper_ = &reserve_helper_;
+  bctx->reserve_contention_ = reserve_contention_.get();
+  bctx->reserve_contention_address = 0;
 }
 void X64Backend::DeinitializeBackendContext(void* ctx) {
   X64BackendContext* bctx = BackendContextForGuestContext(ctx);
@@ -1666,6 +1795,46 @@ uint64_t* X64Backend::GetProfilerRecordForFunction(uint32_t guest_address) {
 
 #endif
 
+uint32_t X64Backend::GetReserveGranularityShift() {
+  return std::clamp(cvars::reservation_granularity_shift, uint32_t(3),
+                    uint32_t(16));
+}
+
+uint32_t X64Backend::GetReserveEntryIndex(uint32_t guest_address) {
+  // Must match X64HelperEmitter::EmitReserveEntryLookup.
+  uint32_t shift = GetReserveGranularityShift();
+  uint32_t block = guest_address >> shift;
+  if (32 - shift > RESERVE_TABLE_BITS) {
+    block = (block * 0x9E3779B1u) >> (32 - RESERVE_TABLE_BITS);
+  }
+  return block;
+}
+
+void X64Backend::DumpReserveContention(size_t max_entry_count) const {
+  if (!reserve_contention_) {
+    return;
+  }
+  std::vector<const ReserveContention*> entries;
+  uint64_t total = 0;
+  for (size_t i = 0; i < RESERVE_NUM_ENTRIES; ++i) {
+    const ReserveContention& entry = reserve_contention_[i];
+    if (entry.count) {
+      entries.push_back(&entry);
+      total += entry.count;
+    }
+  }
+  XELOGI("Reservation contention: {} failed lwarx/ldarx on {} blocks", total,
+         entries.size());
+  size_t count = std::min(entries.size(), max_entry_count);
+  std::partial_sort(entries.begin(), entries.begin() + count, entries.end(),
+                    [](const ReserveContention* a, const ReserveContention* b) {
+                      return a->count > b->count;
+                    });
+  for (size_t i = 0; i < count; ++i) {
+    XELOGI("  {:08X}: {}", entries[i]->last_guest_address, entries[i]->count);
+  }
+}
+
 // todo:flush cache
 uint32_t X64Backend::CreateGuestTrampoline(GuestTrampolineProc proc,
                                            void* userdata1, void* userdata2,
@@ -1712,6 +1881,88 @@ void X64Backend::FreeGuestTrampoline(uint32_t trampoline_addr) {
       (trampoline_addr - GUEST_TRAMPOLINE_BASE) / GUEST_TRAMPOLINE_MIN_LEN;
   guest_trampoline_address_bitmap_.Release(index);
 }
+
+uint64_t X64Backend::CalculateCodegenKey() const {
+  // Relocations are stored relative to the emulator executable, and code is
+  // generated differently by every build, so the executable itself is the
+  // most reliable identification of the build.
+  auto executable = xe::MappedMemory::Open(xe::filesystem::GetExecutablePath(),
+                                           xe::MappedMemory::Mode::kRead);
+  if (!executable) {
+    XELOGW("Unable to identify the emulator executable, not using the "
+           "persistent code cache");
+    return 0;
+  }
+  XXH3_state_t hash_state;
+  XXH3_64bits_reset(&hash_state);
+  XXH3_64bits_update(&hash_state, executable->data(), executable->size());
+  executable->Close();
+
+  struct {
+    uint64_t feature_flags;
+    uint64_t emitter_data;
+    uint64_t virtual_membase;
+    uint32_t align_all_basic_blocks;
+  } settings = {};
+  settings.feature_flags = amd64::GetFeatureFlags();
+  settings.emitter_data = emitter_data_;
+  settings.virtual_membase = uint64_t(
+      reinterpret_cast<uintptr_t>(processor()->memory()->virtual_membase()));
+  settings.align_all_basic_blocks = cvars::align_all_basic_blocks;
+  const bool flags[] = {
+      cvars::emit_source_annotations,
+      cvars::enable_incorrect_roundingmode_behavior,
+      cvars::elide_e0_check,
+      cvars::enable_rmw_context_merging,
+      cvars::emit_mmio_aware_stores_for_recorded_exception_addresses,
+      cvars::xop_rotates,
+      cvars::xop_left_shifts,
+      cvars::xop_right_shifts,
+      cvars::xop_arithmetic_right_shifts,
+      cvars::xop_compares,
+      cvars::use_fast_dot_product,
+      cvars::no_round_to_single,
+      cvars::inline_loadclock,
+      cvars::delay_via_maybeyield,
+      cvars::inline_mmio_access,
+      cvars::permit_float_constant_evaluation,
+      cvars::store_all_context_values,
+      cvars::full_optimization_even_with_debug,
+      cvars::ignore_trap_instructions,
+      cvars::no_reserved_ops,
+      cvars::disable_prefetch_and_cachecontrol,
+      cvars::break_on_unimplemented_instructions,
+      cvars::enable_host_guest_stack_synchronization,
+      cvars::linear_scan_register_allocation,
+      cvars::patch_guest_call_sites,
+  };
+  XXH3_64bits_update(&hash_state, &settings, sizeof(settings));
+  XXH3_64bits_update(&hash_state, flags, sizeof(flags));
+  uint64_t key = XXH3_64bits_digest(&hash_state);
+  // 0 is reserved for "not persistable".
+  return key ? key : 1;
+}
+
+bool X64Backend::LoadPersistentCode(const std::filesystem::path& path) {
+  if (!persistent_code_path_.empty()) {
+    // Only the guest code placed before anything else can be restored.
+    return false;
+  }
+  persistent_code_key_ = CalculateCodegenKey();
+  if (!persistent_code_key_) {
+    return false;
+  }
+  persistent_code_path_ = path;
+  code_cache_->LoadFromFile(path, persistent_code_key_, processor());
+  return true;
+}
+
+void X64Backend::SavePersistentCode() {
+  if (persistent_code_path_.empty()) {
+    return;
+  }
+  code_cache_->SaveToFile(persistent_code_path_, persistent_code_key_);
+}
 }  // namespace x64
 }  // namespace backend
 }  // namespace cpu
@@ -57,10 +57,13 @@ static constexpr uint32_t GUEST_TRAMPOLINE_MIN_LEN = 8;
 static constexpr uint32_t MAX_GUEST_TRAMPOLINES =
     (GUEST_TRAMPOLINE_END - GUEST_TRAMPOLINE_BASE) / GUEST_TRAMPOLINE_MIN_LEN;
 
-#define RESERVE_BLOCK_SHIFT 16
+// Reservations are tracked per block of reservation_granularity_shift bytes
+// of guest memory, with a bit per block in a table of 1 << RESERVE_TABLE_BITS
+// bits. If there are more blocks than that, the block index is hashed, so
+// unrelated blocks only rarely share a bit.
+#define RESERVE_TABLE_BITS 20
 
-#define RESERVE_NUM_ENTRIES \
-  ((1024ULL * 1024ULL * 1024ULL * 4ULL) >> RESERVE_BLOCK_SHIFT)
+#define RESERVE_NUM_ENTRIES (1ULL << RESERVE_TABLE_BITS)
 // https://codalogic.com/blog/2022/12/06/Exploring-PowerPCs-read-modify-write-operations
 struct ReserveHelper {
   uint64_t blocks[RESERVE_NUM_ENTRIES / 64];
@@ -68,6 +71,16 @@ struct ReserveHelper {
   ReserveHelper() { memset(blocks, 0, sizeof(blocks)); }
 };
 
+// Per entry of the reservation table, when reservation_contention_counters is
+// enabled.
+struct ReserveContention {
+  // Number of times a reservation couldn't be acquired because another thread
+  // was holding it.
+  uint32_t count;
+  // Guest address of the last reservation attempt that failed.
+  uint32_t last_guest_address;
+};
+
 struct X64BackendStackpoint {
   uint64_t host_stack_;
   unsigned guest_stack_;
@@ -95,6 +108,8 @@ struct X64BackendContext {
     uint32_t helper_scratch_u32s[16];
   };
   ReserveHelper* reserve_helper_;
+  // nullptr if reservation_contention_counters is disabled.
+  ReserveContention* reserve_contention_;
   uint64_t cached_reserve_value_;
   // guest_tick_count is used if inline_loadclock is used
   uint64_t* guest_tick_count;
@@ -102,6 +117,8 @@ struct X64BackendContext {
   X64BackendStackpoint* stackpoints;
   uint64_t cached_reserve_offset;
   uint32_t cached_reserve_bit;
+  // Guest address being reserved, kept for the contention counters.
+  uint32_t reserve_contention_address;
   unsigned int current_stackpoint_depth;
   unsigned int mxcsr_fpu;  // currently, the way we implement rounding mode
                            // affects both vmx and the fpu
@@ -136,6 +153,8 @@ class X64Backend : public Backend {
   ResolveFunctionThunk resolve_function_thunk() const {
     return resolve_function_thunk_;
   }
+  // Function that patchable call sites call until they're patched.
+  void* indirect_call_thunk() const { return indirect_call_thunk_; }
 
   void* synchronize_guest_and_host_stack_helper() const {
     return synchronize_guest_and_host_stack_helper_;
@@ -179,6 +198,8 @@ class X64Backend : public Backend {
   virtual void FreeGuestTrampoline(uint32_t trampoline_addr) override;
   virtual void SetGuestRoundingMode(void* ctx, unsigned int mode) override;
   virtual bool PopulatePseudoStacktrace(GuestPseudoStackTrace* st) override;
+  bool LoadPersistentCode(const std::filesystem::path& path) override;
+  void SavePersistentCode() override;
   void RecordMMIOExceptionForGuestInstruction(void* host_address);
 
   uint32_t LookupXMMConstantAddress32(unsigned index) {
@@ -190,6 +211,19 @@ class X64Backend : public Backend {
 #if XE_X64_PROFILER_AVAILABLE == 1
   uint64_t* GetProfilerRecordForFunction(uint32_t guest_address);
 #endif
+
+  // Log2 of the size of the guest memory blocks reserved by lwarx/ldarx.
+  static uint32_t GetReserveGranularityShift();
+  // Returns the index of the reservation table entry for the guest address.
+  static uint32_t GetReserveEntryIndex(uint32_t guest_address);
+  // RESERVE_NUM_ENTRIES contention counters, or nullptr if
+  // reservation_contention_counters is disabled.
+  const ReserveContention* reserve_contention() const {
+    return reserve_contention_.get();
+  }
+  // Logs the reservation table entries with the most contention.
+  void DumpReserveContention(size_t max_entry_count = 16) const;
+
  private:
   static bool ExceptionCallbackThunk(Exception* ex, void* data);
   bool ExceptionCallback(Exception* ex);
@@ -199,9 +233,16 @@ class X64Backend : public Backend {
   std::unique_ptr<X64CodeCache> code_cache_;
   uintptr_t emitter_data_ = 0;
 
+  // Hash of everything outside the guest code that affects the generated code,
+  // or 0 if the generated code can't be persisted.
+  uint64_t CalculateCodegenKey() const;
+  std::filesystem::path persistent_code_path_;
+  uint64_t persistent_code_key_ = 0;
+
   HostToGuestThunk host_to_guest_thunk_;
   GuestToHostThunk guest_to_host_thunk_;
   ResolveFunctionThunk resolve_function_thunk_;
+  void* indirect_call_thunk_ = nullptr;
   void* synchronize_guest_and_host_stack_helper_ = nullptr;
 
   // loads stack sizes 1 byte, 2 bytes or 4 bytes
@@ -223,6 +264,7 @@ class X64Backend : public Backend {
 #endif
 
   alignas(64) ReserveHelper reserve_helper_;
+  std::unique_ptr<ReserveContention[]> reserve_contention_;
   // allocates 8-byte aligned addresses in a normally not executable guest
   // address
   // range that will be used to dispatch to host code
@@ -9,8 +9,10 @@
 
 #include "xenia/cpu/backend/x64/x64_code_cache.h"
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
+#include <unordered_set>
 
 #if ENABLE_VTUNE
 #include "third_party/vtune/include/jitprofiling.h"
@@ -19,13 +21,17 @@
 
 #include "third_party/fmt/include/fmt/format.h"
 #include "xenia/base/assert.h"
+#include "xenia/base/atomic.h"
 #include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/literals.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
+#include "xenia/cpu/backend/x64/x64_function.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/module.h"
+#include "xenia/cpu/processor.h"
 
 namespace xe {
 namespace cpu {
@@ -136,9 +142,118 @@ void X64CodeCache::AddIndirection(uint32_t guest_address,
     return;
   }
 
+  auto global_lock = global_critical_region_.Acquire();
   uint32_t* indirection_slot = reinterpret_cast<uint32_t*>(
       indirection_table_base_ + (guest_address - kIndirectionTableBase));
   *indirection_slot = host_address;
+  UpdateCallSites(guest_address, host_address);
+}
+
+void X64CodeCache::set_indirect_call_thunk(uint32_t thunk_address) {
+  indirect_call_thunk_ = thunk_address;
+}
+
+uint64_t X64CodeCache::GetCallSiteBytes(const PatchableCallSite& site,
+                                        uint32_t host_address) const {
+  if (host_address == indirection_default_value_) {
+    host_address = indirect_call_thunk_;
+  }
+  uint32_t next_address = uint32_t(reinterpret_cast<uintptr_t>(
+                              generated_code_execute_base_)) +
+                          site.code_offset + 5;
+  // call/jmp rel32 ; nop dword [rax]
+  return uint64_t(site.is_tail ? 0xE9 : 0xE8) |
+         (uint64_t(host_address - next_address) << 8) |
+         (uint64_t(0x001F0F) << 40);
+}
+
+void X64CodeCache::UpdateCallSite(PatchableCallSite& site,
+                                  uint32_t host_address) {
+  if (site.pin_count) {
+    return;
+  }
+  bool is_patched = host_address != indirection_default_value_;
+  // Aligned, so other threads see either the old or the new call.
+  xe::atomic_exchange(GetCallSiteBytes(site, host_address),
+                      reinterpret_cast<volatile uint64_t*>(
+                          generated_code_write_base_ + site.code_offset));
+  if (is_patched != site.is_patched) {
+    site.is_patched = is_patched;
+    if (is_patched) {
+      ++patched_call_site_count_;
+    } else {
+      --patched_call_site_count_;
+    }
+  }
+}
+
+void X64CodeCache::UpdateCallSites(uint32_t guest_address,
+                                   uint32_t host_address) {
+  auto it = call_sites_.find(guest_address);
+  if (it == call_sites_.end()) {
+    return;
+  }
+  for (PatchableCallSite& site : it->second) {
+    UpdateCallSite(site, host_address);
+  }
+}
+
+void X64CodeCache::AddCallSites(const uint8_t* code_execute_address,
+                                const std::vector<X64CallSite>& call_sites) {
+  if (!indirection_table_base_ || call_sites.empty()) {
+    return;
+  }
+  auto global_lock = global_critical_region_.Acquire();
+  uint32_t code_offset =
+      uint32_t(code_execute_address - generated_code_execute_base_);
+  for (const X64CallSite& call_site : call_sites) {
+    PatchableCallSite site = {};
+    site.code_offset = code_offset + call_site.code_offset;
+    site.is_tail = call_site.is_tail != 0;
+    assert_zero(site.code_offset & 7);
+    // The callee may have been placed after the call was emitted.
+    uint32_t host_address = *reinterpret_cast<const uint32_t*>(
+        indirection_table_base_ +
+        (call_site.guest_address - kIndirectionTableBase));
+    auto& sites = call_sites_[call_site.guest_address];
+    sites.push_back(site);
+    ++call_site_count_;
+    if (host_address != indirection_default_value_) {
+      UpdateCallSite(sites.back(), host_address);
+    }
+  }
+}
+
+void X64CodeCache::PinCallSites(const uint8_t* address, size_t length,
+                                bool pinned) {
+  auto global_lock = global_critical_region_.Acquire();
+  size_t offset = size_t(address - generated_code_execute_base_);
+  for (auto& callee_sites : call_sites_) {
+    uint32_t host_address = *reinterpret_cast<const uint32_t*>(
+        indirection_table_base_ + (callee_sites.first - kIndirectionTableBase));
+    for (PatchableCallSite& site : callee_sites.second) {
+      if (site.code_offset >= offset + length ||
+          site.code_offset + sizeof(uint64_t) <= offset) {
+        continue;
+      }
+      if (pinned) {
+        UpdateCallSite(site, indirection_default_value_);
+        ++site.pin_count;
+      } else {
+        assert_not_zero(site.pin_count);
+        --site.pin_count;
+        UpdateCallSite(site, host_address);
+      }
+    }
+  }
+}
+
+X64CodeCache::CallSiteStats X64CodeCache::GetCallSiteStats() {
+  auto global_lock = global_critical_region_.Acquire();
+  CallSiteStats stats;
+  stats.total = call_site_count_;
+  stats.patched = patched_call_site_count_;
+  return stats;
 }
 
 void X64CodeCache::CommitExecutableRange(uint32_t guest_low,
@@ -223,28 +338,8 @@ void X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
     // already being ran)
 
     // If we are going above the high water mark of committed memory, commit
-    // some more. It's ok if multiple threads do this, as redundant commits
-    // aren't harmful.
-    size_t old_commit_mark, new_commit_mark;
-    do {
-      old_commit_mark = generated_code_commit_mark_;
-      if (high_mark <= old_commit_mark) break;
-
-      new_commit_mark = old_commit_mark + 16_MiB;
-      if (generated_code_execute_base_ == generated_code_write_base_) {
-        xe::memory::AllocFixed(generated_code_execute_base_, new_commit_mark,
-                               xe::memory::AllocationType::kCommit,
-                               xe::memory::PageAccess::kExecuteReadWrite);
-      } else {
-        xe::memory::AllocFixed(generated_code_execute_base_, new_commit_mark,
-                               xe::memory::AllocationType::kCommit,
-                               xe::memory::PageAccess::kExecuteReadOnly);
-        xe::memory::AllocFixed(generated_code_write_base_, new_commit_mark,
-                               xe::memory::AllocationType::kCommit,
-                               xe::memory::PageAccess::kReadWrite);
-      }
-    } while (generated_code_commit_mark_.compare_exchange_weak(
-        old_commit_mark, new_commit_mark));
+    // some more.
+    CommitGeneratedCode(high_mark);
 
     // Copy code.
     std::memcpy(code_write_address, machine_code, func_info.code_size.total);
@@ -282,38 +377,21 @@ void X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
   // Now that everything is ready, fix up the indirection table.
   // Note that we do support code that doesn't have an indirection fixup, so
   // ignore those when we see them.
-  if (guest_address && indirection_table_base_) {
-    uint32_t* indirection_slot = reinterpret_cast<uint32_t*>(
-        indirection_table_base_ + (guest_address - kIndirectionTableBase));
-    *indirection_slot =
-        uint32_t(reinterpret_cast<uint64_t>(code_execute_address));
+  if (guest_address) {
+    AddIndirection(guest_address,
+                   uint32_t(reinterpret_cast<uint64_t>(code_execute_address)));
   }
 }
 
-uint32_t X64CodeCache::PlaceData(const void* data, size_t length) {
-  // Hold a lock while we bump the pointers up.
-  size_t high_mark;
-  uint8_t* data_address = nullptr;
-  {
-    auto global_lock = global_critical_region_.Acquire();
-
-    // Reserve code.
-    // Always move the code to land on 16b alignment.
-    data_address = generated_code_write_base_ + generated_code_offset_;
-    generated_code_offset_ += xe::round_up(length, 16);
-
-    high_mark = generated_code_offset_;
-  }
-
-  // If we are going above the high water mark of committed memory, commit some
-  // more. It's ok if multiple threads do this, as redundant commits aren't
-  // harmful.
+void X64CodeCache::CommitGeneratedCode(size_t high_mark) {
+  // It's ok if multiple threads do this, as redundant commits aren't harmful.
   size_t old_commit_mark, new_commit_mark;
   do {
     old_commit_mark = generated_code_commit_mark_;
     if (high_mark <= old_commit_mark) break;
 
-    new_commit_mark = old_commit_mark + 16_MiB;
+    new_commit_mark =
+        std::max(old_commit_mark + 16_MiB, xe::round_up(high_mark, 16_MiB));
     if (generated_code_execute_base_ == generated_code_write_base_) {
       xe::memory::AllocFixed(generated_code_execute_base_, new_commit_mark,
                              xe::memory::AllocationType::kCommit,
@@ -328,6 +406,26 @@ uint32_t X64CodeCache::PlaceData(const void* data, size_t length) {
     }
   } while (generated_code_commit_mark_.compare_exchange_weak(old_commit_mark,
                                                              new_commit_mark));
+}
+
+uint32_t X64CodeCache::PlaceData(const void* data, size_t length) {
+  // Hold a lock while we bump the pointers up.
+  size_t high_mark;
+  uint8_t* data_address = nullptr;
+  {
+    auto global_lock = global_critical_region_.Acquire();
+
+    // Reserve code.
+    // Always move the code to land on 16b alignment.
+    data_address = generated_code_write_base_ + generated_code_offset_;
+    generated_code_offset_ += xe::round_up(length, 16);
+
+    high_mark = generated_code_offset_;
+  }
+
+  // If we are going above the high water mark of committed memory, commit some
+  // more.
+  CommitGeneratedCode(high_mark);
 
   // Copy code.
   std::memcpy(data_address, data, length);
@@ -335,6 +433,324 @@ uint32_t X64CodeCache::PlaceData(const void* data, size_t length) {
   return uint32_t(uintptr_t(data_address));
 }
 
+namespace {
+
+struct PersistentCodeHeader {
+  static constexpr fourcc_t kMagic = make_fourcc("XJCC");
+  static constexpr uint32_t kVersion = 2;
+
+  fourcc_t magic;
+  uint32_t version;
+  uint64_t codegen_key;
+  // Range of generated_code_offset_ covered by the stored code.
+  uint64_t code_start_offset;
+  uint64_t code_end_offset;
+  uint32_t function_count;
+  uint32_t reserved;
+};
+
+struct PersistentFunctionHeader {
+  uint32_t address;
+  uint32_t end_address;
+  uint64_t code_offset;
+  // EmitFunctionInfo, in fixed-size fields.
+  uint32_t code_size_prolog;
+  uint32_t code_size_body;
+  uint32_t code_size_epilog;
+  uint32_t code_size_tail;
+  uint32_t code_size_total;
+  uint32_t prolog_stack_alloc_offset;
+  uint32_t stack_size;
+  uint32_t source_map_count;
+  uint32_t relocation_count;
+  uint32_t direct_callee_count;
+  uint32_t call_site_count;
+};
+
+// Only its address matters.
+void HostImageAnchor() {}
+
+template <typename T>
+bool ReadVector(FILE* file, std::vector<T>& out, size_t count) {
+  out.resize(count);
+  return !count || fread(out.data(), sizeof(T), count, file) == count;
+}
+
+template <typename T>
+bool WriteVector(FILE* file, const std::vector<T>& data) {
+  return data.empty() ||
+         fwrite(data.data(), sizeof(T), data.size(), file) == data.size();
+}
+
+}  // namespace
+
+uintptr_t X64CodeCache::host_image_anchor() {
+  return reinterpret_cast<uintptr_t>(&HostImageAnchor);
+}
+
+void X64CodeCache::RestoreGuestCode(GuestFunction* function,
+                                    size_t code_offset,
+                                    const EmitFunctionInfo& func_info) {
+  uint8_t* code_execute_address = generated_code_execute_base_ + code_offset;
+  uint8_t* code_write_address = generated_code_write_base_ + code_offset;
+  size_t code_end_offset =
+      code_offset + xe::round_up(func_info.code_size.total, 16);
+  UnwindReservation unwind_reservation =
+      RequestUnwindReservation(generated_code_write_base_ + code_end_offset);
+  code_end_offset += xe::round_up(unwind_reservation.data_size, 16);
+  generated_code_map_.emplace_back((uint64_t(code_offset) << 32) |
+                                       uint64_t(code_end_offset),
+                                   function);
+  PlaceCode(function->address(), code_write_address, func_info,
+            code_execute_address, unwind_reservation);
+  AddIndirection(function->address(),
+                 uint32_t(reinterpret_cast<uintptr_t>(code_execute_address)));
+}
+
+size_t X64CodeCache::LoadFromFile(const std::filesystem::path& path,
+                                  uint64_t codegen_key, Processor* processor) {
+  auto global_lock = global_critical_region_.Acquire();
+  if (persistent_code_start_offset_ != SIZE_MAX) {
+    // Only code placed after the thunks can be restored, and that's only
+    // possible for the first module.
+    return 0;
+  }
+  persistent_code_start_offset_ = generated_code_offset_;
+
+  FILE* file = xe::filesystem::OpenFile(path, "rb");
+  if (!file) {
+    return 0;
+  }
+  PersistentCodeHeader header;
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      header.magic != PersistentCodeHeader::kMagic ||
+      header.version != PersistentCodeHeader::kVersion) {
+    XELOGW("Persistent code cache {} is invalid, ignoring",
+           xe::path_to_utf8(path));
+    fclose(file);
+    return 0;
+  }
+  if (header.codegen_key != codegen_key ||
+      header.code_start_offset != generated_code_offset_ ||
+      header.code_end_offset < header.code_start_offset ||
+      header.code_end_offset > kGeneratedCodeSize) {
+    // Different build, host CPU or settings - everything must be regenerated.
+    XELOGI("Persistent code cache {} is outdated, ignoring",
+           xe::path_to_utf8(path));
+    fclose(file);
+    return 0;
+  }
+
+  struct FunctionRecord {
+    PersistentFunctionHeader header;
+    std::vector<SourceMapEntry> source_map;
+    std::vector<X64CodeRelocation> relocations;
+    std::vector<uint32_t> direct_callees;
+    std::vector<X64CallSite> call_sites;
+  };
+  std::vector<FunctionRecord> records(header.function_count);
+  bool read_ok = true;
+  for (FunctionRecord& record : records) {
+    if (fread(&record.header, sizeof(record.header), 1, file) != 1 ||
+        !ReadVector(file, record.source_map,
+                    record.header.source_map_count) ||
+        !ReadVector(file, record.relocations,
+                    record.header.relocation_count) ||
+        !ReadVector(file, record.direct_callees,
+                    record.header.direct_callee_count) ||
+        !ReadVector(file, record.call_sites, record.header.call_site_count)) {
+      read_ok = false;
+      break;
+    }
+  }
+  size_t code_size = size_t(header.code_end_offset - header.code_start_offset);
+  std::vector<uint8_t> code(code_size);
+  if (read_ok && code_size) {
+    read_ok = fread(code.data(), 1, code_size, file) == code_size;
+  }
+  fclose(file);
+  if (!read_ok) {
+    XELOGW("Persistent code cache {} is truncated, ignoring",
+           xe::path_to_utf8(path));
+    return 0;
+  }
+
+  // Bring the code back at the same offsets. Functions that can't be restored
+  // just leave a hole that's never referenced.
+  CommitGeneratedCode(size_t(header.code_end_offset));
+  std::memcpy(generated_code_write_base_ + header.code_start_offset,
+              code.data(), code_size);
+  generated_code_offset_ = size_t(header.code_end_offset);
+
+  // Records are sorted by code offset, which keeps generated_code_map_ and the
+  // unwind table sorted too, and callees always precede their callers as a
+  // direct call can only be emitted to an already generated function.
+  uintptr_t anchor = host_image_anchor();
+  std::unordered_set<uint32_t> restored_addresses;
+  for (const FunctionRecord& record : records) {
+    const PersistentFunctionHeader& function_header = record.header;
+    if (function_header.code_offset < header.code_start_offset ||
+        function_header.code_offset + function_header.code_size_total >
+            header.code_end_offset) {
+      continue;
+    }
+    if (!std::all_of(record.direct_callees.cbegin(),
+                     record.direct_callees.cend(), [&](uint32_t callee) {
+                       return restored_addresses.count(callee) != 0;
+                     })) {
+      continue;
+    }
+    Module* module = processor->LookupModule(function_header.address);
+    if (!module) {
+      continue;
+    }
+    Function* function = processor->LookupFunction(module,
+                                                    function_header.address);
+    // Don't wait for functions being generated elsewhere, the global lock is
+    // held.
+    if (!function || !function->is_guest() ||
+        function->status() != Symbol::Status::kDeclared ||
+        module->DefineFunction(function) != Symbol::Status::kNew) {
+      continue;
+    }
+    auto x64_function = static_cast<X64Function*>(function);
+
+    uint8_t* code_write_address =
+        generated_code_write_base_ + function_header.code_offset;
+    for (const X64CodeRelocation& relocation : record.relocations) {
+      xe::store<uint64_t>(code_write_address + relocation.code_offset,
+                          uint64_t(anchor + relocation.image_delta));
+    }
+
+    EmitFunctionInfo func_info = {};
+    func_info.code_size.prolog = function_header.code_size_prolog;
+    func_info.code_size.body = function_header.code_size_body;
+    func_info.code_size.epilog = function_header.code_size_epilog;
+    func_info.code_size.tail = function_header.code_size_tail;
+    func_info.code_size.total = function_header.code_size_total;
+    func_info.prolog_stack_alloc_offset =
+        function_header.prolog_stack_alloc_offset;
+    func_info.stack_size = function_header.stack_size;
+
+    x64_function->set_end_address(function_header.end_address);
+    x64_function->source_map() = record.source_map;
+    x64_function->Setup(
+        generated_code_execute_base_ + function_header.code_offset,
+        func_info.code_size.total);
+    x64_function->SetupPersistentInfo(true, func_info, record.relocations,
+                                      record.direct_callees,
+                                      record.call_sites);
+    RestoreGuestCode(x64_function, size_t(function_header.code_offset),
+                     func_info);
+    AddCallSites(x64_function->machine_code(), record.call_sites);
+    x64_function->set_status(Symbol::Status::kDefined);
+    restored_addresses.insert(function_header.address);
+  }
+
+  XELOGI("Restored {} of {} functions from persistent code cache {}",
+         restored_addresses.size(), records.size(), xe::path_to_utf8(path));
+  return restored_addresses.size();
+}
+
+bool X64CodeCache::SaveToFile(const std::filesystem::path& path,
+                              uint64_t codegen_key) {
+  auto global_lock = global_critical_region_.Acquire();
+  if (persistent_code_start_offset_ == SIZE_MAX) {
+    return false;
+  }
+
+  std::vector<const X64Function*> functions;
+  for (const auto& entry : generated_code_map_) {
+    if (!entry.second || (entry.first >> 32) < persistent_code_start_offset_) {
+      continue;
+    }
+    auto x64_function = static_cast<const X64Function*>(entry.second);
+    if (x64_function->is_relocatable() &&
+        x64_function->status() == Symbol::Status::kDefined) {
+      functions.push_back(x64_function);
+    }
+  }
+
+  std::filesystem::create_directories(path.parent_path());
+  FILE* file = xe::filesystem::OpenFile(path, "wb");
+  if (!file) {
+    XELOGE("Failed to open persistent code cache {} for writing",
+           xe::path_to_utf8(path));
+    return false;
+  }
+
+  PersistentCodeHeader header = {};
+  header.magic = PersistentCodeHeader::kMagic;
+  header.version = PersistentCodeHeader::kVersion;
+  header.codegen_key = codegen_key;
+  header.code_start_offset = persistent_code_start_offset_;
+  header.code_end_offset = generated_code_offset_;
+  header.function_count = uint32_t(functions.size());
+  bool write_ok = fwrite(&header, sizeof(header), 1, file) == 1;
+  for (const X64Function* function : functions) {
+    if (!write_ok) {
+      break;
+    }
+    const EmitFunctionInfo& func_info = function->emit_info();
+    PersistentFunctionHeader function_header = {};
+    function_header.address = function->address();
+    function_header.end_address = function->end_address();
+    function_header.code_offset =
+        function->machine_code() - generated_code_execute_base_;
+    function_header.code_size_prolog = uint32_t(func_info.code_size.prolog);
+    function_header.code_size_body = uint32_t(func_info.code_size.body);
+    function_header.code_size_epilog = uint32_t(func_info.code_size.epilog);
+    function_header.code_size_tail = uint32_t(func_info.code_size.tail);
+    function_header.code_size_total = uint32_t(func_info.code_size.total);
+    function_header.prolog_stack_alloc_offset =
+        uint32_t(func_info.prolog_stack_alloc_offset);
+    function_header.stack_size = uint32_t(func_info.stack_size);
+    // source_map() is only non-const for setup.
+    auto& source_map = const_cast<X64Function*>(function)->source_map();
+    function_header.source_map_count = uint32_t(source_map.size());
+    function_header.relocation_count = uint32_t(function->relocations().size());
+    function_header.direct_callee_count =
+        uint32_t(function->direct_callees().size());
+    function_header.call_site_count = uint32_t(function->call_sites().size());
+    write_ok =
+        fwrite(&function_header, sizeof(function_header), 1, file) == 1 &&
+        WriteVector(file, source_map) &&
+        WriteVector(file, function->relocations()) &&
+        WriteVector(file, function->direct_callees()) &&
+        WriteVector(file, function->call_sites());
+  }
+  size_t code_size = generated_code_offset_ - persistent_code_start_offset_;
+  if (write_ok && code_size) {
+    // Callees that are patched in now may not be restored in the next run, so
+    // all calls are written out as they were emitted.
+    std::vector<uint8_t> code(
+        generated_code_write_base_ + persistent_code_start_offset_,
+        generated_code_write_base_ + generated_code_offset_);
+    for (const X64Function* function : functions) {
+      size_t function_offset =
+          size_t(function->machine_code() - generated_code_execute_base_);
+      for (const X64CallSite& call_site : function->call_sites()) {
+        PatchableCallSite site = {};
+        site.code_offset = uint32_t(function_offset + call_site.code_offset);
+        site.is_tail = call_site.is_tail != 0;
+        xe::store<uint64_t>(
+            code.data() + (site.code_offset - persistent_code_start_offset_),
+            GetCallSiteBytes(site, indirection_default_value_));
+      }
+    }
+    write_ok = fwrite(code.data(), 1, code_size, file) == code_size;
+  }
+  fclose(file);
+  if (!write_ok) {
+    XELOGE("Failed to write persistent code cache {}", xe::path_to_utf8(path));
+    std::filesystem::remove(path);
+    return false;
+  }
+  XELOGI("Saved {} functions to persistent code cache {}", functions.size(),
+         xe::path_to_utf8(path));
+  return true;
+}
+
 GuestFunction* X64CodeCache::LookupFunction(uint64_t host_pc) {
   uint32_t key = uint32_t(host_pc - kGeneratedCodeExecuteBase);
   void* fn_entry = std::bsearch(
@@ -15,6 +15,7 @@
 #include <cstdint>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -22,6 +23,12 @@
 #include "xenia/base/mutex.h"
 #include "xenia/cpu/backend/code_cache.h"
 
+namespace xe {
+namespace cpu {
+class Processor;
+}  // namespace cpu
+}  // namespace xe
+
 namespace xe {
 namespace cpu {
 namespace backend {
@@ -39,6 +46,32 @@ struct EmitFunctionInfo {
   size_t stack_size;
 };
 
+// A host address embedded as a 64-bit immediate in generated code. Only
+// addresses within the emulator executable image are relocatable, and they're
+// stored relative to X64CodeCache::host_image_anchor(), which stays the same
+// across runs of the same build.
+struct X64CodeRelocation {
+  // Offset of the immediate from the start of the function.
+  uint32_t code_offset;
+  uint32_t reserved;
+  int64_t image_delta;
+};
+
+// A call to a guest function that wasn't generated yet when the caller was,
+// emitted as
+//   mov ebx, guest_address ; call indirect_call_thunk ; nop3
+// (or jmp instead of call for tail calls) with the call and the nop occupying
+// an aligned 8 bytes. The thunk calls through the indirection table like any
+// other call, and once the callee has been generated, the call is atomically
+// replaced with a direct call to it while other threads may be executing it.
+struct X64CallSite {
+  // Offset of the call from the start of the function.
+  uint32_t code_offset;
+  uint32_t guest_address;
+  uint32_t is_tail;
+  uint32_t reserved;
+};
+
 class X64CodeCache : public CodeCache {
  public:
   ~X64CodeCache() override;
@@ -53,7 +86,6 @@ class X64CodeCache : public CodeCache {
   }
   size_t total_size() const override { return kGeneratedCodeSize; }
 
-  // TODO(benvanik): ELF serialization/etc
   // TODO(benvanik): keep track of code blocks
   // TODO(benvanik): padding/guards/etc
 
@@ -63,6 +95,25 @@ class X64CodeCache : public CodeCache {
 
   void CommitExecutableRange(uint32_t guest_low, uint32_t guest_high);
 
+  // Patchable call sites (see X64CallSite).
+  void set_indirect_call_thunk(uint32_t thunk_address);
+  // Starts tracking the call sites of a function placed at
+  // code_execute_address, patching the ones to functions already placed.
+  // Afterwards, they're kept calling whatever the indirection table entry of
+  // the callee is set to, or reverted to the thunk if it's reset to the
+  // default.
+  void AddCallSites(const uint8_t* code_execute_address,
+                    const std::vector<X64CallSite>& call_sites);
+  // Reverts the call sites overlapping the range to calling the thunk and keeps
+  // them that way until unpinned, so the code in the range can be modified
+  // (by breakpoints) without racing with patching.
+  void PinCallSites(const uint8_t* address, size_t length, bool pinned);
+  struct CallSiteStats {
+    size_t total;
+    size_t patched;
+  };
+  CallSiteStats GetCallSiteStats();
+
   void PlaceHostCode(uint32_t guest_address, void* machine_code,
                      const EmitFunctionInfo& func_info,
                      void*& code_execute_address_out,
@@ -76,6 +127,24 @@ class X64CodeCache : public CodeCache {
 
   GuestFunction* LookupFunction(uint64_t host_pc) override;
 
+  // Reference address within the emulator executable that relocatable host
+  // addresses in generated code are stored relative to.
+  static uintptr_t host_image_anchor();
+
+  // Persistent code cache.
+  // Guest code is restored at exactly the addresses it was originally placed
+  // at, so that rel32 references to the thunks and between functions stay
+  // valid, which means loading must happen before any guest code is placed in
+  // this run. codegen_key identifies everything that affects the generated
+  // code outside of the guest code itself (build, host CPU features, cvars).
+  // Begins recording of guest code for SaveToFile, loading anything previously
+  // saved to the path with a matching key. Returns the number of functions
+  // restored.
+  size_t LoadFromFile(const std::filesystem::path& path, uint64_t codegen_key,
+                      Processor* processor);
+  // Writes all guest code placed since LoadFromFile was called.
+  bool SaveToFile(const std::filesystem::path& path, uint64_t codegen_key);
+
  protected:
   // All executable code falls within 0x80000000 to 0x9FFFFFFF, so we can
   // only map enough for lookups within that range.
@@ -113,6 +182,27 @@ class X64CodeCache : public CodeCache {
                          void* code_execute_address,
                          UnwindReservation unwind_reservation) {}
 
+  // Registers a function whose code was copied into place by LoadFromFile as
+  // if it had just been placed with PlaceGuestCode.
+  void RestoreGuestCode(GuestFunction* function, size_t code_offset,
+                        const EmitFunctionInfo& func_info);
+  void CommitGeneratedCode(size_t high_mark);
+
+  struct PatchableCallSite {
+    // Offset from generated_code_execute_base_.
+    uint32_t code_offset;
+    bool is_tail;
+    bool is_patched;
+    uint16_t pin_count;
+  };
+  // The 8 bytes of the call site calling host_address, or the thunk if
+  // host_address is the default indirection.
+  uint64_t GetCallSiteBytes(const PatchableCallSite& site,
+                            uint32_t host_address) const;
+  // The global lock must be held for these.
+  void UpdateCallSite(PatchableCallSite& site, uint32_t host_address);
+  void UpdateCallSites(uint32_t guest_address, uint32_t host_address);
+
   std::filesystem::path file_name_;
   xe::memory::FileMappingHandle mapping_ =
       xe::memory::kFileMappingHandleInvalid;
@@ -143,6 +233,14 @@ class X64CodeCache : public CodeCache {
   // This can be used to bsearch on host PC to find the guest function.
   // The key is [start address | end address].
   std::vector<std::pair<uint64_t, GuestFunction*>> generated_code_map_;
+  // Offset of the first guest code written out by SaveToFile, or SIZE_MAX if
+  // the persistent cache is not in use.
+  size_t persistent_code_start_offset_ = SIZE_MAX;
+  uint32_t indirect_call_thunk_ = 0;
+  // Patchable call sites by the guest address of the callee.
+  std::unordered_map<uint32_t, std::vector<PatchableCallSite>> call_sites_;
+  size_t call_site_count_ = 0;
+  size_t patched_call_site_count_ = 0;
 };
 
 }  // namespace x64
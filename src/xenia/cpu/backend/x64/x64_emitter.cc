@@ -53,6 +53,11 @@ DEFINE_bool(enable_incorrect_roundingmode_behavior, false,
             "code. The workaround may cause reduced CPU performance but is a "
             "more accurate emulation",
             "x64");
+DEFINE_bool(patch_guest_call_sites, true,
+            "Patch calls to guest functions that haven't been generated yet "
+            "when the caller is into direct calls once they are, rather than "
+            "always calling them through the indirection table.",
+            "x64");
 DEFINE_uint32(align_all_basic_blocks, 0,
               "Aligns the start of all basic blocks to N bytes. Only specify a "
               "power of 2, 16 is the recommended value. Results in larger "
@@ -119,13 +124,19 @@ bool X64Emitter::Emit(GuestFunction* function, HIRBuilder* builder,
   debug_info_ = debug_info;
   debug_info_flags_ = debug_info_flags;
   trace_data_ = &function->trace_data();
+  baseline_function_ = function->is_baseline_tier() ? function : nullptr;
   source_map_arena_.Reset();
+  is_relocatable_ = true;
+  relocations_.clear();
+  direct_callees_.clear();
+  call_sites_.clear();
 
   // Fill the generator with code.
   EmitFunctionInfo func_info = {};
   if (!Emit(builder, func_info)) {
     return false;
   }
+  func_info_ = func_info;
 
   // Copy the final code to the cache and relocate it.
   *out_code_size = getSize();
@@ -160,6 +171,11 @@ void* X64Emitter::Emplace(const EmitFunctionInfo& func_info,
   top_ = reinterpret_cast<uint8_t*>(new_write_address);
   ready();
   top_ = old_address;
+  if (function) {
+    // Only patchable now that the rel32 operands are final.
+    code_cache_->AddCallSites(reinterpret_cast<uint8_t*>(new_execute_address),
+                              call_sites_);
+  }
   reset();
   tail_code_.clear();
   for (auto&& cached_label : label_cache_) {
@@ -169,6 +185,14 @@ void* X64Emitter::Emplace(const EmitFunctionInfo& func_info,
   return new_execute_address;
 }
 
+// Called from the prolog of baseline functions once they become hot.
+uint64_t RequestReoptimization(void* raw_context, uint64_t function_ptr) {
+  auto guest_context = reinterpret_cast<ppc::PPCContext_s*>(raw_context);
+  guest_context->thread_state->processor()->RequestReoptimization(
+      reinterpret_cast<GuestFunction*>(function_ptr));
+  return 0;
+}
+
 bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
   Xbyak::Label epilog_label;
   epilog_label_ = &epilog_label;
@@ -260,6 +284,7 @@ bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
 #endif
   // Safe now to do some tracing.
   if (debug_info_flags_ & DebugInfoFlags::kDebugInfoTraceFunctions) {
+    MarkNotRelocatable();
     // We require 32-bit addresses.
     assert_true(uint64_t(trace_data_->header()) < UINT_MAX);
     auto trace_header = trace_data_->header();
@@ -286,6 +311,19 @@ bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
     bts(qword[low_address(&trace_header->function_thread_use)], rax);
   }
 
+  if (baseline_function_) {
+    // Count down to translating the function again with all optimizations.
+    // Nothing is allocated to registers yet, so they can be clobbered.
+    MarkNotRelocatable();
+    Xbyak::Label not_hot;
+    mov(rax, reinterpret_cast<uint64_t>(baseline_function_->tier_up_counter()));
+    sub(dword[rax], 1);
+    jnz(not_hot, T_NEAR);
+    CallNative(RequestReoptimization,
+               reinterpret_cast<uint64_t>(baseline_function_));
+    L(not_hot);
+  }
+
   // Load membase.
   /*
   * chrispy: removed this, as long as we load it in HostToGuestThunk we can
@@ -377,6 +415,7 @@ void X64Emitter::EmitProfilerEpilogue() {
   if (cvars::instrument_call_times) {
     uint64_t* profiler_entry =
         backend()->GetProfilerRecordForFunction(current_guest_function_);
+    MarkNotRelocatable();
 
     mov(ecx, 0x7ffe0014);
     mov(rdx, qword[rcx]);
@@ -407,6 +446,7 @@ void X64Emitter::MarkSourceOffset(const Instr* i) {
   }
 
   if (debug_info_flags_ & DebugInfoFlags::kDebugInfoTraceFunctionCoverage) {
+    MarkNotRelocatable();
     uint32_t instruction_index =
         (entry->guest_address - trace_data_->start_address()) / 4;
     lock();
@@ -700,9 +740,15 @@ void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
   assert_not_null(function);
   ForgetMxcsrMode();
   auto fn = static_cast<X64Function*>(function);
+  if (function->optimized_function()) {
+    fn = static_cast<X64Function*>(function->optimized_function());
+  }
   // Resolve address to the function to call and store in rax.
 
-  if (fn->machine_code()) {
+  // Baseline code will be replaced, so it's only called through the
+  // indirection table (or patchable call sites).
+  if (fn->machine_code() && !fn->is_baseline_tier()) {
+    direct_callees_.push_back(function->address());
     if (!(instr->flags & hir::CALL_TAIL)) {
       mov(rcx, qword[rsp + StackLayout::GUEST_CALL_RET_ADDR]);
 
@@ -722,6 +768,10 @@ void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
 
     return;
   } else if (code_cache_->has_indirection_table()) {
+    if (cvars::patch_guest_call_sites) {
+      CallPatchable(instr, function);
+      return;
+    }
     // Load the pointer to the indirection table maintained in X64CodeCache.
     // The target dword will either contain the address of the generated code
     // or a thunk to ResolveAddress.
@@ -754,6 +804,50 @@ void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
   }
 }
 
+void X64Emitter::CallPatchable(const hir::Instr* instr,
+                               GuestFunction* function) {
+  bool is_tail = (instr->flags & hir::CALL_TAIL) != 0;
+  if (is_tail) {
+    // Since we skip the prolog we need to mark the return here.
+    EmitTraceUserCallReturn();
+    EmitProfilerEpilogue();
+    // Pass the callers return address over.
+    mov(rcx, qword[rsp + StackLayout::GUEST_RET_ADDR]);
+
+    add(rsp, static_cast<uint32_t>(stack_size()));
+    PopStackpoint();
+  } else {
+    // Return address is from the previous SET_RETURN_ADDRESS.
+    mov(rcx, qword[rsp + StackLayout::GUEST_CALL_RET_ADDR]);
+  }
+
+  // The thunk loads the target from the indirection table like CallIndirect.
+  mov(ebx, function->address());
+  // The call is replaced with a single 8 byte store, so it must not cross an
+  // 8 byte boundary.
+  size_t misalignment = getSize() & 7;
+  if (misalignment) {
+    nop(8 - misalignment);
+  }
+  X64CallSite call_site = {};
+  call_site.code_offset = uint32_t(getSize());
+  call_site.guest_address = function->address();
+  call_site.is_tail = is_tail;
+  call_sites_.push_back(call_site);
+  if (is_tail) {
+    jmp(backend()->indirect_call_thunk(), T_NEAR);
+  } else {
+    call(backend()->indirect_call_thunk());
+  }
+  // nop dword [rax], padding the call to 8 bytes.
+  db(0x0F);
+  db(0x1F);
+  db(0x00);
+  if (!is_tail) {
+    synchronize_stack_on_next_instruction_ = true;
+  }
+}
+
 void X64Emitter::CallIndirect(const hir::Instr* instr,
                               const Xbyak::Reg64& reg) {
   ForgetMxcsrMode();
@@ -775,7 +869,7 @@ void X64Emitter::CallIndirect(const hir::Instr* instr,
     // Old-style resolve.
     // Not too important because indirection table is almost always available.
     mov(edx, reg.cvt32());
-    mov(rax, reinterpret_cast<uint64_t>(ResolveFunction));
+    MovHostAddress(rax, reinterpret_cast<void*>(ResolveFunction));
     mov(rcx, GetContextReg());
     call(rax);
   }
@@ -822,6 +916,8 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
       // rdx = arg0
       // r8  = arg1
       // r9  = arg2
+      // The arguments are usually heap objects.
+      MarkNotRelocatable();
       mov(rcx, reinterpret_cast<uint64_t>(builtin_function->handler()));
       mov(rdx, reinterpret_cast<uint64_t>(builtin_function->arg0()));
       mov(r8, reinterpret_cast<uint64_t>(builtin_function->arg1()));
@@ -836,7 +932,8 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
       // rdx = arg0
       // r8  = arg1
       // r9  = arg2
-      mov(rcx, reinterpret_cast<uint64_t>(extern_function->extern_handler()));
+      MovHostAddress(
+          rcx, reinterpret_cast<void*>(extern_function->extern_handler()));
       mov(rdx,
           qword[GetContextReg() + offsetof(ppc::PPCContext, kernel_state)]);
       call(backend()->guest_to_host_thunk());
@@ -844,6 +941,7 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
     }
   }
   if (undefined) {
+    MarkNotRelocatable();
     CallNative(UndefinedCallExtern, reinterpret_cast<uint64_t>(function));
   }
 }
@@ -869,11 +967,25 @@ void X64Emitter::CallNativeSafe(void* fn) {
   // rdx = arg0
   // r8  = arg1
   // r9  = arg2
-  mov(rcx, reinterpret_cast<uint64_t>(fn));
+  MovHostAddress(rcx, fn);
   call(backend()->guest_to_host_thunk());
   // rax = host return
 }
 
+void X64Emitter::MovHostAddress(const Xbyak::Reg64& reg,
+                                const void* host_address) {
+  // Always use the full movabs form, even if the address happens to fit in 32
+  // bits, so the immediate can be patched when restoring persistent code.
+  db(0x48 | (reg.getIdx() >> 3));
+  db(0xB8 | (reg.getIdx() & 7));
+  X64CodeRelocation relocation = {};
+  relocation.code_offset = uint32_t(getSize());
+  relocation.image_delta = int64_t(reinterpret_cast<uintptr_t>(host_address) -
+                                   X64CodeCache::host_image_anchor());
+  relocations_.push_back(relocation);
+  dq(reinterpret_cast<uint64_t>(host_address));
+}
+
 void X64Emitter::SetReturnAddress(uint64_t value) {
   mov(rax, value);
   mov(qword[rsp + StackLayout::GUEST_CALL_RET_ADDR], rax);
@@ -13,6 +13,7 @@
 #include <vector>
 
 #include "xenia/base/arena.h"
+#include "xenia/cpu/backend/x64/x64_code_cache.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/function_trace_data.h"
 #include "xenia/cpu/hir/hir_builder.h"
@@ -36,9 +37,6 @@ namespace backend {
 namespace x64 {
 using namespace amd64;
 class X64Backend;
-class X64CodeCache;
-
-struct EmitFunctionInfo;
 
 enum RegisterFlags {
   REG_DEST = (1 << 0),
@@ -260,6 +258,9 @@ class X64Emitter : public Xbyak::CodeGenerator {
   void UnimplementedInstr(const hir::Instr* i);
 
   void Call(const hir::Instr* instr, GuestFunction* function);
+  // Call to a function that hasn't been generated yet, patched to a direct
+  // call once it is (see X64CallSite).
+  void CallPatchable(const hir::Instr* instr, GuestFunction* function);
   void CallIndirect(const hir::Instr* instr, const Xbyak::Reg64& reg);
   void CallExtern(const hir::Instr* instr, const Function* function);
   void CallNative(void* fn);
@@ -270,6 +271,25 @@ class X64Emitter : public Xbyak::CodeGenerator {
   void CallNativeSafe(void* fn);
   void SetReturnAddress(uint64_t value);
 
+  // Loads an address within the emulator executable (host function or static
+  // data) into reg, recording a relocation for the persistent code cache.
+  void MovHostAddress(const Xbyak::Reg64& reg, const void* host_address);
+  // Must be called when the code being emitted references host memory that
+  // isn't relocatable across runs (heap objects, per-run tables), which keeps
+  // the function out of the persistent code cache.
+  void MarkNotRelocatable() { is_relocatable_ = false; }
+
+  // Persistent code cache information for the last emitted function.
+  bool is_relocatable() const { return is_relocatable_; }
+  const EmitFunctionInfo& func_info() const { return func_info_; }
+  const std::vector<X64CodeRelocation>& relocations() const {
+    return relocations_;
+  }
+  const std::vector<uint32_t>& direct_callees() const {
+    return direct_callees_;
+  }
+  const std::vector<X64CallSite>& call_sites() const { return call_sites_; }
+
   Xbyak::Reg64 GetNativeParam(uint32_t param);
 
   Xbyak::Reg64 GetContextReg() const;
@@ -412,10 +432,18 @@ class X64Emitter : public Xbyak::CodeGenerator {
   FunctionDebugInfo* debug_info_ = nullptr;
   uint32_t debug_info_flags_ = 0;
   FunctionTraceData* trace_data_ = nullptr;
+  // Function being emitted if it's in the baseline tier.
+  GuestFunction* baseline_function_ = nullptr;
   Arena source_map_arena_;
 
   size_t stack_size_ = 0;
 
+  bool is_relocatable_ = true;
+  EmitFunctionInfo func_info_ = {};
+  std::vector<X64CodeRelocation> relocations_;
+  std::vector<uint32_t> direct_callees_;
+  std::vector<X64CallSite> call_sites_;
+
   static const uint32_t gpr_reg_map_[GPR_COUNT];
   static const uint32_t xmm_reg_map_[XMM_COUNT];
   /*
@@ -30,11 +30,27 @@ void X64Function::Setup(uint8_t* machine_code, size_t machine_code_length) {
   machine_code_length_ = machine_code_length;
 }
 
+void X64Function::SetupPersistentInfo(
+    bool is_relocatable, const EmitFunctionInfo& emit_info,
+    std::vector<X64CodeRelocation> relocations,
+    std::vector<uint32_t> direct_callees,
+    std::vector<X64CallSite> call_sites) {
+  is_relocatable_ = is_relocatable;
+  emit_info_ = emit_info;
+  relocations_ = std::move(relocations);
+  direct_callees_ = std::move(direct_callees);
+  call_sites_ = std::move(call_sites);
+}
+
 bool X64Function::CallImpl(ThreadState* thread_state, uint32_t return_address) {
   auto backend =
       reinterpret_cast<X64Backend*>(thread_state->processor()->backend());
   auto thunk = backend->host_to_guest_thunk();
-  thunk(machine_code_, thread_state->context(),
+  // Hot baseline functions are superseded by their optimized version.
+  GuestFunction* optimized_function = this->optimized_function();
+  uint8_t* machine_code =
+      optimized_function ? optimized_function->machine_code() : machine_code_;
+  thunk(machine_code, thread_state->context(),
         reinterpret_cast<void*>(uintptr_t(return_address)));
   return true;
 }
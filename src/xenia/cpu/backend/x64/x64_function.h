@@ -10,6 +10,9 @@
 #ifndef XENIA_CPU_BACKEND_X64_X64_FUNCTION_H_
 #define XENIA_CPU_BACKEND_X64_X64_FUNCTION_H_
 
+#include <vector>
+
+#include "xenia/cpu/backend/x64/x64_code_cache.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/thread_state.h"
 
@@ -28,12 +31,40 @@ class X64Function : public GuestFunction {
 
   void Setup(uint8_t* machine_code, size_t machine_code_length);
 
+  // Information needed to write the function to the persistent code cache.
+  // Functions that reference host memory that can't be relocated (such as
+  // heap objects) are not relocatable and are never persisted.
+  bool is_relocatable() const { return is_relocatable_; }
+  const EmitFunctionInfo& emit_info() const { return emit_info_; }
+  const std::vector<X64CodeRelocation>& relocations() const {
+    return relocations_;
+  }
+  // Guest functions called directly (rel32) rather than through the
+  // indirection table. These must have been restored for this function to be.
+  const std::vector<uint32_t>& direct_callees() const {
+    return direct_callees_;
+  }
+  // Calls that may have been patched since, which are reverted when the code
+  // is written out.
+  const std::vector<X64CallSite>& call_sites() const { return call_sites_; }
+  void SetupPersistentInfo(bool is_relocatable,
+                           const EmitFunctionInfo& emit_info,
+                           std::vector<X64CodeRelocation> relocations,
+                           std::vector<uint32_t> direct_callees,
+                           std::vector<X64CallSite> call_sites);
+
  protected:
   bool CallImpl(ThreadState* thread_state, uint32_t return_address) override;
 
  private:
   uint8_t* machine_code_ = nullptr;
   size_t machine_code_length_ = 0;
+
+  bool is_relocatable_ = false;
+  EmitFunctionInfo emit_info_ = {};
+  std::vector<X64CodeRelocation> relocations_;
+  std::vector<uint32_t> direct_callees_;
+  std::vector<X64CallSite> call_sites_;
 };
 
 }  // namespace x64
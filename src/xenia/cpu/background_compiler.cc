@@ -0,0 +1,255 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/background_compiler.h"
+
+#include <algorithm>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/byte_order.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/profiling.h"
+#include "xenia/cpu/function.h"
+#include "xenia/cpu/ppc/ppc_decode_data.h"
+#include "xenia/cpu/ppc/ppc_opcode_info.h"
+#include "xenia/cpu/processor.h"
+
+DEFINE_int32(
+    background_compiler_threads, 0,
+    "Number of threads used for compiling guest functions ahead of their "
+    "first call. -1 to calculate automatically (half of logical CPU cores), a "
+    "positive number to specify the number of threads explicitly (up to the "
+    "number of logical CPU cores), 0 to disable background compilation.",
+    "CPU");
+
+namespace xe {
+namespace cpu {
+
+static thread_local bool is_background_compiler_thread_ = false;
+
+BackgroundCompiler::BackgroundCompiler(Processor* processor)
+    : processor_(processor) {}
+
+BackgroundCompiler::~BackgroundCompiler() { Shutdown(); }
+
+std::unique_ptr<BackgroundCompiler> BackgroundCompiler::Create(
+    Processor* processor) {
+  if (cvars::background_compiler_threads == 0) {
+    return nullptr;
+  }
+  uint32_t logical_processor_count = xe::threading::logical_processor_count();
+  size_t thread_count;
+  if (cvars::background_compiler_threads < 0) {
+    thread_count = std::max(logical_processor_count / 2, uint32_t(1));
+  } else {
+    thread_count = std::min(uint32_t(cvars::background_compiler_threads),
+                            logical_processor_count);
+  }
+  auto compiler = std::make_unique<BackgroundCompiler>(processor);
+  if (!compiler->Initialize(thread_count)) {
+    return nullptr;
+  }
+  return compiler;
+}
+
+bool BackgroundCompiler::Initialize(size_t thread_count) {
+  xe::threading::Thread::CreationParameters params;
+  // Compilation recurses through the passes and the emitter, keep the default
+  // guest-like stack size.
+  params.initial_priority = xe::threading::ThreadPriority::kBelowNormal;
+  for (size_t i = 0; i < thread_count; ++i) {
+    std::unique_ptr<xe::threading::Thread> thread =
+        xe::threading::Thread::Create(params, [this, i]() { WorkerThread(i); });
+    if (!thread) {
+      XELOGE("Failed to create background compiler thread {}", i);
+      Shutdown();
+      return false;
+    }
+    thread->set_name("CPU Background Compiler");
+    threads_.push_back(std::move(thread));
+  }
+  XELOGI("Background compilation enabled with {} threads", threads_.size());
+  return true;
+}
+
+void BackgroundCompiler::Shutdown() {
+  if (threads_.empty()) {
+    return;
+  }
+  {
+    std::lock_guard<xe_mutex> lock(request_lock_);
+    shutdown_ = true;
+    queue_ = {};
+  }
+  request_cond_.notify_all();
+  for (auto& thread : threads_) {
+    xe::threading::Wait(thread.get(), false);
+  }
+  threads_.clear();
+  idle_cond_.notify_all();
+}
+
+void BackgroundCompiler::Enqueue(uint32_t address, Priority priority) {
+  {
+    std::lock_guard<xe_mutex> lock(request_lock_);
+    if (shutdown_ || !requested_addresses_.insert(address).second) {
+      return;
+    }
+    queue_.push({uint32_t(priority), next_sequence_++, address, false});
+  }
+  ++stat_queued_;
+  request_cond_.notify_one();
+}
+
+void BackgroundCompiler::EnqueueReoptimization(uint32_t address) {
+  {
+    std::lock_guard<xe_mutex> lock(request_lock_);
+    if (shutdown_) {
+      return;
+    }
+    // The function has been compiled once already, so it's in
+    // requested_addresses_ if it went through here, and duplicate requests are
+    // filtered by the function itself.
+    queue_.push({uint32_t(Priority::kReoptimize), next_sequence_++, address,
+                 true});
+  }
+  ++stat_queued_;
+  request_cond_.notify_one();
+}
+
+void BackgroundCompiler::Enqueue(const std::vector<uint32_t>& addresses,
+                                 Priority priority) {
+  size_t queued = 0;
+  {
+    std::lock_guard<xe_mutex> lock(request_lock_);
+    if (shutdown_) {
+      return;
+    }
+    for (uint32_t address : addresses) {
+      if (!requested_addresses_.insert(address).second) {
+        continue;
+      }
+      queue_.push({uint32_t(priority), next_sequence_++, address, false});
+      ++queued;
+    }
+  }
+  if (!queued) {
+    return;
+  }
+  stat_queued_ += queued;
+  if (queued == 1) {
+    request_cond_.notify_one();
+  } else {
+    request_cond_.notify_all();
+  }
+}
+
+void BackgroundCompiler::EnqueueCallees(uint32_t start_address,
+                                        uint32_t end_address) {
+  Memory* memory = processor_->memory();
+  std::vector<uint32_t> callees;
+  for (uint32_t address = start_address; address <= end_address;
+       address += 4) {
+    uint32_t code =
+        xe::load_and_swap<uint32_t>(memory->TranslateVirtual(address));
+    if (ppc::LookupOpcode(code) != ppc::PPCOpcode::bx) {
+      continue;
+    }
+    ppc::PPCDecodeData d;
+    d.address = address;
+    d.code = code;
+    if (!d.I.LK()) {
+      continue;
+    }
+    uint32_t target = d.I.ADDR();
+    if (target >= start_address && target <= end_address) {
+      // Recursion or a local call-as-branch, nothing new to compile.
+      continue;
+    }
+    callees.push_back(target);
+  }
+  Enqueue(callees, Priority::kCallee);
+}
+
+void BackgroundCompiler::WaitForIdle() {
+  std::unique_lock<xe_mutex> lock(request_lock_);
+  while (!shutdown_ && (!queue_.empty() || threads_busy_)) {
+    idle_cond_.wait(lock);
+  }
+}
+
+BackgroundCompiler::Stats BackgroundCompiler::QueryStats() const {
+  Stats stats;
+  stats.queued = stat_queued_;
+  stats.compiled = stat_compiled_;
+  stats.skipped = stat_skipped_;
+  stats.failed = stat_failed_;
+  stats.reoptimized = stat_reoptimized_;
+  return stats;
+}
+
+bool BackgroundCompiler::IsWorkerThread() {
+  return is_background_compiler_thread_;
+}
+
+void BackgroundCompiler::WorkerThread(size_t thread_index) {
+  is_background_compiler_thread_ = true;
+  while (true) {
+    uint32_t address;
+    bool reoptimize;
+    {
+      std::unique_lock<xe_mutex> lock(request_lock_);
+      if (shutdown_) {
+        return;
+      }
+      if (queue_.empty()) {
+        if (!threads_busy_) {
+          idle_cond_.notify_all();
+        }
+        request_cond_.wait(lock);
+        continue;
+      }
+      address = queue_.top().address;
+      reoptimize = queue_.top().reoptimize;
+      queue_.pop();
+      ++threads_busy_;
+    }
+
+    // A guest thread may have gotten to it first, in which case there's
+    // nothing left to do. Otherwise ResolveFunction handles the races with
+    // guest threads demanding the same function through the entry table.
+    if (reoptimize) {
+      SCOPE_profile_cpu_i("cpu", "BackgroundReoptimize");
+      if (processor_->ReoptimizeFunction(address)) {
+        ++stat_reoptimized_;
+      } else {
+        ++stat_failed_;
+      }
+    } else if (processor_->QueryFunction(address)) {
+      ++stat_skipped_;
+    } else {
+      SCOPE_profile_cpu_i("cpu", "BackgroundCompile");
+      Function* function = processor_->ResolveFunction(address);
+      if (function) {
+        ++stat_compiled_;
+      } else {
+        XELOGCPU("Background compilation of {:08X} failed", address);
+        ++stat_failed_;
+      }
+    }
+
+    {
+      std::lock_guard<xe_mutex> lock(request_lock_);
+      --threads_busy_;
+    }
+  }
+}
+
+}  // namespace cpu
+}  // namespace xe
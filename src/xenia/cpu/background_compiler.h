@@ -0,0 +1,146 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_BACKGROUND_COMPILER_H_
+#define XENIA_CPU_BACKGROUND_COMPILER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <queue>
+#include <unordered_set>
+#include <vector>
+
+#include "xenia/base/cvar.h"
+#include "xenia/base/mutex.h"
+#include "xenia/base/threading.h"
+
+DECLARE_int32(background_compiler_threads);
+
+namespace xe {
+namespace cpu {
+
+class Processor;
+
+// Compiles guest functions ahead of the guest threads that will eventually
+// call them. Requests are serviced in priority order by a small pool of worker
+// threads, each of which goes through Processor::ResolveFunction and thus the
+// frontend's translator pool, so every worker ends up with its own
+// PPCTranslator/Compiler/Assembler and arenas. Finished code is published the
+// same way as synchronously compiled code, through the indirection table, so
+// guest threads pick it up without any additional synchronization.
+class BackgroundCompiler {
+ public:
+  // Lower values are dequeued first.
+  enum class Priority : uint32_t {
+    // Direct call targets of a function a guest thread just demanded - likely
+    // to be needed within the next few microseconds.
+    kCallee = 0,
+    // Hot baseline functions to translate with all optimizations (tiered
+    // compilation).
+    kReoptimize = 1,
+    // Functions that were resolved in a previous run (InfoCacheFlags
+    // was_resolved bit).
+    kPreviouslyResolved = 2,
+    // Functions discovered through static analysis of the image.
+    kDiscovered = 3,
+  };
+
+  struct Stats {
+    uint64_t queued;
+    uint64_t compiled;
+    uint64_t skipped;
+    uint64_t failed;
+    uint64_t reoptimized;
+  };
+
+  explicit BackgroundCompiler(Processor* processor);
+  ~BackgroundCompiler();
+
+  // Creates the worker threads according to the background_compiler_threads
+  // cvar. Returns nullptr if background compilation is disabled.
+  static std::unique_ptr<BackgroundCompiler> Create(Processor* processor);
+
+  size_t thread_count() const { return threads_.size(); }
+
+  // Queues the function at the given guest address for compilation. Requests
+  // for addresses that are already queued or compiled are dropped.
+  void Enqueue(uint32_t address, Priority priority);
+  void Enqueue(const std::vector<uint32_t>& addresses, Priority priority);
+
+  // Queues the baseline function at the given guest address for translation
+  // with all optimizations (see Processor::ReoptimizeFunction).
+  void EnqueueReoptimization(uint32_t address);
+
+  // Queues the direct (bl) call targets within [start_address, end_address].
+  void EnqueueCallees(uint32_t start_address, uint32_t end_address);
+
+  // Blocks until the queue is drained and all workers are idle.
+  void WaitForIdle();
+
+  // Drops all pending requests and stops the worker threads.
+  void Shutdown();
+
+  Stats QueryStats() const;
+
+  // Whether the calling thread is one of the background compiler workers.
+  static bool IsWorkerThread();
+
+ private:
+  struct Request {
+    uint32_t priority;
+    // Monotonic sequence number, so requests of equal priority are serviced
+    // in FIFO order (which roughly follows the image layout).
+    uint64_t sequence;
+    uint32_t address;
+    bool reoptimize;
+
+    bool operator<(const Request& other) const {
+      // std::priority_queue is a max-heap.
+      if (priority != other.priority) {
+        return priority > other.priority;
+      }
+      return sequence > other.sequence;
+    }
+  };
+
+  bool Initialize(size_t thread_count);
+  void WorkerThread(size_t thread_index);
+
+  Processor* processor_;
+
+  xe_mutex request_lock_;
+  std::condition_variable_any request_cond_;
+  // Protected with request_lock_, notify_one request_cond_ when pushed to.
+  std::priority_queue<Request> queue_;
+  // Addresses that have been queued at any point, to avoid repeatedly
+  // requesting the same function. Protected with request_lock_.
+  std::unordered_set<uint32_t> requested_addresses_;
+  uint64_t next_sequence_ = 0;
+  // Number of workers currently compiling. Protected with request_lock_.
+  size_t threads_busy_ = 0;
+  // Protected with request_lock_, notify_all request_cond_ when set.
+  bool shutdown_ = false;
+  // Signaled when the queue is empty and no worker is busy.
+  std::condition_variable_any idle_cond_;
+
+  std::vector<std::unique_ptr<xe::threading::Thread>> threads_;
+
+  std::atomic<uint64_t> stat_queued_ = {0};
+  std::atomic<uint64_t> stat_compiled_ = {0};
+  std::atomic<uint64_t> stat_skipped_ = {0};
+  std::atomic<uint64_t> stat_failed_ = {0};
+  std::atomic<uint64_t> stat_reoptimized_ = {0};
+};
+
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_BACKGROUND_COMPILER_H_
@@ -0,0 +1,225 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/common_subexpression_elimination_pass.h"
+
+#include <cstring>
+
+#include "xenia/base/memory.h"
+#include "xenia/base/profiling.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::Value;
+
+namespace {
+
+uint32_t GetSrcSignatureType(uint32_t signature, int n) {
+  switch (n) {
+    case 0:
+      return GET_OPCODE_SIG_TYPE_SRC1(signature);
+    case 1:
+      return GET_OPCODE_SIG_TYPE_SRC2(signature);
+    default:
+      return GET_OPCODE_SIG_TYPE_SRC3(signature);
+  }
+}
+
+// Constants are compared bitwise, as +0.0 and -0.0 must not be merged.
+void GetConstantBits(const Value* value, uint64_t& low, uint64_t& high) {
+  if (value->type == VEC128_TYPE) {
+    low = value->constant.v128.low;
+    high = value->constant.v128.high;
+  } else {
+    low = 0;
+    high = 0;
+    std::memcpy(&low, &value->constant, GetTypeSize(value->type));
+  }
+}
+
+size_t HashValue(const Value* value) {
+  if (!value->IsConstant()) {
+    return std::hash<const Value*>()(value);
+  }
+  uint64_t low, high;
+  GetConstantBits(value, low, high);
+  return xe::memory::hash_combine(size_t(value->type), low, high);
+}
+
+bool IsValueEqual(const Value* a, const Value* b) {
+  if (a == b) {
+    return true;
+  }
+  if (!a->IsConstant() || !b->IsConstant() || a->type != b->type) {
+    return false;
+  }
+  uint64_t a_low, a_high, b_low, b_high;
+  GetConstantBits(a, a_low, a_high);
+  GetConstantBits(b, b_low, b_high);
+  return a_low == b_low && a_high == b_high;
+}
+
+bool IsSrcEqual(uint32_t sig_type, const Instr::Op& a, const Instr::Op& b) {
+  switch (sig_type) {
+    case OPCODE_SIG_TYPE_X:
+      return true;
+    case OPCODE_SIG_TYPE_V:
+      return IsValueEqual(a.value, b.value);
+    case OPCODE_SIG_TYPE_O:
+      return a.offset == b.offset;
+    default:
+      return false;
+  }
+}
+
+}  // namespace
+
+CommonSubexpressionEliminationPass::CommonSubexpressionEliminationPass()
+    : ConditionalGroupSubpass() {}
+
+CommonSubexpressionEliminationPass::~CommonSubexpressionEliminationPass() {}
+
+bool CommonSubexpressionEliminationPass::Run(HIRBuilder* builder,
+                                             bool& result) {
+  SCOPE_profile_cpu_f("cpu");
+
+  // Example:
+  //   v0 = add v10, 16
+  //   v1 = load v0
+  //   v2 = add v10, 16  <-- replaced with v2 = v0
+  //   v3 = load v2
+  // Values are usually only used within their block at this point, so
+  // numbering is done per block; this also catches most of the repeated
+  // address calculations, byte swaps and splats emitted per guest instruction.
+  result = false;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    available_.clear();
+    for (auto i = block->instr_head; i; i = i->next) {
+      if (i->opcode == &OPCODE_SET_ROUNDING_MODE_info ||
+          i->opcode == &OPCODE_SET_NJM_info ||
+          i->opcode == &OPCODE_CALL_info ||
+          i->opcode == &OPCODE_CALL_TRUE_info ||
+          i->opcode == &OPCODE_CALL_INDIRECT_info ||
+          i->opcode == &OPCODE_CALL_INDIRECT_TRUE_info ||
+          i->opcode == &OPCODE_CALL_EXTERN_info) {
+        // Float results computed before this may differ from those after,
+        // including after calls, which may change the rounding mode too.
+        available_.clear();
+        continue;
+      }
+      if (!IsCandidate(i)) {
+        continue;
+      }
+      size_t hash = HashInstr(i);
+      Instr* existing = nullptr;
+      auto range = available_.equal_range(hash);
+      for (auto it = range.first; it != range.second; ++it) {
+        if (IsEquivalent(it->second, i)) {
+          existing = it->second;
+          break;
+        }
+      }
+      if (!existing) {
+        available_.emplace(hash, i);
+        continue;
+      }
+      i->Replace(&OPCODE_ASSIGN_info, 0);
+      i->set_src1(existing->dest);
+      ++eliminated_count_;
+      result = true;
+    }
+  }
+  available_.clear();
+
+  return true;
+}
+
+bool CommonSubexpressionEliminationPass::IsCandidate(const Instr* i) {
+  const OpcodeInfo* opcode = i->opcode;
+  if (opcode->flags &
+      (OPCODE_FLAG_BRANCH | OPCODE_FLAG_MEMORY | OPCODE_FLAG_VOLATILE |
+       OPCODE_FLAG_IGNORE | OPCODE_FLAG_PAIRED_PREV)) {
+    return false;
+  }
+  if (GET_OPCODE_SIG_TYPE_DEST(opcode->signature) != OPCODE_SIG_TYPE_V) {
+    return false;
+  }
+  // Assignments are handled by SimplificationPass, and the rest read state
+  // that isn't expressed through their operands.
+  if (opcode == &OPCODE_ASSIGN_info || opcode == &OPCODE_LOAD_CLOCK_info ||
+      opcode == &OPCODE_LOAD_LOCAL_info ||
+      opcode == &OPCODE_LOAD_CONTEXT_info) {
+    return false;
+  }
+  // The paired instruction that follows reads flags set by this one.
+  if (i->next && i->next->opcode->flags & OPCODE_FLAG_PAIRED_PREV) {
+    return false;
+  }
+  for (int n = 0; n < 3; ++n) {
+    uint32_t sig_type = GetSrcSignatureType(opcode->signature, n);
+    if (sig_type != OPCODE_SIG_TYPE_X && sig_type != OPCODE_SIG_TYPE_V &&
+        sig_type != OPCODE_SIG_TYPE_O) {
+      return false;
+    }
+  }
+  return true;
+}
+
+size_t CommonSubexpressionEliminationPass::HashInstr(const Instr* i) {
+  uint32_t signature = i->opcode->signature;
+  size_t src_hashes[3] = {};
+  for (int n = 0; n < 3; ++n) {
+    uint32_t sig_type = GetSrcSignatureType(signature, n);
+    const Instr::Op& src = i->srcs[n];
+    if (sig_type == OPCODE_SIG_TYPE_V) {
+      src_hashes[n] = HashValue(src.value);
+    } else if (sig_type == OPCODE_SIG_TYPE_O) {
+      src_hashes[n] = std::hash<uint64_t>()(src.offset);
+    }
+  }
+  if (i->opcode->flags & OPCODE_FLAG_COMMUNATIVE) {
+    // Order-independent, so that add v0, v1 and add v1, v0 collide.
+    src_hashes[0] += src_hashes[1];
+    src_hashes[1] = 0;
+  }
+  return xe::memory::hash_combine(std::hash<const void*>()(i->opcode),
+                                  i->flags, size_t(i->dest->type),
+                                  src_hashes[0], src_hashes[1], src_hashes[2]);
+}
+
+bool CommonSubexpressionEliminationPass::IsEquivalent(const Instr* a,
+                                                      const Instr* b) {
+  if (a->opcode != b->opcode || a->flags != b->flags ||
+      a->dest->type != b->dest->type) {
+    return false;
+  }
+  uint32_t signature = a->opcode->signature;
+  if (IsSrcEqual(GET_OPCODE_SIG_TYPE_SRC1(signature), a->src1, b->src1) &&
+      IsSrcEqual(GET_OPCODE_SIG_TYPE_SRC2(signature), a->src2, b->src2) &&
+      IsSrcEqual(GET_OPCODE_SIG_TYPE_SRC3(signature), a->src3, b->src3)) {
+    return true;
+  }
+  // Commutative opcodes have two value operands and nothing else.
+  return (a->opcode->flags & OPCODE_FLAG_COMMUNATIVE) &&
+         IsValueEqual(a->src1.value, b->src2.value) &&
+         IsValueEqual(a->src2.value, b->src1.value);
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
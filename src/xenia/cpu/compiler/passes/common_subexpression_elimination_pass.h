@@ -0,0 +1,57 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_COMMON_SUBEXPRESSION_ELIMINATION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_COMMON_SUBEXPRESSION_ELIMINATION_PASS_H_
+
+#include <unordered_map>
+
+#include "xenia/cpu/compiler/passes/conditional_group_subpass.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Value numbering within each block: a pure instruction computing the same
+// opcode over the same operands as an earlier one is turned into an assignment
+// of the earlier result, which SimplificationPass then propagates.
+// Memory, volatile and paired instructions are never numbered, and changes of
+// the floating-point mode invalidate everything numbered before them.
+class CommonSubexpressionEliminationPass : public ConditionalGroupSubpass {
+ public:
+  CommonSubexpressionEliminationPass();
+  ~CommonSubexpressionEliminationPass() override;
+
+  bool Run(hir::HIRBuilder* builder, bool& result) override;
+
+  // Returns the number of instructions eliminated since the last call, for
+  // per-function statistics.
+  uint32_t TakeEliminatedCount() {
+    uint32_t count = eliminated_count_;
+    eliminated_count_ = 0;
+    return count;
+  }
+
+ private:
+  static bool IsCandidate(const hir::Instr* i);
+  static size_t HashInstr(const hir::Instr* i);
+  static bool IsEquivalent(const hir::Instr* a, const hir::Instr* b);
+
+  // Numbered instructions of the current block, keyed by HashInstr.
+  std::unordered_multimap<size_t, hir::Instr*> available_;
+  uint32_t eliminated_count_ = 0;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_COMMON_SUBEXPRESSION_ELIMINATION_PASS_H_
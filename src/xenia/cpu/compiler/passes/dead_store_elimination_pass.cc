@@ -0,0 +1,158 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/dead_store_elimination_pass.h"
+
+#include "xenia/base/cvar.h"
+#include "xenia/base/profiling.h"
+#include "xenia/cpu/compiler/compiler.h"
+#include "xenia/cpu/ppc/ppc_context.h"
+
+DECLARE_bool(debug);
+DECLARE_bool(store_all_context_values);
+DECLARE_bool(full_optimization_even_with_debug);
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+
+DeadStoreEliminationPass::DeadStoreEliminationPass() : CompilerPass() {}
+
+DeadStoreEliminationPass::~DeadStoreEliminationPass() {}
+
+bool DeadStoreEliminationPass::Initialize(Compiler* compiler) {
+  if (!CompilerPass::Initialize(compiler)) {
+    return false;
+  }
+  live_.resize(static_cast<uint32_t>(sizeof(ppc::PPCContext)));
+  return true;
+}
+
+bool DeadStoreEliminationPass::Run(HIRBuilder* builder) {
+  SCOPE_profile_cpu_f("cpu");
+
+  // Stores must all be kept for the debugger to see the guest state.
+  if (!cvars::full_optimization_even_with_debug &&
+      (cvars::debug || cvars::store_all_context_values)) {
+    return true;
+  }
+
+  // Example:
+  //   block0:
+  //     store_context +100, v0  <-- removed, overwritten on both paths
+  //     branch_true v1, block2
+  //   block1:
+  //     store_context +100, v2
+  //     branch block3
+  //   block2:
+  //     store_context +100, v3
+  //   block3:
+  //     v4 = load_context +100
+  uint16_t block_count = 0;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    block->ordinal = block_count++;
+  }
+  uint32_t context_size = static_cast<uint32_t>(sizeof(ppc::PPCContext));
+  block_live_in_.resize(block_count);
+  for (uint16_t i = 0; i < block_count; ++i) {
+    block_live_in_[i].clear();
+    block_live_in_[i].resize(context_size);
+  }
+
+  // Live-in sets only ever grow, so this converges. Walking the blocks in
+  // reverse handles straight-line code in a single iteration.
+  bool changed;
+  do {
+    changed = false;
+    for (auto block = builder->last_block(); block; block = block->prev) {
+      CalculateLiveOut(block, live_);
+      ProcessBlock(block, live_, false);
+      llvm::BitVector& live_in = block_live_in_[block->ordinal];
+      if (live_in != live_) {
+        live_in = live_;
+        changed = true;
+      }
+    }
+  } while (changed);
+
+  for (auto block = builder->first_block(); block; block = block->next) {
+    CalculateLiveOut(block, live_);
+    ProcessBlock(block, live_, true);
+  }
+
+  return true;
+}
+
+void DeadStoreEliminationPass::CalculateLiveOut(Block* block,
+                                                llvm::BitVector& live) {
+  // The control flow analysis only adds edges for branches, so the
+  // fallthrough is checked here. Branch targets are merged in by ProcessBlock
+  // at the branch itself, as stores may follow a conditional branch.
+  Instr* tail = block->instr_tail;
+  if (tail && (tail->opcode == &OPCODE_BRANCH_info ||
+               tail->opcode == &OPCODE_RETURN_info)) {
+    live.reset();
+  } else if (block->next) {
+    live = block_live_in_[block->next->ordinal];
+  } else {
+    // Falling off the end of the function.
+    live.set();
+  }
+}
+
+void DeadStoreEliminationPass::ProcessBlock(Block* block, llvm::BitVector& live,
+                                            bool remove_dead_stores) {
+  Instr* i = block->instr_tail;
+  while (i) {
+    Instr* prev = i->prev;
+    if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
+      uint32_t offset = static_cast<uint32_t>(i->src1.offset);
+      uint32_t size = static_cast<uint32_t>(GetTypeSize(i->src2.value->type));
+      bool is_live = false;
+      for (uint32_t n = offset; n < offset + size; ++n) {
+        if (live.test(n)) {
+          is_live = true;
+          break;
+        }
+      }
+      if (is_live) {
+        live.reset(offset, offset + size);
+      } else if (remove_dead_stores) {
+        i->UnlinkAndNOP();
+      }
+    } else if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
+      uint32_t offset = static_cast<uint32_t>(i->src1.offset);
+      uint32_t size = static_cast<uint32_t>(GetTypeSize(i->dest->type));
+      live.set(offset, offset + size);
+    } else if (i->opcode == &OPCODE_BRANCH_info) {
+      live |= block_live_in_[i->src1.label->block->ordinal];
+    } else if (i->opcode == &OPCODE_BRANCH_TRUE_info ||
+               i->opcode == &OPCODE_BRANCH_FALSE_info) {
+      live |= block_live_in_[i->src2.label->block->ordinal];
+    } else if (i->opcode->flags & OPCODE_FLAG_VOLATILE ||
+               i->opcode == &OPCODE_CONTEXT_BARRIER_info) {
+      // Calls, traps, returns and the like - everything may be observed.
+      live.set();
+    }
+    i = prev;
+  }
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
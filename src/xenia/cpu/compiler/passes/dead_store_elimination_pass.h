@@ -0,0 +1,66 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_DEAD_STORE_ELIMINATION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_DEAD_STORE_ELIMINATION_PASS_H_
+
+#include <vector>
+
+#include "xenia/base/platform.h"
+#include "xenia/cpu/compiler/compiler_pass.h"
+
+#if XE_COMPILER_MSVC
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#pragma warning(disable : 4267)
+#include <llvm/ADT/BitVector.h>
+#pragma warning(pop)
+#else
+#include <llvm/ADT/BitVector.h>
+#endif  // XE_COMPILER_MSVC
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Removes context stores that are overwritten on every path before the value
+// may be observed. Liveness of each byte of the context is propagated
+// backwards across blocks, through the branch targets and the fallthrough to
+// the next block, until it converges. Anything that may leave the function or
+// hand the context to other code (calls, traps, returns, context barriers and
+// other volatile instructions) makes the whole context live.
+class DeadStoreEliminationPass : public CompilerPass {
+ public:
+  DeadStoreEliminationPass();
+  ~DeadStoreEliminationPass() override;
+
+  bool Initialize(Compiler* compiler) override;
+
+  bool Run(hir::HIRBuilder* builder) override;
+
+ private:
+  // Computes the bytes live at the end of the block.
+  void CalculateLiveOut(hir::Block* block, llvm::BitVector& live);
+  // Walks the block backwards from the live-out set, leaving the live-in set
+  // in live. Dead stores are removed if remove_dead_stores is set.
+  void ProcessBlock(hir::Block* block, llvm::BitVector& live,
+                    bool remove_dead_stores);
+
+  // Indexed by block ordinal.
+  std::vector<llvm::BitVector> block_live_in_;
+  llvm::BitVector live_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_DEAD_STORE_ELIMINATION_PASS_H_
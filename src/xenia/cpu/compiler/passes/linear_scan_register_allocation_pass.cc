@@ -0,0 +1,340 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/linear_scan_register_allocation_pass.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+#include "xenia/base/profiling.h"
+
+DEFINE_bool(linear_scan_register_allocation, false,
+            "Use the linear scan register allocator with live range "
+            "splitting instead of the default register allocator. Values are "
+            "still only kept in registers within a block.",
+            "CPU");
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::backend::MachineInfo;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::RegAssignment;
+using xe::cpu::hir::TypeName;
+using xe::cpu::hir::Value;
+
+LinearScanRegisterAllocationPass::LinearScanRegisterAllocationPass(
+    const MachineInfo* machine_info)
+    : CompilerPass() {
+  for (uint32_t n = 0; machine_info->register_sets[n].count; ++n) {
+    const MachineInfo::RegisterSet& set = machine_info->register_sets[n];
+    RegisterFile& register_file = register_files_.emplace_back();
+    register_file.set = &set;
+    register_file.count = set.count;
+  }
+  for (RegisterFile& register_file : register_files_) {
+    uint32_t types = register_file.set->types;
+    if (types & MachineInfo::RegisterSet::INT_TYPES) {
+      for (int type = INT8_TYPE; type <= INT64_TYPE; ++type) {
+        type_register_files_[type] = &register_file;
+      }
+    }
+    if (types & MachineInfo::RegisterSet::FLOAT_TYPES) {
+      type_register_files_[FLOAT32_TYPE] = &register_file;
+      type_register_files_[FLOAT64_TYPE] = &register_file;
+    }
+    if (types & MachineInfo::RegisterSet::VEC_TYPES) {
+      type_register_files_[VEC128_TYPE] = &register_file;
+    }
+  }
+}
+
+LinearScanRegisterAllocationPass::~LinearScanRegisterAllocationPass() = default;
+
+bool LinearScanRegisterAllocationPass::Run(HIRBuilder* builder) {
+  SCOPE_profile_cpu_f("cpu");
+
+  NumberInstructions(builder);
+
+  for (RegisterFile& register_file : register_files_) {
+    register_file.available.set();
+    register_file.active.clear();
+  }
+  live_spill_slots_.clear();
+  for (auto& free_spill_slots : free_spill_slots_) {
+    free_spill_slots.clear();
+  }
+
+  // Values never live across blocks at this point, so there's no need to
+  // reset anything at block boundaries - all intervals of the previous block
+  // will have expired.
+  for (auto block = builder->first_block(); block; block = block->next) {
+    for (auto instr = block->instr_head; instr; instr = instr->next) {
+      uint32_t position = instr->ordinal;
+      ExpireIntervals(position);
+      ReleaseSpillSlots(position);
+
+      uint32_t signature = instr->opcode->signature;
+      if (GET_OPCODE_SIG_TYPE_DEST(signature) != OPCODE_SIG_TYPE_V) {
+        continue;
+      }
+      Value* value = instr->dest;
+      // Must not have been set already.
+      assert_null(value->reg.set);
+      uint32_t end = CalculateIntervalEnd(value);
+
+      // Since x64 (and other platforms) can often take advantage of
+      // dest == src1 register mappings, try to reuse the register of src1 if
+      // it has just been retired by this instruction.
+      const RegAssignment* preferred_reg = nullptr;
+      if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V) {
+        Value* src1 = instr->src1.value;
+        if (!src1->IsConstant() && src1->reg.set &&
+            src1->last_use == instr) {
+          preferred_reg = &src1->reg;
+        }
+      }
+
+      if (!TryAllocateRegister(value, end, preferred_reg)) {
+        RegisterFile* register_file = RegisterFileForType(value->type);
+        if (!SplitInterval(builder, instr, register_file)) {
+          // Unable to spill anything - this shouldn't happen.
+          XELOGE("Unable to spill any registers");
+          assert_always();
+          return false;
+        }
+        if (!TryAllocateRegister(value, end, nullptr)) {
+          XELOGE("Register allocation failed");
+          assert_always();
+          return false;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+void LinearScanRegisterAllocationPass::NumberInstructions(HIRBuilder* builder) {
+  uint16_t block_ordinal = 0;
+  // Leave room for reloads before the first instruction.
+  uint32_t instr_ordinal = kOrdinalStep;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    block->ordinal = block_ordinal++;
+    for (auto instr = block->instr_head; instr; instr = instr->next) {
+      instr->ordinal = instr_ordinal;
+      instr_ordinal += kOrdinalStep;
+    }
+  }
+}
+
+uint32_t LinearScanRegisterAllocationPass::CalculateIntervalEnd(Value* value) {
+  // Values without any uses (like the results of the atomic ops) still need a
+  // register to be written to.
+  Instr* last_use = value->def;
+  for (auto use = value->use_head; use; use = use->next) {
+    assert_true(use->instr->block == value->def->block);
+    if (use->instr->ordinal > last_use->ordinal) {
+      last_use = use->instr;
+    }
+  }
+  value->last_use = last_use;
+  return last_use->ordinal;
+}
+
+void LinearScanRegisterAllocationPass::ExpireIntervals(uint32_t position) {
+  // Values last used by the instruction at the position are retired before
+  // its dest is allocated, so the dest may reuse their register.
+  for (RegisterFile& register_file : register_files_) {
+    auto& active = register_file.active;
+    for (size_t i = 0; i < active.size();) {
+      if (active[i].end <= position) {
+        register_file.available.set(active[i].value->reg.index);
+        active[i] = active.back();
+        active.pop_back();
+      } else {
+        ++i;
+      }
+    }
+  }
+}
+
+void LinearScanRegisterAllocationPass::ReleaseSpillSlots(uint32_t position) {
+  for (size_t i = 0; i < live_spill_slots_.size();) {
+    const SpillSlot& spill_slot = live_spill_slots_[i];
+    if (spill_slot.end < position) {
+      free_spill_slots_[spill_slot.slot->type].push_back(spill_slot.slot);
+      live_spill_slots_[i] = live_spill_slots_.back();
+      live_spill_slots_.pop_back();
+    } else {
+      ++i;
+    }
+  }
+}
+
+bool LinearScanRegisterAllocationPass::TryAllocateRegister(
+    Value* value, uint32_t end, const RegAssignment* preferred_reg) {
+  RegisterFile* register_file = RegisterFileForType(value->type);
+  uint32_t index;
+  if (preferred_reg && preferred_reg->set == register_file->set &&
+      register_file->available.test(preferred_reg->index)) {
+    index = uint32_t(preferred_reg->index);
+  } else if (!xe::bit_scan_forward(
+                 uint32_t(register_file->available.to_ulong()), &index) ||
+             index >= register_file->count) {
+    return false;
+  }
+  register_file->available.reset(index);
+  value->reg.set = register_file->set;
+  value->reg.index = int32_t(index);
+  register_file->active.push_back({value, end});
+  return true;
+}
+
+bool LinearScanRegisterAllocationPass::SplitInterval(
+    HIRBuilder* builder, Instr* instr, RegisterFile* register_file) {
+  uint32_t position = instr->ordinal;
+
+  // The store must not come between paired instructions, so it's placed before
+  // the whole pair - values defined within it can't be spilled.
+  Instr* store_point = instr;
+  while (store_point->opcode->flags & OPCODE_FLAG_PAIRED_PREV &&
+         store_point->prev) {
+    store_point = store_point->prev;
+  }
+
+  // The reload must not come between paired instructions either, so it's
+  // placed before the whole pair containing the next use.
+  auto get_load_point = [](Instr* next_use) {
+    Instr* load_point = next_use;
+    while (load_point->opcode->flags & OPCODE_FLAG_PAIRED_PREV &&
+           load_point->prev) {
+      load_point = load_point->prev;
+    }
+    return load_point;
+  };
+
+  // Pick the interval with the furthest next use.
+  size_t spill_index = SIZE_MAX;
+  Instr* spill_next_use = nullptr;
+  Instr* spill_load_point = nullptr;
+  for (size_t i = 0; i < register_file->active.size(); ++i) {
+    Value* value = register_file->active[i].value;
+    if (value->def->ordinal >= store_point->ordinal) {
+      continue;
+    }
+    Instr* next_use = nullptr;
+    for (auto use = value->use_head; use; use = use->next) {
+      if (use->instr->ordinal > position &&
+          (!next_use || use->instr->ordinal < next_use->ordinal)) {
+        next_use = use->instr;
+      }
+    }
+    // Active intervals end after the position, so there's always one.
+    assert_not_null(next_use);
+    // The reloaded value must be defined after the position to be allocated
+    // by the scan, which isn't the case if the next use is paired with the
+    // current instruction.
+    Instr* load_point = get_load_point(next_use);
+    if (load_point->ordinal <= position) {
+      continue;
+    }
+    if (!spill_next_use || next_use->ordinal > spill_next_use->ordinal) {
+      spill_index = i;
+      spill_next_use = next_use;
+      spill_load_point = load_point;
+    }
+  }
+  if (spill_index == SIZE_MAX) {
+    return false;
+  }
+  LiveInterval interval = register_file->active[spill_index];
+  register_file->active[spill_index] = register_file->active.back();
+  register_file->active.pop_back();
+  register_file->available.set(interval.value->reg.index);
+  Value* spill_value = interval.value;
+
+  if (!spill_value->HasLocalSlot()) {
+    // Reloaded values share the slot of the original value, so they don't
+    // need to be stored again if they're spilled.
+    spill_value->SetLocalSlot(
+        AcquireSpillSlot(builder, spill_value->type, interval.end));
+    builder->StoreLocal(spill_value->GetLocalSlot(), spill_value);
+    Instr* spill_store = builder->last_instr();
+    spill_store->MoveBefore(store_point);
+    spill_store->ordinal = store_point->ordinal - 1;
+  }
+
+  // Split the interval - the remaining uses will refer to a new value, loaded
+  // from the slot right before the next use or its pair. Since that's after
+  // the current position, it will be allocated once the scan gets there.
+  Value* new_value = builder->LoadLocal(spill_value->GetLocalSlot());
+  Instr* spill_load = builder->last_instr();
+  spill_load->MoveBefore(spill_load_point);
+  spill_load->ordinal = spill_load_point->ordinal - 1;
+  new_value->SetLocalSlot(spill_value->GetLocalSlot());
+
+  // Renaming modifies the use list, so gather the instructions first.
+  std::vector<Instr*> renamed_instrs;
+  Instr* last_use = spill_value->def;
+  for (auto use = spill_value->use_head; use; use = use->next) {
+    if (use->instr->ordinal > position) {
+      renamed_instrs.push_back(use->instr);
+    } else if (use->instr->ordinal > last_use->ordinal) {
+      last_use = use->instr;
+    }
+  }
+  for (Instr* renamed_instr : renamed_instrs) {
+    uint32_t signature = renamed_instr->opcode->signature;
+    if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V &&
+        renamed_instr->src1.value == spill_value) {
+      renamed_instr->set_src1(new_value);
+    }
+    if (GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_V &&
+        renamed_instr->src2.value == spill_value) {
+      renamed_instr->set_src2(new_value);
+    }
+    if (GET_OPCODE_SIG_TYPE_SRC3(signature) == OPCODE_SIG_TYPE_V &&
+        renamed_instr->src3.value == spill_value) {
+      renamed_instr->set_src3(new_value);
+    }
+  }
+  spill_value->last_use = last_use;
+
+  return true;
+}
+
+Value* LinearScanRegisterAllocationPass::AcquireSpillSlot(HIRBuilder* builder,
+                                                          TypeName type,
+                                                          uint32_t end) {
+  auto& free_spill_slots = free_spill_slots_[type];
+  Value* slot;
+  if (!free_spill_slots.empty()) {
+    slot = free_spill_slots.back();
+    free_spill_slots.pop_back();
+  } else {
+    slot = builder->AllocLocal(type);
+  }
+  live_spill_slots_.push_back({slot, end});
+  return slot;
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,100 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_LINEAR_SCAN_REGISTER_ALLOCATION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_LINEAR_SCAN_REGISTER_ALLOCATION_PASS_H_
+
+#include <bitset>
+#include <vector>
+
+#include "xenia/base/cvar.h"
+#include "xenia/cpu/backend/machine_info.h"
+#include "xenia/cpu/compiler/compiler_pass.h"
+
+DECLARE_bool(linear_scan_register_allocation);
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Linear scan register allocator with live range splitting, an alternative to
+// RegisterAllocationPass. Like it, it only allocates registers to values within
+// a block - it must run after DataFlowAnalysisPass, which turns every value
+// live across a block boundary into a local, so that the live interval of each
+// value is simply [def, last use] in the linear instruction order.
+// When a register set is exhausted, the active interval whose next use is the
+// furthest away is split: it's stored to a spill slot at the current position
+// and reloaded into a new value right before its next use, which is then
+// allocated like any other value once the scan gets there. Spill slots whose
+// value is dead are reused for later spills of the same type, keeping the
+// stack frame small.
+class LinearScanRegisterAllocationPass : public CompilerPass {
+ public:
+  explicit LinearScanRegisterAllocationPass(
+      const backend::MachineInfo* machine_info);
+  ~LinearScanRegisterAllocationPass() override;
+
+  bool Run(hir::HIRBuilder* builder) override;
+
+ private:
+  // Instruction ordinals are spaced out so that reloads inserted before an
+  // instruction can be given an ordinal of their own.
+  static constexpr uint32_t kOrdinalStep = 2;
+
+  struct LiveInterval {
+    hir::Value* value;
+    // Ordinal of the last use.
+    uint32_t end;
+  };
+  struct RegisterFile {
+    const backend::MachineInfo::RegisterSet* set = nullptr;
+    uint32_t count = 0;
+    std::bitset<32> available;
+    // Intervals currently holding a register of this set.
+    std::vector<LiveInterval> active;
+  };
+  struct SpillSlot {
+    hir::Value* slot;
+    // Ordinal of the last use of the spilled value, after which the slot can
+    // be reused.
+    uint32_t end;
+  };
+
+  void NumberInstructions(hir::HIRBuilder* builder);
+  RegisterFile* RegisterFileForType(hir::TypeName type) {
+    return type_register_files_[type];
+  }
+  static uint32_t CalculateIntervalEnd(hir::Value* value);
+
+  void ExpireIntervals(uint32_t position);
+  void ReleaseSpillSlots(uint32_t position);
+  bool TryAllocateRegister(hir::Value* value, uint32_t end,
+                           const hir::RegAssignment* preferred_reg);
+  bool SplitInterval(hir::HIRBuilder* builder, hir::Instr* instr,
+                     RegisterFile* register_file);
+  hir::Value* AcquireSpillSlot(hir::HIRBuilder* builder, hir::TypeName type,
+                               uint32_t end);
+
+  std::vector<RegisterFile> register_files_;
+  // Indexed by hir::TypeName.
+  RegisterFile* type_register_files_[hir::MAX_TYPENAME] = {};
+
+  // Spill slots still holding a live value, and those available for reuse by
+  // type.
+  std::vector<SpillSlot> live_spill_slots_;
+  std::vector<hir::Value*> free_spill_slots_[hir::MAX_TYPENAME];
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_LINEAR_SCAN_REGISTER_ALLOCATION_PASS_H_
@@ -9,29 +9,87 @@
 
 #include "xenia/cpu/entry_table.h"
 
+#include <cstdint>
+#include <memory>
+
+#include "xenia/base/assert.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/threading.h"
 
 namespace xe {
 namespace cpu {
 
-EntryTable::EntryTable() = default;
+EntryTable::EntryTable() : pages_(new std::atomic<Page*>[kPageCount]) {
+  for (uint32_t i = 0; i < kPageCount; ++i) {
+    pages_[i].store(nullptr, std::memory_order_relaxed);
+  }
+}
 
 EntryTable::~EntryTable() {
   auto global_lock = global_critical_region_.Acquire();
+  for (uint32_t i = 0; i < kPageCount; ++i) {
+    Page* page = pages_[i].load(std::memory_order_relaxed);
+    if (!page) {
+      continue;
+    }
+    for (auto& slot : page->entries) {
+      delete slot.load(std::memory_order_relaxed);
+    }
+    delete page;
+  }
   for (auto it : map_.Values()) {
     Entry* entry = it;
     delete entry;
   }
+  for (Entry* entry : deleted_entries_) {
+    delete entry;
+  }
+}
+
+std::atomic<Entry*>* EntryTable::LookupSlot(uint32_t address, bool create) {
+  assert_true(IsInTable(address));
+  uint32_t offset = address - kTableBase;
+  std::atomic<Page*>& page_slot = pages_[offset >> kPageShift];
+  Page* page = page_slot.load(std::memory_order_acquire);
+  if (!page) {
+    if (!create) {
+      return nullptr;
+    }
+    auto new_page = std::make_unique<Page>();
+    for (auto& slot : new_page->entries) {
+      slot.store(nullptr, std::memory_order_relaxed);
+    }
+    if (page_slot.compare_exchange_strong(page, new_page.get(),
+                                          std::memory_order_acq_rel,
+                                          std::memory_order_acquire)) {
+      page = new_page.release();
+    }
+    // Otherwise another thread has created the page first, and page now
+    // points to it.
+  }
+  return &page->entries[(offset & ((1 << kPageShift) - 1)) >> 2];
+}
+
+void EntryTable::WaitForCompilation(Entry* entry) {
+  while (entry->status == Entry::STATUS_COMPILING) {
+    // TODO(benvanik): sleep for less time?
+    xe::threading::Sleep(std::chrono::microseconds(10));
+  }
 }
 
 Entry* EntryTable::Get(uint32_t address) {
-  auto global_lock = global_critical_region_.Acquire();
-  uint32_t idx = map_.IndexForKey(address);
-  if (idx == map_.size() || *map_.KeyAt(idx) != address) {
-    return nullptr;
+  Entry* entry;
+  if (IsInTable(address)) {
+    std::atomic<Entry*>* slot = LookupSlot(address, false);
+    entry = slot ? slot->load(std::memory_order_acquire) : nullptr;
+  } else {
+    auto global_lock = global_critical_region_.Acquire();
+    uint32_t idx = map_.IndexForKey(address);
+    if (idx == map_.size() || *map_.KeyAt(idx) != address) {
+      return nullptr;
+    }
+    entry = *map_.ValueAt(idx);
   }
-  Entry* entry = *map_.ValueAt(idx);
   if (entry) {
     // TODO(benvanik): wait if needed?
     if (entry->status != Entry::STATUS_READY) {
@@ -42,8 +100,38 @@ Entry* EntryTable::Get(uint32_t address) {
 }
 
 Entry::Status EntryTable::GetOrCreate(uint32_t address, Entry** out_entry) {
-  // TODO(benvanik): replace with a map with wait-free for find.
-  // https://github.com/facebook/folly/blob/master/folly/AtomicHashMap.h
+  if (IsInTable(address)) {
+    std::atomic<Entry*>* slot = LookupSlot(address, true);
+    Entry* entry = slot->load(std::memory_order_acquire);
+    if (!entry) {
+      // Try to claim the slot. Most of the time nobody else is racing to
+      // create the same entry, so the allocation is rarely wasted.
+      auto new_entry = std::make_unique<Entry>();
+      new_entry->address = address;
+      new_entry->end_address = 0;
+      new_entry->status = Entry::STATUS_COMPILING;
+      new_entry->function = nullptr;
+      new_entry->table_entries_index = SIZE_MAX;
+      if (slot->compare_exchange_strong(entry, new_entry.get(),
+                                        std::memory_order_acq_rel,
+                                        std::memory_order_acquire)) {
+        entry = new_entry.release();
+        auto global_lock = global_critical_region_.Acquire();
+        // Unless deleted between being created and now.
+        if (slot->load(std::memory_order_relaxed) == entry) {
+          entry->table_entries_index = table_entries_.size();
+          table_entries_.push_back(entry);
+        }
+        *out_entry = entry;
+        return Entry::STATUS_NEW;
+      }
+      // Lost the race, entry now is what the other thread has created.
+    }
+    // If we aren't ready yet spin and wait.
+    WaitForCompilation(entry);
+    *out_entry = entry;
+    return entry->status;
+  }
 
   auto global_lock = global_critical_region_.Acquire();
 
@@ -56,15 +144,9 @@ Entry::Status EntryTable::GetOrCreate(uint32_t address, Entry** out_entry) {
   if (entry) {
     // If we aren't ready yet spin and wait.
     if (entry->status == Entry::STATUS_COMPILING) {
-      // chrispy: i think this is dead code, if we are compiling we're holding
-      // the global lock, arent we? so we wouldnt be executing here
-      // Still compiling, so spin.
-      do {
-        global_lock.unlock();
-        // TODO(benvanik): sleep for less time?
-        xe::threading::Sleep(std::chrono::microseconds(10));
-        global_lock.lock();
-      } while (entry->status == Entry::STATUS_COMPILING);
+      global_lock.unlock();
+      WaitForCompilation(entry);
+      global_lock.lock();
     }
     status = entry->status;
   } else {
@@ -85,23 +167,48 @@ Entry::Status EntryTable::GetOrCreate(uint32_t address, Entry** out_entry) {
 
 void EntryTable::Delete(uint32_t address) {
   auto global_lock = global_critical_region_.Acquire();
-  // doesnt this leak memory by not deleting the entry?
-  uint32_t idx = map_.IndexForKey(address);
-  if (idx != map_.size() && *map_.KeyAt(idx) == address) {
-    map_.EraseAt(idx);
+  Entry* entry = nullptr;
+  if (IsInTable(address)) {
+    std::atomic<Entry*>* slot = LookupSlot(address, false);
+    if (slot) {
+      entry = slot->exchange(nullptr, std::memory_order_acq_rel);
+    }
+    // May have been deleted before the creating thread added it to the list.
+    if (entry && entry->table_entries_index < table_entries_.size() &&
+        table_entries_[entry->table_entries_index] == entry) {
+      Entry* last_entry = table_entries_.back();
+      last_entry->table_entries_index = entry->table_entries_index;
+      table_entries_[entry->table_entries_index] = last_entry;
+      table_entries_.pop_back();
+    }
+  } else {
+    uint32_t idx = map_.IndexForKey(address);
+    if (idx != map_.size() && *map_.KeyAt(idx) == address) {
+      entry = *map_.ValueAt(idx);
+      map_.EraseAt(idx);
+    }
+  }
+  // Lookups on other threads may still be holding the entry.
+  if (entry) {
+    deleted_entries_.push_back(entry);
   }
 }
 
 std::vector<Function*> EntryTable::FindWithAddress(uint32_t address) {
-  auto global_lock = global_critical_region_.Acquire();
   std::vector<Function*> fns;
-  for (auto& it : map_.Values()) {
-    Entry* entry = it;
+  auto add_if_contains = [&](const Entry* entry) {
     if (address >= entry->address && address <= entry->end_address) {
       if (entry->status == Entry::STATUS_READY) {
         fns.push_back(entry->function);
       }
     }
+  };
+  auto global_lock = global_critical_region_.Acquire();
+  for (Entry* entry : table_entries_) {
+    add_if_contains(entry);
+  }
+  for (auto& it : map_.Values()) {
+    add_if_contains(it);
   }
   return fns;
 }
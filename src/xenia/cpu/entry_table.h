@@ -10,7 +10,8 @@
 #ifndef XENIA_CPU_ENTRY_TABLE_H_
 #define XENIA_CPU_ENTRY_TABLE_H_
 
-#include <unordered_map>
+#include <atomic>
+#include <memory>
 #include <vector>
 
 #include "xenia/base/mutex.h"
@@ -30,8 +31,13 @@ typedef struct Entry_t {
 
   uint32_t address;
   uint32_t end_address;
-  Status status;
+  // function and end_address must be written before the status is set to
+  // STATUS_READY, and read after observing it.
+  std::atomic<Status> status;
   Function* function;
+  // Index in the list of the entries in the table of EntryTable, for
+  // removing it without searching.
+  size_t table_entries_index;
 } Entry;
 
 class EntryTable {
@@ -46,10 +52,42 @@ class EntryTable {
   std::vector<Function*> FindWithAddress(uint32_t address);
 
  private:
+  // Guest code normally lives within the same range as covered by the
+  // indirection table in the x64 backend. Entries for it are looked up in a
+  // two-level radix table without taking any locks - the pages and the
+  // entries are only ever published with a compare-exchange and are never
+  // freed until the table is destroyed. Anything outside the range, or not
+  // aligned to an instruction, goes to the locked fallback map.
+  static constexpr uint32_t kTableBase = 0x80000000;
+  static constexpr uint32_t kTableSize = 0x20000000;
+  // Each page covers 16 KB of guest code.
+  static constexpr uint32_t kPageShift = 14;
+  static constexpr uint32_t kPageCount = kTableSize >> kPageShift;
+  static constexpr uint32_t kEntriesPerPage = (1 << kPageShift) / 4;
+
+  struct Page {
+    std::atomic<Entry*> entries[kEntriesPerPage];
+  };
+
+  static bool IsInTable(uint32_t address) {
+    return address - kTableBase < kTableSize && !(address & 3);
+  }
+  // Returns the slot for the address, or nullptr if its page hasn't been
+  // created yet and create is false.
+  std::atomic<Entry*>* LookupSlot(uint32_t address, bool create);
+  static void WaitForCompilation(Entry* entry);
+
+  std::unique_ptr<std::atomic<Page*>[]> pages_;
+
   xe::global_critical_region global_critical_region_;
-  // TODO(benvanik): replace with a better data structure.
+  // Entries outside of the table range, and entries removed from the table
+  // that may still be referenced by other threads, protected by
+  // global_critical_region_.
   xe::split_map<uint32_t, Entry*> map_;
-  // std::unordered_map<uint32_t, Entry*> map_;
+  std::vector<Entry*> deleted_entries_;
+  // Entries currently in the table, for containment queries without scanning
+  // every slot, protected by global_critical_region_. Freed with the pages.
+  std::vector<Entry*> table_entries_;
 };
 
 }  // namespace cpu
@@ -9,6 +9,7 @@
 
 #include "xenia/cpu/function.h"
 
+#include "xenia/base/assert.h"
 #include "xenia/base/logging.h"
 #include "xenia/cpu/symbol.h"
 #include "xenia/cpu/thread_state.h"
@@ -60,6 +61,14 @@ GuestFunction::GuestFunction(Module* module, uint32_t address)
 
 GuestFunction::~GuestFunction() = default;
 
+void GuestFunction::SetOptimizedFunction(
+    std::unique_ptr<GuestFunction> function) {
+  assert_null(optimized_function_owner_);
+  optimized_function_owner_ = std::move(function);
+  optimized_function_.store(optimized_function_owner_.get(),
+                            std::memory_order_release);
+}
+
 void GuestFunction::SetupExtern(ExternHandler handler, Export* export_data) {
   behavior_ = Behavior::kExtern;
   extern_handler_ = handler;
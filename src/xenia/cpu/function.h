@@ -10,6 +10,7 @@
 #ifndef XENIA_CPU_FUNCTION_H_
 #define XENIA_CPU_FUNCTION_H_
 
+#include <atomic>
 #include <memory>
 #include <vector>
 
@@ -151,10 +152,38 @@ class GuestFunction : public Function {
 
   bool Call(ThreadState* thread_state, uint32_t return_address) override;
 
+  // Tiered compilation (see Processor::RequestReoptimization).
+  // Baseline functions are translated with few optimizations, and count down
+  // tier_up_counter on every entry. Once it reaches zero, the function is
+  // translated again with all optimizations into a separate function object,
+  // which replaces it in the indirection table.
+  bool is_baseline_tier() const { return is_baseline_tier_; }
+  void SetBaselineTier(uint32_t tier_up_threshold) {
+    is_baseline_tier_ = true;
+    tier_up_counter_ = tier_up_threshold;
+  }
+  uint32_t* tier_up_counter() { return &tier_up_counter_; }
+  // Returns false if reoptimization has already been requested.
+  bool MarkReoptimizationRequested() {
+    return !reoptimization_requested_.exchange(true);
+  }
+  GuestFunction* optimized_function() const {
+    return optimized_function_.load(std::memory_order_acquire);
+  }
+  void SetOptimizedFunction(std::unique_ptr<GuestFunction> function);
+
  protected:
   virtual bool CallImpl(ThreadState* thread_state, uint32_t return_address) = 0;
 
  protected:
+  bool is_baseline_tier_ = false;
+  // Decremented by the generated code without synchronization, only needs to
+  // reach zero eventually.
+  uint32_t tier_up_counter_ = 0;
+  std::atomic<bool> reoptimization_requested_ = {false};
+  std::unique_ptr<GuestFunction> optimized_function_owner_;
+  std::atomic<GuestFunction*> optimized_function_ = {nullptr};
+
   std::unique_ptr<FunctionDebugInfo> debug_info_;
   FunctionTraceData trace_data_;
   std::vector<SourceMapEntry> source_map_;
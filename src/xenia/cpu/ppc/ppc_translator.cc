@@ -12,6 +12,7 @@
 #include "xenia/base/assert.h"
 #include "xenia/base/byte_order.h"
 #include "xenia/base/cvar.h"
+#include "xenia/base/logging.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/reset_scope.h"
@@ -28,6 +29,11 @@
 DEFINE_bool(dump_translated_hir_functions, false, "dumps translated hir",
             "CPU");
 
+DEFINE_bool(log_cse_stats, false,
+            "Log the number of instructions removed by common subexpression "
+            "elimination in each translated function.",
+            "CPU");
+
 namespace xe {
 namespace cpu {
 namespace ppc {
@@ -58,13 +64,18 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   compiler_->AddPass(std::make_unique<passes::ContextPromotionPass>());
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
 
-  // Grouped simplification + constant propagation.
+  // Grouped simplification + constant propagation + CSE.
   // Loops until no changes are made.
   auto sap = std::make_unique<passes::ConditionalGroupPass>();
   sap->AddPass(std::make_unique<passes::SimplificationPass>());
   if (validate) sap->AddPass(std::make_unique<passes::ValidationPass>());
   sap->AddPass(std::make_unique<passes::ConstantPropagationPass>());
   if (validate) sap->AddPass(std::make_unique<passes::ValidationPass>());
+  auto cse_pass =
+      std::make_unique<passes::CommonSubexpressionEliminationPass>();
+  cse_pass_ = cse_pass.get();
+  sap->AddPass(std::move(cse_pass));
+  if (validate) sap->AddPass(std::make_unique<passes::ValidationPass>());
   compiler_->AddPass(std::move(sap));
 
   if (backend->machine_info()->supports_extended_load_store) {
@@ -77,9 +88,8 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   }
   compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
-  // compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
-  // if (validate)
-  // compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
+  if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
   compiler_->AddPass(std::make_unique<passes::DeadCodeEliminationPass>());
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
 
@@ -91,12 +101,48 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   // Will modify the HIR to add loads/stores.
   // This should be the last pass before finalization, as after this all
   // registers are assigned and ready to be emitted.
-  compiler_->AddPass(std::make_unique<passes::RegisterAllocationPass>(
-      backend->machine_info()));
+  if (cvars::linear_scan_register_allocation) {
+    // The linear scan allocator expects all values live across blocks to have
+    // been moved to locals.
+    compiler_->AddPass(std::make_unique<passes::DataFlowAnalysisPass>());
+    if (validate)
+      compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+    compiler_->AddPass(
+        std::make_unique<passes::LinearScanRegisterAllocationPass>(
+            backend->machine_info()));
+  } else {
+    compiler_->AddPass(std::make_unique<passes::RegisterAllocationPass>(
+        backend->machine_info()));
+  }
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
 
   // Must come last. The HIR is not really HIR after this.
   compiler_->AddPass(std::make_unique<passes::FinalizationPass>());
+
+  // Baseline tier of tiered compilation: only the passes that are required
+  // or pay for themselves in the time taken to emit the code. Local context
+  // promotion removes most of the loads and stores emitted per instruction,
+  // and a single round of simplification cleans up after it.
+  baseline_compiler_.reset(new Compiler(frontend->processor()));
+  baseline_compiler_->AddPass(std::make_unique<passes::ContextPromotionPass>());
+  if (validate) {
+    baseline_compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  }
+  baseline_compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
+  if (validate) {
+    baseline_compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  }
+  baseline_compiler_->AddPass(
+      std::make_unique<passes::DeadCodeEliminationPass>());
+  if (validate) {
+    baseline_compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  }
+  baseline_compiler_->AddPass(std::make_unique<passes::RegisterAllocationPass>(
+      backend->machine_info()));
+  if (validate) {
+    baseline_compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  }
+  baseline_compiler_->AddPass(std::make_unique<passes::FinalizationPass>());
 }
 
 PPCTranslator::~PPCTranslator() = default;
@@ -157,6 +203,7 @@ bool PPCTranslator::Translate(GuestFunction* function,
   // Reset() all caching when we leave.
   xe::make_reset_scope(builder_);
   xe::make_reset_scope(compiler_);
+  xe::make_reset_scope(baseline_compiler_);
   xe::make_reset_scope(assembler_);
   xe::make_reset_scope(&string_buffer_);
 
@@ -231,9 +278,19 @@ bool PPCTranslator::Translate(GuestFunction* function,
   }
 
   // Compile/optimize/etc.
-  if (!compiler_->Compile(builder_.get())) {
+  Compiler* compiler = function->is_baseline_tier() ? baseline_compiler_.get()
+                                                    : compiler_.get();
+  cse_pass_->TakeEliminatedCount();
+  if (!compiler->Compile(builder_.get())) {
     return false;
   }
+  if (cvars::log_cse_stats) {
+    uint32_t cse_count = cse_pass_->TakeEliminatedCount();
+    if (cse_count) {
+      XELOGI("CSE eliminated {} instructions in {:08X}", cse_count,
+             function->address());
+    }
+  }
 
   // Stash optimized HIR.
   if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmHir) {
@@ -17,6 +17,16 @@
 #include "xenia/cpu/compiler/compiler.h"
 #include "xenia/cpu/function.h"
 
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+class CommonSubexpressionEliminationPass;
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
 namespace xe {
 namespace cpu {
 namespace ppc {
@@ -41,7 +51,11 @@ class PPCTranslator {
   std::unique_ptr<PPCScanner> scanner_;
   std::unique_ptr<PPCHIRBuilder> builder_;
   std::unique_ptr<compiler::Compiler> compiler_;
+  // Used for functions in the baseline tier of tiered compilation.
+  std::unique_ptr<compiler::Compiler> baseline_compiler_;
   std::unique_ptr<backend::Assembler> assembler_;
+  // Owned by compiler_.
+  compiler::passes::CommonSubexpressionEliminationPass* cse_pass_ = nullptr;
 
   StringBuffer string_buffer_;
 };
@@ -9,6 +9,8 @@
 
 #include "xenia/cpu/processor.h"
 
+#include <algorithm>
+
 #include "xenia/base/assert.h"
 #include "xenia/base/atomic.h"
 #include "xenia/base/byte_order.h"
@@ -48,6 +50,16 @@ DEFINE_path(trace_function_data_path, "", "File to write trace data to.",
             "CPU");
 DEFINE_bool(break_on_start, false, "Break into the debugger on startup.",
             "CPU");
+DEFINE_bool(tiered_compilation, false,
+            "Translate guest functions with only the cheapest optimizations "
+            "at first, and again with all of them in the background once they "
+            "have been called tiered_compilation_threshold times. Reduces "
+            "stuttering and loading times. Not used with --debug.",
+            "CPU");
+DEFINE_uint32(tiered_compilation_threshold, 1000,
+              "Number of calls after which a function translated with "
+              "tiered_compilation is translated again with all optimizations.",
+              "CPU");
 
 namespace xe {
 namespace kernel {
@@ -86,6 +98,17 @@ Processor::Processor(xe::Memory* memory, ExportResolver* export_resolver)
     : memory_(memory), export_resolver_(export_resolver) {}
 
 Processor::~Processor() {
+  // Writes the final profile, which needs the function names.
+  sampling_profiler_.reset();
+
+  // Workers call back into the frontend and modules, stop them first.
+  background_compiler_.reset();
+
+  // Needs the functions, which are owned by the modules.
+  if (backend_) {
+    backend_->SavePersistentCode();
+  }
+
   {
     auto global_lock = global_critical_region_.Acquire();
     modules_.clear();
@@ -147,6 +170,9 @@ bool Processor::Setup(std::unique_ptr<backend::Backend> backend) {
     }
   }
 
+  background_compiler_ = BackgroundCompiler::Create(this);
+  sampling_profiler_ = SamplingProfiler::Create(this);
+
   // Open the trace data path, if requested.
   functions_trace_path_ = cvars::trace_function_data_path;
   if (!functions_trace_path_.empty()) {
@@ -281,6 +307,13 @@ Function* Processor::ResolveFunction(uint32_t address) {
     entry->function = function;
     entry->end_address = function->end_address();
     status = entry->status = Entry::STATUS_READY;
+
+    // A guest thread had to stall on this one, so it's likely going to call
+    // into its direct callees next - get those compiling in the background.
+    if (background_compiler_ && !BackgroundCompiler::IsWorkerThread()) {
+      background_compiler_->EnqueueCallees(function->address(),
+                                           function->end_address());
+    }
   }
   if (status == Entry::STATUS_READY) {
     // Ready to use.
@@ -340,8 +373,13 @@ bool Processor::DemandFunction(Function* function) {
   if (symbol_status == Symbol::Status::kNew) {
     // Symbol is undefined, so define now.
     assert_true(function->is_guest());
-    if (!frontend_->DefineFunction(static_cast<GuestFunction*>(function),
-                                   debug_info_flags_)) {
+    auto guest_function = static_cast<GuestFunction*>(function);
+    if (cvars::tiered_compilation && !cvars::debug &&
+        guest_function->behavior() == Function::Behavior::kDefault) {
+      guest_function->SetBaselineTier(
+          std::max(cvars::tiered_compilation_threshold, uint32_t(1)));
+    }
+    if (!frontend_->DefineFunction(guest_function, debug_info_flags_)) {
       function->set_status(Symbol::Status::kFailed);
       return false;
     }
@@ -361,6 +399,49 @@ bool Processor::DemandFunction(Function* function) {
   return true;
 }
 
+void Processor::RequestReoptimization(GuestFunction* function) {
+  if (!function->MarkReoptimizationRequested()) {
+    return;
+  }
+  if (background_compiler_) {
+    background_compiler_->EnqueueReoptimization(function->address());
+  } else {
+    ReoptimizeFunction(function->address());
+  }
+}
+
+bool Processor::ReoptimizeFunction(uint32_t address) {
+  SCOPE_profile_cpu_f("cpu");
+
+  Function* function = QueryFunction(address);
+  if (!function || !function->is_guest() ||
+      function->status() != Symbol::Status::kDefined) {
+    return false;
+  }
+  auto guest_function = static_cast<GuestFunction*>(function);
+  if (!guest_function->is_baseline_tier() ||
+      guest_function->optimized_function()) {
+    return false;
+  }
+
+  // The baseline code may still be running on other threads, so it's left in
+  // place, and the optimized code becomes a separate function. Placing it
+  // switches the indirection table entry, and the call sites patched to the
+  // baseline code, over to it.
+  std::unique_ptr<GuestFunction> optimized_function =
+      backend_->CreateGuestFunction(function->module(), address);
+  optimized_function->set_name(guest_function->name());
+  optimized_function->set_end_address(guest_function->end_address());
+  if (!frontend_->DefineFunction(optimized_function.get(),
+                                 debug_info_flags_)) {
+    XELOGW("Failed to reoptimize function {:08X}", address);
+    return false;
+  }
+  optimized_function->set_status(Symbol::Status::kDefined);
+  guest_function->SetOptimizedFunction(std::move(optimized_function));
+  return true;
+}
+
 bool Processor::Execute(ThreadState* thread_state, uint32_t address) {
   SCOPE_profile_cpu_f("cpu");
 
@@ -504,6 +585,9 @@ void Processor::OnThreadDestroyed(uint32_t thread_id) {
   assert_true(it != thread_debug_infos_.end());
   it->second->thread_handle = NULL;
   thread_debug_infos_.erase(it);
+  if (sampling_profiler_) {
+    sampling_profiler_->OnThreadDestroyed(thread_id);
+  }
 }
 
 void Processor::OnThreadEnteringWait(uint32_t thread_id) {
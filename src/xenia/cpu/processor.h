@@ -19,12 +19,14 @@
 #include "xenia/base/mapped_memory.h"
 #include "xenia/base/mutex.h"
 #include "xenia/cpu/backend/backend.h"
+#include "xenia/cpu/background_compiler.h"
 #include "xenia/cpu/debug_listener.h"
 #include "xenia/cpu/entry_table.h"
 #include "xenia/cpu/export_resolver.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/module.h"
 #include "xenia/cpu/ppc/ppc_frontend.h"
+#include "xenia/cpu/sampling_profiler.h"
 #include "xenia/cpu/thread_debug_info.h"
 #include "xenia/cpu/thread_state.h"
 #include "xenia/memory.h"
@@ -71,6 +73,14 @@ class Processor {
   ppc::PPCFrontend* frontend() const { return frontend_.get(); }
   backend::Backend* backend() const { return backend_.get(); }
   ExportResolver* export_resolver() const { return export_resolver_; }
+  // Null if background compilation is disabled.
+  BackgroundCompiler* background_compiler() const {
+    return background_compiler_.get();
+  }
+  // Null unless the guest_sampling_profiler cvar is set.
+  SamplingProfiler* sampling_profiler() const {
+    return sampling_profiler_.get();
+  }
 
   bool Setup(std::unique_ptr<backend::Backend> backend);
 
@@ -119,6 +129,15 @@ class Processor {
   Function* LookupFunction(Module* module, uint32_t address);
   Function* ResolveFunction(uint32_t address);
 
+  // Tiered compilation (see GuestFunction::is_baseline_tier). Called by
+  // baseline functions that have become hot to have them translated again
+  // with all optimizations, in the background if possible.
+  void RequestReoptimization(GuestFunction* function);
+  // Translates the baseline function at the address with all optimizations
+  // on the calling thread. Returns false if it's not a baseline function or
+  // has already been reoptimized.
+  bool ReoptimizeFunction(uint32_t address);
+
   bool Execute(ThreadState* thread_state, uint32_t address);
   bool ExecuteRaw(ThreadState* thread_state, uint32_t address);
   uint64_t Execute(ThreadState* thread_state, uint32_t address, uint64_t args[],
@@ -263,6 +282,8 @@ class Processor {
 
   std::unique_ptr<ppc::PPCFrontend> frontend_;
   std::unique_ptr<backend::Backend> backend_;
+  std::unique_ptr<BackgroundCompiler> background_compiler_;
+  std::unique_ptr<SamplingProfiler> sampling_profiler_;
   ExportResolver* export_resolver_ = nullptr;
 
   EntryTable entry_table_;
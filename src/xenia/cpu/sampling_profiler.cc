@@ -0,0 +1,394 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/sampling_profiler.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <string>
+
+#include "xenia/base/clock.h"
+#include "xenia/base/cvar.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+#include "xenia/base/string.h"
+#include "xenia/cpu/backend/backend.h"
+#include "xenia/cpu/backend/code_cache.h"
+#include "xenia/cpu/function.h"
+#include "xenia/cpu/ppc/ppc_scanner.h"
+#include "xenia/cpu/processor.h"
+#include "xenia/cpu/stack_walker.h"
+#include "xenia/cpu/thread.h"
+
+DEFINE_int32(guest_sampling_profiler, 0,
+             "Interval in milliseconds between samples of the guest threads "
+             "taken by the sampling profiler, or 0 to disable it. Requires a "
+             "stack walker (Windows only for now).",
+             "CPU");
+DEFINE_path(guest_sampling_profile_path, "guest_profile",
+            "Path prefix of the files written by the sampling profiler.",
+            "CPU");
+DEFINE_int32(guest_sampling_profile_write_interval, 30,
+             "Interval in seconds between writes of the sampling profile, or "
+             "0 to only write it on exit.",
+             "CPU");
+
+namespace xe {
+namespace cpu {
+
+namespace {
+
+// Deeper guest stacks are truncated, keeping the innermost frames.
+constexpr size_t kMaxSampleFrames = 128;
+
+std::string GetFunctionName(uint32_t address, const GuestFunction* function) {
+  if (!address) {
+    return "[host]";
+  }
+  if (function && !function->name().empty()) {
+    return function->name();
+  }
+  return fmt::format("sub_{:08X}", address);
+}
+
+}  // namespace
+
+SamplingProfiler::SamplingProfiler(Processor* processor)
+    : processor_(processor) {}
+
+SamplingProfiler::~SamplingProfiler() { Shutdown(); }
+
+std::unique_ptr<SamplingProfiler> SamplingProfiler::Create(
+    Processor* processor) {
+  if (cvars::guest_sampling_profiler <= 0) {
+    return nullptr;
+  }
+  if (!processor->stack_walker()) {
+    XELOGW("Disabling the sampling profiler due to lack of stack walker");
+    return nullptr;
+  }
+  auto profiler = std::make_unique<SamplingProfiler>(processor);
+  if (!profiler->Initialize()) {
+    return nullptr;
+  }
+  return profiler;
+}
+
+bool SamplingProfiler::Initialize() {
+  shutdown_event_ = xe::threading::Event::CreateManualResetEvent(false);
+  if (!shutdown_event_) {
+    return false;
+  }
+  xe::threading::Thread::CreationParameters params;
+  params.create_suspended = false;
+  // Samples have to be taken regardless of how busy the guest threads are.
+  params.initial_priority = xe::threading::ThreadPriority::kAboveNormal;
+  thread_ =
+      xe::threading::Thread::Create(params, [this]() { SamplerThread(); });
+  if (!thread_) {
+    XELOGE("Failed to create the sampling profiler thread");
+    return false;
+  }
+  thread_->set_name("CPU Sampling Profiler");
+  XELOGI("Sampling guest threads every {} ms",
+         cvars::guest_sampling_profiler);
+  return true;
+}
+
+void SamplingProfiler::Shutdown() {
+  if (!thread_) {
+    return;
+  }
+  shutdown_event_->Set();
+  xe::threading::Wait(thread_.get(), false);
+  thread_.reset();
+  XELOGI("Sampling profiler took {} samples", sample_count_.load());
+  WriteProfile();
+}
+
+void SamplingProfiler::SamplerThread() {
+  auto interval =
+      std::chrono::milliseconds(uint32_t(cvars::guest_sampling_profiler));
+  uint64_t write_interval_ms =
+      uint64_t(std::max(cvars::guest_sampling_profile_write_interval, 0)) *
+      1000;
+  uint64_t last_write_ms = Clock::QueryHostUptimeMillis();
+  while (xe::threading::Wait(shutdown_event_.get(), false, interval) ==
+         xe::threading::WaitResult::kTimeout) {
+    SampleThreads();
+    if (write_interval_ms) {
+      uint64_t now_ms = Clock::QueryHostUptimeMillis();
+      if (now_ms - last_write_ms >= write_interval_ms) {
+        WriteProfile();
+        last_write_ms = now_ms;
+      }
+    }
+  }
+}
+
+void SamplingProfiler::SampleThreads() {
+  StackWalker* stack_walker = processor_->stack_walker();
+  uint64_t frame_host_pcs[kMaxSampleFrames];
+
+  // The global lock is only held while taking the list of threads and while
+  // checking whether each is still there, not while threads are suspended, so
+  // guest threads aren't stalled by sampling, and a suspended thread holding
+  // the lock can't block the sampler.
+  std::vector<uint32_t> thread_ids;
+  for (ThreadDebugInfo* thread_info : processor_->QueryThreadDebugInfos()) {
+    thread_ids.push_back(thread_info->thread_id);
+  }
+  for (uint32_t thread_id : thread_ids) {
+    Thread* thread;
+    {
+      auto global_lock = global_critical_region::AcquireDirect();
+      ThreadDebugInfo* thread_info =
+          processor_->QueryThreadDebugInfo(thread_id);
+      if (!thread_info) {
+        continue;
+      }
+      thread = thread_info->thread;
+      if (!thread || thread_info->state != ThreadDebugInfo::State::kAlive ||
+          thread_info->suspended || !thread->can_debugger_suspend()) {
+        continue;
+      }
+      // Keeps the thread from being destroyed until it's sampled.
+      sampling_thread_id_.store(thread_id);
+    }
+    // Nothing is allocated while a thread is suspended, as it may be holding
+    // the heap lock.
+    size_t frame_count = 0;
+    xe::threading::Thread* host_thread = thread->thread();
+    if (host_thread && host_thread->Suspend()) {
+      frame_count = stack_walker->CaptureStackTrace(
+          host_thread->native_handle(), frame_host_pcs, 0,
+          xe::countof(frame_host_pcs), nullptr, nullptr, nullptr);
+      host_thread->Resume();
+    }
+    sampling_thread_id_.store(0);
+    if (frame_count) {
+      RecordSample(frame_host_pcs, frame_count);
+    }
+  }
+}
+
+void SamplingProfiler::OnThreadDestroyed(uint32_t thread_id) {
+  // The thread is not registered anymore, so the sampler can't start sampling
+  // it again, only finish sampling it.
+  while (sampling_thread_id_.load() == thread_id) {
+    xe::threading::MaybeYield();
+  }
+}
+
+void SamplingProfiler::RecordSample(const uint64_t* frame_host_pcs,
+                                    size_t frame_count) {
+  backend::CodeCache* code_cache = processor_->backend()->code_cache();
+  uint32_t leaf_guest_pc = 0;
+  std::vector<uint32_t> stack;
+  std::vector<GuestFunction*> stack_functions;
+  for (size_t i = 0; i < frame_count; ++i) {
+    uint64_t host_pc = frame_host_pcs[i];
+    GuestFunction* function = code_cache->LookupFunction(host_pc);
+    if (!function) {
+      if (!i) {
+        stack.push_back(0);
+        stack_functions.push_back(nullptr);
+      }
+      continue;
+    }
+    if (!i) {
+      leaf_guest_pc = function->MapMachineCodeToGuestAddress(host_pc);
+    }
+    stack.push_back(function->address());
+    stack_functions.push_back(function);
+  }
+  if (stack.empty() || (stack.size() == 1 && !stack[0])) {
+    // Not called from guest code - a host thread running guest callbacks, or
+    // one that hasn't entered the guest yet.
+    return;
+  }
+  std::reverse(stack.begin(), stack.end());
+  std::reverse(stack_functions.begin(), stack_functions.end());
+
+  std::lock_guard<xe_mutex> lock(data_lock_);
+  ++sample_count_;
+  ++stacks_[stack];
+  if (stack.back()) {
+    ++functions_[stack.back()].self;
+  }
+  if (leaf_guest_pc) {
+    ++instructions_[leaf_guest_pc];
+  }
+  for (size_t i = 0; i < stack.size(); ++i) {
+    uint32_t address = stack[i];
+    if (!address) {
+      continue;
+    }
+    // Recursive functions are counted once per sample.
+    if (std::find(stack.begin(), stack.begin() + i, address) !=
+        stack.begin() + i) {
+      continue;
+    }
+    FunctionSamples& samples = functions_[address];
+    samples.function = stack_functions[i];
+    ++samples.total;
+  }
+}
+
+bool SamplingProfiler::WriteProfile() {
+  std::filesystem::path path = cvars::guest_sampling_profile_path;
+  if (path.empty()) {
+    return false;
+  }
+  if (path.has_parent_path()) {
+    std::filesystem::create_directories(path.parent_path());
+  }
+  auto with_suffix = [&path](const char* suffix) {
+    std::filesystem::path result = path;
+    result += suffix;
+    return result;
+  };
+  bool result = true;
+  result &= WriteCollapsedStacks(with_suffix(".collapsed"));
+  result &= WriteFunctions(with_suffix("_functions.csv"));
+  result &= WriteBlocks(with_suffix("_blocks.csv"));
+  result &= WriteInstructions(with_suffix("_instructions.csv"));
+  if (!result) {
+    XELOGE("Failed to write the sampling profile to {}",
+           xe::path_to_utf8(path));
+  }
+  return result;
+}
+
+bool SamplingProfiler::WriteCollapsedStacks(const std::filesystem::path& path) {
+  FILE* file = xe::filesystem::OpenFile(path, "wb");
+  if (!file) {
+    return false;
+  }
+  std::lock_guard<xe_mutex> lock(data_lock_);
+  std::string line;
+  for (const auto& it : stacks_) {
+    line.clear();
+    for (uint32_t address : it.first) {
+      if (!line.empty()) {
+        line.push_back(';');
+      }
+      auto function_it = functions_.find(address);
+      line += GetFunctionName(address, function_it != functions_.end()
+                                           ? function_it->second.function
+                                           : nullptr);
+    }
+    std::fprintf(file, "%s %" PRIu64 "\n", line.c_str(), it.second);
+  }
+  std::fclose(file);
+  return true;
+}
+
+bool SamplingProfiler::WriteFunctions(const std::filesystem::path& path) {
+  FILE* file = xe::filesystem::OpenFile(path, "wb");
+  if (!file) {
+    return false;
+  }
+  std::lock_guard<xe_mutex> lock(data_lock_);
+  std::vector<std::pair<uint32_t, const FunctionSamples*>> sorted;
+  sorted.reserve(functions_.size());
+  for (const auto& it : functions_) {
+    sorted.emplace_back(it.first, &it.second);
+  }
+  std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+    if (a.second->self != b.second->self) {
+      return a.second->self > b.second->self;
+    }
+    return a.second->total > b.second->total;
+  });
+  uint64_t sample_count = std::max(sample_count_.load(), uint64_t(1));
+  std::fprintf(file, "address,name,self,total,self_percent,total_percent\n");
+  for (const auto& it : sorted) {
+    std::fprintf(file, "%08X,%s,%" PRIu64 ",%" PRIu64 ",%.3f,%.3f\n", it.first,
+                 GetFunctionName(it.first, it.second->function).c_str(),
+                 it.second->self, it.second->total,
+                 100.0 * it.second->self / sample_count,
+                 100.0 * it.second->total / sample_count);
+  }
+  std::fclose(file);
+  return true;
+}
+
+bool SamplingProfiler::WriteBlocks(const std::filesystem::path& path) {
+  FILE* file = xe::filesystem::OpenFile(path, "wb");
+  if (!file) {
+    return false;
+  }
+  std::lock_guard<xe_mutex> lock(data_lock_);
+  struct BlockSamples {
+    uint32_t function_address;
+    uint32_t start_address;
+    uint32_t end_address;
+    uint64_t samples;
+  };
+  std::vector<BlockSamples> blocks;
+  // Blocks are found again on each write rather than kept from compilation,
+  // as only the sampled functions need them.
+  ppc::PPCScanner scanner(processor_->frontend());
+  for (const auto& it : functions_) {
+    GuestFunction* function = it.second.function;
+    if (!it.second.self || !function || !function->has_end_address()) {
+      continue;
+    }
+    for (const ppc::BlockInfo& block_info : scanner.FindBlocks(function)) {
+      uint64_t samples = 0;
+      for (uint32_t address = block_info.start_address;
+           address <= block_info.end_address; address += 4) {
+        auto instruction_it = instructions_.find(address);
+        if (instruction_it != instructions_.end()) {
+          samples += instruction_it->second;
+        }
+      }
+      if (samples) {
+        blocks.push_back({it.first, block_info.start_address,
+                          block_info.end_address, samples});
+      }
+    }
+  }
+  std::sort(blocks.begin(), blocks.end(),
+            [](const BlockSamples& a, const BlockSamples& b) {
+              return a.samples > b.samples;
+            });
+  std::fprintf(file, "function,start,end,samples\n");
+  for (const BlockSamples& block : blocks) {
+    std::fprintf(file, "%08X,%08X,%08X,%" PRIu64 "\n", block.function_address,
+                 block.start_address, block.end_address, block.samples);
+  }
+  std::fclose(file);
+  return true;
+}
+
+bool SamplingProfiler::WriteInstructions(const std::filesystem::path& path) {
+  FILE* file = xe::filesystem::OpenFile(path, "wb");
+  if (!file) {
+    return false;
+  }
+  std::lock_guard<xe_mutex> lock(data_lock_);
+  std::vector<std::pair<uint32_t, uint64_t>> sorted(instructions_.begin(),
+                                                    instructions_.end());
+  std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+    return a.second > b.second;
+  });
+  std::fprintf(file, "address,samples\n");
+  for (const auto& it : sorted) {
+    std::fprintf(file, "%08X,%" PRIu64 "\n", it.first, it.second);
+  }
+  std::fclose(file);
+  return true;
+}
+
+}  // namespace cpu
+}  // namespace xe
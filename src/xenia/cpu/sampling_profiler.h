@@ -0,0 +1,110 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_SAMPLING_PROFILER_H_
+#define XENIA_CPU_SAMPLING_PROFILER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "xenia/base/mutex.h"
+#include "xenia/base/threading.h"
+
+namespace xe {
+namespace cpu {
+
+class GuestFunction;
+class Processor;
+
+// Periodically suspends every running guest thread for just long enough to
+// capture its host stack, and maps the generated code on it back to guest
+// functions and instructions through the code cache and the source maps.
+// Unlike instrument_call_times, the generated code is not changed, so timing
+// isn't distorted, and the overhead only depends on the sampling interval.
+//
+// The samples are aggregated per guest function, basic block and instruction,
+// and written (replacing the previous files) periodically and on shutdown:
+//   <path>.collapsed - guest call stacks in the collapsed format used by
+//                      flamegraph.pl, speedscope and others.
+//   <path>_functions.csv, <path>_blocks.csv, <path>_instructions.csv.
+class SamplingProfiler {
+ public:
+  explicit SamplingProfiler(Processor* processor);
+  ~SamplingProfiler();
+
+  // Starts sampling according to the guest_sampling_profiler cvar.
+  // Returns nullptr if the profiler is disabled or if stacks can't be walked
+  // on this platform.
+  static std::unique_ptr<SamplingProfiler> Create(Processor* processor);
+
+  // Writes everything sampled so far.
+  bool WriteProfile();
+
+  // Stops sampling and writes the final profile.
+  void Shutdown();
+
+  uint64_t sample_count() const { return sample_count_; }
+
+  // Called by the processor after a thread has been unregistered and before
+  // it's destroyed, waits for the sampler to finish sampling it if it is.
+  void OnThreadDestroyed(uint32_t thread_id);
+
+ private:
+  struct FunctionSamples {
+    GuestFunction* function = nullptr;
+    // Samples with the function at the top of the guest stack.
+    uint64_t self = 0;
+    // Samples with the function anywhere on the guest stack.
+    uint64_t total = 0;
+  };
+
+  bool Initialize();
+  void SamplerThread();
+  void SampleThreads();
+  // frame_host_pcs[0] is the innermost frame.
+  void RecordSample(const uint64_t* frame_host_pcs, size_t frame_count);
+
+  bool WriteCollapsedStacks(const std::filesystem::path& path);
+  bool WriteFunctions(const std::filesystem::path& path);
+  bool WriteBlocks(const std::filesystem::path& path);
+  bool WriteInstructions(const std::filesystem::path& path);
+
+  Processor* processor_;
+
+  std::unique_ptr<xe::threading::Event> shutdown_event_;
+  std::unique_ptr<xe::threading::Thread> thread_;
+
+  // Protects the aggregated samples, which are written to by the sampler
+  // thread and read when writing the profile.
+  xe_mutex data_lock_;
+  // By the guest address of the function.
+  std::unordered_map<uint32_t, FunctionSamples> functions_;
+  // By the guest address of the instruction, for the innermost frame.
+  std::unordered_map<uint32_t, uint64_t> instructions_;
+  // Guest function addresses from the outermost to the innermost frame. Zero
+  // at the end denotes the thread being in host code (the kernel, or a
+  // blocking call) called from the guest.
+  std::map<std::vector<uint32_t>, uint64_t> stacks_;
+  std::atomic<uint64_t> sample_count_ = {0};
+
+  // ID of the thread being suspended and walked, which must not be destroyed
+  // until it's done, or 0. Set while holding the global lock after checking
+  // that the thread is still registered.
+  std::atomic<uint32_t> sampling_thread_id_ = {0};
+};
+
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_SAMPLING_PROFILER_H_
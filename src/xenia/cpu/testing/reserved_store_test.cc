@@ -0,0 +1,136 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/testing/util.h"
+
+#include <algorithm>
+#include <thread>
+
+#include "xenia/cpu/thread_state.h"
+
+using namespace xe::cpu::hir;
+using namespace xe::cpu;
+using namespace xe::cpu::testing;
+using xe::cpu::ppc::PPCContext;
+
+namespace {
+
+// Increments the 32-bit value at the guest address in r3, r4 times, with a
+// lwarx/stwcx. loop, counting the failed stwcx. in r5.
+void GenerateIncrementLoop(HIRBuilder& b) {
+  auto loop = b.NewLabel();
+  auto failed = b.NewLabel();
+  b.MarkLabel(loop);
+  auto address = LoadGPR(b, 3);
+  auto value = b.LoadWithReserve(address, INT32_TYPE);
+  auto stored = b.StoreWithReserve(
+      address, b.Add(value, b.LoadConstantInt32(1)), INT32_TYPE);
+  b.BranchFalse(stored, failed);
+  StoreGPR(b, 4, b.Sub(LoadGPR(b, 4), b.LoadConstantInt64(1)));
+  b.BranchTrue(b.CompareNE(LoadGPR(b, 4), b.LoadZeroInt64()), loop);
+  b.Return();
+  b.MarkLabel(failed);
+  StoreGPR(b, 5, b.Add(LoadGPR(b, 5), b.LoadConstantInt64(1)));
+  b.Branch(loop);
+}
+
+// Runs the loop on thread_count host threads at once, thread i incrementing
+// the value at counter_addresses[i % counter_addresses.size()].
+// Returns the total number of failed stwcx.
+uint64_t RunIncrementLoops(TestFunction& test, uint32_t thread_count,
+                           uint32_t iteration_count,
+                           const std::vector<uint32_t>& counter_addresses) {
+  uint64_t failed_count = 0;
+  for (auto& processor : test.processors) {
+    auto fn = processor->ResolveFunction(0x80000000);
+    REQUIRE(fn);
+    std::vector<std::unique_ptr<ThreadState>> thread_states;
+    for (uint32_t i = 0; i < thread_count; ++i) {
+      thread_states.push_back(
+          std::make_unique<ThreadState>(processor.get(), 0x100 + i));
+      auto ctx = thread_states.back()->context();
+      ctx->lr = 0xBCBCBCBC;
+      ctx->r[3] = counter_addresses[i % counter_addresses.size()];
+      ctx->r[4] = iteration_count;
+      ctx->r[5] = 0;
+    }
+    std::vector<std::thread> threads;
+    for (uint32_t i = 0; i < thread_count; ++i) {
+      ThreadState* thread_state = thread_states[i].get();
+      threads.emplace_back([fn, thread_state]() {
+        fn->Call(thread_state, uint32_t(thread_state->context()->lr));
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    for (auto& thread_state : thread_states) {
+      REQUIRE(thread_state->context()->r[4] == 0);
+      failed_count += thread_state->context()->r[5];
+    }
+  }
+  return failed_count;
+}
+
+uint32_t GetThreadCount() {
+  return std::clamp(std::thread::hardware_concurrency(), 4u, 16u);
+}
+
+}  // namespace
+
+TEST_CASE("RESERVED_STORE_SHARED_COUNTER", "[instr][reserve]") {
+  TestFunction test(GenerateIncrementLoop);
+  uint32_t counter_address = test.memory->SystemHeapAlloc(4);
+  auto counter = test.memory->TranslateVirtual<uint32_t*>(counter_address);
+  *counter = 0;
+
+  uint32_t thread_count = GetThreadCount();
+  constexpr uint32_t kIterationCount = 100000;
+  RunIncrementLoops(test, thread_count, kIterationCount, {counter_address});
+  // No increment may be lost, no matter how often stwcx. had to be retried.
+  REQUIRE(*counter ==
+          uint32_t(test.processors.size()) * thread_count * kIterationCount);
+}
+
+TEST_CASE("RESERVED_STORE_DISTINCT_CACHE_LINES", "[instr][reserve]") {
+  TestFunction test(GenerateIncrementLoop);
+  uint32_t thread_count = GetThreadCount();
+  // Every counter in its own 128 byte cache line, all within the same 64 KB.
+  uint32_t base_address =
+      test.memory->SystemHeapAlloc(thread_count * 128, 65536);
+  std::vector<uint32_t> counter_addresses;
+  for (uint32_t i = 0; i < thread_count; ++i) {
+    counter_addresses.push_back(base_address + i * 128);
+    *test.memory->TranslateVirtual<uint32_t*>(counter_addresses.back()) = 0;
+  }
+
+  constexpr uint32_t kIterationCount = 100000;
+  uint64_t failed_count = RunIncrementLoops(test, thread_count,
+                                            kIterationCount, counter_addresses);
+  for (uint32_t counter_address : counter_addresses) {
+    REQUIRE(*test.memory->TranslateVirtual<uint32_t*>(counter_address) ==
+            uint32_t(test.processors.size()) * kIterationCount);
+  }
+#if XE_ARCH_AMD64
+  // Unless the counters share a reservation table entry, reservations on
+  // other cache lines must never make a stwcx. fail.
+  bool entries_distinct = true;
+  for (uint32_t i = 0; i < thread_count; ++i) {
+    for (uint32_t j = 0; j < i; ++j) {
+      entries_distinct &=
+          backend::x64::X64Backend::GetReserveEntryIndex(
+              counter_addresses[i]) !=
+          backend::x64::X64Backend::GetReserveEntryIndex(counter_addresses[j]);
+    }
+  }
+  if (entries_distinct) {
+    REQUIRE(failed_count == 0);
+  }
+#endif  // XE_ARCH_AMD64
+}
@@ -10,15 +10,21 @@
 #include "xenia/cpu/xex_module.h"
 
 #include <algorithm>
+#include <atomic>
+#include <thread>
 
 #include "third_party/fmt/include/fmt/format.h"
 
+#include "xenia/base/aes_cbc.h"
 #include "xenia/base/byte_order.h"
 #include "xenia/base/cvar.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
 
+#include "xenia/cpu/backend/backend.h"
+#include "xenia/cpu/background_compiler.h"
 #include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/export_resolver.h"
 #include "xenia/cpu/lzx.h"
@@ -28,8 +34,6 @@
 #include "xenia/kernel/xmodule.h"
 
 #include "third_party/crypto/TinySHA1.hpp"
-#include "third_party/crypto/rijndael-alg-fst.c"
-#include "third_party/crypto/rijndael-alg-fst.h"
 #include "third_party/pe/pe_image.h"
 #include "xenia/cpu/ppc/ppc_decode_data.h"
 #include "xenia/cpu/ppc/ppc_instr.h"
@@ -48,6 +52,22 @@ DEFINE_bool(
     "finding/stress testing with the JIT",
     "CPU");
 
+DEFINE_bool(
+    persistent_code_cache, false,
+    "Save the code generated for the executable to the cache directory on "
+    "exit, and reuse it on subsequent runs of the same executable instead of "
+    "recompiling it. Discarded automatically when the emulator build, the "
+    "host CPU or code generation settings change.",
+    "CPU");
+
+DEFINE_bool(
+    aot_function_manifest, false,
+    "Compile the functions listed in the manifest written by aot_compile for "
+    "the executable when it's loaded, instead of when they're first called. "
+    "Without background compiler threads, this delays the boot until all of "
+    "them are compiled.",
+    "CPU");
+
 DECLARE_bool(allow_plugins);
 
 static const uint8_t xe_xex2_retail_key[16] = {
@@ -60,21 +80,11 @@ static const uint8_t xe_xex2_devkit_key[16] = {
 void aes_decrypt_buffer(const uint8_t* session_key, const uint8_t* input_buffer,
                         const size_t input_size, uint8_t* output_buffer,
                         const size_t output_size) {
-  uint32_t rk[4 * (MAXNR + 1)];
-  uint8_t ivec[16] = {0};
-  int32_t Nr = rijndaelKeySetupDec(rk, session_key, 128);
-  const uint8_t* ct = input_buffer;
-  uint8_t* pt = output_buffer;
-  for (size_t n = 0; n < input_size; n += 16, ct += 16, pt += 16) {
-    // Decrypt 16 uint8_ts from input -> output.
-    rijndaelDecrypt(rk, Nr, ct, pt);
-    for (size_t i = 0; i < 16; i++) {
-      // XOR with previous.
-      pt[i] ^= ivec[i];
-      // Set previous.
-      ivec[i] = ct[i];
-    }
-  }
+  // A trailing partial block can't be decrypted, leave it out.
+  xe::AesCbcDecryptor(session_key)
+      .Decrypt(input_buffer, output_buffer,
+               std::min(input_size, output_size) &
+                   ~(xe::AesCbcDecryptor::kBlockSize - 1));
 }
 
 namespace xe {
@@ -630,9 +640,8 @@ int XexModule::ReadImageBasicCompressed(const void* xex_addr,
   std::memset(buffer, 0, total_size);  // Quickly zero the contents.
   uint8_t* d = buffer;
 
-  uint32_t rk[4 * (MAXNR + 1)];
-  uint8_t ivec[16] = {0};
-  int32_t Nr = rijndaelKeySetupDec(rk, session_key_, 128);
+  // The chain continues across the blocks.
+  xe::AesCbcDecryptor decryptor(session_key_);
 
   for (size_t n = 0; n < block_count; n++) {
     const uint32_t data_size = comp_info.blocks[n].data_size;
@@ -646,20 +655,11 @@ int XexModule::ReadImageBasicCompressed(const void* xex_addr,
         }
         memcpy(d, p, data_size);
         break;
-      case XEX_ENCRYPTION_NORMAL: {
-        const uint8_t* ct = p;
-        uint8_t* pt = d;
-        for (size_t m = 0; m < data_size; m += 16, ct += 16, pt += 16) {
-          // Decrypt 16 uint8_ts from input -> output.
-          rijndaelDecrypt(rk, Nr, ct, pt);
-          for (size_t i = 0; i < 16; i++) {
-            // XOR with previous.
-            pt[i] ^= ivec[i];
-            // Set previous.
-            ivec[i] = ct[i];
-          }
-        }
-      } break;
+      case XEX_ENCRYPTION_NORMAL:
+        assert_zero(data_size % xe::AesCbcDecryptor::kBlockSize);
+        decryptor.Decrypt(
+            p, d, data_size & ~(xe::AesCbcDecryptor::kBlockSize - 1));
+        break;
       default:
         assert_always();
         return 1;
@@ -689,7 +689,6 @@ int XexModule::ReadImageCompressed(const void* xex_addr, size_t xex_length) {
   uint8_t* compress_buffer = NULL;
   const uint8_t* p = NULL;
   uint8_t* d = NULL;
-  sha1::SHA1 s;
 
   // Decrypt (if needed).
   bool free_input = false;
@@ -721,26 +720,69 @@ int XexModule::ReadImageCompressed(const void* xex_addr, size_t xex_length) {
   p = input_buffer;
   d = compress_buffer;
 
-  // De-block.
   int result_code = 0;
 
-  uint8_t block_calced_digest[0x14];
+  // Locate the blocks first, so their hashes can be checked in parallel. The
+  // hash and the size of each block are in the info of the previous block, at
+  // its beginning, or in the header for the first one.
+  struct CompressedBlock {
+    const uint8_t* data;
+    uint32_t size;
+    const uint8_t* hash;
+  };
+  std::vector<CompressedBlock> blocks;
+  const uint8_t* input_end = input_buffer + input_size;
   while (cur_block->block_size) {
-    const uint8_t* pnext = p + cur_block->block_size;
-    const auto* next_block = (const xex2_compressed_block_info*)p;
-
-    // Compare block hash, if no match we probably used wrong decrypt key
-    s.reset();
-    s.processBytes(p, cur_block->block_size);
-    s.finalize(block_calced_digest);
-    if (memcmp(block_calced_digest, cur_block->block_hash, 0x14) != 0) {
+    uint32_t block_size = cur_block->block_size;
+    if (block_size < sizeof(xex2_compressed_block_info) ||
+        block_size > size_t(input_end - p)) {
+      // Likely garbage from the wrong decryption key.
       result_code = 2;
       break;
     }
+    blocks.push_back({p, block_size, cur_block->block_hash});
+    cur_block = reinterpret_cast<const xex2_compressed_block_info*>(p);
+    p += block_size;
+  }
+
+  // Compare block hashes, if no match we probably used wrong decrypt key.
+  std::atomic<bool> hashes_match{true};
+  auto check_block_hashes = [&](size_t first_block, size_t end_block) {
+    sha1::SHA1 s;
+    uint8_t block_calced_digest[0x14];
+    for (size_t i = first_block; i < end_block && hashes_match; ++i) {
+      s.reset();
+      s.processBytes(blocks[i].data, blocks[i].size);
+      s.finalize(block_calced_digest);
+      if (memcmp(block_calced_digest, blocks[i].hash, 0x14) != 0) {
+        hashes_match = false;
+      }
+    }
+  };
+  // Threads only for big images, blocks are usually 32 KB.
+  size_t hash_thread_count =
+      std::min({size_t(std::max(std::thread::hardware_concurrency(), 1u)),
+                size_t(8), blocks.size() / 64 + 1});
+  size_t blocks_per_thread =
+      (blocks.size() + hash_thread_count - 1) / hash_thread_count;
+  std::vector<std::thread> hash_threads;
+  for (size_t i = 1; i < hash_thread_count; ++i) {
+    hash_threads.emplace_back(
+        check_block_hashes, std::min(blocks.size(), i * blocks_per_thread),
+        std::min(blocks.size(), (i + 1) * blocks_per_thread));
+  }
+  check_block_hashes(0, std::min(blocks.size(), blocks_per_thread));
+  for (std::thread& hash_thread : hash_threads) {
+    hash_thread.join();
+  }
+  if (!result_code && !hashes_match) {
+    result_code = 2;
+  }
 
+  // De-block.
+  for (size_t i = 0; i < blocks.size() && !result_code; ++i) {
     // skip block info
-    p += 4;
-    p += 20;
+    p = blocks[i].data + sizeof(xex2_compressed_block_info);
 
     while (true) {
       const size_t chunk_size = (p[0] << 8) | p[1];
@@ -753,9 +795,6 @@ int XexModule::ReadImageCompressed(const void* xex_addr, size_t xex_length) {
       p += chunk_size;
       d += chunk_size;
     }
-
-    p = pnext;
-    cur_block = next_block;
   }
 
   if (!result_code) {
@@ -1132,7 +1171,27 @@ void XexModule::Precompile() {
   }
 
   info_cache_.Init(this);
-  PrecompileDiscoveredFunctions();
+
+  // Must happen before any code is generated for the module, including by the
+  // background compiler.
+  if (cvars::persistent_code_cache && is_executable()) {
+    std::filesystem::path code_cache_path =
+        kernel_state_->emulator()->cache_root() / "modules" / image_sha_str_ /
+        "code_cache.bin";
+    processor_->backend()->LoadPersistentCode(code_cache_path);
+  }
+
+  std::vector<uint32_t> aot_functions;
+  if (cvars::aot_function_manifest && is_executable()) {
+    aot_functions = LoadAotManifest();
+  }
+
+  if (processor_->background_compiler()) {
+    QueueBackgroundCompilation(aot_functions);
+  } else {
+    PrecompileAotFunctions(aot_functions);
+    PrecompileDiscoveredFunctions();
+  }
 }
 bool XexModule::Unload() {
   if (!loaded_) {
@@ -1399,6 +1458,158 @@ InfoCacheFlags* XexModule::GetInstructionAddressFlags(uint32_t guest_addr) {
 
   return info_cache_.LookupFlags(guest_addr);
 }
+void XexModule::QueueBackgroundCompilation(
+    const std::vector<uint32_t>& aot_functions) {
+  BackgroundCompiler* background_compiler = processor_->background_compiler();
+  if (!background_compiler) {
+    return;
+  }
+
+  // Functions that were compiled ahead of time or called in previous runs are
+  // the most likely to be needed soon, so they go first. The ahead-of-time
+  // ones are controlled by aot_function_manifest, as when they're compiled
+  // without the background compiler.
+  background_compiler->Enqueue(
+      aot_functions, BackgroundCompiler::Priority::kPreviouslyResolved);
+  std::vector<uint32_t> known_functions;
+  std::vector<uint32_t> discovered_functions;
+  if (cvars::enable_early_precompilation) {
+    if (auto flags = info_cache_.LookupFlags(0)) {
+      uint32_t end = (high_address_ - low_address_) / 4;
+      for (uint32_t i = 0; i < end; i++) {
+        if (flags[i].was_resolved) {
+          known_functions.push_back(low_address_ + (i * 4));
+        }
+      }
+    }
+    background_compiler->Enqueue(
+        known_functions, BackgroundCompiler::Priority::kPreviouslyResolved);
+
+    discovered_functions = DiscoverFunctions();
+    background_compiler->Enqueue(discovered_functions,
+                                 BackgroundCompiler::Priority::kDiscovered);
+  }
+
+  XELOGI("Queued {} ahead-of-time, {} known and {} discovered functions for "
+         "background compilation",
+         aot_functions.size(), known_functions.size(),
+         discovered_functions.size());
+}
+void XexModule::PrecompileAotFunctions(
+    const std::vector<uint32_t>& aot_functions) {
+  for (uint32_t address : aot_functions) {
+    auto sym = processor_->LookupFunction(address);
+    if (!sym || sym->status() != Symbol::Status::kDefined) {
+      processor_->ResolveFunction(address);
+    }
+  }
+}
+std::vector<uint32_t> XexModule::DiscoverFunctions() {
+  std::vector<uint32_t> functions;
+  for (uint32_t address : PreanalyzeCode()) {
+    if (address >= low_address_ && address < high_address_) {
+      functions.push_back(address);
+    }
+  }
+  return functions;
+}
+
+namespace {
+
+struct AotManifestHeader {
+  static constexpr fourcc_t kMagic = make_fourcc("XAOT");
+  static constexpr uint32_t kVersion = 1;
+
+  fourcc_t magic;
+  uint32_t version;
+  // Code range of the image the manifest was written for.
+  uint32_t low_address;
+  uint32_t high_address;
+  uint32_t function_count;
+  uint32_t reserved;
+};
+
+}  // namespace
+
+std::filesystem::path XexModule::GetAotManifestPath() const {
+  return kernel_state_->emulator()->cache_root() / "modules" /
+         image_sha_str_ / "aot_functions.bin";
+}
+bool XexModule::SaveAotManifest(const std::vector<uint32_t>& addresses) const {
+  std::filesystem::path path = GetAotManifestPath();
+  std::filesystem::create_directories(path.parent_path());
+  FILE* file = xe::filesystem::OpenFile(path, "wb");
+  if (!file) {
+    XELOGE("Failed to open function manifest {} for writing",
+           xe::path_to_utf8(path));
+    return false;
+  }
+  AotManifestHeader header = {};
+  header.magic = AotManifestHeader::kMagic;
+  header.version = AotManifestHeader::kVersion;
+  header.low_address = low_address_;
+  header.high_address = high_address_;
+  header.function_count = uint32_t(addresses.size());
+  bool write_ok =
+      fwrite(&header, sizeof(header), 1, file) == 1 &&
+      (addresses.empty() || fwrite(addresses.data(), sizeof(uint32_t),
+                                   addresses.size(),
+                                   file) == addresses.size());
+  fclose(file);
+  if (!write_ok) {
+    XELOGE("Failed to write function manifest {}", xe::path_to_utf8(path));
+    std::filesystem::remove(path);
+    return false;
+  }
+  return true;
+}
+std::vector<uint32_t> XexModule::LoadAotManifest() const {
+  std::vector<uint32_t> addresses;
+  std::filesystem::path path = GetAotManifestPath();
+  FILE* file = xe::filesystem::OpenFile(path, "rb");
+  if (!file) {
+    return addresses;
+  }
+  AotManifestHeader header;
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      header.magic != AotManifestHeader::kMagic ||
+      header.version != AotManifestHeader::kVersion ||
+      header.low_address != low_address_ ||
+      header.high_address != high_address_) {
+    XELOGW("Ignoring incompatible function manifest {}",
+           xe::path_to_utf8(path));
+    fclose(file);
+    return addresses;
+  }
+  // Don't trust the count to allocate more than the file can contain.
+  std::error_code file_size_error;
+  uint64_t file_size = std::filesystem::file_size(path, file_size_error);
+  if (file_size_error || file_size < sizeof(header) ||
+      header.function_count >
+          (file_size - sizeof(header)) / sizeof(uint32_t)) {
+    XELOGW("Function manifest {} is truncated", xe::path_to_utf8(path));
+    fclose(file);
+    return addresses;
+  }
+  addresses.resize(header.function_count);
+  if (header.function_count &&
+      fread(addresses.data(), sizeof(uint32_t), addresses.size(), file) !=
+          addresses.size()) {
+    XELOGW("Function manifest {} is truncated", xe::path_to_utf8(path));
+    addresses.clear();
+  }
+  fclose(file);
+  addresses.erase(std::remove_if(addresses.begin(), addresses.end(),
+                                 [this](uint32_t address) {
+                                   return address < low_address_ ||
+                                          address >= high_address_ ||
+                                          (address & 3);
+                                 }),
+                  addresses.end());
+  XELOGI("Loaded {} functions from the ahead-of-time manifest",
+         addresses.size());
+  return addresses;
+}
 void XexModule::PrecompileDiscoveredFunctions() {
   if (!cvars::enable_early_precompilation) {
     return;
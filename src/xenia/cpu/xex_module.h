@@ -10,6 +10,7 @@
 #ifndef XENIA_CPU_XEX_MODULE_H_
 #define XENIA_CPU_XEX_MODULE_H_
 
+#include <filesystem>
 #include <string>
 #include <vector>
 #include "xenia/base/mapped_memory.h"
@@ -234,12 +235,27 @@ class XexModule : public xe::cpu::Module {
 
   virtual void Precompile() override;
 
+  // Functions found by static analysis of the code sections. Only meaningful
+  // once the module has been precompiled, as that locates the save/restore
+  // helpers.
+  std::vector<uint32_t> DiscoverFunctions();
+  // Manifest of functions that compiled successfully ahead of time, written
+  // by Emulator::CompileXexAheadOfTime and compiled by Precompile when the
+  // module is loaded.
+  std::filesystem::path GetAotManifestPath() const;
+  bool SaveAotManifest(const std::vector<uint32_t>& addresses) const;
+
  protected:
   std::unique_ptr<Function> CreateFunction(uint32_t address) override;
 
  private:
   void PrecompileKnownFunctions();
   void PrecompileDiscoveredFunctions();
+  void PrecompileAotFunctions(const std::vector<uint32_t>& aot_functions);
+  // Hands the ahead-of-time, known and discovered functions to the background
+  // compiler instead of compiling them on the calling thread.
+  void QueueBackgroundCompilation(const std::vector<uint32_t>& aot_functions);
+  std::vector<uint32_t> LoadAotManifest() const;
   std::vector<uint32_t> PreanalyzeCode();
   friend struct XexInfoCache;
   void ReadSecurityInfo();
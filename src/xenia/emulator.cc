@@ -11,6 +11,7 @@
 
 #include <algorithm>
 #include <cinttypes>
+#include <cstring>
 
 #include "config.h"
 #include "third_party/fmt/include/fmt/format.h"
@@ -33,8 +34,10 @@
 #include "xenia/base/system.h"
 #include "xenia/cpu/backend/code_cache.h"
 #include "xenia/cpu/backend/null_backend.h"
+#include "xenia/cpu/background_compiler.h"
 #include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/thread_state.h"
+#include "xenia/cpu/xex_module.h"
 #include "xenia/gpu/command_processor.h"
 #include "xenia/gpu/graphics_system.h"
 #include "xenia/hid/input_driver.h"
@@ -86,6 +89,10 @@ DECLARE_int32(user_language);
 
 DECLARE_bool(allow_plugins);
 
+DECLARE_bool(aot_function_manifest);
+DECLARE_bool(enable_early_precompilation);
+DECLARE_bool(persistent_code_cache);
+
 namespace xe {
 using namespace xe::literals;
 
@@ -547,6 +554,68 @@ X_STATUS Emulator::LaunchXexFile(const std::filesystem::path& path) {
   return result;
 }
 
+X_STATUS Emulator::CompileXexAheadOfTime(const std::filesystem::path& path) {
+  // The code cache is opened when the module is loaded, and every discovered
+  // function is compiled then, rather than when it's called. Whatever
+  // manifest exists already is replaced rather than merged.
+  cvars::persistent_code_cache = true;
+  cvars::enable_early_precompilation = true;
+  cvars::aot_function_manifest = false;
+
+  X_STATUS result = MountPath(path, "\\Device\\Harddisk0\\Partition1");
+  if (XFAILED(result)) {
+    return result;
+  }
+  auto module = kernel_state_->LoadUserModule(
+      "game:\\" + xe::path_to_utf8(path.filename()), false);
+  if (!module || !module->xex_module()) {
+    XELOGE("Failed to load {}", xe::path_to_utf8(path));
+    return X_STATUS_NOT_FOUND;
+  }
+  // Runs FindSaveRest and PreanalyzeCode, and queues every function found for
+  // background compilation, or compiles them if there's no background
+  // compiler.
+  result = kernel_state_->FinishLoadingUserModule(module, false);
+  if (XFAILED(result)) {
+    XELOGE("Failed to finish loading {}: {:08X}", xe::path_to_utf8(path),
+           result);
+    return result;
+  }
+  cpu::BackgroundCompiler* background_compiler =
+      processor_->background_compiler();
+  if (background_compiler) {
+    background_compiler->WaitForIdle();
+  }
+
+  // Anything the background compiler didn't get to is compiled here.
+  cpu::XexModule* xex_module = module->xex_module();
+  std::vector<uint32_t> discovered_functions = xex_module->DiscoverFunctions();
+  std::vector<uint32_t> compiled_functions;
+  compiled_functions.reserve(discovered_functions.size());
+  for (uint32_t address : discovered_functions) {
+    cpu::Function* function = processor_->QueryFunction(address);
+    if (!function) {
+      function = processor_->ResolveFunction(address);
+    }
+    if (function && function->status() == cpu::Symbol::Status::kDefined) {
+      compiled_functions.push_back(address);
+    } else {
+      XELOGW("Failed to compile {:08X}", address);
+    }
+  }
+
+  // The code is generated by this executable, so its host addresses and the
+  // cache key match those of the runs that will load it.
+  processor_->backend()->SavePersistentCode();
+  if (!xex_module->SaveAotManifest(compiled_functions)) {
+    return X_STATUS_UNSUCCESSFUL;
+  }
+  XELOGI("Compiled {} of {} discovered functions, manifest written to {}",
+         compiled_functions.size(), discovered_functions.size(),
+         xe::path_to_utf8(xex_module->GetAotManifestPath()));
+  return X_STATUS_SUCCESS;
+}
+
 X_STATUS Emulator::LaunchDiscImage(const std::filesystem::path& path) {
   std::string module_path = FindLaunchModule();
   X_STATUS result = CompleteLaunch(path, module_path);
@@ -830,18 +899,76 @@ void Emulator::Resume() {
   }
 }
 
-bool Emulator::SaveToFile(const std::filesystem::path& path) {
+namespace {
+
+// Opens a full snapshot to be the base of an incremental one.
+std::unique_ptr<MappedMemory> OpenSnapshotBase(
+    const std::filesystem::path& path,
+    std::unique_ptr<MemorySnapshotBase>& out_memory_base) {
+  auto map = MappedMemory::Open(path, MappedMemory::Mode::kRead);
+  if (!map) {
+    XELOGE("Could not open base snapshot {}", xe::path_to_utf8(path));
+    return nullptr;
+  }
+  ByteStream stream(map->data(), map->size());
+  if (map->size() < sizeof(uint32_t) * 2 + sizeof(bool) + sizeof(uint64_t) ||
+      stream.Read<uint32_t>() != kEmulatorSaveSignature ||
+      stream.Read<uint32_t>() != kEmulatorSaveVersion) {
+    XELOGE("{} is not a snapshot of this version", xe::path_to_utf8(path));
+    return nullptr;
+  }
+  if (stream.Read<bool>()) {
+    XELOGE("Base snapshot {} must not be incremental itself",
+           xe::path_to_utf8(path));
+    return nullptr;
+  }
+  uint64_t memory_offset = stream.Read<uint64_t>();
+  if (memory_offset >= map->size()) {
+    return nullptr;
+  }
+  out_memory_base = MemorySnapshotBase::Parse(
+      map->data() + memory_offset, map->size() - size_t(memory_offset));
+  if (!out_memory_base) {
+    XELOGE("Base snapshot {} is corrupted", xe::path_to_utf8(path));
+    return nullptr;
+  }
+  return map;
+}
+
+}  // namespace
+
+bool Emulator::SaveToFile(const std::filesystem::path& path,
+                          const std::filesystem::path& base_path) {
+  std::unique_ptr<MappedMemory> base_map;
+  std::unique_ptr<MemorySnapshotBase> memory_base;
+  if (!base_path.empty()) {
+    base_map = OpenSnapshotBase(base_path, memory_base);
+    if (!base_map) {
+      return false;
+    }
+  }
+
   Pause();
 
   filesystem::CreateEmptyFile(path);
   auto map = MappedMemory::Open(path, MappedMemory::Mode::kReadWrite, 0, 2_GiB);
   if (!map) {
+    Resume();
     return false;
   }
 
   // Save the emulator state to a file
   ByteStream stream(map->data(), map->size());
   stream.Write(kEmulatorSaveSignature);
+  stream.Write(kEmulatorSaveVersion);
+  stream.Write(base_map != nullptr);
+  // Offset of the memory section, so the snapshot can be used as a base
+  // without restoring everything before it. Filled in below.
+  size_t memory_offset_position = stream.offset();
+  stream.Write(uint64_t(0));
+  if (base_map) {
+    stream.Write(xe::path_to_utf8(std::filesystem::absolute(base_path)));
+  }
   stream.Write(title_id_.has_value());
   if (title_id_.has_value()) {
     stream.Write(title_id_.value());
@@ -853,7 +980,10 @@ bool Emulator::SaveToFile(const std::filesystem::path& path) {
   graphics_system_->Save(&stream);
   audio_system_->Save(&stream);
   kernel_state_->Save(&stream);
-  memory_->Save(&stream);
+  uint64_t memory_offset = stream.offset();
+  std::memcpy(map->data() + memory_offset_position, &memory_offset,
+              sizeof(memory_offset));
+  memory_->Save(&stream, memory_base.get());
   map->Close(stream.offset());
 
   Resume();
@@ -867,6 +997,25 @@ bool Emulator::RestoreFromFile(const std::filesystem::path& path) {
     return false;
   }
 
+  ByteStream stream(map->data(), map->size());
+  if (stream.Read<uint32_t>() != kEmulatorSaveSignature ||
+      stream.Read<uint32_t>() != kEmulatorSaveVersion) {
+    XELOGE("{} is not a snapshot of this version", xe::path_to_utf8(path));
+    return false;
+  }
+  bool is_incremental = stream.Read<bool>();
+  // Offset of the memory section, only needed for bases.
+  stream.Read<uint64_t>();
+  std::unique_ptr<MappedMemory> base_map;
+  std::unique_ptr<MemorySnapshotBase> memory_base;
+  if (is_incremental) {
+    base_map = OpenSnapshotBase(xe::to_path(stream.Read<std::string>()),
+                                memory_base);
+    if (!base_map) {
+      return false;
+    }
+  }
+
   restoring_ = true;
 
   // Terminate any loaded titles.
@@ -874,10 +1023,6 @@ bool Emulator::RestoreFromFile(const std::filesystem::path& path) {
   kernel_state_->TerminateTitle();
 
   auto lock = global_critical_region::AcquireDirect();
-  ByteStream stream(map->data(), map->size());
-  if (stream.Read<uint32_t>() != kEmulatorSaveSignature) {
-    return false;
-  }
 
   auto has_title_id = stream.Read<bool>();
   std::optional<uint32_t> title_id;
@@ -909,7 +1054,7 @@ bool Emulator::RestoreFromFile(const std::filesystem::path& path) {
     XELOGE("Could not restore kernel state!");
     return false;
   }
-  if (!memory_->Restore(&stream)) {
+  if (!memory_->Restore(&stream, memory_base.get())) {
     XELOGE("Could not restore memory!");
     return false;
   }
@@ -53,6 +53,7 @@ class Window;
 namespace xe {
 
 constexpr fourcc_t kEmulatorSaveSignature = make_fourcc("XSAV");
+constexpr uint32_t kEmulatorSaveVersion = 1;
 static const std::string kDefaultGameSymbolicLink = "GAME:";
 static const std::string kDefaultPartitionSymbolicLink = "D:";
 
@@ -224,6 +225,11 @@ class Emulator {
 
   X_STATUS LaunchDefaultModule(const std::filesystem::path& path);
 
+  // Loads a .xex without running it and compiles every function that can be
+  // found in it, writing the persistent code cache and the function manifest
+  // that later runs of the same executable load.
+  X_STATUS CompileXexAheadOfTime(const std::filesystem::path& path);
+
   struct ContentInstallationInfo {
     XContentType content_type;
     std::string installation_path;
@@ -254,7 +260,11 @@ class Emulator {
   void Pause();
   void Resume();
   bool is_paused() const { return paused_; }
-  bool SaveToFile(const std::filesystem::path& path);
+  // Saves the state of the emulator. If base_path is a full snapshot saved
+  // earlier, only the memory changed since it is written, and base_path is
+  // needed to restore the snapshot.
+  bool SaveToFile(const std::filesystem::path& path,
+                  const std::filesystem::path& base_path = {});
   bool RestoreFromFile(const std::filesystem::path& path);
 
   // The game can request another title to be loaded.
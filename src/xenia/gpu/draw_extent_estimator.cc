@@ -168,7 +168,35 @@ uint32_t DrawExtentEstimator::EstimateVertexMaxY(const Shader& vertex_shader) {
 
   float max_y = -FLT_MAX;
 
+  // The vertex shader is still interpreted for every vertex, only skipping the
+  // instructions not affecting the position. Compiling the position path to
+  // x64 code processing multiple vertices at once is not implemented.
   shader_interpreter_.SetShader(vertex_shader);
+  auto position_skipped_instructions_it =
+      position_skipped_instructions_.find(vertex_shader.ucode_data_hash());
+  if (position_skipped_instructions_it ==
+      position_skipped_instructions_.end()) {
+    std::vector<uint64_t> skipped_instructions;
+    ShaderInterpreter::GetInstructionsNotAffectingPosition(
+        vertex_shader, skipped_instructions);
+    position_skipped_instructions_it =
+        position_skipped_instructions_
+            .emplace(vertex_shader.ucode_data_hash(),
+                     std::move(skipped_instructions))
+            .first;
+  }
+  if (!position_skipped_instructions_it->second.empty()) {
+    shader_interpreter_.SetSkippedInstructions(
+        position_skipped_instructions_it->second.data());
+  }
+
+  // The result for a vertex only depends on its index, and taking the maximum
+  // is idempotent, so recently processed indices, which are common in indexed
+  // draws, can be skipped. Indices are 24-bit, so UINT32_MAX is never seen.
+  constexpr uint32_t kRecentVertexIndexCount = 256;
+  uint32_t recent_vertex_indices[kRecentVertexIndexCount];
+  std::fill(std::begin(recent_vertex_indices),
+            std::end(recent_vertex_indices), UINT32_MAX);
 
   PositionYExportSink position_y_export_sink;
   shader_interpreter_.SetExportSink(&position_y_export_sink);
@@ -197,6 +225,12 @@ uint32_t DrawExtentEstimator::EstimateVertexMaxY(const Shader& vertex_shader) {
     vertex_index =
         std::min(max_index,
                  std::max(min_index, (vertex_index + index_offset) & 0xFFFFFF));
+    uint32_t& recent_vertex_index =
+        recent_vertex_indices[vertex_index % kRecentVertexIndexCount];
+    if (recent_vertex_index == vertex_index) {
+      continue;
+    }
+    recent_vertex_index = vertex_index;
 
     position_y_export_sink.Reset();
 
@@ -245,6 +279,7 @@ uint32_t DrawExtentEstimator::EstimateVertexMaxY(const Shader& vertex_shader) {
     max_y = std::max(max_y, vertex_y);
   }
   shader_interpreter_.SetExportSink(nullptr);
+  shader_interpreter_.SetSkippedInstructions(nullptr);
 
   int32_t max_y_24p8 = ui::FloatToD3D11Fixed16p8(max_y);
   // 16p8 range is -32768 to 32767+255/256, but it's stored as uint32_t here,
@@ -12,6 +12,8 @@
 
 #include <cstdint>
 #include <optional>
+#include <unordered_map>
+#include <vector>
 
 #include "xenia/gpu/register_file.h"
 #include "xenia/gpu/shader.h"
@@ -68,6 +70,11 @@ class DrawExtentEstimator {
   TraceWriter* trace_writer_;
 
   ShaderInterpreter shader_interpreter_;
+
+  // Instructions not affecting the position exports, by the ucode hash of the
+  // vertex shader. Empty if all instructions need to be executed.
+  std::unordered_map<uint64_t, std::vector<uint64_t>>
+      position_skipped_instructions_;
 };
 
 }  // namespace gpu
@@ -53,3 +53,6 @@ project("xenia-gpu-shader-compiler")
         "1>scratch/stdout-shader-compiler.txt",
       })
     end
+  filter({})
+
+include("testing")
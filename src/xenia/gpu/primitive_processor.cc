@@ -12,6 +12,7 @@
 #include <algorithm>
 #include <cstring>
 #include <functional>
+#include <memory>
 #include <utility>
 
 #include "xenia/base/assert.h"
@@ -62,16 +63,31 @@ DEFINE_bool(
 DEFINE_int32(
     primitive_processor_cache_min_indices, 4096,
     "Smallest number of guest indices to store in the cache to try reusing "
-    "later in the same frame if processing (such as primitive type conversion "
-    "or reset index replacement) is performed.\n"
+    "later if processing (such as primitive type conversion or reset index "
+    "replacement) is performed.\n"
     "Setting this to a very high value may result in excessive CPU processing, "
     "while a very low value may result in excessive locking and lookups.\n"
     "Negative values disable caching.",
     "GPU");
+DEFINE_int32(
+    primitive_processor_cache_host_memory_mb, 64,
+    "Maximum size, in megabytes, of converted indices that the primitive "
+    "processor cache keeps in host memory to upload again in later frames "
+    "instead of converting them again while the guest indices are not "
+    "modified.\n"
+    "0 limits reuse of converted indices to the frame they were converted in.",
+    "GPU");
 
 namespace xe {
 namespace gpu {
 
+namespace {
+size_t GetCacheHostIndicesMaxSizeBytes() {
+  return size_t(std::max(cvars::primitive_processor_cache_host_memory_mb, 0))
+         << 20;
+}
+}  // namespace
+
 // SIMD processing here assumes that alignment is not required (neither AVX nor
 // Neon requires it) and there's no punishment for using an unaligned access
 // instruction when the data is actually aligned (AVX has separate aligned /
@@ -242,12 +258,17 @@ bool PrimitiveProcessor::InitializeCommon(
 
 void PrimitiveProcessor::ShutdownCommon() {
   if (memory_invalidation_callback_handle_) {
+    XELOGI(
+        "Primitive processor cache: {} hits ({} from previous frames), {} "
+        "misses",
+        cache_hits_, cache_hits_previous_frames_, cache_misses_);
     // Clear the cache if it has ever been used and unregister the invalidation
     // callback.
     {
       auto global_lock = global_critical_region_.Acquire();
       cache_map_.clear();
       cache_bucket_free_first_entry_ = SIZE_MAX;
+      cache_host_indices_size_bytes_ = 0;
       std::memset(cache_buckets_non_empty_l1_, 0,
                   sizeof(cache_buckets_non_empty_l1_));
       std::memset(cache_buckets_non_empty_l2_, 0,
@@ -256,6 +277,8 @@ void PrimitiveProcessor::ShutdownCommon() {
     memory_.UnregisterPhysicalMemoryInvalidationCallback(
         memory_invalidation_callback_handle_);
     memory_invalidation_callback_handle_ = nullptr;
+    shared_memory_.UnregisterGlobalWatch(shared_memory_global_watch_handle_);
+    shared_memory_global_watch_handle_ = nullptr;
     cache_entry_pool_.clear();
   }
 }
@@ -266,16 +289,23 @@ void PrimitiveProcessor::ClearPerFrameCache() {
     return;
   }
   auto global_lock = global_critical_region_.Acquire();
-  for (const std::pair<CacheKey, size_t>& cache_map_entry : cache_map_) {
-    cache_entry_pool_[cache_map_entry.second].free_next =
-        cache_bucket_free_first_entry_;
-    cache_bucket_free_first_entry_ = cache_map_entry.second;
+  for (auto cache_map_it = cache_map_.cbegin();
+       cache_map_it != cache_map_.cend();) {
+    // Removal only invalidates the iterator of the removed entry.
+    size_t entry_index = cache_map_it->second;
+    ++cache_map_it;
+    const CacheEntry& entry = cache_entry_pool_[entry_index];
+    // Host converted index buffers are only valid until the end of the frame,
+    // without a host memory copy of the indices, the entry can't be used
+    // anymore.
+    if ((entry.result.index_buffer_type ==
+             ProcessedIndexBufferType::kHostConverted &&
+         !entry.host_indices) ||
+        cache_frame_ - entry.last_used_frame >= kCacheMaxUnusedFrames) {
+      RemoveCacheEntry(entry_index, global_lock);
+    }
   }
-  cache_map_.clear();
-  std::memset(cache_buckets_non_empty_l1_, 0,
-              sizeof(cache_buckets_non_empty_l1_));
-  std::memset(cache_buckets_non_empty_l2_, 0,
-              sizeof(cache_buckets_non_empty_l2_));
+  ++cache_frame_;
 }
 
 bool PrimitiveProcessor::Process(ProcessingResult& result_out) {
@@ -735,7 +765,7 @@ bool PrimitiveProcessor::Process(ProcessingResult& result_out) {
                 0, guest_draw_vertex_count, cacheable.host_draw_vertex_count);
           }
           auto host_indices = reinterpret_cast<uint16_t*>(
-              RequestHostConvertedIndexBufferForCurrentFrame(
+              cache_transaction.RequestHostConvertedIndexBuffer(
                   xenos::IndexFormat::kInt16, cacheable.host_draw_vertex_count,
                   false, guest_index_base, cacheable.host_index_buffer_handle));
           if (!host_indices) {
@@ -769,7 +799,7 @@ bool PrimitiveProcessor::Process(ProcessingResult& result_out) {
                 0, guest_draw_vertex_count, cacheable.host_draw_vertex_count);
           }
           auto host_indices = reinterpret_cast<uint32_t*>(
-              RequestHostConvertedIndexBufferForCurrentFrame(
+              cache_transaction.RequestHostConvertedIndexBuffer(
                   xenos::IndexFormat::kInt32, cacheable.host_draw_vertex_count,
                   false, guest_index_base, cacheable.host_index_buffer_handle));
           if (!host_indices) {
@@ -868,7 +898,7 @@ bool PrimitiveProcessor::Process(ProcessingResult& result_out) {
                                                   ? xenos::IndexFormat::kInt32
                                                   : xenos::IndexFormat::kInt16;
                 void* host_indices_ptr =
-                    RequestHostConvertedIndexBufferForCurrentFrame(
+                    cache_transaction.RequestHostConvertedIndexBuffer(
                         cacheable.host_index_format, guest_draw_vertex_count,
                         true, guest_index_base,
                         cacheable.host_index_buffer_handle);
@@ -920,7 +950,7 @@ bool PrimitiveProcessor::Process(ProcessingResult& result_out) {
               cacheable.index_buffer_type =
                   ProcessedIndexBufferType::kHostConverted;
               auto host_indices = reinterpret_cast<uint32_t*>(
-                  RequestHostConvertedIndexBufferForCurrentFrame(
+                  cache_transaction.RequestHostConvertedIndexBuffer(
                       xenos::IndexFormat::kInt32, guest_draw_vertex_count, true,
                       guest_index_base, cacheable.host_index_buffer_handle));
               if (!host_indices) {
@@ -1431,14 +1461,51 @@ PrimitiveProcessor::CacheTransaction::CacheTransaction(
     auto global_lock = processor_.global_critical_region_.Acquire();
     auto cache_map_it = processor_.cache_map_.find(key_);
     if (cache_map_it != processor_.cache_map_.end()) {
-      result_ = processor_.cache_entry_pool_[cache_map_it->second].result;
-      result_type_ = ResultType::kExisting;
+      ++processor_.cache_hits_;
+      CacheEntry& entry = processor_.cache_entry_pool_[cache_map_it->second];
+      result_ = entry.result;
+      if (entry.result.index_buffer_type !=
+              ProcessedIndexBufferType::kHostConverted ||
+          entry.result_frame == processor_.cache_frame_) {
+        entry.last_used_frame = processor_.cache_frame_;
+        result_type_ = ResultType::kExisting;
+      } else {
+        // Converted in a previous frame - take the host memory copy to upload
+        // it to a buffer for the current frame outside the lock, and to store
+        // the entry again with the new buffer.
+        ++processor_.cache_hits_previous_frames_;
+        host_indices_ =
+            processor_.RemoveCacheEntry(cache_map_it->second, global_lock);
+        assert_not_null(host_indices_);
+        result_type_ = ResultType::kUploadedAgain;
+      }
     } else {
+      ++processor_.cache_misses_;
+    }
+    if (result_type_ != ResultType::kExisting) {
       // Inhibit writing the new result if the range happens to be modified
       // during the processing outside the lock.
       processor_.cache_currently_processing_base_ = key_.base;
       processor_.cache_currently_processing_size_bytes_ = size_bytes;
+      processor_.cache_currently_processing_invalidated_ = false;
+      keep_host_indices_ = processor_.cache_host_indices_size_bytes_ <
+                           GetCacheHostIndicesMaxSizeBytes();
+    }
+  }
+  if (result_type_ == ResultType::kUploadedAgain) {
+    // The access callback is still enabled for the range since the entry
+    // hasn't been invalidated.
+    void* mapping = processor_.RequestHostConvertedIndexBufferForCurrentFrame(
+        host_indices_->format, host_indices_->count, false, key_.base,
+        result_.host_index_buffer_handle);
+    if (mapping) {
+      std::memcpy(mapping, host_indices_->data.data() + host_indices_->offset,
+                  host_indices_->GetSizeBytes());
+      return;
     }
+    // Try to process the indices as if they weren't in the cache.
+    host_indices_.reset();
+    result_type_ = ResultType::kNewUnset;
   }
   if (result_type_ != ResultType::kExisting) {
     // Enable the invalidation callback before reading the indices.
@@ -1449,12 +1516,60 @@ PrimitiveProcessor::CacheTransaction::CacheTransaction(
       processor_.memory_invalidation_callback_handle_ =
           processor_.memory_.RegisterPhysicalMemoryInvalidationCallback(
               MemoryInvalidationCallbackThunk, &processor_);
+      processor_.shared_memory_global_watch_handle_ =
+          processor_.shared_memory_.RegisterGlobalWatch(
+              SharedMemoryGlobalWatchCallbackThunk, &processor_);
     }
     processor_.memory_.EnablePhysicalMemoryAccessCallbacks(
         key_.base, size_bytes, true, false);
   }
 }
 
+void* PrimitiveProcessor::CacheTransaction::RequestHostConvertedIndexBuffer(
+    xenos::IndexFormat format, uint32_t index_count, bool coalign_for_simd,
+    uint32_t coalignment_original_address, size_t& backend_handle_out) {
+  assert_true(result_type_ == ResultType::kNewUnset);
+  assert_null(host_indices_);
+  // Without keeping the indices, convert directly to the buffer for the
+  // current frame, which may be write-combined, so it's never read back.
+  void* mapping = processor_.RequestHostConvertedIndexBufferForCurrentFrame(
+      format, index_count, coalign_for_simd && !keep_host_indices_,
+      coalignment_original_address, backend_handle_out);
+  if (!mapping || !keep_host_indices_) {
+    return mapping;
+  }
+  host_indices_ = std::make_unique<CachedHostIndices>();
+  host_indices_->format = format;
+  host_indices_->count = index_count;
+  host_indices_->data.resize(
+      host_indices_->GetSizeBytes() +
+      (coalign_for_simd ? XE_GPU_PRIMITIVE_PROCESSOR_SIMD_SIZE : 0));
+  host_indices_->offset =
+      coalign_for_simd
+          ? size_t(GetSimdCoalignmentOffset(host_indices_->data.data(),
+                                            coalignment_original_address))
+          : 0;
+  host_indices_frame_mapping_ = mapping;
+  return host_indices_->data.data() + host_indices_->offset;
+}
+
+void PrimitiveProcessor::CacheTransaction::SetNewResult(
+    const CachedResult& new_result) {
+  // Replacement of an existing entry is not allowed.
+  assert_true(result_type_ == ResultType::kNewUnset ||
+              result_type_ == ResultType::kNewSet);
+  if (host_indices_frame_mapping_) {
+    assert_true(new_result.index_buffer_type ==
+                ProcessedIndexBufferType::kHostConverted);
+    std::memcpy(host_indices_frame_mapping_,
+                host_indices_->data.data() + host_indices_->offset,
+                host_indices_->GetSizeBytes());
+    host_indices_frame_mapping_ = nullptr;
+  }
+  result_ = new_result;
+  result_type_ = ResultType::kNewSet;
+}
+
 PrimitiveProcessor::CacheTransaction::~CacheTransaction() {
   if (!key_.count || result_type_ == ResultType::kExisting) {
     return;
@@ -1462,10 +1577,14 @@ PrimitiveProcessor::CacheTransaction::~CacheTransaction() {
 
   auto global_lock = processor_.global_critical_region_.Acquire();
 
+  bool invalidated = processor_.cache_currently_processing_invalidated_;
   processor_.cache_currently_processing_base_ = 0;
   processor_.cache_currently_processing_size_bytes_ = 0;
+  processor_.cache_currently_processing_invalidated_ = false;
 
-  if (result_type_ == ResultType::kNewSet) {
+  if ((result_type_ == ResultType::kNewSet ||
+       result_type_ == ResultType::kUploadedAgain) &&
+      !invalidated) {
     size_t new_entry_index;
     if (processor_.cache_bucket_free_first_entry_ != SIZE_MAX) {
       new_entry_index = processor_.cache_bucket_free_first_entry_;
@@ -1511,11 +1630,74 @@ PrimitiveProcessor::CacheTransaction::~CacheTransaction() {
 
     new_entry.key = key_;
     new_entry.result = result_;
+    new_entry.result_frame = processor_.cache_frame_;
+    new_entry.last_used_frame = processor_.cache_frame_;
+    if (host_indices_ &&
+        result_.index_buffer_type == ProcessedIndexBufferType::kHostConverted &&
+        processor_.cache_host_indices_size_bytes_ +
+                host_indices_->data.size() <=
+            GetCacheHostIndicesMaxSizeBytes()) {
+      processor_.cache_host_indices_size_bytes_ += host_indices_->data.size();
+      new_entry.host_indices = std::move(host_indices_);
+    }
 
     processor_.cache_map_.emplace(key_, new_entry_index);
   }
 }
 
+std::unique_ptr<PrimitiveProcessor::CachedHostIndices>
+PrimitiveProcessor::RemoveCacheEntry(
+    size_t entry_index, const global_unique_lock_type& global_lock) {
+  CacheEntry& entry = cache_entry_pool_[entry_index];
+  CacheKey entry_key = entry.key;
+  // Remove the entry from the cache map.
+  auto entry_map_it = cache_map_.find(entry_key);
+  assert_true(entry_map_it != cache_map_.end());
+  if (entry_map_it != cache_map_.end()) {
+    cache_map_.erase(entry_map_it);
+  }
+  // Unlink the entry from the lists of the buckets.
+  uint32_t entry_bucket_index_first =
+      entry_key.base >> kCacheBucketSizeBytesLog2;
+  uint32_t entry_bucket_count = entry.GetBucketCount();
+  for (uint32_t entry_link_index = 0; entry_link_index < entry_bucket_count;
+       ++entry_link_index) {
+    uint32_t entry_bucket_index = entry_bucket_index_first + entry_link_index;
+    size_t entry_link_prev = entry.buckets_prev[entry_link_index];
+    size_t entry_link_next = entry.buckets_next[entry_link_index];
+    if (entry_link_prev != SIZE_MAX) {
+      CacheEntry& entry_prev = cache_entry_pool_[entry_link_prev];
+      entry_prev.buckets_next[size_t(
+          (entry_prev.key.base >> kCacheBucketSizeBytesLog2) !=
+          entry_bucket_index)] = entry_link_next;
+    } else {
+      if (entry_link_next != SIZE_MAX) {
+        cache_bucket_first_entries_[entry_bucket_index] = entry_link_next;
+      } else {
+        // The only entry that was remaining in the bucket - it's empty now.
+        cache_buckets_non_empty_l1_[entry_bucket_index >> 6] &=
+            ~(uint64_t(1) << (entry_bucket_index & 63));
+        UpdateCacheBucketsNonEmptyL2(entry_bucket_index >> 6, global_lock);
+      }
+    }
+    if (entry_link_next != SIZE_MAX) {
+      CacheEntry& entry_next = cache_entry_pool_[entry_link_next];
+      entry_next.buckets_prev[size_t(
+          (entry_next.key.base >> kCacheBucketSizeBytesLog2) !=
+          entry_bucket_index)] = entry_link_prev;
+    }
+  }
+  std::unique_ptr<CachedHostIndices> host_indices =
+      std::move(entry.host_indices);
+  if (host_indices) {
+    cache_host_indices_size_bytes_ -= host_indices->data.size();
+  }
+  // Make the entry free for reuse.
+  entry.free_next = cache_bucket_free_first_entry_;
+  cache_bucket_free_first_entry_ = entry_index;
+  return host_indices;
+}
+
 std::pair<uint32_t, uint32_t> PrimitiveProcessor::MemoryInvalidationCallback(
     uint32_t physical_address_start, uint32_t length, bool exact_range) {
   if (length == 0 || physical_address_start >= SharedMemory::kBufferSize) {
@@ -1541,6 +1723,15 @@ std::pair<uint32_t, uint32_t> PrimitiveProcessor::MemoryInvalidationCallback(
   uint32_t bucket_l2_bits_index_first = bucket_index_first >> 12;
   uint32_t bucket_l2_bits_index_last = bucket_index_last >> 12;
   auto global_lock = global_critical_region_.Acquire();
+  if (cache_currently_processing_size_bytes_ &&
+      cache_currently_processing_base_ < physical_address_end &&
+      cache_currently_processing_base_ +
+              cache_currently_processing_size_bytes_ >
+          physical_address_start) {
+    // Don't store the entry being processed as its indices may be outdated.
+    cache_currently_processing_invalidated_ = true;
+    any_invalidated = true;
+  }
   for (uint32_t bucket_l2_bits_index = bucket_l2_bits_index_first;
        bucket_l2_bits_index <= bucket_l2_bits_index_last;
        ++bucket_l2_bits_index) {
@@ -1608,60 +1799,11 @@ std::pair<uint32_t, uint32_t> PrimitiveProcessor::MemoryInvalidationCallback(
               entry.buckets_next[bucket_index - entry_bucket_index_first];
           // For exact_range, don't invalidate bucket entries that are outside
           // the specified range.
-          if (entry_key.base < physical_address_end) {
-            uint32_t entry_end = entry_key.base + entry_key.GetSizeBytes();
-            if (entry_end > physical_address_end) {
-              // Invalidate the entry.
-              any_invalidated = true;
-              // Remove the entry from the cache map.
-              auto entry_map_it = cache_map_.find(entry_key);
-              assert_true(entry_map_it != cache_map_.end());
-              if (entry_map_it != cache_map_.end()) {
-                cache_map_.erase(entry_map_it);
-              }
-              // Unlink the entry from the bucket's list.
-              uint32_t entry_link_index_last =
-                  ((entry_end - 1) >> kCacheBucketSizeBytesLog2) -
-                  entry_bucket_index_first;
-              assert_true(
-                  entry_link_index_last <= 1,
-                  "Cache entries only store list links within two buckets");
-              for (uint32_t entry_link_index = 0;
-                   entry_link_index <= entry_link_index_last;
-                   ++entry_link_index) {
-                uint32_t entry_bucket_index =
-                    entry_bucket_index_first + entry_link_index;
-                size_t entry_link_prev = entry.buckets_prev[entry_link_index];
-                size_t entry_link_next = entry.buckets_next[entry_link_index];
-                if (entry_link_prev != SIZE_MAX) {
-                  CacheEntry& entry_prev = cache_entry_pool_[entry_link_prev];
-                  entry_prev.buckets_next[size_t(
-                      (entry_prev.key.base >> kCacheBucketSizeBytesLog2) !=
-                      entry_bucket_index)] = entry_link_next;
-                } else {
-                  if (entry_link_next != SIZE_MAX) {
-                    cache_bucket_first_entries_[entry_bucket_index] =
-                        entry_link_next;
-                  } else {
-                    // The only entry that was remaining in the bucket - it's
-                    // empty now.
-                    cache_buckets_non_empty_l1_[entry_bucket_index >> 6] &=
-                        ~(uint64_t(1) << (entry_bucket_index & 63));
-                    UpdateCacheBucketsNonEmptyL2(entry_bucket_index >> 6,
-                                                 global_lock);
-                  }
-                }
-                if (entry_link_next != SIZE_MAX) {
-                  CacheEntry& entry_next = cache_entry_pool_[entry_link_next];
-                  entry_next.buckets_prev[size_t(
-                      (entry_next.key.base >> kCacheBucketSizeBytesLog2) !=
-                      entry_bucket_index)] = entry_link_prev;
-                }
-              }
-              // Make the entry free for reuse.
-              entry.free_next = cache_bucket_free_first_entry_;
-              cache_bucket_free_first_entry_ = entry_index;
-            }
+          if (entry_key.base < physical_address_end &&
+              entry_key.base + entry_key.GetSizeBytes() >
+                  physical_address_start) {
+            any_invalidated = true;
+            RemoveCacheEntry(entry_index, global_lock);
           }
           entry_index = next_entry_index;
         } while (entry_index != SIZE_MAX);
@@ -1682,5 +1824,16 @@ PrimitiveProcessor::MemoryInvalidationCallbackThunk(
       ->MemoryInvalidationCallback(physical_address_start, length, exact_range);
 }
 
+void PrimitiveProcessor::SharedMemoryGlobalWatchCallbackThunk(
+    const global_unique_lock_type& global_lock, void* context,
+    uint32_t address_first, uint32_t address_last, bool invalidated_by_gpu) {
+  // CPU writes are handled by the physical memory invalidation callback.
+  if (!invalidated_by_gpu) {
+    return;
+  }
+  reinterpret_cast<PrimitiveProcessor*>(context)->MemoryInvalidationCallback(
+      address_first, address_last - address_first + 1, true);
+}
+
 }  // namespace gpu
 }  // namespace xe
@@ -17,9 +17,11 @@
 #include <cstring>
 #include <deque>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "xenia/base/assert.h"
 #include "xenia/base/cvar.h"
@@ -272,7 +274,9 @@ class PrimitiveProcessor {
 
   // Call at boundaries of lifespans of converted data (between frames,
   // preferably in the end of a frame so between the swap and the next draw,
-  // access violation handlers need to do less work).
+  // access violation handlers need to do less work). Cache entries with
+  // converted indices kept in host memory stay to be uploaded again in later
+  // frames, the rest, and entries not used for a while, are dropped.
   void ClearPerFrameCache();
 
   static constexpr size_t GetBuiltinIndexBufferOffsetBytes(size_t handle) {
@@ -709,7 +713,11 @@ class PrimitiveProcessor {
 
   std::deque<SinglePrimitiveRange> single_primitive_ranges_;
 
-  // Caching for reuse of converted indices within a frame.
+  // Caching for reuse of converted indices within a frame, and, for indices
+  // also kept in host memory, across frames.
+
+  // Entries not used for this many frames are dropped at the end of a frame.
+  static constexpr uint64_t kCacheMaxUnusedFrames = 60;
 
   // 256 KB as the largest possible guest index buffer - 0xFFFF 32-bit indices -
   // is slightly smaller than 256 KB, thus cache entries need store links within
@@ -777,6 +785,21 @@ class PrimitiveProcessor {
     size_t host_index_buffer_handle;
   };
 
+  // Converted indices kept in host memory for uploading again in later frames,
+  // since host converted index buffers only live until the end of the frame.
+  struct CachedHostIndices {
+    xenos::IndexFormat format;
+    uint32_t count;
+    // Offset of the indices in data, for SIMD coalignment with the guest ones.
+    size_t offset;
+    std::vector<uint8_t> data;
+    size_t GetSizeBytes() const {
+      return (format == xenos::IndexFormat::kInt16 ? sizeof(uint16_t)
+                                                   : sizeof(uint32_t)) *
+             count;
+    }
+  };
+
   struct CacheEntry {
     static_assert(
         UINT16_MAX * sizeof(uint32_t) <=
@@ -792,6 +815,12 @@ class PrimitiveProcessor {
     size_t buckets_next[2];
     CacheKey key;
     CachedResult result;
+    // The frame in which result.host_index_buffer_handle was obtained.
+    uint64_t result_frame;
+    uint64_t last_used_frame;
+    // For kHostConverted, if not over the memory budget, the indices to upload
+    // again in a later frame.
+    std::unique_ptr<CachedHostIndices> host_indices;
     static uint32_t GetBucketCount(CacheKey key) {
       uint32_t count =
           ((key.base + (key.GetSizeBytes() - 1)) >> kCacheBucketSizeBytesLog2) -
@@ -825,18 +854,29 @@ class PrimitiveProcessor {
   // If an entry was found in the cache (GetFoundResult results non-null), it
   // MUST be used instead of processing - this class doesn't provide the
   // possibility replace existing entries.
+  // An entry converted in a previous frame is uploaded again from the host
+  // memory copy during initialization, and is found like one from the current
+  // frame.
   class CacheTransaction final {
    public:
     CacheTransaction(PrimitiveProcessor& processor, CacheKey key);
     const CachedResult* GetFoundResult() const {
-      return result_type_ == ResultType::kExisting ? &result_ : nullptr;
-    }
-    void SetNewResult(const CachedResult& new_result) {
-      // Replacement of an existing entry is not allowed.
-      assert_true(result_type_ != ResultType::kExisting);
-      result_ = new_result;
-      result_type_ = ResultType::kNewSet;
+      return (result_type_ == ResultType::kExisting ||
+              result_type_ == ResultType::kUploadedAgain)
+                 ? &result_
+                 : nullptr;
     }
+    // Use instead of RequestHostConvertedIndexBufferForCurrentFrame for
+    // processing within the transaction. The indices must be written before
+    // SetNewResult. If the result can be kept for later frames, the returned
+    // buffer is in host memory, and is copied to the frame's buffer in
+    // SetNewResult.
+    void* RequestHostConvertedIndexBuffer(xenos::IndexFormat format,
+                                          uint32_t index_count,
+                                          bool coalign_for_simd,
+                                          uint32_t coalignment_original_address,
+                                          size_t& backend_handle_out);
+    void SetNewResult(const CachedResult& new_result);
     ~CacheTransaction();
 
    private:
@@ -851,13 +891,27 @@ class PrimitiveProcessor {
       kNewUnset,
       kNewSet,
       kExisting,
+      // Found with indices from a previous frame, which have been uploaded for
+      // the current frame - to be stored in the cache again.
+      kUploadedAgain,
     };
     ResultType result_type_ = ResultType::kNewUnset;
+    // Whether the memory budget allows keeping a host memory copy of the
+    // converted indices.
+    bool keep_host_indices_ = false;
+    // Host memory copy of the converted indices to keep in the cache.
+    std::unique_ptr<CachedHostIndices> host_indices_;
+    // The buffer for the current frame to copy host_indices_ to.
+    void* host_indices_frame_mapping_ = nullptr;
   };
 
   std::deque<CacheEntry> cache_entry_pool_;
 
   void* memory_invalidation_callback_handle_ = nullptr;
+  // For invalidation of indices written by the GPU (by resolves or memexport),
+  // which the physical memory invalidation callback isn't called for.
+  // Registered along with the physical memory invalidation callback.
+  SharedMemory::GlobalWatchHandle shared_memory_global_watch_handle_ = nullptr;
 
   xe::global_critical_region global_critical_region_;
   // Modified by both the processor and the invalidation callback.
@@ -871,8 +925,20 @@ class PrimitiveProcessor {
   // 0 if not in a cache transaction that hasn't found an existing entry
   // currently.
   uint32_t cache_currently_processing_size_bytes_ = 0;
+  // Set by the invalidation callback if the range currently being processed
+  // has been modified.
+  bool cache_currently_processing_invalidated_ = false;
   // Modified by both the processor and the invalidation callback.
   size_t cache_bucket_free_first_entry_ = SIZE_MAX;
+  // Incremented in ClearPerFrameCache.
+  uint64_t cache_frame_ = 0;
+  // Total size of the data of CacheEntry::host_indices.
+  // Modified by both the processor and the invalidation callback.
+  size_t cache_host_indices_size_bytes_ = 0;
+  // Statistics, modified by the processor.
+  uint64_t cache_hits_ = 0;
+  uint64_t cache_hits_previous_frames_ = 0;
+  uint64_t cache_misses_ = 0;
   // Modified by both the processor and the invalidation callback.
   uint64_t cache_buckets_non_empty_l1_[(kCacheBucketCount + 63) / 64] = {};
   // For even faster handling of memory invalidation - whether any bit is set in
@@ -894,6 +960,11 @@ class PrimitiveProcessor {
       cache_buckets_non_empty_l2_ref &= ~cache_buckets_non_empty_l2_bit;
     }
   }
+  // Unlinks the entry from the cache map and the buckets, and frees it,
+  // returning its host memory copy of the indices, if there was one.
+  // Must be called in a global critical region.
+  std::unique_ptr<CachedHostIndices> RemoveCacheEntry(
+      size_t entry_index, const global_unique_lock_type& global_lock);
   // cache_buckets_non_empty_l1_ (along with cache_buckets_non_empty_l2_, which
   // must be kept in sync) used for indication whether each entry is non-empty,
   // for faster clearing (there's no special index here for an empty entry).
@@ -903,6 +974,9 @@ class PrimitiveProcessor {
   static std::pair<uint32_t, uint32_t> MemoryInvalidationCallbackThunk(
       void* context_ptr, uint32_t physical_address_start, uint32_t length,
       bool exact_range);
+  static void SharedMemoryGlobalWatchCallbackThunk(
+      const global_unique_lock_type& global_lock, void* context,
+      uint32_t address_first, uint32_t address_last, bool invalidated_by_gpu);
 };
 
 }  // namespace gpu
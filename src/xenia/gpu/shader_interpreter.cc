@@ -9,6 +9,7 @@
 
 #include "xenia/gpu/shader_interpreter.h"
 
+#include <bitset>
 #include <cfloat>
 #include <cmath>
 #include <cstring>
@@ -85,8 +86,13 @@ void ShaderInterpreter::Execute() {
 
         for (uint32_t exec_index = 0; exec_index < cf_exec.count();
              ++exec_index) {
-          const uint32_t* exec_instruction =
-              &ucode_[3 * (cf_exec.address() + exec_index)];
+          uint32_t instruction_address = cf_exec.address() + exec_index;
+          if (skipped_instructions_ &&
+              (skipped_instructions_[instruction_address >> 6] &
+               (UINT64_C(1) << (instruction_address & 63)))) {
+            continue;
+          }
+          const uint32_t* exec_instruction = &ucode_[3 * instruction_address];
           if ((cf_exec.sequence() >> (exec_index << 1)) & 0b01) {
             const ucode::FetchInstruction& fetch_instr =
                 *reinterpret_cast<const ucode::FetchInstruction*>(
@@ -1219,5 +1225,243 @@ void ShaderInterpreter::ExecuteVertexFetchInstruction(
                    result);
 }
 
+bool ShaderInterpreter::GetInstructionsNotAffectingPosition(
+    const Shader& shader, std::vector<uint64_t>& skipped_instructions_out) {
+  skipped_instructions_out.clear();
+  assert_true(shader.is_ucode_analyzed());
+  if (shader.type() != xenos::ShaderType::kVertex) {
+    return false;
+  }
+  const uint32_t* ucode = shader.ucode_dwords();
+  uint32_t instruction_count = uint32_t(shader.ucode_dword_count() / 3);
+
+  // Only handling straight-line control flow, where the execs are executed in
+  // order or skipped, until an unconditional end.
+  struct Exec {
+    uint32_t address;
+    uint32_t count;
+    uint32_t sequence;
+    bool is_conditional;
+  };
+  std::vector<Exec> execs;
+  bool exec_ended = false;
+  for (uint32_t cf_index = 0;
+       !exec_ended && cf_index < 2 * shader.cf_pair_index_bound(); ++cf_index) {
+    const uint32_t* cf_pair = &ucode[3 * (cf_index >> 1)];
+    ucode::ControlFlowInstruction cf_instr;
+    if (cf_index & 1) {
+      cf_instr.dword_0 = (cf_pair[1] >> 16) | (cf_pair[2] << 16);
+      cf_instr.dword_1 = cf_pair[2] >> 16;
+    } else {
+      cf_instr.dword_0 = cf_pair[0];
+      cf_instr.dword_1 = cf_pair[1] & 0xFFFF;
+    }
+    ucode::ControlFlowOpcode cf_opcode = cf_instr.opcode();
+    switch (cf_opcode) {
+      case ucode::ControlFlowOpcode::kNop:
+      case ucode::ControlFlowOpcode::kAlloc:
+      case ucode::ControlFlowOpcode::kMarkVsFetchDone:
+        break;
+      case ucode::ControlFlowOpcode::kExec:
+      case ucode::ControlFlowOpcode::kExecEnd:
+      case ucode::ControlFlowOpcode::kCondExec:
+      case ucode::ControlFlowOpcode::kCondExecEnd:
+      case ucode::ControlFlowOpcode::kCondExecPred:
+      case ucode::ControlFlowOpcode::kCondExecPredEnd:
+      case ucode::ControlFlowOpcode::kCondExecPredClean:
+      case ucode::ControlFlowOpcode::kCondExecPredCleanEnd: {
+        const ucode::ControlFlowExecInstruction& cf_exec =
+            *reinterpret_cast<const ucode::ControlFlowExecInstruction*>(
+                &cf_instr);
+        if (cf_exec.address() + cf_exec.count() > instruction_count) {
+          return false;
+        }
+        Exec& exec = execs.emplace_back();
+        exec.address = cf_exec.address();
+        exec.count = cf_exec.count();
+        exec.sequence = cf_exec.sequence();
+        exec.is_conditional = cf_opcode != ucode::ControlFlowOpcode::kExec &&
+                              cf_opcode != ucode::ControlFlowOpcode::kExecEnd;
+        // A skipped conditional exec doesn't end the shader.
+        exec_ended = cf_opcode == ucode::ControlFlowOpcode::kExecEnd;
+      } break;
+      default:
+        // Loops, calls and jumps.
+        return false;
+    }
+  }
+  if (!exec_ended) {
+    return false;
+  }
+
+  // Backwards liveness analysis of the temporary registers and the previous
+  // scalar result. Only unconditional writes of all components end the
+  // lifetime of a register. The predicate and the address register are not
+  // tracked - instructions changing them are always executed.
+  std::bitset<xenos::kMaxShaderTempRegisters> live_temps;
+  bool previous_scalar_live = false;
+  // Mini vertex fetches use the parameters of the last full one.
+  bool mini_vertex_fetch_later = false;
+  std::vector<uint64_t> needed_instructions((instruction_count + 63) >> 6);
+  for (auto exec_it = execs.crbegin(); exec_it != execs.crend(); ++exec_it) {
+    for (uint32_t exec_index = exec_it->count; exec_index--;) {
+      uint32_t instruction_address = exec_it->address + exec_index;
+      const uint32_t* exec_instruction = &ucode[3 * instruction_address];
+      bool is_needed = false;
+      if ((exec_it->sequence >> (exec_index << 1)) & 0b01) {
+        const ucode::FetchInstruction& fetch_instr =
+            *reinterpret_cast<const ucode::FetchInstruction*>(
+                exec_instruction);
+        if (fetch_instr.is_dest_relative() || fetch_instr.is_src_relative()) {
+          return false;
+        }
+        bool is_unconditional =
+            !exec_it->is_conditional && !fetch_instr.is_predicated();
+        uint32_t dest_write_mask = 0;
+        for (uint32_t i = 0; i < 4; ++i) {
+          if (ucode::GetFetchDestinationComponentSwizzle(
+                  fetch_instr.dest_swizzle(), i) !=
+              ucode::FetchDestinationSwizzle::kKeep) {
+            dest_write_mask |= UINT32_C(1) << i;
+          }
+        }
+        is_needed = dest_write_mask && live_temps.test(fetch_instr.dest());
+        bool is_vertex_fetch =
+            fetch_instr.opcode() == ucode::FetchOpcode::kVertexFetch;
+        bool is_mini_vertex_fetch =
+            is_vertex_fetch && fetch_instr.vertex_fetch().is_mini_fetch();
+        if (is_vertex_fetch && !is_mini_vertex_fetch &&
+            mini_vertex_fetch_later) {
+          is_needed = true;
+        }
+        if (is_needed) {
+          if (is_unconditional && dest_write_mask == 0b1111) {
+            live_temps.reset(fetch_instr.dest());
+          }
+          // Texture fetches are not interpreted, only storing zeros.
+          if (is_vertex_fetch) {
+            live_temps.set(fetch_instr.src());
+            if (is_mini_vertex_fetch) {
+              mini_vertex_fetch_later = true;
+            } else if (is_unconditional) {
+              mini_vertex_fetch_later = false;
+            }
+          }
+        }
+      } else {
+        const ucode::AluInstruction& alu_instr =
+            *reinterpret_cast<const ucode::AluInstruction*>(exec_instruction);
+        bool is_unconditional =
+            !exec_it->is_conditional && !alu_instr.is_predicated();
+        ucode::AluVectorOpcode vector_opcode = alu_instr.vector_opcode();
+        const ucode::AluVectorOpcodeInfo& vector_opcode_info =
+            ucode::GetAluVectorOpcodeInfo(vector_opcode);
+        ucode::AluScalarOpcode scalar_opcode = alu_instr.scalar_opcode();
+        const ucode::AluScalarOpcodeInfo& scalar_opcode_info =
+            ucode::GetAluScalarOpcodeInfo(scalar_opcode);
+        uint32_t vector_result_write_mask =
+            alu_instr.GetVectorOpResultWriteMask();
+        uint32_t scalar_result_write_mask =
+            alu_instr.GetScalarOpResultWriteMask();
+        bool is_vector_executed =
+            vector_result_write_mask || vector_opcode_info.changed_state;
+        bool writes_previous_scalar =
+            scalar_opcode != ucode::AluScalarOpcode::kRetainPrev;
+        if (vector_opcode_info.changed_state ||
+            scalar_opcode_info.changed_state ||
+            (writes_previous_scalar && previous_scalar_live)) {
+          is_needed = true;
+        }
+        if (alu_instr.is_export()) {
+          ucode::ExportRegister export_register =
+              ucode::ExportRegister(alu_instr.vector_dest());
+          if (export_register == ucode::ExportRegister::kVSPosition ||
+              export_register ==
+                  ucode::ExportRegister::kVSPointSizeEdgeFlagKillVertex) {
+            is_needed = true;
+          }
+        } else {
+          if ((vector_result_write_mask &&
+               alu_instr.is_vector_dest_relative()) ||
+              (scalar_result_write_mask &&
+               alu_instr.is_scalar_dest_relative())) {
+            return false;
+          }
+          if ((vector_result_write_mask &&
+               live_temps.test(alu_instr.vector_dest())) ||
+              (scalar_result_write_mask &&
+               live_temps.test(alu_instr.scalar_dest()))) {
+            is_needed = true;
+          }
+        }
+        if (is_needed) {
+          if (is_unconditional) {
+            if (!alu_instr.is_export()) {
+              if (vector_result_write_mask == 0b1111) {
+                live_temps.reset(alu_instr.vector_dest());
+              }
+              if (scalar_result_write_mask == 0b1111) {
+                live_temps.reset(alu_instr.scalar_dest());
+              }
+            }
+            if (writes_previous_scalar) {
+              previous_scalar_live = false;
+            }
+          }
+          for (uint32_t i = 0; i < 3; ++i) {
+            if (!is_vector_executed ||
+                !vector_opcode_info.operand_components_used[i] ||
+                !alu_instr.src_is_temp(1 + i)) {
+              continue;
+            }
+            uint32_t src_register = alu_instr.src_reg(1 + i);
+            if (ucode::AluInstruction::is_src_temp_relative(src_register)) {
+              return false;
+            }
+            live_temps.set(ucode::AluInstruction::src_temp_reg(src_register));
+          }
+          switch (scalar_opcode_info.operand_count) {
+            case 1: {
+              if (alu_instr.src_is_temp(3)) {
+                uint32_t src_register = alu_instr.src_reg(3);
+                if (ucode::AluInstruction::is_src_temp_relative(
+                        src_register)) {
+                  return false;
+                }
+                live_temps.set(
+                    ucode::AluInstruction::src_temp_reg(src_register));
+              }
+            } break;
+            case 2:
+              live_temps.set(alu_instr.scalar_const_reg_op_src_temp_reg());
+              break;
+          }
+          switch (scalar_opcode) {
+            case ucode::AluScalarOpcode::kAddsPrev:
+            case ucode::AluScalarOpcode::kMulsPrev:
+            case ucode::AluScalarOpcode::kMulsPrev2:
+            case ucode::AluScalarOpcode::kSubsPrev:
+            case ucode::AluScalarOpcode::kRetainPrev:
+              previous_scalar_live = true;
+              break;
+            default:
+              break;
+          }
+        }
+      }
+      if (is_needed) {
+        needed_instructions[instruction_address >> 6] |=
+            UINT64_C(1) << (instruction_address & 63);
+      }
+    }
+  }
+
+  skipped_instructions_out.reserve(needed_instructions.size());
+  for (uint64_t needed_instructions_block : needed_instructions) {
+    skipped_instructions_out.push_back(~needed_instructions_block);
+  }
+  return true;
+}
+
 }  // namespace gpu
 }  // namespace xe
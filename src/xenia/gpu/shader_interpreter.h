@@ -14,6 +14,7 @@
 #include <array>
 #include <cstddef>
 #include <cstdint>
+#include <vector>
 
 #include "xenia/gpu/register_file.h"
 #include "xenia/gpu/shader.h"
@@ -61,12 +62,25 @@ class ShaderInterpreter {
   void SetShader(xenos::ShaderType shader_type, const uint32_t* ucode) {
     shader_type_ = shader_type;
     ucode_ = ucode;
+    skipped_instructions_ = nullptr;
   }
   void SetShader(const Shader& shader) {
     assert_true(CanInterpretShader(shader));
     SetShader(shader.type(), shader.ucode_dwords());
   }
 
+  // Finds the ALU and fetch instructions of a vertex shader that affect
+  // neither the position nor the point size and the vertex kill flag, as bits
+  // indexed by the instruction address, for when only those exports are
+  // needed. Returns false if the control flow is too complex to analyze, in
+  // this case all instructions must be executed.
+  static bool GetInstructionsNotAffectingPosition(
+      const Shader& shader, std::vector<uint64_t>& skipped_instructions_out);
+  // Must be called after SetShader, nullptr to execute all instructions.
+  void SetSkippedInstructions(const uint64_t* skipped_instructions) {
+    skipped_instructions_ = skipped_instructions;
+  }
+
   void Execute();
 
  private:
@@ -135,6 +149,7 @@ class ShaderInterpreter {
 
   xenos::ShaderType shader_type_ = xenos::ShaderType::kVertex;
   const uint32_t* ucode_ = nullptr;
+  const uint64_t* skipped_instructions_ = nullptr;
 
   // For both inputs and locals.
   float temp_registers_[xenos::kMaxShaderTempRegisters][4];
@@ -0,0 +1,13 @@
+project_root = "../../../.."
+include(project_root.."/tools/build")
+
+test_suite("xenia-gpu-tests", project_root, ".", {
+  links = {
+    "fmt",
+    "snappy",
+    "xenia-base",
+    "xenia-gpu",
+    "xenia-ui",
+    "xxhash",
+  },
+})
@@ -0,0 +1,345 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/shader_interpreter.h"
+
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+
+#include "xenia/base/string_buffer.h"
+#include "xenia/gpu/shader.h"
+#include "xenia/gpu/ucode.h"
+
+namespace xe {
+namespace gpu {
+namespace test {
+
+using ucode::AluScalarOpcode;
+using ucode::AluVectorOpcode;
+using ucode::ControlFlowOpcode;
+using ucode::ExportRegister;
+
+namespace {
+
+// Register and constant operands of ALU instructions.
+struct Src {
+  uint32_t reg;
+  bool is_temp;
+};
+Src R(uint32_t reg) { return {reg, true}; }
+Src C(uint32_t reg) { return {reg, false}; }
+
+// Assembles vertex shader ucode - control flow instructions followed by ALU
+// and fetch instructions, which are placed after the last control flow pair.
+class ShaderBuilder {
+ public:
+  // Instructions are added to the exec last opened, the sequence and the
+  // addresses are filled when building. An exec can have up to 6 of them.
+  void Exec(ControlFlowOpcode opcode, uint32_t condition_bits = 0) {
+    execs_.push_back({opcode, condition_bits, uint32_t(is_fetch_.size())});
+    cf_.push_back(execs_.size() - 1);
+  }
+  // Control flow instructions other than execs, as the 48 raw bits.
+  void ControlFlow(ControlFlowOpcode opcode, uint64_t bits = 0) {
+    cf_.push_back(~size_t(0));
+    other_cf_.push_back(bits | (uint64_t(opcode) << 44));
+  }
+
+  // Returns the index of the instruction within the ALU and fetch part.
+  uint32_t Alu(AluVectorOpcode vector_opcode, uint32_t vector_dest,
+               uint32_t vector_write_mask, Src src1, Src src2,
+               bool is_export = false, bool is_predicated = false,
+               AluScalarOpcode scalar_opcode = AluScalarOpcode::kRetainPrev,
+               uint32_t scalar_write_mask = 0, Src src3 = C(0)) {
+    uint32_t dwords[3];
+    dwords[0] = vector_dest | (vector_dest << 8) | (uint32_t(is_export) << 15) |
+                (vector_write_mask << 16) | (scalar_write_mask << 20) |
+                (uint32_t(scalar_opcode) << 26);
+    dwords[1] = uint32_t(is_predicated) << 28;
+    dwords[2] = src3.reg | (src2.reg << 8) | (src1.reg << 16) |
+                (uint32_t(vector_opcode) << 24) |
+                (uint32_t(src3.is_temp) << 29) |
+                (uint32_t(src2.is_temp) << 30) | (uint32_t(src1.is_temp) << 31);
+    return AddInstruction(dwords, false);
+  }
+  uint32_t Export(ExportRegister export_register, uint32_t src) {
+    return Alu(AluVectorOpcode::kMax, uint32_t(export_register), 0b1111,
+               R(src), R(src), true);
+  }
+  uint32_t VertexFetch(uint32_t dest, uint32_t src, bool is_mini_fetch,
+                       bool is_predicated = false) {
+    uint32_t dwords[3];
+    dwords[0] = uint32_t(ucode::FetchOpcode::kVertexFetch) | (src << 5) |
+                (dest << 12) | (uint32_t(1) << 19);
+    // XYZW destination swizzle, 32_32_32_32_FLOAT.
+    dwords[1] = 0b011010001000 |
+                (uint32_t(xenos::VertexFormat::k_32_32_32_32_FLOAT) << 16) |
+                (uint32_t(is_mini_fetch) << 30) |
+                (uint32_t(is_predicated) << 31);
+    // Stride of 4 dwords.
+    dwords[2] = 4;
+    return AddInstruction(dwords, true);
+  }
+
+  std::vector<uint32_t> Build() const {
+    uint32_t cf_pair_count = uint32_t((cf_.size() + 1) / 2);
+    std::vector<uint64_t> cf_bits;
+    size_t other_cf_index = 0;
+    for (size_t exec_index : cf_) {
+      if (exec_index == ~size_t(0)) {
+        cf_bits.push_back(other_cf_[other_cf_index++]);
+        continue;
+      }
+      const ExecInfo& exec = execs_[exec_index];
+      uint32_t end = exec_index + 1 < execs_.size()
+                         ? execs_[exec_index + 1].first_instruction
+                         : uint32_t(is_fetch_.size());
+      uint32_t sequence = 0;
+      for (uint32_t i = exec.first_instruction; i < end; ++i) {
+        if (is_fetch_[i]) {
+          sequence |= uint32_t(1) << ((i - exec.first_instruction) * 2);
+        }
+      }
+      cf_bits.push_back(
+          uint64_t(cf_pair_count + exec.first_instruction) |
+          (uint64_t(end - exec.first_instruction) << 12) |
+          (uint64_t(sequence) << 16) | (uint64_t(exec.condition_bits) << 32) |
+          (uint64_t(exec.opcode) << 44));
+    }
+    cf_bits.resize(cf_pair_count * 2, 0);
+    std::vector<uint32_t> ucode;
+    for (uint32_t i = 0; i < cf_pair_count; ++i) {
+      uint64_t cf_0 = cf_bits[i * 2];
+      uint64_t cf_1 = cf_bits[i * 2 + 1];
+      ucode.push_back(uint32_t(cf_0));
+      ucode.push_back(uint32_t(cf_0 >> 32) | (uint32_t(cf_1) << 16));
+      ucode.push_back(uint32_t(cf_1 >> 16));
+    }
+    ucode.insert(ucode.end(), instructions_.begin(), instructions_.end());
+    return ucode;
+  }
+
+  // Address of an instruction returned by Alu, Export or VertexFetch.
+  uint32_t address(uint32_t instruction) const {
+    return uint32_t((cf_.size() + 1) / 2) + instruction;
+  }
+
+ private:
+  struct ExecInfo {
+    ControlFlowOpcode opcode;
+    uint32_t condition_bits;
+    uint32_t first_instruction;
+  };
+
+  uint32_t AddInstruction(const uint32_t* dwords, bool is_fetch) {
+    uint32_t index = uint32_t(is_fetch_.size());
+    instructions_.insert(instructions_.end(), dwords, dwords + 3);
+    is_fetch_.push_back(is_fetch);
+    return index;
+  }
+
+  std::vector<ExecInfo> execs_;
+  std::vector<uint64_t> other_cf_;
+  // Index in execs_, or ~0 for the next one in other_cf_.
+  std::vector<size_t> cf_;
+  std::vector<uint32_t> instructions_;
+  std::vector<bool> is_fetch_;
+};
+
+struct Analysis {
+  bool analyzed;
+  std::vector<uint64_t> skipped_instructions;
+
+  bool IsSkipped(uint32_t address) const {
+    return (skipped_instructions[address >> 6] >> (address & 63)) & 1;
+  }
+};
+
+Analysis Analyze(const ShaderBuilder& builder) {
+  std::vector<uint32_t> ucode = builder.Build();
+  Shader shader(xenos::ShaderType::kVertex, 0, ucode.data(), ucode.size(),
+                std::endian::native);
+  StringBuffer ucode_disasm_buffer;
+  shader.AnalyzeUcode(ucode_disasm_buffer);
+  Analysis analysis;
+  analysis.analyzed = ShaderInterpreter::GetInstructionsNotAffectingPosition(
+      shader, analysis.skipped_instructions);
+  return analysis;
+}
+
+}  // namespace
+
+TEST_CASE("position_analysis_exports", "[shader_interpreter]") {
+  ShaderBuilder builder;
+  builder.Exec(ControlFlowOpcode::kExec);
+  uint32_t fetch = builder.VertexFetch(0, 0, false);
+  uint32_t position = builder.Alu(AluVectorOpcode::kMul, 1, 0b1111, R(0), C(0));
+  uint32_t point_size =
+      builder.Alu(AluVectorOpcode::kMul, 2, 0b1111, R(0), C(1));
+  uint32_t interpolator =
+      builder.Alu(AluVectorOpcode::kMul, 3, 0b1111, R(0), C(2));
+  builder.Exec(ControlFlowOpcode::kExecEnd);
+  uint32_t position_export = builder.Export(ExportRegister::kVSPosition, 1);
+  uint32_t point_size_export =
+      builder.Export(ExportRegister::kVSPointSizeEdgeFlagKillVertex, 2);
+  uint32_t interpolator_export =
+      builder.Export(ExportRegister::kVSInterpolator0, 3);
+  Analysis analysis = Analyze(builder);
+  REQUIRE(analysis.analyzed);
+  REQUIRE_FALSE(analysis.IsSkipped(builder.address(fetch)));
+  REQUIRE_FALSE(analysis.IsSkipped(builder.address(position)));
+  REQUIRE_FALSE(analysis.IsSkipped(builder.address(point_size)));
+  REQUIRE_FALSE(analysis.IsSkipped(builder.address(position_export)));
+  REQUIRE_FALSE(analysis.IsSkipped(builder.address(point_size_export)));
+  REQUIRE(analysis.IsSkipped(builder.address(interpolator)));
+  REQUIRE(analysis.IsSkipped(builder.address(interpolator_export)));
+}
+
+TEST_CASE("position_analysis_overwritten_temps", "[shader_interpreter]") {
+  ShaderBuilder builder;
+  builder.Exec(ControlFlowOpcode::kExecEnd);
+  // Overwritten before being read by anything needed.
+  uint32_t dead_write = builder.Alu(AluVectorOpcode::kMul, 1, 0b1111, R(0),
+                                    C(0));
+  // Only partially overwrites the register, so the previous write is needed.
+  uint32_t full_write = builder.Alu(AluVectorOpcode::kMul, 1, 0b1111, R(0),
+                                    C(1));
+  uint32_t partial_write =
+      builder.Alu(AluVectorOpcode::kMul, 1, 0b0011, R(0), C(2));
+  uint32_t position_export = builder.Export(ExportRegister::kVSPosition, 1);
+  Analysis analysis = Analyze(builder);
+  REQUIRE(analysis.analyzed);
+  REQUIRE(analysis.IsSkipped(builder.address(dead_write)));
+  REQUIRE_FALSE(analysis.IsSkipped(builder.address(full_write)));
+  REQUIRE_FALSE(analysis.IsSkipped(builder.address(partial_write)));
+  REQUIRE_FALSE(analysis.IsSkipped(builder.address(position_export)));
+}
+
+TEST_CASE("position_analysis_predication", "[shader_interpreter]") {
+  SECTION("Predicated instructions") {
+    ShaderBuilder builder;
+    builder.Exec(ControlFlowOpcode::kExecEnd);
+    // Always executed, as it changes the predicate.
+    uint32_t predicate_set = builder.Alu(
+        AluVectorOpcode::kMax, 4, 0b0000, R(4), R(4), false, false,
+        AluScalarOpcode::kSetpEq, 0b0000, R(5));
+    uint32_t write = builder.Alu(AluVectorOpcode::kMul, 1, 0b1111, R(0), C(0));
+    // May not be executed, so the previous write is still needed.
+    uint32_t predicated_write =
+        builder.Alu(AluVectorOpcode::kMul, 1, 0b1111, R(0), C(1), false, true);
+    uint32_t position_export = builder.Export(ExportRegister::kVSPosition, 1);
+    Analysis analysis = Analyze(builder);
+    REQUIRE(analysis.analyzed);
+    REQUIRE_FALSE(analysis.IsSkipped(builder.address(predicate_set)));
+    REQUIRE_FALSE(analysis.IsSkipped(builder.address(write)));
+    REQUIRE_FALSE(analysis.IsSkipped(builder.address(predicated_write)));
+    REQUIRE_FALSE(analysis.IsSkipped(builder.address(position_export)));
+  }
+  SECTION("Predicated fetches") {
+    ShaderBuilder builder;
+    builder.Exec(ControlFlowOpcode::kExecEnd);
+    uint32_t fetch = builder.VertexFetch(1, 0, false);
+    uint32_t predicated_fetch = builder.VertexFetch(1, 0, false, true);
+    uint32_t position_export = builder.Export(ExportRegister::kVSPosition, 1);
+    Analysis analysis = Analyze(builder);
+    REQUIRE(analysis.analyzed);
+    REQUIRE_FALSE(analysis.IsSkipped(builder.address(fetch)));
+    REQUIRE_FALSE(analysis.IsSkipped(builder.address(predicated_fetch)));
+    REQUIRE_FALSE(analysis.IsSkipped(builder.address(position_export)));
+  }
+  SECTION("Conditional execs") {
+    ShaderBuilder builder;
+    builder.Exec(ControlFlowOpcode::kExec);
+    uint32_t write = builder.Alu(AluVectorOpcode::kMul, 1, 0b1111, R(0), C(0));
+    builder.Exec(ControlFlowOpcode::kCondExec);
+    uint32_t conditional_write =
+        builder.Alu(AluVectorOpcode::kMul, 1, 0b1111, R(0), C(1));
+    uint32_t conditional_interpolator =
+        builder.Alu(AluVectorOpcode::kMul, 2, 0b1111, R(0), C(2));
+    builder.Exec(ControlFlowOpcode::kExecEnd);
+    uint32_t position_export = builder.Export(ExportRegister::kVSPosition, 1);
+    Analysis analysis = Analyze(builder);
+    REQUIRE(analysis.analyzed);
+    REQUIRE_FALSE(analysis.IsSkipped(builder.address(write)));
+    REQUIRE_FALSE(analysis.IsSkipped(builder.address(conditional_write)));
+    REQUIRE(analysis.IsSkipped(builder.address(conditional_interpolator)));
+    REQUIRE_FALSE(analysis.IsSkipped(builder.address(position_export)));
+  }
+}
+
+TEST_CASE("position_analysis_vertex_fetch", "[shader_interpreter]") {
+  ShaderBuilder builder;
+  builder.Exec(ControlFlowOpcode::kExecEnd);
+  // Only used for the parameters of the mini fetch after it.
+  uint32_t full_fetch = builder.VertexFetch(2, 0, false);
+  uint32_t mini_fetch = builder.VertexFetch(1, 0, true);
+  uint32_t unused_fetch = builder.VertexFetch(3, 0, false);
+  uint32_t position_export = builder.Export(ExportRegister::kVSPosition, 1);
+  Analysis analysis = Analyze(builder);
+  REQUIRE(analysis.analyzed);
+  REQUIRE_FALSE(analysis.IsSkipped(builder.address(full_fetch)));
+  REQUIRE_FALSE(analysis.IsSkipped(builder.address(mini_fetch)));
+  REQUIRE(analysis.IsSkipped(builder.address(unused_fetch)));
+  REQUIRE_FALSE(analysis.IsSkipped(builder.address(position_export)));
+}
+
+TEST_CASE("position_analysis_flow_control", "[shader_interpreter]") {
+  SECTION("Conditional end") {
+    // Execution continues if the condition isn't met, but there's nothing
+    // after it.
+    ShaderBuilder builder;
+    builder.Exec(ControlFlowOpcode::kCondExecEnd);
+    builder.Export(ExportRegister::kVSPosition, 0);
+    Analysis analysis = Analyze(builder);
+    REQUIRE_FALSE(analysis.analyzed);
+    REQUIRE(analysis.skipped_instructions.empty());
+  }
+  SECTION("Loops") {
+    ShaderBuilder builder;
+    builder.ControlFlow(ControlFlowOpcode::kLoopStart);
+    builder.Exec(ControlFlowOpcode::kExec);
+    builder.Alu(AluVectorOpcode::kMul, 1, 0b1111, R(0), C(0));
+    builder.ControlFlow(ControlFlowOpcode::kLoopEnd);
+    builder.Exec(ControlFlowOpcode::kExecEnd);
+    builder.Export(ExportRegister::kVSPosition, 1);
+    Analysis analysis = Analyze(builder);
+    REQUIRE_FALSE(analysis.analyzed);
+    REQUIRE(analysis.skipped_instructions.empty());
+  }
+  SECTION("Jumps") {
+    ShaderBuilder builder;
+    builder.ControlFlow(ControlFlowOpcode::kCondJmp);
+    builder.Exec(ControlFlowOpcode::kExecEnd);
+    builder.Export(ExportRegister::kVSPosition, 0);
+    Analysis analysis = Analyze(builder);
+    REQUIRE_FALSE(analysis.analyzed);
+    REQUIRE(analysis.skipped_instructions.empty());
+  }
+  SECTION("Allocations and fetch done hints") {
+    ShaderBuilder builder;
+    builder.ControlFlow(ControlFlowOpcode::kAlloc);
+    builder.Exec(ControlFlowOpcode::kExec);
+    uint32_t position =
+        builder.Alu(AluVectorOpcode::kMul, 1, 0b1111, R(0), C(0));
+    builder.ControlFlow(ControlFlowOpcode::kMarkVsFetchDone);
+    builder.Exec(ControlFlowOpcode::kExecEnd);
+    uint32_t position_export = builder.Export(ExportRegister::kVSPosition, 1);
+    Analysis analysis = Analyze(builder);
+    REQUIRE(analysis.analyzed);
+    REQUIRE_FALSE(analysis.IsSkipped(builder.address(position)));
+    REQUIRE_FALSE(analysis.IsSkipped(builder.address(position_export)));
+  }
+}
+
+}  // namespace test
+}  // namespace gpu
+}  // namespace xe
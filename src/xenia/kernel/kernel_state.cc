@@ -39,6 +39,11 @@ DEFINE_uint32(max_signed_profiles, 4,
               "Limits how many profiles can be assigned. Possible values: 1-4",
               "Kernel");
 
+DEFINE_uint32(async_file_io_threads, 2,
+              "Number of threads reading from files opened for asynchronous "
+              "I/O, so the guest thread requesting the read doesn't wait for "
+              "the host disk. 0 to read on the requesting thread.",
+              "Kernel");
 DEFINE_uint32(kernel_build_version, 1888, "Define current kernel version",
               "Kernel");
 
@@ -103,6 +108,20 @@ KernelState::~KernelState() {
     dispatch_thread_->Wait(0, 0, 0, nullptr);
   }
 
+  if (!file_io_threads_.empty()) {
+    {
+      std::lock_guard<std::mutex> lock(file_io_mutex_);
+      file_io_threads_running_ = false;
+    }
+    file_io_cond_.notify_all();
+    for (auto& thread : file_io_threads_) {
+      thread->Wait(0, 0, 0, nullptr);
+    }
+    file_io_threads_.clear();
+    // Drop the references held by requests that were never serviced.
+    file_io_queue_.clear();
+  }
+
   executable_module_.reset();
   user_modules_.clear();
   kernel_modules_.clear();
@@ -422,6 +441,43 @@ void KernelState::SetExecutableModule(object_ref<UserModule> module) {
     dispatch_thread_->set_name("Kernel Dispatch");
     dispatch_thread_->Create();
   }
+
+  if (file_io_threads_.empty() && cvars::async_file_io_threads) {
+    file_io_threads_running_ = true;
+    for (uint32_t i = 0; i < cvars::async_file_io_threads; ++i) {
+      auto thread = object_ref<XHostThread>(new XHostThread(
+          this, 128 * 1024, 0,
+          [this]() {
+            std::unique_lock<std::mutex> lock(file_io_mutex_);
+            while (true) {
+              file_io_cond_.wait(lock, [this]() {
+                return !file_io_threads_running_ || !file_io_queue_.empty();
+              });
+              if (!file_io_threads_running_) {
+                break;
+              }
+              auto fn = std::move(file_io_queue_.front());
+              file_io_queue_.pop_front();
+              lock.unlock();
+              fn();
+              lock.lock();
+            }
+            return 0;
+          },
+          GetSystemProcess()));
+      thread->set_name(fmt::format("Kernel File I/O {}", i));
+      thread->Create();
+      file_io_threads_.push_back(std::move(thread));
+    }
+  }
+}
+
+void KernelState::QueueFileIO(std::function<void()> fn) {
+  {
+    std::lock_guard<std::mutex> lock(file_io_mutex_);
+    file_io_queue_.push_back(std::move(fn));
+  }
+  file_io_cond_.notify_one();
 }
 
 void KernelState::LoadKernelModule(object_ref<KernelModule> kernel_module) {
@@ -16,6 +16,7 @@
 #include <functional>
 #include <list>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 #include "achievement_manager.h"
@@ -320,6 +321,15 @@ class KernelState {
       uint32_t overlapped_ptr, std::function<void()> pre_callback = nullptr,
       std::function<void()> post_callback = nullptr);
 
+  // Whether reads from non-synchronous files are performed asynchronously by
+  // QueueFileIO.
+  bool has_file_io_threads() const { return !file_io_threads_.empty(); }
+  // Runs the function on one of the file I/O threads. These are guest-visible
+  // host threads, so the function may complete the request the guest way
+  // (signaling events, queueing APCs). Unlike the deferred dispatch, the
+  // requests are serviced by several threads in parallel, and right away.
+  void QueueFileIO(std::function<void()> fn);
+
   bool Save(ByteStream* stream);
   bool Restore(ByteStream* stream);
 
@@ -382,6 +392,13 @@ class KernelState {
   std::condition_variable_any dispatch_cond_;
   std::list<std::function<void()>> dispatch_queue_;
 
+  bool file_io_threads_running_ = false;
+  std::vector<object_ref<XHostThread>> file_io_threads_;
+  std::mutex file_io_mutex_;
+  std::condition_variable file_io_cond_;
+  // Guarded by file_io_mutex_.
+  std::list<std::function<void()>> file_io_queue_;
+
   BitMap tls_bitmap_;
   uint32_t ke_timestamp_bundle_ptr_ = 0;
   std::unique_ptr<xe::threading::HighResolutionTimer> timestamp_timer_;
@@ -11,9 +11,12 @@
 
 #include <algorithm>
 #include <cstring>
+#include <iterator>
+#include <new>
 
 #include "xenia/base/byte_stream.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/threading.h"
 #include "xenia/kernel/xobject.h"
 #include "xenia/kernel/xthread.h"
 
@@ -23,42 +26,159 @@ namespace util {
 
 ObjectTable::ObjectTable() {}
 
-ObjectTable::~ObjectTable() { Reset(); }
+ObjectTable::~ObjectTable() {
+  Reset();
+  // No lookups in a table being destroyed.
+  auto global_lock = global_critical_region_.Acquire();
+  ReclaimRetired(true);
+}
 
 void ObjectTable::Reset() {
   auto global_lock = global_critical_region_.Acquire();
 
   // Release all objects.
-  for (uint32_t n = 0; n < table_capacity_; n++) {
-    ObjectTableEntry& entry = table_[n];
-    if (entry.object) {
-      entry.object->Release();
-    }
-  }
-  for (uint32_t n = 0; n < host_table_capacity_; n++) {
-    ObjectTableEntry& entry = host_table_[n];
-    if (entry.object) {
-      entry.object->Release();
+  for (EntryTable* table : {&table_, &host_table_}) {
+    for (uint32_t n = 0; n < table->capacity(); n++) {
+      XObject* object = (*table)[n].object.exchange(nullptr);
+      if (object) {
+        RetireObject(object);
+      }
     }
+    // Lookups may still be reading the storage even if there were no objects.
+    RetireStorage(table->Clear());
   }
+  ReclaimRetired();
 
-  table_capacity_ = 0;
-  host_table_capacity_ = 0;
   last_free_entry_ = 0;
   last_free_host_entry_ = 0;
-  free(table_);
-  table_ = nullptr;
-  free(host_table_);
-  host_table_ = nullptr;
+}
+
+ObjectTable::ObjectTableEntry* ObjectTable::EntryTable::Find(
+    uint32_t slot) const {
+  const Directory* directory = directory_.load(std::memory_order_acquire);
+  if (!directory || slot >= directory->capacity) {
+    return nullptr;
+  }
+  return &directory->pages[slot >> kPageShift][slot & (kPageSize - 1)];
+}
+
+bool ObjectTable::EntryTable::Resize(uint32_t new_capacity) {
+  size_t new_page_count = (size_t(new_capacity) + kPageSize - 1) >> kPageShift;
+  while (pages_.size() < new_page_count) {
+    // Value-initialized, so the entries are empty.
+    auto page = std::unique_ptr<ObjectTableEntry[]>(
+        new (std::nothrow) ObjectTableEntry[kPageSize]());
+    if (!page) {
+      return false;
+    }
+    pages_.push_back(std::move(page));
+  }
+  // Entries of pages kept from before the table was shrunk.
+  for (uint32_t slot = capacity_; slot < new_capacity; ++slot) {
+    ObjectTableEntry& entry = (*this)[slot];
+    entry.handle_ref_count = 0;
+    entry.object.store(nullptr);
+  }
+
+  auto directory = std::make_unique<Directory>();
+  directory->capacity = new_capacity;
+  directory->pages.reserve(new_page_count);
+  for (size_t i = 0; i < new_page_count; ++i) {
+    directory->pages.push_back(pages_[i].get());
+  }
+  directory_.store(directory.get(), std::memory_order_release);
+  directories_.push_back(std::move(directory));
+  capacity_ = new_capacity;
+  return true;
+}
+
+std::unique_ptr<ObjectTable::EntryTable::Storage>
+ObjectTable::EntryTable::Clear() {
+  directory_.store(nullptr, std::memory_order_release);
+  capacity_ = 0;
+  auto storage = std::make_unique<Storage>();
+  storage->pages = std::move(pages_);
+  storage->directories = std::move(directories_);
+  pages_.clear();
+  directories_.clear();
+  return storage;
+}
+
+uint32_t ObjectTable::ReaderEpochs::Enter() {
+  static std::atomic<uint32_t> next_stripe = 0;
+  thread_local uint32_t stripe = next_stripe++ % kStripeCount;
+  uint32_t counter_index = (epoch_.load() & 1) * kStripeCount + stripe;
+  // Sequentially consistent, so the entry is read after this is visible to
+  // TryAdvance.
+  counters_[counter_index].count.fetch_add(1);
+  return counter_index;
+}
+
+void ObjectTable::ReaderEpochs::Exit(uint32_t counter_index) {
+  counters_[counter_index].count.fetch_sub(1, std::memory_order_release);
+}
+
+bool ObjectTable::ReaderEpochs::IsDrained(uint32_t parity) const {
+  for (uint32_t i = 0; i < kStripeCount; ++i) {
+    if (counters_[parity * kStripeCount + i].count.load()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void ObjectTable::ReaderEpochs::TryAdvance() {
+  // The set for the epoch before the current one is the same as for the next.
+  // A lookup may have read the epoch before the previous advance and counted
+  // itself in that set afterwards, but then it has read the entry after the
+  // removal too.
+  uint32_t epoch = epoch_.load();
+  if (IsDrained((epoch + 1) & 1)) {
+    epoch_.compare_exchange_strong(epoch, epoch + 1);
+  }
+}
+
+void ObjectTable::RetireObject(XObject* object) {
+  // The epoch is read after the object has been removed from the entry.
+  retired_.push_back({reader_epochs_.epoch(), object, nullptr});
+}
+
+void ObjectTable::RetireStorage(std::unique_ptr<EntryTable::Storage> storage) {
+  retired_.push_back({reader_epochs_.epoch(), nullptr, std::move(storage)});
+}
+
+void ObjectTable::ReclaimRetired(bool force) {
+  if (retired_.empty()) {
+    return;
+  }
+  if (!force) {
+    reader_epochs_.TryAdvance();
+    reader_epochs_.TryAdvance();
+  }
+  // Releasing objects may reenter the table, so take them out of the list
+  // first.
+  std::vector<RetiredItem> reclaimed;
+  auto retired_end = std::stable_partition(
+      retired_.begin(), retired_.end(), [this, force](const RetiredItem& item) {
+        return !force && !reader_epochs_.HasPassed(item.epoch);
+      });
+  std::move(retired_end, retired_.end(), std::back_inserter(reclaimed));
+  retired_.erase(retired_end, retired_.end());
+  for (RetiredItem& item : reclaimed) {
+    if (item.object) {
+      item.object->Release();
+    }
+  }
 }
 
 X_STATUS ObjectTable::FindFreeSlot(uint32_t* out_slot, bool host) {
   // Find a free slot.
   uint32_t slot = host ? last_free_host_entry_ : last_free_entry_;
-  uint32_t capacity = host ? host_table_capacity_ : table_capacity_;
+  EntryTable& table = host ? host_table_ : table_;
+  uint32_t capacity = table.capacity();
   uint32_t scan_count = 0;
   while (scan_count < capacity) {
-    ObjectTableEntry& entry = host ? host_table_[slot] : table_[slot];
+    ObjectTableEntry& entry = table[slot];
     if (!entry.object) {
       *out_slot = slot;
       return X_STATUS_SUCCESS;
@@ -86,29 +206,16 @@ X_STATUS ObjectTable::FindFreeSlot(uint32_t* out_slot, bool host) {
 }
 
 bool ObjectTable::Resize(uint32_t new_capacity, bool host) {
-  uint32_t capacity = host ? host_table_capacity_ : table_capacity_;
-  uint32_t new_size = new_capacity * sizeof(ObjectTableEntry);
-  uint32_t old_size = capacity * sizeof(ObjectTableEntry);
-  auto new_table = reinterpret_cast<ObjectTableEntry*>(
-      realloc(host ? host_table_ : table_, new_size));
-  if (!new_table) {
+  EntryTable& table = host ? host_table_ : table_;
+  uint32_t capacity = table.capacity();
+  if (!table.Resize(new_capacity)) {
     return false;
   }
 
-  // Zero out new entries.
-  if (new_size > old_size) {
-    std::memset(reinterpret_cast<uint8_t*>(new_table) + old_size, 0,
-                new_size - old_size);
-  }
-
   if (host) {
     last_free_host_entry_ = capacity;
-    host_table_capacity_ = new_capacity;
-    host_table_ = new_table;
   } else {
     last_free_entry_ = capacity;
-    table_capacity_ = new_capacity;
-    table_ = new_table;
   }
 
   return true;
@@ -120,6 +227,8 @@ X_STATUS ObjectTable::AddHandle(XObject* object, X_HANDLE* out_handle) {
   uint32_t handle = 0;
   {
     auto global_lock = global_critical_region_.Acquire();
+    // Release what earlier removals left for lookups that are done now.
+    ReclaimRetired();
 
     // Find a free slot.
     uint32_t slot = 0;
@@ -129,8 +238,10 @@ X_STATUS ObjectTable::AddHandle(XObject* object, X_HANDLE* out_handle) {
     // Stash.
     if (XSUCCEEDED(result)) {
       ObjectTableEntry& entry = host_object ? host_table_[slot] : table_[slot];
-      entry.object = object;
       entry.handle_ref_count = 1;
+      // Retain so long as the object is in the table.
+      object->Retain();
+      entry.object.store(object);
       handle = slot << 2;
       if (!host_object) {
         if (object->type() != XObject::Type::Socket) {
@@ -141,9 +252,6 @@ X_STATUS ObjectTable::AddHandle(XObject* object, X_HANDLE* out_handle) {
       }
       object->handles().push_back(handle);
 
-      // Retain so long as the object is in the table.
-      object->Retain();
-
       XELOGI("Added handle:{:08X} for {}", handle, typeid(*object).name());
     }
   }
@@ -218,9 +326,8 @@ X_STATUS ObjectTable::RemoveHandle(X_HANDLE handle) {
     return X_STATUS_INVALID_HANDLE;
   }
 
-  if (entry->object) {
-    auto object = entry->object;
-    entry->object = nullptr;
+  XObject* object = entry->object.exchange(nullptr);
+  if (object) {
     assert_zero(entry->handle_ref_count);
     entry->handle_ref_count = 0;
 
@@ -237,9 +344,10 @@ X_STATUS ObjectTable::RemoveHandle(X_HANDLE handle) {
     if (!object->name().empty()) {
       RemoveNameMapping(object->name());
     }
-    // Release now that the object has been removed from the table.
-    object->Release();
+    // Release once no lookup can be retaining it.
+    RetireObject(object);
   }
+  ReclaimRetired();
 
   return X_STATUS_SUCCESS;
 }
@@ -248,20 +356,14 @@ std::vector<object_ref<XObject>> ObjectTable::GetAllObjects() {
   auto lock = global_critical_region_.Acquire();
   std::vector<object_ref<XObject>> results;
 
-  for (uint32_t slot = 0; slot < host_table_capacity_; slot++) {
-    auto& entry = host_table_[slot];
-    if (entry.object && std::find(results.begin(), results.end(),
-                                  entry.object) == results.end()) {
-      entry.object->Retain();
-      results.push_back(object_ref<XObject>(entry.object));
-    }
-  }
-  for (uint32_t slot = 0; slot < table_capacity_; slot++) {
-    auto& entry = table_[slot];
-    if (entry.object && std::find(results.begin(), results.end(),
-                                  entry.object) == results.end()) {
-      entry.object->Retain();
-      results.push_back(object_ref<XObject>(entry.object));
+  for (EntryTable* table : {&host_table_, &table_}) {
+    for (uint32_t slot = 0; slot < table->capacity(); slot++) {
+      XObject* object = (*table)[slot].object.load();
+      if (object && std::find(results.begin(), results.end(), object) ==
+                        results.end()) {
+        object->Retain();
+        results.push_back(object_ref<XObject>(object));
+      }
     }
   }
 
@@ -270,15 +372,15 @@ std::vector<object_ref<XObject>> ObjectTable::GetAllObjects() {
 
 void ObjectTable::PurgeAllObjects() {
   auto lock = global_critical_region_.Acquire();
-  for (uint32_t slot = 0; slot < table_capacity_; slot++) {
+  for (uint32_t slot = 0; slot < table_.capacity(); slot++) {
     auto& entry = table_[slot];
-    if (entry.object) {
+    XObject* object = entry.object.exchange(nullptr);
+    if (object) {
       entry.handle_ref_count = 0;
-      entry.object->Release();
-
-      entry.object = nullptr;
+      RetireObject(object);
     }
   }
+  ReclaimRetired();
 }
 
 ObjectTable::ObjectTableEntry* ObjectTable::LookupTable(X_HANDLE handle) {
@@ -294,12 +396,9 @@ ObjectTable::ObjectTableEntry* ObjectTable::LookupTableInLock(X_HANDLE handle) {
 
   const bool is_host_object = XObject::is_handle_host_object(handle);
   uint32_t slot = GetHandleSlot(handle, is_host_object);
-  if (is_host_object) {
-    if (slot <= host_table_capacity_) {
-      return &host_table_[slot];
-    }
-  } else if (slot <= table_capacity_) {
-    return &table_[slot];
+  EntryTable& table = is_host_object ? host_table_ : table_;
+  if (slot < table.capacity()) {
+    return &table[slot];
   }
 
   return nullptr;
@@ -320,37 +419,22 @@ XObject* ObjectTable::LookupObject(X_HANDLE handle, bool already_locked) {
     return nullptr;
   }
 
-  XObject* object = nullptr;
-  if (!already_locked) {
-    global_critical_region_.mutex().lock();
-  }
-
+  // No lock needed - entries are only released after the lookups that may
+  // have read them are done, so the object stays alive until it's retained.
   const bool is_host_object = XObject::is_handle_host_object(handle);
   uint32_t slot = GetHandleSlot(handle, is_host_object);
-
-  // Verify slot.
-  if (is_host_object) {
-    if (slot < host_table_capacity_) {
-      ObjectTableEntry& entry = host_table_[slot];
-      if (entry.object) {
-        object = entry.object;
-      }
-    }
-  } else if (slot < table_capacity_) {
-    ObjectTableEntry& entry = table_[slot];
-    if (entry.object) {
-      object = entry.object;
+  uint32_t reader_counter = reader_epochs_.Enter();
+  XObject* object = nullptr;
+  ObjectTableEntry* entry =
+      (is_host_object ? host_table_ : table_).Find(slot);
+  if (entry) {
+    object = entry->object.load();
+    // Retain the object pointer.
+    if (object) {
+      object->Retain();
     }
   }
-
-  // Retain the object pointer.
-  if (object) {
-    object->Retain();
-  }
-
-  if (!already_locked) {
-    global_critical_region_.mutex().unlock();
-  }
+  reader_epochs_.Exit(reader_counter);
 
   return object;
 }
@@ -358,21 +442,14 @@ XObject* ObjectTable::LookupObject(X_HANDLE handle, bool already_locked) {
 void ObjectTable::GetObjectsByType(XObject::Type type,
                                    std::vector<object_ref<XObject>>* results) {
   auto global_lock = global_critical_region_.Acquire();
-  for (uint32_t slot = 0; slot < host_table_capacity_; ++slot) {
-    auto& entry = host_table_[slot];
-    if (entry.object) {
-      if (entry.object->type() == type) {
-        entry.object->Retain();
-        results->push_back(object_ref<XObject>(entry.object));
-      }
-    }
-  }
-  for (uint32_t slot = 0; slot < table_capacity_; ++slot) {
-    auto& entry = table_[slot];
-    if (entry.object) {
-      if (entry.object->type() == type) {
-        entry.object->Retain();
-        results->push_back(object_ref<XObject>(entry.object));
+  for (EntryTable* table : {&host_table_, &table_}) {
+    for (uint32_t slot = 0; slot < table->capacity(); ++slot) {
+      XObject* object = (*table)[slot].object.load();
+      if (object) {
+        if (object->type() == type) {
+          object->Retain();
+          results->push_back(object_ref<XObject>(object));
+        }
       }
     }
   }
@@ -431,14 +508,14 @@ X_STATUS ObjectTable::GetObjectByName(const std::string_view name,
 }
 
 bool ObjectTable::Save(ByteStream* stream) {
-  stream->Write<uint32_t>(host_table_capacity_);
-  for (uint32_t i = 0; i < host_table_capacity_; i++) {
+  stream->Write<uint32_t>(host_table_.capacity());
+  for (uint32_t i = 0; i < host_table_.capacity(); i++) {
     auto& entry = host_table_[i];
     stream->Write<int32_t>(entry.handle_ref_count);
   }
 
-  stream->Write<uint32_t>(table_capacity_);
-  for (uint32_t i = 0; i < table_capacity_; i++) {
+  stream->Write<uint32_t>(table_.capacity());
+  for (uint32_t i = 0; i < table_.capacity(); i++) {
     auto& entry = table_[i];
     stream->Write<int32_t>(entry.handle_ref_count);
   }
@@ -448,14 +525,14 @@ bool ObjectTable::Save(ByteStream* stream) {
 
 bool ObjectTable::Restore(ByteStream* stream) {
   Resize(stream->Read<uint32_t>(), true);
-  for (uint32_t i = 0; i < host_table_capacity_; i++) {
+  for (uint32_t i = 0; i < host_table_.capacity(); i++) {
     auto& entry = host_table_[i];
     // entry.object = nullptr;
     entry.handle_ref_count = stream->Read<int32_t>();
   }
 
   Resize(stream->Read<uint32_t>(), false);
-  for (uint32_t i = 0; i < table_capacity_; i++) {
+  for (uint32_t i = 0; i < table_.capacity(); i++) {
     auto& entry = table_[i];
     // entry.object = nullptr;
     entry.handle_ref_count = stream->Read<int32_t>();
@@ -467,13 +544,13 @@ bool ObjectTable::Restore(ByteStream* stream) {
 X_STATUS ObjectTable::RestoreHandle(X_HANDLE handle, XObject* object) {
   const bool is_host_object = XObject::is_handle_host_object(handle);
   uint32_t slot = GetHandleSlot(handle, is_host_object);
-  uint32_t capacity = is_host_object ? host_table_capacity_ : table_capacity_;
-  assert_true(capacity >= slot);
+  EntryTable& table = is_host_object ? host_table_ : table_;
+  assert_true(table.capacity() > slot);
 
-  if (capacity >= slot) {
-    auto& entry = is_host_object ? host_table_[slot] : table_[slot];
-    entry.object = object;
+  if (table.capacity() > slot) {
+    auto& entry = table[slot];
     object->Retain();
+    entry.object.store(object);
   }
 
   return X_STATUS_SUCCESS;
@@ -10,11 +10,14 @@
 #ifndef XENIA_KERNEL_UTIL_OBJECT_TABLE_H_
 #define XENIA_KERNEL_UTIL_OBJECT_TABLE_H_
 
+#include <atomic>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
 #include "xenia/base/mutex.h"
+#include "xenia/base/platform.h"
 #include "xenia/base/string_key.h"
 #include "xenia/kernel/xobject.h"
 #include "xenia/xbox.h"
@@ -47,6 +50,8 @@ class ObjectTable {
   // Restores a XObject reference with a handle. Mainly for internal use - do
   // not use.
   X_STATUS RestoreHandle(X_HANDLE handle, XObject* object);
+  // Lookups don't take the lock, already_locked is only kept for callers that
+  // hold it for other reasons.
   template <typename T>
   object_ref<T> LookupObject(X_HANDLE handle, bool already_locked = false) {
     auto object = LookupObject(handle, already_locked);
@@ -82,9 +87,82 @@ class ObjectTable {
 
  private:
   struct ObjectTableEntry {
+    // Only accessed with the lock held.
     int handle_ref_count = 0;
-    XObject* object = nullptr;
+    // Written with the lock held, read by lookups without it.
+    std::atomic<XObject*> object{nullptr};
   };
+
+  // Entries are stored in fixed size pages that stay in place as the table
+  // grows, so lookups can read them without the lock while another thread
+  // resizes the table. The pages are found through a directory that is
+  // replaced, not modified, when the table grows - old directories are kept
+  // until the table is reset, as lookups may still be reading them.
+  class EntryTable {
+   public:
+    struct Directory {
+      uint32_t capacity;
+      std::vector<ObjectTableEntry*> pages;
+    };
+    struct Storage {
+      std::vector<std::unique_ptr<ObjectTableEntry[]>> pages;
+      std::vector<std::unique_ptr<Directory>> directories;
+    };
+
+    uint32_t capacity() const { return capacity_; }
+    // Lock must be held, slot must be below the capacity.
+    ObjectTableEntry& operator[](uint32_t slot) {
+      return pages_[slot >> kPageShift][slot & (kPageSize - 1)];
+    }
+    // Returns nullptr if the slot is out of range. Doesn't need the lock, but
+    // must be done within a ReaderEpochs section.
+    ObjectTableEntry* Find(uint32_t slot) const;
+    bool Resize(uint32_t new_capacity);
+    // Makes the table empty for lookups started afterwards, returning the
+    // storage, which must only be freed once earlier lookups are done.
+    std::unique_ptr<Storage> Clear();
+
+   private:
+    static constexpr uint32_t kPageShift = 12;
+    static constexpr uint32_t kPageSize = uint32_t(1) << kPageShift;
+
+    uint32_t capacity_ = 0;
+    std::vector<std::unique_ptr<ObjectTableEntry[]>> pages_;
+    std::vector<std::unique_ptr<Directory>> directories_;
+    std::atomic<const Directory*> directory_{nullptr};
+  };
+
+  // Tells when lookups that may have read an object from an entry before it
+  // was cleared are done, so the reference the table held can be released.
+  // Lookups count themselves in one of two sets of counters, selected by the
+  // parity of the epoch. The epoch is only advanced once the set of lookups
+  // from the epoch before the current one has drained, so when it has been
+  // advanced twice since something was removed, no lookup that may have seen
+  // it is left. Nothing ever waits for lookups - a thread suspended in one
+  // only delays releasing what was removed.
+  class ReaderEpochs {
+   public:
+    // Returns the counter to pass to Exit.
+    uint32_t Enter();
+    void Exit(uint32_t counter_index);
+    uint32_t epoch() const { return epoch_.load(); }
+    // Advances the epoch if possible, without waiting.
+    void TryAdvance();
+    // Whether all lookups that may have started by the epoch are done.
+    bool HasPassed(uint32_t epoch) const { return epoch_.load() - epoch >= 2; }
+
+   private:
+    // Counters are spread across cache lines by thread to avoid contention.
+    static constexpr uint32_t kStripeCount = 8;
+    struct alignas(XE_HOST_CACHE_LINE_SIZE) Counter {
+      std::atomic<uint32_t> count{0};
+    };
+    bool IsDrained(uint32_t parity) const;
+
+    std::atomic<uint32_t> epoch_{0};
+    Counter counters_[2 * kStripeCount];
+  };
+
   ObjectTableEntry* LookupTableInLock(X_HANDLE handle);
   ObjectTableEntry* LookupTable(X_HANDLE handle);
   XObject* LookupObject(X_HANDLE handle, bool already_locked);
@@ -98,12 +176,24 @@ class ObjectTable {
   }
   X_STATUS FindFreeSlot(uint32_t* out_slot, bool host);
   bool Resize(uint32_t new_capacity, bool host);
+  // Objects removed from entries, and storage of cleared tables, waiting for
+  // lookups that may still be accessing them to be done. Lock must be held.
+  void RetireObject(XObject* object);
+  void RetireStorage(std::unique_ptr<EntryTable::Storage> storage);
+  // Releases what no lookup can be accessing anymore, or everything if force
+  // is true. Lock must be held.
+  void ReclaimRetired(bool force = false);
 
   xe::global_critical_region global_critical_region_;
-  uint32_t table_capacity_ = 0;
-  uint32_t host_table_capacity_ = 0;
-  ObjectTableEntry* table_ = nullptr;
-  ObjectTableEntry* host_table_ = nullptr;
+  ReaderEpochs reader_epochs_;
+  struct RetiredItem {
+    uint32_t epoch;
+    XObject* object;
+    std::unique_ptr<EntryTable::Storage> storage;
+  };
+  std::vector<RetiredItem> retired_;
+  EntryTable table_;
+  EntryTable host_table_;
   uint32_t last_free_entry_ = 0;
   uint32_t last_free_host_entry_ = 0;
   std::unordered_map<string_key_case, X_HANDLE> name_table_;
@@ -125,6 +125,62 @@ dword_result_t NtOpenFile_entry(
 }
 DECLARE_XBOXKRNL_EXPORT1(NtOpenFile, kFileSystem, kImplemented);
 
+// Whether a read from the file can be completed asynchronously. Reads at the
+// end of the file still fail immediately with X_STATUS_END_OF_FILE, and reads
+// from the current position must be serialized, so they're done right away.
+static bool IsAsyncRead(const XFile* file, const uint64_t* byte_offset) {
+  if (file->is_synchronous() || !byte_offset ||
+      !kernel_state()->has_file_io_threads()) {
+    return false;
+  }
+  // The size of the entry may be outdated if the file has been written to.
+  file->entry()->update();
+  return *byte_offset < file->entry()->size();
+}
+
+// Performs the read on a file I/O thread, and completes it the way an
+// overlapped read completes: the status block is written, the event is
+// signaled, and the APC is queued to the thread that requested the read.
+static void QueueAsyncRead(object_ref<XFile> file, object_ref<XEvent> ev,
+                           uint32_t apc_routine, uint32_t apc_context,
+                           uint32_t io_status_block_ptr,
+                           std::function<X_STATUS(uint32_t*)> read) {
+  // Both the event and the file itself are signaled when the read completes,
+  // like the event of the file object on NT.
+  file->ResetAsyncEvent();
+  if (ev) {
+    ev->Reset();
+  }
+  if (io_status_block_ptr) {
+    auto io_status_block =
+        kernel_memory()->TranslateVirtual<X_IO_STATUS_BLOCK*>(
+            io_status_block_ptr);
+    io_status_block->status = X_STATUS_PENDING;
+    io_status_block->information = 0;
+  }
+  auto thread = retain_object(XThread::GetCurrentThread());
+  kernel_state()->QueueFileIO([file, ev, thread, apc_routine, apc_context,
+                               io_status_block_ptr, read]() {
+    uint32_t bytes_read = 0;
+    X_STATUS result = read(&bytes_read);
+    if (io_status_block_ptr) {
+      auto io_status_block =
+          kernel_memory()->TranslateVirtual<X_IO_STATUS_BLOCK*>(
+              io_status_block_ptr);
+      io_status_block->status = result;
+      io_status_block->information = bytes_read;
+    }
+    // Low bit probably means do not queue to IO ports.
+    if ((apc_routine & ~1u) && apc_context) {
+      thread->EnqueueApc(apc_routine & ~1u, apc_context, io_status_block_ptr,
+                         0);
+    }
+    if (ev) {
+      ev->Set(0, false);
+    }
+  });
+}
+
 dword_result_t NtReadFile_entry(dword_t file_handle, dword_t event_handle,
                                 lpvoid_t apc_routine_ptr, lpvoid_t apc_context,
                                 pointer_t<X_IO_STATUS_BLOCK> io_status_block,
@@ -144,7 +200,8 @@ dword_result_t NtReadFile_entry(dword_t file_handle, dword_t event_handle,
   }
 
   if (XSUCCEEDED(result)) {
-    if (true || file->is_synchronous()) {
+    uint64_t byte_offset = byte_offset_ptr ? uint64_t(*byte_offset_ptr) : 0;
+    if (!IsAsyncRead(file.get(), byte_offset_ptr ? &byte_offset : nullptr)) {
       // Synchronous.
       uint32_t bytes_read = 0;
       result = file->Read(
@@ -175,23 +232,17 @@ dword_result_t NtReadFile_entry(dword_t file_handle, dword_t event_handle,
       // we have written the info out.
       signal_event = true;
     } else {
-      // TODO(benvanik): async.
-
-      // X_STATUS_PENDING if not returning immediately.
-      // XFile is waitable and signalled after each async req completes.
-      // reset the input event (->Reset())
-      /*xeNtReadFileState* call_state = new xeNtReadFileState();
-      XAsyncRequest* request = new XAsyncRequest(
-      state, file,
-      (XAsyncRequest::CompletionCallback)xeNtReadFileCompleted,
-      call_state);*/
-      // result = file->Read(buffer.guest_address(), buffer_length, byte_offset,
-      //                     request);
-      if (io_status_block) {
-        io_status_block->status = X_STATUS_PENDING;
-        io_status_block->information = 0;
-      }
-
+      // XFile is waitable and signaled after each async request completes.
+      uint32_t buffer_ptr = buffer.guest_address();
+      uint32_t length = buffer_length;
+      uint32_t context = apc_context.guest_address();
+      QueueAsyncRead(file, ev, apc_routine_ptr.guest_address(), context,
+                     io_status_block.guest_address(),
+                     [file, buffer_ptr, length, byte_offset,
+                      context](uint32_t* bytes_read) {
+                       return file->Read(buffer_ptr, length, byte_offset,
+                                         bytes_read, context);
+                     });
       result = X_STATUS_PENDING;
     }
   }
@@ -227,7 +278,8 @@ dword_result_t NtReadFileScatter_entry(
   }
 
   if (XSUCCEEDED(result)) {
-    if (true || file->is_synchronous()) {
+    uint64_t byte_offset = byte_offset_ptr ? uint64_t(*byte_offset_ptr) : 0;
+    if (!IsAsyncRead(file.get(), byte_offset_ptr ? &byte_offset : nullptr)) {
       // Synchronous.
       uint32_t bytes_read = 0;
       result = file->ReadScatter(
@@ -258,26 +310,19 @@ dword_result_t NtReadFileScatter_entry(
       // we have written the info out.
       signal_event = true;
     } else {
-      // TODO(benvanik): async.
-
       // TODO: On Windows it might be worth trying to use Win32 ReadFileScatter
       // here instead of handling it ourselves
-
-      // X_STATUS_PENDING if not returning immediately.
-      // XFile is waitable and signalled after each async req completes.
-      // reset the input event (->Reset())
-      /*xeNtReadFileState* call_state = new xeNtReadFileState();
-      XAsyncRequest* request = new XAsyncRequest(
-      state, file,
-      (XAsyncRequest::CompletionCallback)xeNtReadFileCompleted,
-      call_state);*/
-      // result = file->Read(buffer.guest_address(), buffer_length, byte_offset,
-      //                     request);
-      if (io_status_block) {
-        io_status_block->status = X_STATUS_PENDING;
-        io_status_block->information = 0;
-      }
-
+      uint32_t segments_ptr = segment_array.guest_address();
+      uint32_t scatter_length = length;
+      uint32_t context = apc_context.guest_address();
+      QueueAsyncRead(file, ev, apc_routine_ptr.guest_address(), context,
+                     io_status_block.guest_address(),
+                     [file, segments_ptr, scatter_length, byte_offset,
+                      context](uint32_t* bytes_read) {
+                       return file->ReadScatter(segments_ptr, scatter_length,
+                                                byte_offset, bytes_read,
+                                                context);
+                     });
       result = X_STATUS_PENDING;
     }
   }
@@ -597,6 +597,55 @@ static void CriticalSectionPrefetchW(const void* vp) {
 #endif
 }
 
+// Contended critical sections are waited on by parking the thread on the
+// address of the signal state of the header with a host futex, rather than
+// through an XEvent created for the header - the signal state is the number
+// of ownership handoffs from leaving threads that waiters haven't taken yet.
+// Like the auto-reset event, a handoff made before the waiter parks isn't
+// lost.
+static volatile uint32_t* GetCriticalSectionSignalState(
+    X_RTL_CRITICAL_SECTION* cs) {
+  return reinterpret_cast<volatile uint32_t*>(&cs->header.signal_state);
+}
+
+static void SignalCriticalSection(X_RTL_CRITICAL_SECTION* cs) {
+  volatile uint32_t* signal_state = GetCriticalSectionSignalState(cs);
+  // Big-endian like the rest of the header.
+  uint32_t value;
+  do {
+    value = *signal_state;
+  } while (!xe::atomic_cas(
+      value, xe::byte_swap(xe::byte_swap(value) + 1), signal_state));
+  xe::threading::WakeByAddressSingle(signal_state);
+}
+
+static void WaitForCriticalSection(X_RTL_CRITICAL_SECTION* cs) {
+  volatile uint32_t* signal_state = GetCriticalSectionSignalState(cs);
+  XThreadGuestWaitScope guest_wait_scope;
+  while (true) {
+    uint32_t value = *signal_state;
+    if (!value) {
+      xe::threading::WaitOnAddress(signal_state, 0);
+      continue;
+    }
+    if (xe::atomic_cas(value, xe::byte_swap(xe::byte_swap(value) - 1),
+                       signal_state)) {
+      break;
+    }
+  }
+}
+
+// Whether the thread owning the critical section is blocked itself, so it
+// won't leave the critical section soon and spinning is pointless.
+static bool IsCriticalSectionOwnerWaiting(X_RTL_CRITICAL_SECTION* cs) {
+  uint32_t owning_thread = cs->owning_thread;
+  if (!owning_thread) {
+    return false;
+  }
+  auto owner = kernel_memory()->TranslateVirtual<X_KTHREAD*>(owning_thread);
+  return owner->thread_state == X_KTHREAD_STATE_WAITING;
+}
+
 void RtlEnterCriticalSection_entry(pointer_t<X_RTL_CRITICAL_SECTION> cs) {
   if (!cs.guest_address()) {
     XELOGE("Null critical section in RtlEnterCriticalSection!");
@@ -613,7 +662,7 @@ void RtlEnterCriticalSection_entry(pointer_t<X_RTL_CRITICAL_SECTION> cs) {
     return;
   }
 
-  // Spin loop
+  // Spin loop, for as long as the owner may be about to leave.
   while (spin_count--) {
     if (xe::atomic_cas(-1, 0, &cs->lock_count)) {
       // Acquired.
@@ -621,12 +670,14 @@ void RtlEnterCriticalSection_entry(pointer_t<X_RTL_CRITICAL_SECTION> cs) {
       cs->recursion_count = 1;
       return;
     }
+    if (!(spin_count & 63) && IsCriticalSectionOwnerWaiting(cs)) {
+      break;
+    }
   }
 
   if (xe::atomic_inc(&cs->lock_count) != 0) {
-    // Create a full waiter.
-    xeKeWaitForSingleObject(reinterpret_cast<void*>(cs.host_address()), 8, 0, 0,
-                            nullptr);
+    // Park until a leaving thread hands the ownership over.
+    WaitForCriticalSection(cs);
   }
 
   assert_true(cs->owning_thread == 0);
@@ -683,7 +734,7 @@ void RtlLeaveCriticalSection_entry(pointer_t<X_RTL_CRITICAL_SECTION> cs) {
   cs->owning_thread = 0;
   if (xe::atomic_dec(&cs->lock_count) != -1) {
     // There were waiters - wake one of them.
-    xeKeSetEvent(reinterpret_cast<X_KEVENT*>(cs.host_address()), 1, 0);
+    SignalCriticalSection(cs);
   }
 }
 DECLARE_XBOXKRNL_EXPORT2(RtlLeaveCriticalSection, kNone, kImplemented,
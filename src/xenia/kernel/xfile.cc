@@ -98,7 +98,7 @@ X_STATUS XFile::Read(uint32_t buffer_guest_address, uint32_t buffer_length,
                      uint32_t apc_context, bool notify_completion) {
   if (byte_offset == uint64_t(-1)) {
     // Read from current position.
-    byte_offset = position_;
+    byte_offset = position_.load();
   }
 
   size_t bytes_read = 0;
@@ -241,7 +241,7 @@ X_STATUS XFile::Write(uint32_t buffer_guest_address, uint32_t buffer_length,
                       uint32_t apc_context) {
   if (byte_offset == uint64_t(-1)) {
     // Write from current position.
-    byte_offset = position_;
+    byte_offset = position_.load();
   }
 
   size_t bytes_written = 0;
@@ -301,7 +301,7 @@ bool XFile::Save(ByteStream* stream) {
   }
 
   stream->Write(file_->entry()->absolute_path());
-  stream->Write<uint64_t>(position_);
+  stream->Write<uint64_t>(position_.load());
   stream->Write(file_access());
   stream->Write<bool>(
       (file_->entry()->attributes() & vfs::kFileAttributeDirectory) != 0);
@@ -10,6 +10,7 @@
 #ifndef XENIA_KERNEL_XFILE_H_
 #define XENIA_KERNEL_XFILE_H_
 
+#include <atomic>
 #include <string>
 
 #include "xenia/kernel/xevent.h"
@@ -144,7 +145,7 @@ class XFile : public XObject {
   const std::string& path() const { return file_->entry()->path(); }
   const std::string& name() const { return file_->entry()->name(); }
 
-  uint64_t position() const { return position_; }
+  uint64_t position() const { return position_.load(); }
   void set_position(uint64_t value) { position_ = value; }
 
   X_STATUS QueryDirectory(X_FILE_DIRECTORY_INFORMATION* out_info, size_t length,
@@ -177,6 +178,10 @@ class XFile : public XObject {
 
   bool is_synchronous() const { return is_synchronous_; }
 
+  // Unsignals the file when an asynchronous request is started, so waiting on
+  // it waits for the request rather than for the previous one.
+  void ResetAsyncEvent() { async_event_->Reset(); }
+
  protected:
   void NotifyIOCompletionPorts(XIOCompletion::IONotification& notification);
 
@@ -195,7 +200,9 @@ class XFile : public XObject {
 
   // TODO(benvanik): create flags, open state, etc.
 
-  uint64_t position_ = 0;
+  // Advanced by asynchronous reads on IO worker threads while guest threads
+  // may be accessing it.
+  std::atomic<uint64_t> position_{0};
 
   xe::filesystem::WildcardEngine find_engine_;
   size_t find_index_ = 0;
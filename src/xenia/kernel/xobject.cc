@@ -9,6 +9,7 @@
 
 #include "xenia/kernel/xobject.h"
 
+#include <utility>
 #include <vector>
 
 #include "xenia/base/byte_stream.h"
@@ -204,8 +205,12 @@ X_STATUS XObject::Wait(uint32_t wait_reason, uint32_t processor_mode,
                         TimeoutTicksToMs(*opt_timeout)))
                   : std::chrono::milliseconds::max();
 
-  auto result =
-      xe::threading::Wait(wait_handle, alertable ? true : false, timeout_ms);
+  xe::threading::WaitResult result;
+  {
+    XThreadGuestWaitScope guest_wait_scope;
+    result =
+        xe::threading::Wait(wait_handle, alertable ? true : false, timeout_ms);
+  }
   switch (result) {
     case xe::threading::WaitResult::kSuccess:
       WaitCallback();
@@ -231,9 +236,13 @@ X_STATUS XObject::SignalAndWait(XObject* signal_object, XObject* wait_object,
                         TimeoutTicksToMs(*opt_timeout)))
                   : std::chrono::milliseconds::max();
 
-  auto result = xe::threading::SignalAndWait(
-      signal_object->GetWaitHandle(), wait_object->GetWaitHandle(),
-      alertable ? true : false, timeout_ms);
+  xe::threading::WaitResult result;
+  {
+    XThreadGuestWaitScope guest_wait_scope;
+    result = xe::threading::SignalAndWait(
+        signal_object->GetWaitHandle(), wait_object->GetWaitHandle(),
+        alertable ? true : false, timeout_ms);
+  }
   switch (result) {
     case xe::threading::WaitResult::kSuccess:
       wait_object->WaitCallback();
@@ -268,8 +277,12 @@ X_STATUS XObject::WaitMultiple(uint32_t count, XObject** objects,
                   : std::chrono::milliseconds::max();
 
   if (wait_type) {
-    auto result = xe::threading::WaitAny(wait_handles, count,
-                                         alertable ? true : false, timeout_ms);
+    std::pair<xe::threading::WaitResult, size_t> result;
+    {
+      XThreadGuestWaitScope guest_wait_scope;
+      result = xe::threading::WaitAny(wait_handles, count,
+                                      alertable ? true : false, timeout_ms);
+    }
     switch (result.first) {
       case xe::threading::WaitResult::kSuccess:
         objects[result.second]->WaitCallback();
@@ -288,8 +301,12 @@ X_STATUS XObject::WaitMultiple(uint32_t count, XObject** objects,
         return X_STATUS_UNSUCCESSFUL;
     }
   } else {
-    auto result = xe::threading::WaitAll(wait_handles, count,
-                                         alertable ? true : false, timeout_ms);
+    xe::threading::WaitResult result;
+    {
+      XThreadGuestWaitScope guest_wait_scope;
+      result = xe::threading::WaitAll(wait_handles, count,
+                                      alertable ? true : false, timeout_ms);
+    }
     switch (result) {
       case xe::threading::WaitResult::kSuccess:
         for (uint32_t i = 0; i < count; i++) {
@@ -145,6 +145,11 @@ void XThread::set_last_error(uint32_t error_code) {
   guest_object<X_KTHREAD>()->last_error = error_code;
 }
 
+void XThread::set_guest_waiting(bool waiting) {
+  guest_object<X_KTHREAD>()->thread_state =
+      waiting ? X_KTHREAD_STATE_WAITING : X_KTHREAD_STATE_RUNNING;
+}
+
 void XThread::set_name(const std::string_view name) {
   thread_name_ = fmt::format("{} ({:08X})", name, handle());
 
@@ -174,6 +174,15 @@ struct X_KPCR {
   uint8_t unk_2AC[0x2C];            // 0x2AC
 };
 
+// Values of X_KTHREAD::thread_state, as KTHREAD_STATE on NT. Only the waiting
+// state is maintained, while threads are blocked in waits where other threads
+// may spin for them.
+enum X_KTHREAD_STATE : uint8_t {
+  X_KTHREAD_STATE_INITIALIZED = 0,
+  X_KTHREAD_STATE_RUNNING = 2,
+  X_KTHREAD_STATE_WAITING = 5,
+};
+
 struct X_KTHREAD {
   X_DISPATCH_HEADER header;       // 0x0
   xe::be<uint32_t> unk_10;        // 0x10
@@ -191,7 +200,7 @@ struct X_KTHREAD {
   xe::be<uint32_t> stack_limit;   // 0x60
   xe::be<uint32_t> stack_kernel;  // 0x64
   xe::be<uint32_t> tls_address;   // 0x68
-  // state = is thread running, suspended, etc
+  // state = is thread running, suspended, etc - X_KTHREAD_STATE
   uint8_t thread_state;  // 0x6C
   // 0x70 = priority?
   uint8_t unk_6D[0x3];        // 0x6D
@@ -307,6 +316,9 @@ class XThread : public XObject, public cpu::Thread {
   uint32_t thread_id() const { return thread_id_; }
   uint32_t last_error();
   void set_last_error(uint32_t error_code);
+  // Marks the thread as blocked in a wait in its X_KTHREAD, telling threads
+  // spinning on locks it owns that it won't release them soon.
+  void set_guest_waiting(bool waiting);
   void set_name(const std::string_view name);
 
   X_STATUS Create();
@@ -389,6 +401,29 @@ class XThread : public XObject, public cpu::Thread {
   int32_t priority_ = 0;
 };
 
+// Marks the current guest thread, if called on one, as waiting while a host
+// wait on its behalf is in scope.
+class XThreadGuestWaitScope {
+ public:
+  XThreadGuestWaitScope()
+      : thread_(XThread::IsInThread() ? XThread::GetCurrentThread()
+                                      : nullptr) {
+    if (thread_) {
+      thread_->set_guest_waiting(true);
+    }
+  }
+  ~XThreadGuestWaitScope() {
+    if (thread_) {
+      thread_->set_guest_waiting(false);
+    }
+  }
+  XThreadGuestWaitScope(const XThreadGuestWaitScope&) = delete;
+  XThreadGuestWaitScope& operator=(const XThreadGuestWaitScope&) = delete;
+
+ private:
+  XThread* thread_;
+};
+
 class XHostThread : public XThread {
  public:
   XHostThread(KernelState* kernel_state, uint32_t stack_size,
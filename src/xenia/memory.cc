@@ -11,9 +11,11 @@
 
 #include <algorithm>
 #include <cstring>
+#include <thread>
 #include <utility>
 
 #include "third_party/fmt/include/fmt/format.h"
+#include "third_party/snappy/snappy.h"
 #include "xenia/base/assert.h"
 #include "xenia/base/byte_stream.h"
 #include "xenia/base/clock.h"
@@ -21,6 +23,7 @@
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/threading.h"
+#include "xenia/base/xxhash.h"
 
 #include "xenia/cpu/mmio_handler.h"
 
@@ -648,24 +651,194 @@ void Memory::DumpMap() {
   XELOGE("");
 }
 
-bool Memory::Save(ByteStream* stream) {
+namespace {
+
+template <typename T>
+void AppendToSnapshot(std::vector<uint8_t>& out, const T& value) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+  out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+void WriteSnapshotChunkHeader(std::vector<uint8_t>& out,
+                              const MemorySnapshotChunk& chunk) {
+  AppendToSnapshot(out, chunk.first_page);
+  AppendToSnapshot(out, chunk.page_count);
+  AppendToSnapshot(out, chunk.hash);
+  AppendToSnapshot(out, chunk.encoding);
+  AppendToSnapshot(out, chunk.data_size);
+}
+
+bool ReadSnapshotChunk(ByteStream* stream, MemorySnapshotChunk& chunk) {
+  constexpr size_t kHeaderSize = sizeof(uint32_t) * 2 + sizeof(uint64_t) +
+                                 sizeof(MemorySnapshotEncoding) +
+                                 sizeof(uint32_t);
+  if (stream->data_length() - stream->offset() < kHeaderSize) {
+    return false;
+  }
+  chunk.first_page = stream->Read<uint32_t>();
+  chunk.page_count = stream->Read<uint32_t>();
+  chunk.hash = stream->Read<uint64_t>();
+  chunk.encoding = stream->Read<MemorySnapshotEncoding>();
+  chunk.data_size = stream->Read<uint32_t>();
+  if (stream->data_length() - stream->offset() < chunk.data_size) {
+    return false;
+  }
+  chunk.data = chunk.data_size ? stream->data() + stream->offset() : nullptr;
+  stream->set_offset(stream->offset() + chunk.data_size);
+  return true;
+}
+
+// length must be a multiple of 8, which it is for whole pages.
+bool IsSnapshotDataZero(const uint8_t* data, size_t length) {
+  const uint64_t* words = reinterpret_cast<const uint64_t*>(data);
+  for (size_t i = 0; i < length / sizeof(uint64_t); ++i) {
+    if (words[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool DecodeSnapshotChunk(const MemorySnapshotChunk& chunk, uint8_t* dest,
+                         size_t dest_size) {
+  switch (chunk.encoding) {
+    case MemorySnapshotEncoding::kZero:
+      std::memset(dest, 0, dest_size);
+      return true;
+    case MemorySnapshotEncoding::kNone:
+      if (chunk.data_size != dest_size) {
+        return false;
+      }
+      std::memcpy(dest, chunk.data, dest_size);
+      return true;
+    case MemorySnapshotEncoding::kSnappy: {
+      size_t uncompressed_size;
+      if (!snappy::GetUncompressedLength(
+              reinterpret_cast<const char*>(chunk.data), chunk.data_size,
+              &uncompressed_size) ||
+          uncompressed_size != dest_size) {
+        return false;
+      }
+      return snappy::RawUncompress(reinterpret_cast<const char*>(chunk.data),
+                                   chunk.data_size,
+                                   reinterpret_cast<char*>(dest));
+    }
+    default:
+      return false;
+  }
+}
+
+}  // namespace
+
+std::unique_ptr<MemorySnapshotBase> MemorySnapshotBase::Parse(
+    const uint8_t* data, size_t size) {
+  ByteStream stream(const_cast<uint8_t*>(data), size);
+  if (size < sizeof(uint32_t)) {
+    return nullptr;
+  }
+  uint32_t heap_count = stream.Read<uint32_t>();
+  if (heap_count > 16) {
+    return nullptr;
+  }
+  auto base = std::make_unique<MemorySnapshotBase>();
+  base->heaps_.resize(heap_count);
+  for (auto& heap_chunks : base->heaps_) {
+    if (size - stream.offset() < sizeof(uint32_t)) {
+      return nullptr;
+    }
+    // Skip the page table.
+    size_t page_table_size = stream.Read<uint32_t>() * sizeof(PageEntry);
+    if (size - stream.offset() < page_table_size + sizeof(uint32_t)) {
+      return nullptr;
+    }
+    stream.set_offset(stream.offset() + page_table_size);
+    uint32_t chunk_count = stream.Read<uint32_t>();
+    for (uint32_t i = 0; i < chunk_count; ++i) {
+      MemorySnapshotChunk chunk;
+      if (!ReadSnapshotChunk(&stream, chunk) ||
+          chunk.encoding == MemorySnapshotEncoding::kBase) {
+        return nullptr;
+      }
+      heap_chunks.emplace(chunk.first_page, chunk);
+    }
+  }
+  return base;
+}
+
+const MemorySnapshotChunk* MemorySnapshotBase::FindChunk(
+    uint32_t heap_index, uint32_t first_page) const {
+  if (heap_index >= heaps_.size()) {
+    return nullptr;
+  }
+  auto it = heaps_[heap_index].find(first_page);
+  return it != heaps_[heap_index].end() ? &it->second : nullptr;
+}
+
+bool Memory::Save(ByteStream* stream, const MemorySnapshotBase* base) {
   XELOGD("Serializing memory...");
-  heaps_.v00000000.Save(stream);
-  heaps_.v40000000.Save(stream);
-  heaps_.v80000000.Save(stream);
-  heaps_.v90000000.Save(stream);
-  heaps_.physical.Save(stream);
+  BaseHeap* heaps[] = {
+      &heaps_.v00000000, &heaps_.v40000000, &heaps_.v80000000,
+      &heaps_.v90000000, &heaps_.physical,
+  };
+  constexpr uint32_t kHeapCount = uint32_t(xe::countof(heaps));
+
+  // Hashing and compression take most of the time, and the heaps are
+  // independent, so each one is written to its own buffer on its own thread.
+  std::vector<uint8_t> heap_data[kHeapCount];
+  std::thread heap_threads[kHeapCount];
+  for (uint32_t i = 0; i < kHeapCount; ++i) {
+    heap_threads[i] = std::thread([&heaps, &heap_data, base, i]() {
+      heaps[i]->Save(heap_data[i], i, base);
+    });
+  }
+  for (std::thread& heap_thread : heap_threads) {
+    heap_thread.join();
+  }
+
+  stream->Write(kHeapCount);
+  for (const std::vector<uint8_t>& data : heap_data) {
+    stream->Write(data.data(), data.size());
+  }
 
   return true;
 }
 
-bool Memory::Restore(ByteStream* stream) {
+bool Memory::Restore(ByteStream* stream, const MemorySnapshotBase* base) {
   XELOGD("Restoring memory...");
-  heaps_.v00000000.Restore(stream);
-  heaps_.v40000000.Restore(stream);
-  heaps_.v80000000.Restore(stream);
-  heaps_.v90000000.Restore(stream);
-  heaps_.physical.Restore(stream);
+  BaseHeap* heaps[] = {
+      &heaps_.v00000000, &heaps_.v40000000, &heaps_.v80000000,
+      &heaps_.v90000000, &heaps_.physical,
+  };
+  constexpr uint32_t kHeapCount = uint32_t(xe::countof(heaps));
+
+  if (stream->Read<uint32_t>() != kHeapCount) {
+    XELOGE("Memory snapshot has an unexpected number of heaps");
+    return false;
+  }
+  std::vector<MemorySnapshotChunk> heap_chunks[kHeapCount];
+  for (uint32_t i = 0; i < kHeapCount; ++i) {
+    if (!heaps[i]->Restore(stream, heap_chunks[i])) {
+      return false;
+    }
+  }
+
+  bool heap_results[kHeapCount];
+  std::thread heap_threads[kHeapCount];
+  for (uint32_t i = 0; i < kHeapCount; ++i) {
+    heap_threads[i] =
+        std::thread([&heaps, &heap_chunks, &heap_results, base, i]() {
+          heap_results[i] = heaps[i]->RestoreChunks(heap_chunks[i], i, base);
+        });
+  }
+  for (std::thread& heap_thread : heap_threads) {
+    heap_thread.join();
+  }
+  for (bool heap_result : heap_results) {
+    if (!heap_result) {
+      XELOGE("Memory snapshot is corrupted or doesn't match its base");
+      return false;
+    }
+  }
 
   return true;
 }
@@ -721,6 +894,7 @@ void BaseHeap::Initialize(Memory* memory, uint8_t* membase, HeapType heap_type,
   host_address_offset_ = host_address_offset;
   page_table_.resize(heap_size / page_size);
   unreserved_page_count_ = uint32_t(page_table_.size());
+  free_pages_.Reset(uint32_t(page_table_.size()));
 }
 
 void BaseHeap::Dispose() {
@@ -787,81 +961,205 @@ void BaseHeap::DumpMap() {
   }
 }
 
-bool BaseHeap::Save(ByteStream* stream) {
+void BaseHeap::Save(std::vector<uint8_t>& out, uint32_t heap_index,
+                    const MemorySnapshotBase* base) {
   XELOGD("Heap {:08X}-{:08X}", heap_base_, heap_base_ + (heap_size_ - 1));
 
-  for (size_t i = 0; i < page_table_.size(); i++) {
-    auto& page = page_table_[i];
-    stream->Write(page.qword);
-    if (!page.state) {
-      // Unallocated.
+  uint32_t page_count = uint32_t(page_table_.size());
+  AppendToSnapshot(out, page_count);
+  const uint8_t* page_table_bytes =
+      reinterpret_cast<const uint8_t*>(page_table_.data());
+  out.insert(out.end(), page_table_bytes,
+             page_table_bytes + sizeof(PageEntry) * page_count);
+  size_t chunk_count_offset = out.size();
+  uint32_t chunk_count = 0;
+  AppendToSnapshot(out, chunk_count);
+
+  uint32_t chunk_max_pages =
+      std::max(kMemorySnapshotChunkSize >> page_size_shift_, uint32_t(1));
+  std::vector<char> compressed(
+      snappy::MaxCompressedLength(chunk_max_pages << page_size_shift_));
+  std::vector<std::pair<uint32_t, memory::PageAccess>> unreadable_pages;
+  uint32_t page_number = 0;
+  while (page_number < page_count) {
+    if (!(page_table_[page_number].state & kMemoryAllocationCommit)) {
+      ++page_number;
       continue;
     }
+    MemorySnapshotChunk chunk = {};
+    chunk.first_page = page_number;
+    uint32_t chunk_end =
+        std::min(xe::round_up(page_number + 1, chunk_max_pages), page_count);
+    while (page_number < chunk_end &&
+           (page_table_[page_number].state & kMemoryAllocationCommit)) {
+      ++page_number;
+    }
+    chunk.page_count = page_number - chunk.first_page;
+    size_t length = size_t(chunk.page_count) << page_size_shift_;
+    const uint8_t* data =
+        TranslateRelative(size_t(chunk.first_page) << page_size_shift_);
+
+    // Only the pages the guest can't read need their protection changed.
+    unreadable_pages.clear();
+    for (uint32_t i = chunk.first_page; i < page_number; ++i) {
+      if (!(page_table_[i].current_protect & kMemoryProtectRead)) {
+        memory::PageAccess old_access;
+        memory::Protect(TranslateRelative(size_t(i) << page_size_shift_),
+                        page_size_, memory::PageAccess::kReadOnly,
+                        &old_access);
+        unreadable_pages.emplace_back(i, old_access);
+      }
+    }
 
-    // TODO(DrChat): write compressed with snappy.
-    if (page.state & kMemoryAllocationCommit) {
-      void* addr = TranslateRelative(i * page_size_);
-
-      memory::PageAccess old_access;
-      memory::Protect(addr, page_size_, memory::PageAccess::kReadWrite,
-                      &old_access);
-
-      stream->Write(addr, page_size_);
+    chunk.hash = XXH3_64bits(data, length);
+    const MemorySnapshotChunk* base_chunk =
+        base ? base->FindChunk(heap_index, chunk.first_page) : nullptr;
+    if (base_chunk && base_chunk->page_count == chunk.page_count &&
+        base_chunk->hash == chunk.hash) {
+      chunk.encoding = MemorySnapshotEncoding::kBase;
+    } else if (IsSnapshotDataZero(data, length)) {
+      chunk.encoding = MemorySnapshotEncoding::kZero;
+    } else {
+      size_t compressed_size;
+      snappy::RawCompress(reinterpret_cast<const char*>(data), length,
+                          compressed.data(), &compressed_size);
+      if (compressed_size < length) {
+        chunk.encoding = MemorySnapshotEncoding::kSnappy;
+        chunk.data_size = uint32_t(compressed_size);
+      } else {
+        chunk.encoding = MemorySnapshotEncoding::kNone;
+        chunk.data_size = uint32_t(length);
+      }
+    }
+    WriteSnapshotChunkHeader(out, chunk);
+    if (chunk.encoding == MemorySnapshotEncoding::kSnappy) {
+      out.insert(out.end(), compressed.data(),
+                 compressed.data() + chunk.data_size);
+    } else if (chunk.encoding == MemorySnapshotEncoding::kNone) {
+      out.insert(out.end(), data, data + length);
+    }
+    ++chunk_count;
 
-      memory::Protect(addr, page_size_, old_access, nullptr);
+    for (const auto& unreadable_page : unreadable_pages) {
+      memory::Protect(
+          TranslateRelative(size_t(unreadable_page.first) << page_size_shift_),
+          page_size_, unreadable_page.second, nullptr);
     }
   }
 
-  return true;
+  std::memcpy(out.data() + chunk_count_offset, &chunk_count,
+              sizeof(chunk_count));
 }
 
-bool BaseHeap::Restore(ByteStream* stream) {
+bool BaseHeap::Restore(ByteStream* stream,
+                       std::vector<MemorySnapshotChunk>& out_chunks) {
   XELOGD("Heap {:08X}-{:08X}", heap_base_, heap_base_ + (heap_size_ - 1));
 
-  for (size_t i = 0; i < page_table_.size(); i++) {
-    auto& page = page_table_[i];
-    page.qword = stream->Read<uint64_t>();
-    if (!page.state) {
-      // Unallocated.
-      continue;
+  uint32_t page_count = uint32_t(page_table_.size());
+  if (stream->Read<uint32_t>() != page_count) {
+    XELOGE("Memory snapshot has a different layout of heap {:08X}",
+           heap_base_);
+    return false;
+  }
+  stream->Read(page_table_.data(), sizeof(PageEntry) * page_count);
+  free_pages_.Reset(page_count);
+  for (uint32_t i = 0; i < page_count; ++i) {
+    if (page_table_[i].state) {
+      free_pages_.MarkUsed(i, 1);
     }
+  }
 
-    memory::PageAccess page_access = memory::PageAccess::kNoAccess;
-    if ((page.current_protect & kMemoryProtectRead) &&
-        (page.current_protect & kMemoryProtectWrite)) {
-      page_access = memory::PageAccess::kReadWrite;
-    } else if (page.current_protect & kMemoryProtectRead) {
-      page_access = memory::PageAccess::kReadOnly;
+  // Commit the memory if it isn't already. We do not need to reserve any
+  // memory, as the mapping has already taken care of that. The protection is
+  // set by RestoreChunks once the contents are written.
+  uint32_t page_number = 0;
+  while (page_number < page_count) {
+    if (!(page_table_[page_number].state & kMemoryAllocationCommit)) {
+      ++page_number;
+      continue;
     }
-
-    // Commit the memory if it isn't already. We do not need to reserve any
-    // memory, as the mapping has already taken care of that.
-    if (page.state & kMemoryAllocationCommit) {
-      xe::memory::AllocFixed(TranslateRelative(i * page_size_), page_size_,
-                             memory::AllocationType::kCommit,
-                             memory::PageAccess::kReadWrite);
+    uint32_t first_page = page_number;
+    while (page_number < page_count &&
+           (page_table_[page_number].state & kMemoryAllocationCommit)) {
+      ++page_number;
     }
+    xe::memory::AllocFixed(
+        TranslateRelative(size_t(first_page) << page_size_shift_),
+        size_t(page_number - first_page) << page_size_shift_,
+        memory::AllocationType::kCommit, memory::PageAccess::kReadWrite);
+  }
+
+  uint32_t chunk_count = stream->Read<uint32_t>();
+  out_chunks.clear();
+  out_chunks.reserve(chunk_count);
+  for (uint32_t i = 0; i < chunk_count; ++i) {
+    MemorySnapshotChunk chunk;
+    if (!ReadSnapshotChunk(stream, chunk) || !chunk.page_count ||
+        chunk.first_page >= page_count ||
+        page_count - chunk.first_page < chunk.page_count) {
+      XELOGE("Memory snapshot of heap {:08X} is corrupted", heap_base_);
+      return false;
+    }
+    out_chunks.push_back(chunk);
+  }
+  return true;
+}
 
-    // Now read into memory. We'll set R/W protection first, then set the
-    // protection back to its previous state.
-    // TODO(DrChat): read compressed with snappy.
-    if (page.state & kMemoryAllocationCommit) {
-      void* addr = TranslateRelative(i * page_size_);
-      xe::memory::Protect(addr, page_size_, memory::PageAccess::kReadWrite,
-                          nullptr);
-
-      stream->Read(addr, page_size_);
+bool BaseHeap::RestoreChunks(const std::vector<MemorySnapshotChunk>& chunks,
+                             uint32_t heap_index,
+                             const MemorySnapshotBase* base) {
+  bool result = true;
+  for (const MemorySnapshotChunk& chunk : chunks) {
+    const MemorySnapshotChunk* source = &chunk;
+    if (chunk.encoding == MemorySnapshotEncoding::kBase) {
+      source = base ? base->FindChunk(heap_index, chunk.first_page) : nullptr;
+      if (!source || source->page_count != chunk.page_count ||
+          source->hash != chunk.hash) {
+        result = false;
+        continue;
+      }
+    }
+    if (!DecodeSnapshotChunk(
+            *source,
+            TranslateRelative(size_t(chunk.first_page) << page_size_shift_),
+            size_t(chunk.page_count) << page_size_shift_)) {
+      result = false;
+    }
+  }
 
-      xe::memory::Protect(addr, page_size_, page_access, nullptr);
+  // Set the protection of the committed pages back, in runs of the same
+  // access.
+  uint32_t page_count = uint32_t(page_table_.size());
+  uint32_t page_number = 0;
+  while (page_number < page_count) {
+    if (!(page_table_[page_number].state & kMemoryAllocationCommit)) {
+      ++page_number;
+      continue;
+    }
+    uint32_t first_page = page_number;
+    memory::PageAccess page_access =
+        ToPageAccess(page_table_[page_number].current_protect);
+    while (page_number < page_count &&
+           (page_table_[page_number].state & kMemoryAllocationCommit) &&
+           ToPageAccess(page_table_[page_number].current_protect) ==
+               page_access) {
+      ++page_number;
+    }
+    if (page_access != memory::PageAccess::kReadWrite) {
+      xe::memory::Protect(
+          TranslateRelative(size_t(first_page) << page_size_shift_),
+          size_t(page_number - first_page) << page_size_shift_, page_access,
+          nullptr);
     }
   }
 
-  return true;
+  return result;
 }
 
 void BaseHeap::Reset() {
   // TODO(DrChat): protect pages.
   std::memset(page_table_.data(), 0, sizeof(PageEntry) * page_table_.size());
+  free_pages_.Reset(uint32_t(page_table_.size()));
   // TODO(Triang3l): Remove access callbacks from pages if this is a physical
   // memory heap.
 }
@@ -970,6 +1268,7 @@ bool BaseHeap::AllocFixed(uint32_t base_address, uint32_t size,
     }
     page_entry.state = kMemoryAllocationReserve | allocation_type;
   }
+  free_pages_.MarkUsed(start_page_number, page_count);
 
   return true;
 }
@@ -1008,93 +1307,25 @@ bool BaseHeap::AllocRange(uint32_t low_address, uint32_t high_address,
   auto global_lock = global_critical_region_.Acquire();
 
   // Find a free page range.
-  // The base page must match the requested alignment, so we first scan for
-  // a free aligned page and only then check for continuous free pages.
-  // TODO(benvanik): optimized searching (free list buckets, bitmap, etc).
-  uint32_t start_page_number = UINT_MAX;
-  uint32_t end_page_number = UINT_MAX;
+  // The base page must match the requested alignment. The free page map skips
+  // over used and free stretches many pages at a time, rather than checking
+  // every candidate base page and the pages after it.
   // chrispy:todo, page_scan_stride is probably always a power of two...
   uint32_t page_scan_stride = alignment >> page_size_shift_;
   high_page_number =
       high_page_number - QuickMod(high_page_number, page_scan_stride);
-  if (top_down) {
-    for (int64_t base_page_number =
-             high_page_number - xe::round_up(page_count, page_scan_stride);
-         base_page_number >= low_page_number;
-         base_page_number -= page_scan_stride) {
-      if (page_table_[base_page_number].state != 0) {
-        // Base page not free, skip to next usable page.
-        continue;
-      }
-      // Check requested range to ensure free.
-      start_page_number = uint32_t(base_page_number);
-      end_page_number = uint32_t(base_page_number) + page_count - 1;
-      assert_true(end_page_number < page_table_.size());
-      bool any_taken = false;
-      for (uint32_t page_number = uint32_t(base_page_number);
-           !any_taken && page_number <= end_page_number; ++page_number) {
-        bool is_free = page_table_[page_number].state == 0;
-        if (!is_free) {
-          // At least one page in the range is used, skip to next.
-          // We know we'll be starting at least before this page.
-          any_taken = true;
-          if (page_count > page_number) {
-            // Not enough space left to fit entire page range. Breaks outer
-            // loop.
-            base_page_number = -1;
-          } else {
-            base_page_number = page_number - page_count;
-            base_page_number -= QuickMod(base_page_number, page_scan_stride);
-            base_page_number += page_scan_stride;  // cancel out loop logic
-          }
-          break;
-        }
-      }
-      if (!any_taken) {
-        // Found our place.
-        break;
-      }
-      // Retry.
-      start_page_number = end_page_number = UINT_MAX;
-    }
-  } else {
-    for (uint32_t base_page_number = low_page_number;
-         base_page_number <= high_page_number - page_count;
-         base_page_number += page_scan_stride) {
-      if (page_table_[base_page_number].state != 0) {
-        // Base page not free, skip to next usable page.
-        continue;
-      }
-      // Check requested range to ensure free.
-      start_page_number = base_page_number;
-      end_page_number = base_page_number + page_count - 1;
-      bool any_taken = false;
-      for (uint32_t page_number = base_page_number;
-           !any_taken && page_number <= end_page_number; ++page_number) {
-        bool is_free = page_table_[page_number].state == 0;
-        if (!is_free) {
-          // At least one page in the range is used, skip to next.
-          // We know we'll be starting at least after this page.
-          any_taken = true;
-          base_page_number = xe::round_up(page_number + 1, page_scan_stride);
-          base_page_number -= page_scan_stride;  // cancel out loop logic
-          break;
-        }
-      }
-      if (!any_taken) {
-        // Found our place.
-        break;
-      }
-      // Retry.
-      start_page_number = end_page_number = UINT_MAX;
-    }
-  }
-  if (start_page_number == UINT_MAX || end_page_number == UINT_MAX) {
+  uint32_t start_page_number =
+      top_down ? free_pages_.FindLast(page_count, page_scan_stride,
+                                      low_page_number, high_page_number)
+               : free_pages_.FindFirst(page_count, page_scan_stride,
+                                       low_page_number, high_page_number);
+  if (start_page_number == FreeRangeMap::kInvalidIndex) {
     // Out of memory.
     XELOGE("BaseHeap::Alloc failed to find contiguous range");
     // assert_always("Heap exhausted!");
     return false;
   }
+  uint32_t end_page_number = start_page_number + page_count - 1;
 
   // Allocate from host.
   if (allocation_type == kMemoryAllocationReserve) {
@@ -1127,6 +1358,7 @@ bool BaseHeap::AllocRange(uint32_t low_address, uint32_t high_address,
     page_entry.state = kMemoryAllocationReserve | allocation_type;
     unreserved_page_count_--;
   }
+  free_pages_.MarkUsed(start_page_number, page_count);
 
   *out_address = heap_base_ + (start_page_number << page_size_shift_);
   return true;
@@ -1236,6 +1468,7 @@ bool BaseHeap::Release(uint32_t base_address, uint32_t* out_region_size) {
     page_entry.qword = 0;
     unreserved_page_count_++;
   }
+  free_pages_.MarkFree(base_page_number, base_page_entry.region_page_count);
 
   return true;
 }
@@ -14,9 +14,11 @@
 #include <memory>
 #include <mutex>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include "xenia/base/free_range_map.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/mutex.h"
 #include "xenia/cpu/mmio_handler.h"
@@ -98,6 +100,50 @@ union PageEntry {
   };
 };
 
+// How the contents of a run of committed pages are stored in a snapshot.
+enum class MemorySnapshotEncoding : uint32_t {
+  // All zeros, nothing is stored.
+  kZero,
+  kNone,
+  kSnappy,
+  // Same as the chunk at the same pages in the base snapshot, nothing is
+  // stored.
+  kBase,
+};
+
+// A run of committed pages of a heap in a snapshot. Runs don't cross
+// kMemorySnapshotChunkSize boundaries, so the same allocations are split into
+// the same chunks in every snapshot.
+struct MemorySnapshotChunk {
+  uint32_t first_page;
+  uint32_t page_count;
+  // XXH3 of the contents, to find the chunks changed since the base snapshot.
+  uint64_t hash;
+  MemorySnapshotEncoding encoding;
+  uint32_t data_size;
+  // Points into the snapshot file, nullptr if nothing is stored.
+  const uint8_t* data;
+};
+
+constexpr uint32_t kMemorySnapshotChunkSize = 64 * 1024;
+
+// Chunks of a full snapshot, which an incremental snapshot refers to instead
+// of storing the ones that haven't changed since.
+class MemorySnapshotBase {
+ public:
+  // data is the memory section of the snapshot written by Memory::Save, and
+  // must stay valid while this is used.
+  static std::unique_ptr<MemorySnapshotBase> Parse(const uint8_t* data,
+                                                   size_t size);
+
+  const MemorySnapshotChunk* FindChunk(uint32_t heap_index,
+                                       uint32_t first_page) const;
+
+ private:
+  // By the first page, for each heap.
+  std::vector<std::unordered_map<uint32_t, MemorySnapshotChunk>> heaps_;
+};
+
 // Heap abstraction for page-based allocation.
 class BaseHeap {
  public:
@@ -198,8 +244,16 @@ class BaseHeap {
   xe::memory::PageAccess QueryRangeAccess(uint32_t low_address,
                                           uint32_t high_address);
 
-  bool Save(ByteStream* stream);
-  bool Restore(ByteStream* stream);
+  // Appends the page table and the committed pages to out. With a base
+  // snapshot, chunks that haven't changed since it are only referenced.
+  void Save(std::vector<uint8_t>& out, uint32_t heap_index,
+            const MemorySnapshotBase* base);
+  // Restores the page table and commits the pages, returning the chunks of
+  // their contents, which are decoded by RestoreChunks afterwards.
+  bool Restore(ByteStream* stream,
+               std::vector<MemorySnapshotChunk>& out_chunks);
+  bool RestoreChunks(const std::vector<MemorySnapshotChunk>& chunks,
+                     uint32_t heap_index, const MemorySnapshotBase* base);
 
   void Reset();
 
@@ -221,6 +275,9 @@ class BaseHeap {
   uint32_t unreserved_page_count_;
   xe::global_critical_region global_critical_region_;
   std::vector<PageEntry> page_table_;
+  // Pages with no allocation state, kept in sync with page_table_ to find
+  // free ranges in AllocRange without scanning the page table.
+  FreeRangeMap free_pages_;
 };
 
 // Normal heap allowing allocations from guest virtual address ranges.
@@ -536,8 +593,12 @@ class Memory {
   // Dumps a map of all allocated memory to the log.
   void DumpMap();
 
-  bool Save(ByteStream* stream);
-  bool Restore(ByteStream* stream);
+  // Writes all the heaps, compressing them in parallel. Unless base is null,
+  // the snapshot is incremental, only containing pages changed since base.
+  bool Save(ByteStream* stream, const MemorySnapshotBase* base = nullptr);
+  // Restores the heaps, taking the unchanged pages of an incremental snapshot
+  // from base.
+  bool Restore(ByteStream* stream, const MemorySnapshotBase* base = nullptr);
 
   void SetMMIOExceptionRecordingCallback(cpu::MmioAccessRecordCallback callback,
                                          void* context);
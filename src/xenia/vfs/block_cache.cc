@@ -0,0 +1,195 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2023 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/vfs/block_cache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "xenia/base/assert.h"
+
+namespace xe {
+namespace vfs {
+
+size_t BlockCache::KeyHash::operator()(const Key& key) const {
+  size_t hash = std::hash<const void*>()(key.device);
+  hash ^= std::hash<uint64_t>()(key.file_id) + 0x9E3779B97F4A7C15ull +
+          (hash << 6) + (hash >> 2);
+  hash ^= std::hash<uint64_t>()(key.block_index) + 0x9E3779B97F4A7C15ull +
+          (hash << 6) + (hash >> 2);
+  return hash;
+}
+
+BlockCache::BlockCache(size_t capacity) : capacity_(capacity) {}
+
+BlockCache::~BlockCache() = default;
+
+size_t BlockCache::Read(const Device* device, uint64_t file_id,
+                        uint64_t file_size, void* buffer, size_t length,
+                        uint64_t offset, uint32_t read_ahead_blocks,
+                        const ReadFunction& read_function) {
+  if (offset >= file_size) {
+    return 0;
+  }
+  length = size_t(std::min(uint64_t(length), file_size - offset));
+  if (length >= kBypassLength) {
+    return read_function(buffer, length, offset);
+  }
+
+  auto dest = static_cast<uint8_t*>(buffer);
+  uint64_t end = offset + length;
+  uint64_t file_block_count = (file_size + kBlockSize - 1) / kBlockSize;
+  size_t total_read = 0;
+  std::vector<uint8_t> staging;
+  while (offset < end) {
+    Key key = {device, file_id, offset / kBlockSize};
+    size_t block_offset = size_t(offset % kBlockSize);
+    size_t copy_length =
+        size_t(std::min(uint64_t(kBlockSize - block_offset), end - offset));
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      size_t copied;
+      if (CopyFromBlockLocked(key, block_offset, dest, copy_length,
+                              &copied)) {
+        ++hits_;
+        dest += copied;
+        offset += copied;
+        total_read += copied;
+        if (copied < copy_length) {
+          return total_read;
+        }
+        continue;
+      }
+    }
+    ++misses_;
+
+    // Read everything up to the end of the request, plus the read-ahead, at
+    // once.
+    uint64_t last_block_index = (end - 1) / kBlockSize;
+    uint64_t run_end_block_index = std::min(
+        last_block_index + 1 + read_ahead_blocks, file_block_count);
+    uint64_t run_offset = key.block_index * kBlockSize;
+    size_t run_length = size_t(
+        std::min(run_end_block_index * kBlockSize, file_size) - run_offset);
+    staging.resize(run_length);
+    size_t run_read = read_function(staging.data(), run_length, run_offset);
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      for (size_t block_start = 0; block_start < run_read;
+           block_start += kBlockSize) {
+        size_t block_size = std::min(kBlockSize, run_read - block_start);
+        // A short block that isn't the last one of the file is an incomplete
+        // read, don't cache it.
+        if (block_size < kBlockSize &&
+            run_offset + block_start + block_size != file_size) {
+          break;
+        }
+        Key block_key = {device, file_id,
+                         key.block_index + block_start / kBlockSize};
+        InsertBlockLocked(block_key, staging.data() + block_start,
+                          block_size);
+        if (block_key.block_index > last_block_index) {
+          ++read_ahead_blocks_;
+        }
+      }
+    }
+    // A read that ended before the requested data, such as of a truncated
+    // file, has nothing more to give.
+    if (run_offset + run_read <= offset) {
+      break;
+    }
+    size_t run_copy_length =
+        size_t(std::min(end, run_offset + run_read) - offset);
+    std::memcpy(dest, staging.data() + block_offset, run_copy_length);
+    dest += run_copy_length;
+    offset += run_copy_length;
+    total_read += run_copy_length;
+    if (run_read < run_length && offset < end) {
+      break;
+    }
+  }
+  return total_read;
+}
+
+void BlockCache::Invalidate(const Device* device) {
+  std::lock_guard<std::mutex> lock(lock_);
+  for (auto it = blocks_.begin(); it != blocks_.end();) {
+    if (it->key.device == device) {
+      size_ -= it->size;
+      block_map_.erase(it->key);
+      it = blocks_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void BlockCache::Clear() {
+  std::lock_guard<std::mutex> lock(lock_);
+  block_map_.clear();
+  blocks_.clear();
+  size_ = 0;
+}
+
+BlockCache::Stats BlockCache::stats() const {
+  Stats stats;
+  stats.hits = hits_;
+  stats.misses = misses_;
+  stats.read_ahead_blocks = read_ahead_blocks_;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    stats.size = size_;
+  }
+  return stats;
+}
+
+bool BlockCache::CopyFromBlockLocked(const Key& key, size_t block_offset,
+                                     uint8_t* dest, size_t length,
+                                     size_t* out_copied) {
+  auto it = block_map_.find(key);
+  if (it == block_map_.end()) {
+    return false;
+  }
+  blocks_.splice(blocks_.begin(), blocks_, it->second);
+  const Block& block = *it->second;
+  size_t copied =
+      block_offset < block.size ? std::min(length, block.size - block_offset)
+                                : 0;
+  std::memcpy(dest, block.data.get() + block_offset, copied);
+  *out_copied = copied;
+  return true;
+}
+
+void BlockCache::InsertBlockLocked(const Key& key, const uint8_t* data,
+                                   size_t size) {
+  auto it = block_map_.find(key);
+  if (it != block_map_.end()) {
+    blocks_.splice(blocks_.begin(), blocks_, it->second);
+    return;
+  }
+  Block block;
+  block.key = key;
+  block.size = size;
+  block.data = std::make_unique<uint8_t[]>(size);
+  std::memcpy(block.data.get(), data, size);
+  blocks_.push_front(std::move(block));
+  block_map_.emplace(key, blocks_.begin());
+  size_ += size;
+  // Keep at least the new block even if the capacity is smaller.
+  while (size_ > capacity_ && blocks_.size() > 1) {
+    const Block& evicted = blocks_.back();
+    size_ -= evicted.size;
+    block_map_.erase(evicted.key);
+    blocks_.pop_back();
+  }
+}
+
+}  // namespace vfs
+}  // namespace xe
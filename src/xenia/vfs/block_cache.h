@@ -0,0 +1,111 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2023 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_VFS_BLOCK_CACHE_H_
+#define XENIA_VFS_BLOCK_CACHE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace xe {
+namespace vfs {
+
+class Device;
+
+// Cache of fixed-size blocks of file data, shared by the devices of a virtual
+// file system, for devices where reading is expensive (decompression, many
+// small host reads). Blocks are evicted in least recently used order once the
+// capacity is exceeded.
+class BlockCache {
+ public:
+  static constexpr size_t kBlockSize = 64 * 1024;
+  // Reads at least this large bypass the cache, they'd evict a lot of it
+  // without benefiting from it.
+  static constexpr size_t kBypassLength = 1024 * 1024;
+
+  // Reads length bytes at offset of the file into buffer. Returns the number
+  // of bytes read, which may be less only at the end of the file.
+  using ReadFunction =
+      std::function<size_t(void* buffer, size_t length, uint64_t offset)>;
+
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t read_ahead_blocks;
+    size_t size;
+  };
+
+  explicit BlockCache(size_t capacity);
+  ~BlockCache();
+
+  size_t capacity() const { return capacity_; }
+
+  // Reads from the file through the cache, reading missing blocks, plus
+  // read_ahead_blocks blocks following them, with read_function.
+  // file_id identifies the file within the device.
+  size_t Read(const Device* device, uint64_t file_id, uint64_t file_size,
+              void* buffer, size_t length, uint64_t offset,
+              uint32_t read_ahead_blocks, const ReadFunction& read_function);
+
+  // Drops all blocks of the device, must be done before destroying it.
+  void Invalidate(const Device* device);
+  void Clear();
+
+  Stats stats() const;
+
+ private:
+  struct Key {
+    const Device* device;
+    uint64_t file_id;
+    uint64_t block_index;
+    bool operator==(const Key& other) const {
+      return device == other.device && file_id == other.file_id &&
+             block_index == other.block_index;
+    }
+  };
+  struct KeyHash {
+    size_t operator()(const Key& key) const;
+  };
+  struct Block {
+    Key key;
+    // Less than kBlockSize for the last block of a file.
+    size_t size;
+    std::unique_ptr<uint8_t[]> data;
+  };
+  using BlockList = std::list<Block>;
+
+  // Must be called with lock_ held. Moves the block to the front of the LRU
+  // list and copies from it, returns false if it's not cached.
+  bool CopyFromBlockLocked(const Key& key, size_t block_offset, uint8_t* dest,
+                           size_t length, size_t* out_copied);
+  // Must be called with lock_ held.
+  void InsertBlockLocked(const Key& key, const uint8_t* data, size_t size);
+
+  size_t capacity_;
+
+  mutable std::mutex lock_;
+  // Most recently used first.
+  BlockList blocks_;
+  std::unordered_map<Key, BlockList::iterator, KeyHash> block_map_;
+  size_t size_ = 0;
+
+  std::atomic<uint64_t> hits_ = {0};
+  std::atomic<uint64_t> misses_ = {0};
+  std::atomic<uint64_t> read_ahead_blocks_ = {0};
+};
+
+}  // namespace vfs
+}  // namespace xe
+
+#endif  // XENIA_VFS_BLOCK_CACHE_H_
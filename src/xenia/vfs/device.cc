@@ -9,7 +9,10 @@
 
 #include "xenia/vfs/device.h"
 
+#include <mutex>
+
 #include "xenia/base/logging.h"
+#include "xenia/base/utf8.h"
 
 namespace xe {
 namespace vfs {
@@ -17,5 +20,48 @@ namespace vfs {
 Device::Device(const std::string_view mount_path) : mount_path_(mount_path) {}
 Device::~Device() = default;
 
+Entry* Device::LookupResolvedPath(const std::string_view path) const {
+  size_t hash = xe::utf8::hash_fnv1a_case(path);
+  std::shared_lock<std::shared_mutex> lock(resolved_paths_mutex_);
+  auto range = resolved_paths_.equal_range(hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (xe::utf8::equal_case(it->second.path, path)) {
+      return it->second.entry;
+    }
+  }
+  return nullptr;
+}
+
+uint64_t Device::resolved_path_generation() const {
+  std::shared_lock<std::shared_mutex> lock(resolved_paths_mutex_);
+  return resolved_path_generation_;
+}
+
+void Device::CacheResolvedPath(const std::string_view path, Entry* entry,
+                               uint64_t generation) {
+  size_t hash = xe::utf8::hash_fnv1a_case(path);
+  std::unique_lock<std::shared_mutex> lock(resolved_paths_mutex_);
+  if (generation != resolved_path_generation_) {
+    // The entry may have been deleted meanwhile.
+    return;
+  }
+  auto range = resolved_paths_.equal_range(hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (xe::utf8::equal_case(it->second.path, path)) {
+      return;
+    }
+  }
+  if (resolved_paths_.size() >= kMaxResolvedPathCount) {
+    resolved_paths_.clear();
+  }
+  resolved_paths_.emplace(hash, ResolvedPath{std::string(path), entry});
+}
+
+void Device::InvalidateResolvedPaths() {
+  std::unique_lock<std::shared_mutex> lock(resolved_paths_mutex_);
+  resolved_paths_.clear();
+  ++resolved_path_generation_;
+}
+
 }  // namespace vfs
 }  // namespace xe
@@ -11,7 +11,9 @@
 #define XENIA_VFS_DEVICE_H_
 
 #include <memory>
+#include <shared_mutex>
 #include <string>
+#include <unordered_map>
 
 #include "xenia/base/mutex.h"
 #include "xenia/base/string_buffer.h"
@@ -20,6 +22,8 @@
 namespace xe {
 namespace vfs {
 
+class BlockCache;
+
 class Device {
  public:
   explicit Device(const std::string_view mount_path);
@@ -42,9 +46,39 @@ class Device {
   virtual uint32_t sectors_per_allocation_unit() const = 0;
   virtual uint32_t bytes_per_sector() const = 0;
 
+  // Cache of the entries paths relative to the root entry resolved to, so
+  // repeated opens of the same files don't walk the tree again. Only
+  // successful resolutions are cached. The generation is obtained before
+  // resolving, and the result is only cached if no entry has been deleted or
+  // renamed in between.
+  Entry* LookupResolvedPath(const std::string_view path) const;
+  uint64_t resolved_path_generation() const;
+  void CacheResolvedPath(const std::string_view path, Entry* entry,
+                         uint64_t generation);
+  void InvalidateResolvedPaths();
+
+  // Cache for devices with expensive reads to read through, set by the
+  // virtual file system when the device is registered, or null.
+  BlockCache* block_cache() const { return block_cache_; }
+  void set_block_cache(BlockCache* block_cache) { block_cache_ = block_cache; }
+
  protected:
   xe::global_critical_region global_critical_region_;
   std::string mount_path_;
+
+ private:
+  static constexpr size_t kMaxResolvedPathCount = 65536;
+
+  struct ResolvedPath {
+    std::string path;
+    Entry* entry;
+  };
+  mutable std::shared_mutex resolved_paths_mutex_;
+  // By the case-insensitive hash of the path.
+  std::unordered_multimap<size_t, ResolvedPath> resolved_paths_;
+  uint64_t resolved_path_generation_ = 0;
+
+  BlockCache* block_cache_ = nullptr;
 };
 
 }  // namespace vfs
@@ -11,8 +11,12 @@
 
 #include <algorithm>
 
+#include "xenia/base/cvar.h"
 #include "xenia/base/logging.h"
 #include "xenia/vfs/devices/disc_image_entry.h"
+
+DECLARE_bool(vfs_read_ahead_hints);
+
 namespace xe {
 namespace vfs {
 
@@ -37,6 +41,17 @@ X_STATUS DiscImageFile::ReadSync(void* buffer, size_t buffer_length,
   size_t real_offset = entry_->data_offset() + byte_offset;
   size_t real_length =
       std::min(buffer_length, entry_->data_size() - byte_offset);
+  if (cvars::vfs_read_ahead_hints) {
+    // Page in what a streaming guest will read next while this is copied.
+    uint32_t read_ahead_blocks = UpdateReadAhead(byte_offset, real_length);
+    size_t data_end = entry_->data_offset() + entry_->data_size();
+    if (read_ahead_blocks && real_offset + real_length < data_end) {
+      entry_->mmap()->Prefetch(
+          real_offset + real_length,
+          std::min(read_ahead_blocks * kReadAheadBlockSize,
+                   data_end - (real_offset + real_length)));
+    }
+  }
   std::memcpy(buffer, entry_->mmap()->data() + real_offset, real_length);
   *out_bytes_read = real_length;
   return X_STATUS_SUCCESS;
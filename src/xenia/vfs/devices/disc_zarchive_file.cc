@@ -11,6 +11,7 @@
 
 #include <algorithm>
 
+#include "xenia/vfs/block_cache.h"
 #include "xenia/vfs/devices/disc_zarchive_device.h"
 #include "xenia/vfs/devices/disc_zarchive_entry.h"
 
@@ -31,10 +32,22 @@ X_STATUS DiscZarchiveFile::ReadSync(void* buffer, size_t buffer_length,
   if (byte_offset >= entry_->size()) {
     return X_STATUS_END_OF_FILE;
   }
-  const uint64_t bytes_read =
-      ((DiscZarchiveDevice*)entry_->device_)
-          ->reader()
-          ->ReadFromFile(entry_->handle_, byte_offset, buffer_length, buffer);
+  auto reader = ((DiscZarchiveDevice*)entry_->device_)->reader();
+  auto read = [this, reader](void* read_buffer, size_t length,
+                             uint64_t offset) {
+    return size_t(
+        reader->ReadFromFile(entry_->handle_, offset, length, read_buffer));
+  };
+  BlockCache* block_cache = entry_->device_->block_cache();
+  if (block_cache) {
+    // Decompression works on whole ZArchive blocks, caching them saves
+    // decompressing the same block again for every small read from it.
+    block_cache->Read(entry_->device_, uint64_t(uintptr_t(entry_)),
+                      entry_->size(), buffer, buffer_length, byte_offset,
+                      UpdateReadAhead(byte_offset, buffer_length), read);
+  } else {
+    read(buffer, buffer_length, byte_offset);
+  }
   const size_t real_length =
       std::min(buffer_length, entry_->data_size() - byte_offset);
   *out_bytes_read = real_length;
@@ -9,8 +9,11 @@
 
 #include "xenia/vfs/devices/host_path_file.h"
 
+#include "xenia/base/cvar.h"
 #include "xenia/vfs/devices/host_path_entry.h"
 
+DECLARE_bool(vfs_read_ahead_hints);
+
 namespace xe {
 namespace vfs {
 
@@ -35,6 +38,14 @@ X_STATUS HostPathFile::ReadSync(void* buffer, size_t buffer_length,
     return X_STATUS_ACCESS_DENIED;
   }
 
+  if (cvars::vfs_read_ahead_hints) {
+    if (uint32_t read_ahead_blocks =
+            UpdateReadAhead(byte_offset, buffer_length)) {
+      file_handle_->Prefetch(byte_offset + buffer_length,
+                             read_ahead_blocks * kReadAheadBlockSize);
+    }
+  }
+
   if (file_handle_->Read(byte_offset, buffer, buffer_length, out_bytes_read)) {
     return X_STATUS_SUCCESS;
   } else {
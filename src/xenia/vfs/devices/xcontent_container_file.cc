@@ -11,6 +11,8 @@
 #include <cmath>
 
 #include "xenia/base/math.h"
+#include "xenia/vfs/block_cache.h"
+#include "xenia/vfs/device.h"
 #include "xenia/vfs/devices/xcontent_container_entry.h"
 #include "xenia/vfs/devices/xcontent_container_file.h"
 
@@ -32,12 +34,29 @@ X_STATUS XContentContainerFile::ReadSync(void* buffer, size_t buffer_length,
     return X_STATUS_END_OF_FILE;
   }
 
+  BlockCache* block_cache = entry_->device()->block_cache();
+  if (block_cache) {
+    *out_bytes_read = block_cache->Read(
+        entry_->device(), uint64_t(uintptr_t(entry_)), entry_->size(), buffer,
+        buffer_length, byte_offset,
+        UpdateReadAhead(byte_offset, buffer_length),
+        [this](void* read_buffer, size_t length, uint64_t offset) {
+          return ReadUncached(read_buffer, length, size_t(offset));
+        });
+  } else {
+    *out_bytes_read = ReadUncached(buffer, buffer_length, byte_offset);
+  }
+  return X_STATUS_SUCCESS;
+}
+
+size_t XContentContainerFile::ReadUncached(void* buffer, size_t buffer_length,
+                                           size_t byte_offset) {
   size_t src_offset = 0;
   uint8_t* p = reinterpret_cast<uint8_t*>(buffer);
   size_t remaining_length =
       std::min(buffer_length, entry_->size() - byte_offset);
 
-  *out_bytes_read = 0;
+  size_t bytes_read = 0;
   for (size_t i = 0; i < entry_->block_list().size(); i++) {
     auto& record = entry_->block_list()[i];
     if (src_offset + record.length <= byte_offset) {
@@ -55,7 +74,7 @@ X_STATUS XContentContainerFile::ReadSync(void* buffer, size_t buffer_length,
     xe::filesystem::Seek(file, record.offset + read_offset, SEEK_SET);
     auto num_read = fread(p, 1, read_length, file);
 
-    *out_bytes_read += num_read;
+    bytes_read += num_read;
     p += num_read;
     src_offset += record.length;
     remaining_length -= read_length;
@@ -64,7 +83,7 @@ X_STATUS XContentContainerFile::ReadSync(void* buffer, size_t buffer_length,
     }
   }
 
-  return X_STATUS_SUCCESS;
+  return bytes_read;
 }
 
 }  // namespace vfs
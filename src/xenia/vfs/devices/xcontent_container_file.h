@@ -35,6 +35,9 @@ class XContentContainerFile : public File {
   X_STATUS SetLength(size_t length) override { return X_STATUS_ACCESS_DENIED; }
 
  private:
+  // Reads from the host files of the package, returns the bytes read.
+  size_t ReadUncached(void* buffer, size_t buffer_length, size_t byte_offset);
+
   XContentContainerEntry* entry_;
 };
 
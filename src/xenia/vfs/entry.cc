@@ -9,6 +9,8 @@
 
 #include "xenia/vfs/entry.h"
 
+#include <mutex>
+
 #include "xenia/base/filesystem.h"
 #include "xenia/base/string.h"
 #include "xenia/vfs/device.h"
@@ -47,19 +49,67 @@ void Entry::Dump(xe::StringBuffer* string_buffer, int indent) {
 
 bool Entry::is_read_only() const { return device_->is_read_only(); }
 
+Entry* Entry::FindChildLocked(const std::string_view name,
+                              size_t name_hash) const {
+  if (children_.size() < kChildIndexMinChildCount) {
+    auto it = std::find_if(children_.cbegin(), children_.cend(),
+                           [&](const auto& child) {
+                             return xe::utf8::equal_case(child->name(), name);
+                           });
+    return it != children_.cend() ? it->get() : nullptr;
+  }
+  auto range = child_index_.equal_range(name_hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (xe::utf8::equal_case(it->second->name(), name)) {
+      return it->second;
+    }
+  }
+  return nullptr;
+}
+
+void Entry::BuildChildIndexLocked() {
+  child_index_.clear();
+  child_index_.reserve(children_.size());
+  for (auto& child : children_) {
+    child_index_.emplace(xe::utf8::hash_fnv1a_case(child->name()),
+                         child.get());
+  }
+  child_index_size_ = children_.size();
+}
+
+void Entry::InvalidateChildIndex() {
+  std::unique_lock<std::shared_mutex> lock(children_mutex_);
+  child_index_.clear();
+  child_index_size_ = 0;
+}
+
 Entry* Entry::GetChild(const std::string_view name) {
-  auto global_lock = global_critical_region_.Acquire();
-  auto it = std::find_if(children_.cbegin(), children_.cend(),
-                         [&](const auto& child) {
-                           return xe::utf8::equal_case(child->name(), name);
-                         });
-  if (it == children_.cend()) {
-    return nullptr;
+  size_t name_hash = xe::utf8::hash_fnv1a_case(name);
+  {
+    std::shared_lock<std::shared_mutex> lock(children_mutex_);
+    if (children_.size() < kChildIndexMinChildCount ||
+        child_index_size_ == children_.size()) {
+      return FindChildLocked(name, name_hash);
+    }
+  }
+  std::unique_lock<std::shared_mutex> lock(children_mutex_);
+  if (child_index_size_ != children_.size()) {
+    BuildChildIndexLocked();
   }
-  return (*it).get();
+  return FindChildLocked(name, name_hash);
 }
 
 Entry* Entry::ResolvePath(const std::string_view path) {
+  // Resolutions from the root are cached by the device.
+  bool use_cache = !parent_ && !path.empty();
+  uint64_t cache_generation = 0;
+  if (use_cache) {
+    Entry* cached_entry = device_->LookupResolvedPath(path);
+    if (cached_entry) {
+      return cached_entry;
+    }
+    cache_generation = device_->resolved_path_generation();
+  }
   // Walk the path, one separator at a time.
   Entry* entry = this;
   for (auto& part : xe::utf8::split_path(path)) {
@@ -69,12 +119,15 @@ Entry* Entry::ResolvePath(const std::string_view path) {
       return nullptr;
     }
   }
+  if (use_cache) {
+    device_->CacheResolvedPath(path, entry, cache_generation);
+  }
   return entry;
 }
 
 Entry* Entry::IterateChildren(const xe::filesystem::WildcardEngine& engine,
                               size_t* current_index) {
-  auto global_lock = global_critical_region_.Acquire();
+  std::shared_lock<std::shared_mutex> lock(children_mutex_);
   while (*current_index < children_.size()) {
     auto& child = children_[*current_index];
     *current_index = *current_index + 1;
@@ -98,10 +151,20 @@ Entry* Entry::CreateEntry(const std::string_view name, uint32_t attributes) {
   if (!entry) {
     return nullptr;
   }
-  children_.push_back(std::move(entry));
-  // TODO(benvanik): resort? would break iteration?
+  Entry* created_entry = entry.get();
+  {
+    std::unique_lock<std::shared_mutex> lock(children_mutex_);
+    bool index_current = child_index_size_ == children_.size();
+    children_.push_back(std::move(entry));
+    // TODO(benvanik): resort? would break iteration?
+    if (index_current && !child_index_.empty()) {
+      child_index_.emplace(xe::utf8::hash_fnv1a_case(created_entry->name()),
+                           created_entry);
+      child_index_size_ = children_.size();
+    }
+  }
   Touch();
-  return children_.back().get();
+  return created_entry;
 }
 
 bool Entry::Delete(Entry* entry) {
@@ -115,12 +178,27 @@ bool Entry::Delete(Entry* entry) {
   if (!DeleteEntryInternal(entry)) {
     return false;
   }
-  for (auto it = children_.begin(); it != children_.end(); ++it) {
-    if (it->get() == entry) {
-      children_.erase(it);
-      break;
+  {
+    std::unique_lock<std::shared_mutex> lock(children_mutex_);
+    bool index_current = child_index_size_ == children_.size();
+    auto range =
+        child_index_.equal_range(xe::utf8::hash_fnv1a_case(entry->name()));
+    for (auto it = range.first; it != range.second; ++it) {
+      if (it->second == entry) {
+        child_index_.erase(it);
+        break;
+      }
     }
+    for (auto it = children_.begin(); it != children_.end(); ++it) {
+      if (it->get() == entry) {
+        children_.erase(it);
+        break;
+      }
+    }
+    child_index_size_ = index_current ? children_.size() : 0;
   }
+  // The cached paths may lead to the deleted entry or its descendants.
+  device_->InvalidateResolvedPaths();
   Touch();
   return true;
 }
@@ -149,6 +227,12 @@ void Entry::Rename(const std::filesystem::path file_path) {
                                               guest_path_without_root);
   path_ = guest_path_without_root;
   name_ = xe::path_to_utf8(file_path.filename());
+
+  // The name is the key in the index of the parent.
+  if (parent_) {
+    parent_->InvalidateChildIndex();
+  }
+  device_->InvalidateResolvedPaths();
 }
 
 }  // namespace vfs
@@ -11,7 +11,9 @@
 #define XENIA_VFS_ENTRY_H_
 
 #include <memory>
+#include <shared_mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "xenia/base/filesystem.h"
@@ -144,6 +146,10 @@ class Entry {
   virtual void RenameEntryInternal(const std::filesystem::path file_path) {}
 
   xe::global_critical_region global_critical_region_;
+  // Guards children_ and the child index, so lookups don't need the global
+  // lock. Devices populating children_ directly before the entry is visible to
+  // the guest don't need to take it.
+  mutable std::shared_mutex children_mutex_;
   Device* device_;
   Entry* parent_;
   std::string path_;
@@ -157,6 +163,23 @@ class Entry {
   uint64_t write_timestamp_;
   bool delete_on_close_;
   std::vector<std::unique_ptr<Entry>> children_;
+
+ private:
+  // Directories with fewer children are searched linearly.
+  static constexpr size_t kChildIndexMinChildCount = 32;
+
+  // Must be called with children_mutex_ held.
+  Entry* FindChildLocked(const std::string_view name, size_t name_hash) const;
+  // Must be called with children_mutex_ held exclusively.
+  void BuildChildIndexLocked();
+  void InvalidateChildIndex();
+
+  // Children by the case-insensitive hash of their name, built on the first
+  // lookup in a large directory.
+  std::unordered_multimap<size_t, Entry*> child_index_;
+  // Number of children in child_index_, it's stale if children were added
+  // directly to children_ since then.
+  size_t child_index_size_ = 0;
 };
 
 }  // namespace vfs
@@ -10,6 +10,7 @@
 #ifndef XENIA_VFS_FILE_H_
 #define XENIA_VFS_FILE_H_
 
+#include <atomic>
 #include <cstdint>
 
 #include "xenia/xbox.h"
@@ -54,10 +55,41 @@ class File {
   const Entry* entry() const { return entry_; }
   Entry* entry() { return entry_; }
 
+  // Reads ahead are done in units of this size.
+  static constexpr size_t kReadAheadBlockSize = 64 * 1024;
+
+  // Tracks whether reads are sequential, returning the number of blocks worth
+  // reading ahead of one at byte_offset, growing while the streak continues.
+  uint32_t UpdateReadAhead(size_t byte_offset, size_t length) {
+    uint32_t sequential_read_count;
+    if (next_sequential_offset_.exchange(byte_offset + length,
+                                         std::memory_order_relaxed) ==
+        byte_offset) {
+      sequential_read_count =
+          sequential_read_count_.fetch_add(1, std::memory_order_relaxed) + 1;
+    } else {
+      sequential_read_count = 0;
+      sequential_read_count_.store(0, std::memory_order_relaxed);
+    }
+    if (sequential_read_count < 2) {
+      return 0;
+    }
+    return sequential_read_count < kMaxReadAheadBlocks
+               ? sequential_read_count
+               : kMaxReadAheadBlocks;
+  }
+
  protected:
+  static constexpr uint32_t kMaxReadAheadBlocks = 8;
+
   // xe::filesystem::FileAccess
   uint32_t file_access_ = 0;
   Entry* entry_ = nullptr;
+
+  // Updated by concurrent reads of the same file, which only makes the
+  // read-ahead less accurate as they're not updated together.
+  std::atomic<size_t> next_sequential_offset_{0};
+  std::atomic<uint32_t> sequential_read_count_{0};
 };
 
 }  // namespace vfs
@@ -0,0 +1,185 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2023 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/vfs/block_cache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe::vfs::test {
+
+namespace {
+
+// Devices are only used as keys by the cache.
+const Device* const kDeviceA = reinterpret_cast<const Device*>(uintptr_t(16));
+const Device* const kDeviceB = reinterpret_cast<const Device*>(uintptr_t(32));
+
+class TestFile {
+ public:
+  // A reported size larger than the data makes reads end early, like reads
+  // of a truncated package.
+  explicit TestFile(size_t size, size_t reported_size = 0)
+      : data_(size), reported_size_(std::max(size, reported_size)) {
+    for (size_t i = 0; i < size; ++i) {
+      data_[i] = uint8_t(i * 7 + (i >> 16));
+    }
+  }
+
+  size_t size() const { return data_.size(); }
+  size_t source_read_count() const { return source_read_count_; }
+
+  size_t Read(BlockCache& cache, const Device* device, void* buffer,
+              size_t length, uint64_t offset, uint32_t read_ahead = 0) {
+    return cache.Read(device, 1, reported_size_, buffer, length, offset,
+                      read_ahead,
+                      [this](void* read_buffer, size_t read_length,
+                             uint64_t read_offset) {
+                        ++source_read_count_;
+                        if (read_offset >= data_.size()) {
+                          return size_t(0);
+                        }
+                        size_t copy_length = std::min(
+                            read_length, data_.size() - size_t(read_offset));
+                        std::memcpy(read_buffer, data_.data() + read_offset,
+                                    copy_length);
+                        return copy_length;
+                      });
+  }
+
+  bool Matches(const void* buffer, size_t length, uint64_t offset) const {
+    return !std::memcmp(buffer, data_.data() + offset, length);
+  }
+
+ private:
+  std::vector<uint8_t> data_;
+  size_t reported_size_;
+  size_t source_read_count_ = 0;
+};
+
+}  // namespace
+
+TEST_CASE("Block cache hits and misses", "[vfs_block_cache]") {
+  constexpr size_t kBlockSize = BlockCache::kBlockSize;
+  BlockCache cache(16 * kBlockSize);
+  TestFile file(5 * kBlockSize + 100);
+  std::vector<uint8_t> buffer(3 * kBlockSize);
+
+  // Spanning two blocks, both read at once.
+  REQUIRE(file.Read(cache, kDeviceA, buffer.data(), 200, kBlockSize - 100) ==
+          200);
+  REQUIRE(file.Matches(buffer.data(), 200, kBlockSize - 100));
+  REQUIRE(file.source_read_count() == 1);
+  REQUIRE(cache.stats().misses == 1);
+
+  REQUIRE(file.Read(cache, kDeviceA, buffer.data(), 50, kBlockSize + 10) ==
+          50);
+  REQUIRE(file.Matches(buffer.data(), 50, kBlockSize + 10));
+  REQUIRE(file.source_read_count() == 1);
+  REQUIRE(cache.stats().hits == 1);
+
+  // Short last block, and reads clamped to the end of the file.
+  REQUIRE(file.Read(cache, kDeviceA, buffer.data(), kBlockSize,
+                    5 * kBlockSize) == 100);
+  REQUIRE(file.Matches(buffer.data(), 100, 5 * kBlockSize));
+  REQUIRE(file.Read(cache, kDeviceA, buffer.data(), kBlockSize,
+                    5 * kBlockSize + 50) == 50);
+  REQUIRE(file.Matches(buffer.data(), 50, 5 * kBlockSize + 50));
+  REQUIRE(file.Read(cache, kDeviceA, buffer.data(), 1, file.size()) == 0);
+  REQUIRE(file.source_read_count() == 2);
+
+  // Same file ID on another device.
+  REQUIRE(file.Read(cache, kDeviceB, buffer.data(), 50, kBlockSize + 10) ==
+          50);
+  REQUIRE(file.source_read_count() == 3);
+
+  cache.Invalidate(kDeviceA);
+  REQUIRE(file.Read(cache, kDeviceA, buffer.data(), 50, kBlockSize + 10) ==
+          50);
+  REQUIRE(file.source_read_count() == 4);
+  REQUIRE(file.Read(cache, kDeviceB, buffer.data(), 50, kBlockSize + 10) ==
+          50);
+  REQUIRE(file.source_read_count() == 4);
+}
+
+TEST_CASE("Block cache read-ahead", "[vfs_block_cache]") {
+  constexpr size_t kBlockSize = BlockCache::kBlockSize;
+  BlockCache cache(16 * kBlockSize);
+  TestFile file(10 * kBlockSize);
+  std::vector<uint8_t> buffer(kBlockSize);
+
+  REQUIRE(file.Read(cache, kDeviceA, buffer.data(), 4096, 0, 4) == 4096);
+  REQUIRE(cache.stats().read_ahead_blocks == 4);
+  for (size_t offset = 4096; offset < 5 * kBlockSize; offset += 4096) {
+    REQUIRE(file.Read(cache, kDeviceA, buffer.data(), 4096, offset) == 4096);
+    REQUIRE(file.Matches(buffer.data(), 4096, offset));
+  }
+  REQUIRE(file.source_read_count() == 1);
+
+  // Read-ahead stops at the end of the file.
+  REQUIRE(file.Read(cache, kDeviceA, buffer.data(), 4096, 8 * kBlockSize,
+                    8) == 4096);
+  REQUIRE(cache.stats().read_ahead_blocks == 5);
+}
+
+TEST_CASE("Block cache short reads", "[vfs_block_cache]") {
+  constexpr size_t kBlockSize = BlockCache::kBlockSize;
+  BlockCache cache(16 * kBlockSize);
+  TestFile file(kBlockSize + 100, 4 * kBlockSize);
+  std::vector<uint8_t> buffer(kBlockSize);
+
+  // Ending within the requested range.
+  REQUIRE(file.Read(cache, kDeviceA, buffer.data(), 200, kBlockSize) == 100);
+  REQUIRE(file.Matches(buffer.data(), 100, kBlockSize));
+  // Ending before the requested range, within the same block.
+  REQUIRE(file.Read(cache, kDeviceA, buffer.data(), 100, kBlockSize + 200) ==
+          0);
+  // Nothing read at all.
+  REQUIRE(file.Read(cache, kDeviceA, buffer.data(), 100, 3 * kBlockSize) ==
+          0);
+  // The incomplete block isn't cached.
+  REQUIRE(file.Read(cache, kDeviceA, buffer.data(), 50, kBlockSize) == 50);
+  REQUIRE(file.source_read_count() == 4);
+}
+
+TEST_CASE("Block cache eviction", "[vfs_block_cache]") {
+  constexpr size_t kBlockSize = BlockCache::kBlockSize;
+  BlockCache cache(4 * kBlockSize);
+  TestFile file(20 * kBlockSize);
+  std::vector<uint8_t> buffer(16);
+
+  for (size_t i = 0; i < 4; ++i) {
+    file.Read(cache, kDeviceA, buffer.data(), 16, i * kBlockSize);
+  }
+  REQUIRE(cache.stats().size == 4 * kBlockSize);
+  // Block 0 becomes the most recently used, block 1 gets evicted.
+  file.Read(cache, kDeviceA, buffer.data(), 16, 0);
+  file.Read(cache, kDeviceA, buffer.data(), 16, 4 * kBlockSize);
+  REQUIRE(cache.stats().size == 4 * kBlockSize);
+  REQUIRE(file.source_read_count() == 5);
+  file.Read(cache, kDeviceA, buffer.data(), 16, 0);
+  REQUIRE(file.source_read_count() == 5);
+  file.Read(cache, kDeviceA, buffer.data(), 16, kBlockSize);
+  REQUIRE(file.source_read_count() == 6);
+  REQUIRE(file.Matches(buffer.data(), 16, kBlockSize));
+
+  // Large reads go to the source directly.
+  std::vector<uint8_t> large_buffer(BlockCache::kBypassLength);
+  REQUIRE(file.Read(cache, kDeviceA, large_buffer.data(), large_buffer.size(),
+                    0) == large_buffer.size());
+  REQUIRE(file.Matches(large_buffer.data(), large_buffer.size(), 0));
+  REQUIRE(file.source_read_count() == 7);
+
+  cache.Clear();
+  REQUIRE(cache.stats().size == 0);
+}
+
+}  // namespace xe::vfs::test
@@ -0,0 +1,129 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2023 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <string>
+
+#include "xenia/base/utf8.h"
+#include "xenia/vfs/device.h"
+#include "xenia/vfs/entry.h"
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe::vfs::test {
+
+namespace {
+
+class TestEntry : public Entry {
+ public:
+  TestEntry(Device* device, Entry* parent, const std::string_view path)
+      : Entry(device, parent, path) {
+    attributes_ = kFileAttributeDirectory;
+  }
+
+  // Adds a child the way devices populate their trees.
+  TestEntry* AddChild(const std::string_view name) {
+    auto child = std::make_unique<TestEntry>(
+        device_, this, xe::utf8::join_guest_paths(path_, name));
+    TestEntry* child_ptr = child.get();
+    children_.push_back(std::move(child));
+    return child_ptr;
+  }
+
+  X_STATUS Open(uint32_t desired_access, File** out_file) override {
+    return X_STATUS_NOT_IMPLEMENTED;
+  }
+
+ protected:
+  std::unique_ptr<Entry> CreateEntryInternal(const std::string_view name,
+                                             uint32_t attributes) override {
+    return std::make_unique<TestEntry>(
+        device_, this, xe::utf8::join_guest_paths(path_, name));
+  }
+  bool DeleteEntryInternal(Entry* entry) override { return true; }
+};
+
+class TestDevice : public Device {
+ public:
+  TestDevice() : Device("\\Device\\Test"), root_entry_(this, nullptr, "") {}
+
+  bool Initialize() override { return true; }
+  void Dump(StringBuffer* string_buffer) override {}
+  Entry* ResolvePath(const std::string_view path) override {
+    return root_entry_.ResolvePath(path);
+  }
+
+  bool is_read_only() const override { return false; }
+
+  const std::string& name() const override { return name_; }
+  uint32_t attributes() const override { return 0; }
+  uint32_t component_name_max_length() const override { return 40; }
+
+  uint32_t total_allocation_units() const override { return 0; }
+  uint32_t available_allocation_units() const override { return 0; }
+  uint32_t sectors_per_allocation_unit() const override { return 0; }
+  uint32_t bytes_per_sector() const override { return 0; }
+
+  TestEntry* root_entry() { return &root_entry_; }
+
+ private:
+  std::string name_ = "TestDevice";
+  TestEntry root_entry_;
+};
+
+std::string GetChildName(size_t index) {
+  return "Child" + std::to_string(index) + ".bin";
+}
+
+void TestLookups(size_t child_count) {
+  TestDevice device;
+  TestEntry* root = device.root_entry();
+  for (size_t i = 0; i < child_count; ++i) {
+    root->AddChild(GetChildName(i))->AddChild("Data");
+  }
+
+  // Twice, to go through the device path cache the second time.
+  for (int pass = 0; pass < 2; ++pass) {
+    for (size_t i = 0; i < child_count; ++i) {
+      std::string name = GetChildName(i);
+      Entry* entry = root->GetChild(xe::utf8::upper_ascii(name));
+      REQUIRE(entry);
+      REQUIRE(entry->name() == name);
+      REQUIRE(device.ResolvePath(xe::utf8::lower_ascii(name)) == entry);
+      REQUIRE(device.ResolvePath(name + "\\DATA") == entry->GetChild("data"));
+    }
+    REQUIRE(!root->GetChild("Child.bin"));
+    REQUIRE(!device.ResolvePath(GetChildName(child_count)));
+  }
+
+  // Children added and deleted after the index has been built.
+  Entry* created = root->CreateEntry("Created.bin", kFileAttributeNormal);
+  REQUIRE(created);
+  REQUIRE(device.ResolvePath("CREATED.BIN") == created);
+  REQUIRE(!root->CreateEntry("created.bin", kFileAttributeNormal));
+  Entry* deleted = root->GetChild(GetChildName(0));
+  REQUIRE(device.ResolvePath(GetChildName(0) + "\\Data"));
+  REQUIRE(root->Delete(deleted));
+  REQUIRE(!root->GetChild(GetChildName(0)));
+  REQUIRE(!device.ResolvePath(GetChildName(0) + "\\Data"));
+  REQUIRE(root->child_count() == child_count);
+
+  // Children added directly by the device.
+  Entry* added = root->AddChild("Added.bin");
+  REQUIRE(root->GetChild("ADDED.BIN") == added);
+  REQUIRE(device.ResolvePath("Created.bin") == created);
+}
+
+}  // namespace
+
+TEST_CASE("Entry child lookup", "[vfs_entry]") {
+  SECTION("Small directory - linear search") { TestLookups(4); }
+  SECTION("Large directory - hash index") { TestLookups(5000); }
+}
+
+}  // namespace xe::vfs::test
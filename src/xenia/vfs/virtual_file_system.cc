@@ -12,19 +12,41 @@
 #include "xenia/vfs/devices/xcontent_container_device.h"
 
 #include "devices/host_path_entry.h"
+#include "xenia/base/cvar.h"
 #include "xenia/base/literals.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/string.h"
 #include "xenia/kernel/xfile.h"
 
+DEFINE_uint32(vfs_block_cache_size, 64,
+              "Memory budget in MiB of the cache of data read from archive and "
+              "package devices (ZArchive, STFS/SVOD), 0 to disable.",
+              "Storage");
+DEFINE_bool(vfs_read_ahead_hints, true,
+            "Hint the host to page in file data ahead of sequential guest "
+            "reads from disc images and host directories.",
+            "Storage");
+
 namespace xe {
 namespace vfs {
 
 using namespace xe::literals;
 
-VirtualFileSystem::VirtualFileSystem() {}
+VirtualFileSystem::VirtualFileSystem() {
+  if (cvars::vfs_block_cache_size) {
+    block_cache_ = std::make_unique<BlockCache>(
+        size_t(cvars::vfs_block_cache_size) * 1_MiB);
+  }
+}
 
 VirtualFileSystem::~VirtualFileSystem() {
+  if (block_cache_) {
+    BlockCache::Stats stats = block_cache_->stats();
+    XELOGI(
+        "VFS block cache: {} hits, {} misses, {} blocks read ahead, {} bytes "
+        "cached",
+        stats.hits, stats.misses, stats.read_ahead_blocks, stats.size);
+  }
   // Delete all devices.
   // This will explode if anyone is still using data from them.
   Clear();
@@ -33,10 +55,14 @@ VirtualFileSystem::~VirtualFileSystem() {
 void VirtualFileSystem::Clear() {
   devices_.clear();
   symlinks_.clear();
+  if (block_cache_) {
+    block_cache_->Clear();
+  }
 }
 
 bool VirtualFileSystem::RegisterDevice(std::unique_ptr<Device> device) {
   auto global_lock = global_critical_region_.Acquire();
+  device->set_block_cache(block_cache_.get());
   devices_.emplace_back(std::move(device));
   return true;
 }
@@ -46,6 +72,9 @@ bool VirtualFileSystem::UnregisterDevice(const std::string_view path) {
   for (auto it = devices_.begin(); it != devices_.end(); ++it) {
     if ((*it)->mount_path() == path) {
       XELOGD("Unregistered device: {}", (*it)->mount_path());
+      if (block_cache_) {
+        block_cache_->Invalidate(it->get());
+      }
       devices_.erase(it);
       return true;
     }
@@ -16,6 +16,7 @@
 #include <vector>
 
 #include "xenia/base/mutex.h"
+#include "xenia/vfs/block_cache.h"
 #include "xenia/vfs/device.h"
 #include "xenia/vfs/entry.h"
 #include "xenia/vfs/file.h"
@@ -59,6 +60,8 @@ class VirtualFileSystem {
 
  private:
   xe::global_critical_region global_critical_region_;
+  // Shared by the registered devices, must outlive them. Null if disabled.
+  std::unique_ptr<BlockCache> block_cache_;
   std::vector<std::unique_ptr<Device>> devices_;
   std::unordered_map<std::string, std::string> symlinks_;
 